@@ -1,8 +1,17 @@
-struct PrimitiveInstanceData
+// One per instance in the instance buffer
+struct InstanceData
 {
-    float4x4 MVP;
-    float4x4 MV;
-    float4x4 M;
+    row_major float3x4 world;
+};
+
+// Per pass camera matrices, applied to every instance's world matrix
+struct ViewData
+{
+    float4x4 viewProjection;
+    float4x4 view;
+    uint instanceBufferIdx;
+    uint lightBufferIdx;
+    uint transparentLightListIdx;
 };
 
 struct MaterialData
@@ -14,25 +23,21 @@ struct MaterialData
     uint metalRoughnessIdx;
 };
 
+// One per light in the light buffer, world space only
 struct LightConstantData
 {
     float4 position;
     float4 direction;
 
-    float4 positionViewSpace;
-    float4 directionViewSpace;
-
     float4 colorIntensity;
 
     float4x4 MVP;
 
     float range;
-    uint shadowMapDescriptorIdx;
     uint type;
-
     uint castsShadow;
 
-    float pad[24];
+    float effectiveRadius;
 };
 
 #define LIGHT_POINT 0
@@ -46,6 +51,24 @@ struct LightPassConstantData
     float4 eyePosWorld;
     uint baseGBufferIdx;
     uint debug;
+
+    uint clusterBufferIdx;
+    uint clusterLightIndicesIdx;
+    float clusterDepthScale;
+    float clusterDepthBias;
+    uint clusterCountX;
+    uint clusterCountY;
+    uint clusterCountZ;
+
+    uint probeVolumeIdx;
+    uint probeVolumeEnabled;
+    uint pad;
+    float4 probeVolumeMin;
+    float4 probeVolumeInverseSize;
+    uint4 probeVolumeCounts;
+
+    float4 skyIrradiance[7];
+    float4 pad2[9];
 };
 
 static const float PI = 3.14159265f;
@@ -77,11 +100,13 @@ float max_float3(float3 v)
 #ifndef NO_DEFAULT_RESOURCES
 
 cbuffer Indices : register(b0) {
+    // First instance in the instance buffer for mesh draws
     const uint g_PrimitiveDataIndex;
     const uint g_MaterialDataIndex;
     const uint g_LightIndex;
     const uint g_LightPassDataIndex;
     const uint g_MiscDescriptorIndex;
+    const uint g_ViewDataIndex;
 };
 
 SamplerState g_sampler : register(s0);
@@ -89,20 +114,23 @@ SamplerState g_samplerShadowMap : register(s1);
 
 float4 DoNormalMap(Texture2D normalMap, float3x3 TBN, float2 uv)
 {
-    float3 normal = normalMap.Sample(g_sampler, uv).xyz;
-    normal = normal * 2.0f - 1.0f;
+    // z is rebuilt from x and y, as cooked normal maps are BC5 and only store those
+    float3 normal;
+    normal.xy = normalMap.Sample(g_sampler, uv).xy * 2.0f - 1.0f;
+    normal.z = sqrt(saturate(1.0f - dot(normal.xy, normal.xy)));
     normal = mul(normal, TBN);
     return float4(normalize(normal), 0.0);
 }
 
-ConstantBuffer<PrimitiveInstanceData> GetPrimitiveInstanceData(uint instance) 
+ConstantBuffer<ViewData> GetViewData()
 {
-    return ResourceDescriptorHeap[g_PrimitiveDataIndex + instance];
+    return ResourceDescriptorHeap[g_ViewDataIndex];
 }
 
-ConstantBuffer<PrimitiveInstanceData> GetPrimitiveData()
+float3x4 GetInstanceWorld(uint instance)
 {
-    return GetPrimitiveInstanceData(0);
+    StructuredBuffer<InstanceData> instances = ResourceDescriptorHeap[GetViewData().instanceBufferIdx];
+    return instances[g_PrimitiveDataIndex + instance].world;
 }
 
 ConstantBuffer<MaterialData> GetMaterial()
@@ -110,14 +138,15 @@ ConstantBuffer<MaterialData> GetMaterial()
     return ResourceDescriptorHeap[g_MaterialDataIndex];
 }
 
-ConstantBuffer<LightConstantData> GetLight()
+LightConstantData GetLightAt(uint lightIndex)
 {
-    return ResourceDescriptorHeap[g_LightIndex];
+    StructuredBuffer<LightConstantData> lights = ResourceDescriptorHeap[GetViewData().lightBufferIdx];
+    return lights[lightIndex];
 }
 
-ConstantBuffer<LightConstantData> GetLightAtOffset(uint offset)
+LightConstantData GetLight()
 {
-    return ResourceDescriptorHeap[g_LightIndex + offset];
+    return GetLightAt(g_LightIndex);
 }
 
 ConstantBuffer<LightPassConstantData> GetLightPassData() 
@@ -67,7 +67,7 @@ float ComputeShadow(LightConstantData light, float3 worldPos)
 float4 PSMain(PSInput input) : SV_TARGET
 {
     ConstantBuffer<LightPassConstantData> passData = GetLightPassData();
-    ConstantBuffer<LightConstantData> light = GetLight();
+    LightConstantData light = GetLight();
 
     Texture2D baseColorTexture = ResourceDescriptorHeap[passData.baseGBufferIdx + GBUFFER_BASE_COLOR];
     Texture2D normalTexture = ResourceDescriptorHeap[passData.baseGBufferIdx + GBUFFER_NORMAL];
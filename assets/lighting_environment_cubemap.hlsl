@@ -12,11 +12,6 @@ TextureCube GetSkyboxTexture()
     return ResourceDescriptorHeap[g_MiscDescriptorIndex];
 }
 
-TextureCube GetIrradianceMap()
-{
-    return ResourceDescriptorHeap[g_LightIndex];
-}
-
 Texture2D GetBRDFLUT()
 {
     return ResourceDescriptorHeap[g_MaterialDataIndex];
@@ -82,11 +77,72 @@ float3 GetSpecularLight(TextureCube skybox, float3 R, float roughness, float3 en
     return prefilterColor;
 }
 
-float3 GetDiffuseLight(TextureCube diffuseMap, float3 N, float3 envIntensity)
+// 9 RGB L2 spherical harmonics coefficients packed back to back, see ProbeGPUData in probevolume.h
+float3 EvaluateSH(float4 sh[7], float3 N)
+{
+    float3 result =
+        sh[0].xyz * 0.282095f +
+        float3(sh[0].w, sh[1].xy) * (0.488603f * N.y) +
+        float3(sh[1].zw, sh[2].x) * (0.488603f * N.z) +
+        sh[2].yzw * (0.488603f * N.x) +
+        sh[3].xyz * (1.092548f * N.x * N.y) +
+        float3(sh[3].w, sh[4].xy) * (1.092548f * N.y * N.z) +
+        float3(sh[4].zw, sh[5].x) * (0.315392f * (3.0f * N.z * N.z - 1.0f)) +
+        sh[5].yzw * (1.092548f * N.x * N.z) +
+        sh[6].xyz * (0.546274f * (N.x * N.x - N.y * N.y));
+
+    return max(result, 0.0f);
+}
+
+// Sky irradiance is projected on the CPU when the skybox loads
+float3 GetDiffuseLight(ConstantBuffer<LightPassConstantData> passData, float3 N)
+{
+    return EvaluateSH(passData.skyIrradiance, N) * passData.environmentIntensity.rgb;
+}
+
+struct ProbeData
+{
+    float4 sh[7];
+};
+
+// Trilinear blend of the 8 probes around worldPos, evaluated in direction N.
+// Coefficients are cosine convolved during the bake, the same as the sky irradiance.
+float3 SampleProbeVolume(ConstantBuffer<LightPassConstantData> passData, float3 worldPos, float3 N)
+{
+    StructuredBuffer<ProbeData> probes = ResourceDescriptorHeap[passData.probeVolumeIdx];
+
+    uint3 counts = passData.probeVolumeCounts.xyz;
+    float3 coordinate = saturate((worldPos - passData.probeVolumeMin.xyz) * passData.probeVolumeInverseSize.xyz) * (float3)(counts - 1);
+    uint3 base = min((uint3)coordinate, counts - 1);
+    float3 fraction = coordinate - (float3)base;
+
+    float4 sh[7];
+    [unroll]
+    for (int i = 0; i < 7; i++) {
+        sh[i] = 0.0f;
+    }
+
+    [unroll]
+    for (uint corner = 0; corner < 8; corner++) {
+        uint3 offset = uint3(corner & 1, (corner >> 1) & 1, corner >> 2);
+        uint3 probe = min(base + offset, counts - 1);
+        float3 weights = lerp(1.0f - fraction, fraction, (float3)offset);
+        float weight = weights.x * weights.y * weights.z;
+
+        ProbeData data = probes[(probe.z * counts.y + probe.y) * counts.x + probe.x];
+        [unroll]
+        for (int j = 0; j < 7; j++) {
+            sh[j] += data.sh[j] * weight;
+        }
+    }
+
+    return EvaluateSH(sh, N);
+}
+
+bool IsInProbeVolume(ConstantBuffer<LightPassConstantData> passData, float3 worldPos)
 {
-    float4 irradianceSample = diffuseMap.Sample(g_sampler, N);
-    float3 irradiance = irradianceSample.rgb * envIntensity;
-    return irradiance;
+    float3 coordinate = (worldPos - passData.probeVolumeMin.xyz) * passData.probeVolumeInverseSize.xyz;
+    return passData.probeVolumeEnabled && all(coordinate >= 0.0f) && all(coordinate <= 1.0f);
 }
 
 // P = position of point being shaded in view space
@@ -97,7 +153,6 @@ float4 PSMain(PSInput input) : SV_TARGET
     ConstantBuffer<LightPassConstantData> passData = GetLightPassData();
 
     TextureCube skybox = GetSkyboxTexture();
-    TextureCube irradianceMap = GetIrradianceMap();
     Texture2D lut = GetBRDFLUT();
 
     Texture2D baseColorTexture = ResourceDescriptorHeap[passData.baseGBufferIdx + GBUFFER_BASE_COLOR];
@@ -140,7 +195,13 @@ float4 PSMain(PSInput input) : SV_TARGET
     float3 R = reflect(-worldSpaceView, N);
 
 
-    float3 diffuseLight = GetDiffuseLight(irradianceMap, N, passData.environmentIntensity.rgb);
+    float3 diffuseLight;
+    if (IsInProbeVolume(passData, worldPos)) {
+        // Baked probes already include the environment intensity
+        diffuseLight = SampleProbeVolume(passData, worldPos, N);
+    } else {
+        diffuseLight = GetDiffuseLight(passData, N);
+    }
     float3 specularLight = GetSpecularLight(skybox, R, roughness, passData.environmentIntensity.rgb);
 
     float3 F0 = 0.04;
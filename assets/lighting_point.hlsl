@@ -65,12 +65,20 @@ float ComputeShadow(LightConstantData light, float3 worldPos)
     return rayQuery.CommittedStatus() == COMMITTED_TRIANGLE_HIT ? 1.0f : 0.0f;
 }
 
+// Light cluster containing a pixel, matches LightClusterIndex in lightclusters.h
+uint GetLightCluster(LightPassConstantData passData, float2 uv, float viewDepth)
+{
+    uint x = min((uint)(uv.x * passData.clusterCountX), passData.clusterCountX - 1);
+    uint y = min((uint)(uv.y * passData.clusterCountY), passData.clusterCountY - 1);
+    int slice = (int)floor(log(viewDepth) * passData.clusterDepthScale + passData.clusterDepthBias);
+    uint z = (uint)clamp(slice, 0, (int)passData.clusterCountZ - 1);
+    return (z * passData.clusterCountY + y) * passData.clusterCountX + x;
+}
+
 // P = position of point being shaded in view space
 // N = normal of point being shaded in view space
 float4 PSMain(PSInput input) : SV_TARGET
 {
-    uint lightCount = g_MiscDescriptorIndex;
-
     float4 finalColor = (float4)0;
 
     ConstantBuffer<LightPassConstantData> passData = GetLightPassData();
@@ -87,8 +95,17 @@ float4 PSMain(PSInput input) : SV_TARGET
     float4 viewPos = ScreenToView(float4(input.uv, depth, 1.0f));
     float3 worldPos = mul(passData.inverseView, viewPos).xyz;
 
-    for (uint i = 0; i < lightCount; i++) {
-        ConstantBuffer<LightConstantData> light = GetLightAtOffset(i);
+    // Only the point lights binned into this pixel's cluster
+    StructuredBuffer<uint2> clusters = ResourceDescriptorHeap[passData.clusterBufferIdx];
+    StructuredBuffer<uint> clusterLightIndices = ResourceDescriptorHeap[passData.clusterLightIndicesIdx];
+    uint2 cluster = clusters[GetLightCluster(passData, input.uv, -viewPos.z)];
+
+    for (uint i = 0; i < cluster.y; i++) {
+        LightConstantData light = GetLightAt(clusterLightIndices[cluster.x + i]);
+
+        if (distance(light.position.xyz, worldPos) > light.effectiveRadius) {
+            continue;
+        }
 
         float shadow = ComputeShadow(light, worldPos);
 
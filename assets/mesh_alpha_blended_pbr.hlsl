@@ -26,15 +26,17 @@ PSInput VSMain(VSInput input)
 {
     PSInput result;
 
-    ConstantBuffer<PrimitiveInstanceData> primitive = GetPrimitiveInstanceData(input.instance);
+    float3x4 world = GetInstanceWorld(input.instance);
+    ConstantBuffer<ViewData> view = GetViewData();
 
-    result.position = mul(primitive.MVP, float4(input.position, 1.0f));
+    float4 worldPos = float4(mul(world, float4(input.position, 1.0f)), 1.0f);
+    result.position = mul(view.viewProjection, worldPos);
 
     float3 binormal = cross(input.normal, input.tangent);
 
-    result.viewPos = mul(primitive.MV, float4(input.position, 1.0f));
+    result.viewPos = mul(view.view, worldPos);
 
-    float3x3 MV3 = (float3x3)primitive.MV;
+    float3x3 MV3 = mul((float3x3)view.view, (float3x3)world);
     result.normalVS = mul(MV3, input.normal);
     result.tangentVS = mul(MV3, input.tangent);
     result.binormalVS = mul(MV3, binormal);
@@ -79,17 +81,30 @@ PSOutput PSMain(PSInput input)
 
     float4 viewPos = input.viewPos;
 
+    // This object's light list, built on the CPU from the lights touching its bounds
+    StructuredBuffer<uint> lightList = ResourceDescriptorHeap[GetViewData().transparentLightListIdx];
+    uint firstLight = g_LightIndex;
     uint lightCount = g_LightPassDataIndex;
 
     result.backBuffer = float4(0, 0, 0, 0);
 
+    float4x4 view = GetViewData().view;
+
     for (uint i = 0; i < lightCount; i++) {
-        ConstantBuffer<LightConstantData> light = ResourceDescriptorHeap[g_LightIndex + i];
+        LightConstantData light = GetLightAt(lightList[firstLight + i]);
+
+        // Lights are stored in world space
+        float3 lightPosView = mul(view, float4(light.position.xyz, 1.0f)).xyz;
 
-        float3 lightToFragment = (-viewPos.xyz) -  (-light.positionViewSpace.xyz);
+        float3 lightToFragment = (-viewPos.xyz) -  (-lightPosView);
         float distance = length(lightToFragment);
         float attenuation = 1.0f / (distance * distance);
 
+        // The list is per object, so some pixels are still out of range
+        if (light.type != LIGHT_DIRECTIONAL && distance > light.effectiveRadius) {
+            continue;
+        }
+
         float3 N = normal.xyz;
 
         // Light direction to fragment
@@ -100,7 +115,7 @@ PSOutput PSMain(PSInput input)
         if (light.type == LIGHT_DIRECTIONAL) {
             attenuation = 1.0f;
             // Light direction to fragment
-            Wi = normalize(light.directionViewSpace.xyz);
+            Wi = normalize(mul((float3x3)view, light.direction.xyz));
             // Direction from fragment to eye
             Wo = normalize(-viewPos.xyz);
         }
@@ -27,14 +27,16 @@ PSInput VSMain(VSInput input)
 {
     PSInput result;
 
-    ConstantBuffer<PrimitiveInstanceData> primitive = GetPrimitiveInstanceData(input.instance);
+    float3x4 world = GetInstanceWorld(input.instance);
+    ConstantBuffer<ViewData> view = GetViewData();
 
-    result.position = mul(primitive.MVP, float4(input.position, 1.0f));
+    float3 worldPos = mul(world, float4(input.position, 1.0f));
+    result.position = mul(view.viewProjection, float4(worldPos, 1.0f));
 
     float3 binormal = cross(input.normal, input.tangent.xyz) * input.tangent.w;
 
     // Write out world space normals
-    float3x3 MV3 = (float3x3)primitive.M;
+    float3x3 MV3 = (float3x3)world;
 
     result.normalVS = mul(MV3, input.normal);
     result.tangentVS = mul(MV3, input.tangent.xyz);
@@ -21,9 +21,8 @@ PSInput VSMain(VSInput input)
 {
     PSInput result;
 
-    ConstantBuffer<PrimitiveInstanceData> primitiveData = GetPrimitiveInstanceData(input.instance);
-
-    result.position = mul(primitiveData.MVP, float4(input.position, 1.0f));
+    float3 worldPos = mul(GetInstanceWorld(input.instance), float4(input.position, 1.0f));
+    result.position = mul(GetViewData().viewProjection, float4(worldPos, 1.0f));
     result.uv = input.uv;
 
     return result;
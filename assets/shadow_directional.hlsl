@@ -14,16 +14,11 @@ PSInput VSMain(VSInput input)
 {
     PSInput result;
 
-    ConstantBuffer<PrimitiveInstanceData> primitive = GetPrimitiveInstanceData(input.instanceID);
-    ConstantBuffer<LightConstantData> light = GetLight();
+    LightConstantData light = GetLight();
 
-    //float4x4 MVP = light.directionalLightViewProjection * primitive.M;
-    float4x4 M = primitive.M;
+    float3 worldPos = mul(GetInstanceWorld(input.instanceID), float4(input.position, 1.0f));
     float4x4 VP = light.MVP;
-    //float4x4 MVP = mul(VP, M);
-    float4x4 MVP = mul(VP, M);
-    float4 aPos = float4(input.position, 1.0f);
-    result.position = mul(MVP, float4(input.position, 1.0f));
+    result.position = mul(VP, float4(worldPos, 1.0f));
 
     return result;
 }
@@ -16,11 +16,12 @@ TextureCube GetSkyboxTexture()
 
 PSInput VSMain(Vertex input)
 {
-    ConstantBuffer<PrimitiveInstanceData> primitive = GetPrimitiveData();
+    // w = 0 so the skybox ignores translation
+    float3 worldDir = mul(GetInstanceWorld(0), float4(input.pos, 0.0f));
 
     PSInput output;
     // Keep skybox at the far plane by locking Z to W
-    output.pos = mul(primitive.MVP, float4(input.pos, 0.0f)).xyww;
+    output.pos = mul(GetViewData().viewProjection, float4(worldDir, 0.0f)).xyww;
     output.pos.z = output.pos.z * 0.9999f;
     // Sample the texcube with just vertex position
     output.texcoord = input.pos;
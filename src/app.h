@@ -8,6 +8,16 @@
 #include "descriptorpool.h"
 #include "constantbufferstructures.h"
 #include "d3dutils.h"
+#include "drawpacket.h"
+#include "transforms.h"
+#include "lightclusters.h"
+#include "lights.h"
+#include "radixsort.h"
+#include "tlas.h"
+#include "blasscheduler.h"
+#include "probevolume.h"
+#include "assetcache.h"
+#include "asyncread.h"
 
 #include <SDL.h>
 
@@ -30,12 +40,21 @@
 #include <span>
 #include <string>
 #include <deque>
+#include <optional>
+#include <unordered_map>
 #include <variant>
 
 const UINT FrameBufferCount = 2;
-const UINT MaxLightCount = 512;
+// The light buffer starts this large and doubles when it fills up
+const UINT InitialLightCapacity = 65536;
+// Total light references across every transparent object's light list
+const UINT MaxTransparentLightIndices = 262144;
+// Irradiance probe buffer slots, 112 bytes each. Enough for 32 probes along every axis.
+const UINT MaxIrradianceProbes = 32 * 32 * 32;
 const UINT MaxMaterialCount = 2048;
-const UINT MaxDescriptors = 4096;
+const UINT MaxDescriptors = 65536;
+// Slots in the instance buffer, 48 bytes each
+const UINT MaxInstanceCount = 262144;
 const DXGI_FORMAT DepthStencilFormat = DXGI_FORMAT_D24_UNORM_S8_UINT;
 
 enum ConstantIndex
@@ -45,6 +64,7 @@ enum ConstantIndex
     ConstantIndex_Light,
     ConstantIndex_LightPassData,
     ConstantIndex_MiscParameter,
+    ConstantIndex_ViewData,
     ConstantIndex_Count
 };
 
@@ -111,12 +131,6 @@ struct Material
     }
 };
 
-struct AABB
-{
-    glm::vec3 min;
-    glm::vec3 max;
-};
-
 struct Primitive
 {
     // FIXME: Lot of duplicated data
@@ -126,8 +140,7 @@ struct Primitive
     ManagedPSORef PSO;
     UINT indexCount;
     UINT materialIndex;
-    DescriptorRef perPrimitiveDescriptor;
-    PrimitiveInstanceConstantData* constantData;
+    // Same as the owning mesh's instances.size()
     int instanceCount;
 
     // Optional custom descriptor for special primitive shaders. Can be anything.
@@ -137,10 +150,46 @@ struct Primitive
     SharedPoolItem<Material> material = nullptr;
 
     AABB localBoundingBox;
-    bool cull;
+    // Entry in App::transforms holding the world bounds of every instance
+    uint32_t boundsIndex = TransformStore::InvalidIndex;
+    bool cull = false;
 
-    ComPtr<D3D12MA::Allocation> blasResult;
-    ComPtr<D3D12MA::Allocation> blasScratch;
+    // Compacted BLAS, suballocated from a buffer shared by every primitive of the model
+    ComPtr<D3D12MA::Allocation> blasBuffer;
+    D3D12_GPU_VIRTUAL_ADDRESS blasAddress = 0;
+};
+
+// A placement of a Mesh in the world.
+// Every glTF node referencing a mesh (and every EXT_mesh_gpu_instancing entry)
+// becomes one instance, all sharing the mesh's primitives and BLAS.
+struct MeshInstance
+{
+    // Index into App::transforms, which holds the base GLTF transform
+    // and the live translation/euler/scale offsets.
+    uint32_t transformIndex;
+};
+
+// A BLAS waiting for the BLAS build scheduler
+struct BLASBuildRequest
+{
+    Primitive* primitive;
+    D3D12_RAYTRACING_GEOMETRY_DESC geometry;
+};
+
+// BLASes built together in one frame. Their uncompacted results share one buffer,
+// and are compacted into another the frame after.
+struct BLASBuildBatch
+{
+    std::vector<Primitive*> primitives;
+    std::vector<UINT64> resultOffsets;
+    UINT64 resultSize = 0;
+    ComPtr<D3D12MA::Allocation> uncompacted;
+    ComPtr<D3D12MA::Allocation> compactedSizes;
+    ComPtr<D3D12MA::Allocation> compactedSizesReadback;
+
+    std::vector<UINT64> compactedOffsets;
+    UINT64 compactedSize = 0;
+    ComPtr<D3D12MA::Allocation> compacted;
 };
 
 struct Mesh
@@ -155,13 +204,11 @@ struct Mesh
     // interface to std::vector
     std::vector<PoolItem<Primitive>> primitives;
 
-    // This is the base transform as defined in the GLTF model
-    glm::mat4 baseModelTransform;
-
-    // These are offsets of baseModelTransform that can be applied live.
-    glm::vec3 translation;
-    glm::vec3 euler;
-    glm::vec3 scale = glm::vec3(1.0f);
+    // Each primitive is drawn once per instance with an instanced draw.
+    // The world matrices of the instances are instances.size() consecutive
+    // slots in the instance buffer starting at firstInstance.
+    std::vector<MeshInstance> instances;
+    uint32_t firstInstance = RangeAllocator::InvalidIndex;
 
     std::string name;
 
@@ -177,12 +224,13 @@ struct Model
     std::vector<ComPtr<ID3D12Resource>> resources;
     std::vector<PoolItem<Mesh>> meshes;
 
-    UniqueDescriptors primitiveDataDescriptors;
-    UniqueDescriptors baseTextureDescriptor;
+    // The GLTF node hierarchy in App::transforms, parents before children.
+    // rootTransform is the parent of every scene root node, moving it moves the whole model.
+    uint32_t firstTransform = 0;
+    uint32_t transformCount = 0;
+    uint32_t rootTransform = TransformStore::InvalidIndex;
 
-    // All of the child mesh constant buffers stored in this constant buffer
-    ComPtr<ID3D12Resource> perPrimitiveConstantBuffer;
-    PrimitiveInstanceConstantData* perPrimitiveBufferPtr;
+    UniqueDescriptors baseTextureDescriptor;
 };
 
 struct Camera
@@ -201,6 +249,8 @@ struct Camera
     bool locked = true;
 
     float fovY = glm::pi<float>() * 0.2f;
+    float nearZ = 0.1f;
+    float farZ = 1000.0f;
 };
 
 struct MouseState
@@ -351,12 +401,6 @@ private:
     D3D12MA::Allocator* allocator;
 };
 
-enum LightType
-{
-    LightType_Point,
-    LightType_Directional,
-};
-
 struct App;
 
 typedef std::function<void(App& app, Model& model)> ModelFinishCallback;
@@ -398,83 +442,6 @@ struct RenderThread
     ComPtr<ID3D12CommandAllocator> commandAllocator;
 };
 
-struct Light
-{
-    LightConstantData* constantData;
-    glm::vec3 position;
-    glm::vec3 direction;
-
-    glm::vec3 color;
-    float intensity;
-    float range;
-
-    LightType lightType;
-
-    bool castsShadow = true;
-
-    // Screen space ray-traced shadow
-    struct {
-        ComPtr<D3D12MA::Allocation> texture;
-        UniqueDescriptors SRV;
-        UniqueDescriptors UAV;
-        UniqueDescriptors DSV;
-    } RayTracedShadow;
-
-    UINT shadowMapSize = 4096;
-
-    float radianceThreshold = 0.001;
-
-    // FIXME: CURRENTLY UNUSED
-    //
-    // Point lights follow the inverse square law and don't have a radius.
-    // But for optimization purposes we need to limit the range of the light.
-    // So we compute the effective radius using radianceThreshold^
-    //
-    // float radiance = attenuation * colorIntensity
-    // radiance = (1.0f / (distance * distance)) * colorIntensity
-    // let effectiveRadius = distance
-    // let radianceThreshold = radiance
-    // radianceThreshold = (1.0f / (effectiveRadius * effectiveRadius))
-    // effectiveRadius = sqrt(1.0f / (radianceThreshold * colorIntensity)) 
-    float effectiveRadius;
-
-    void UpdateConstantData(glm::mat4 viewMatrix)
-    {
-        glm::vec3 normalizedDirection = glm::normalize(direction);
-        constantData->position = glm::vec4(position, 1.0f);
-        constantData->direction = glm::vec4(normalizedDirection, 0.0f);
-        constantData->positionViewSpace = viewMatrix * constantData->position;
-        constantData->directionViewSpace = viewMatrix * glm::normalize(constantData->direction);
-        constantData->colorIntensity = glm::vec4(color * intensity, 1.0f);
-        constantData->range = range;
-        constantData->shadowMapDescriptorIdx = RayTracedShadow.SRV.Index();
-        constantData->lightType = (UINT)lightType;
-        constantData->castsShadow = castsShadow;
-
-        if (lightType == LightType_Point) {
-            float CI = glm::length(color * intensity);
-            effectiveRadius = sqrtf(1.0f / (radianceThreshold * CI));
-        }
-
-        // if (lightType == LightType_Directional) {
-        //     DirectX::XMMATRIX mat = DirectX::XMMatrixOrthographicRH(frustumSize, frustumSize, -frustumSize, frustumSize);
-        //     //glm::mat4 directionalProjection = glm::transpose(glm::make_mat4(reinterpret_cast<float*>(&mat.r)));
-        //     glm::mat4 directionalProjection = glm::ortho(-frustumSize, frustumSize, -frustumSize, frustumSize, 0.1f, frustumSize * 2.0f);
-        //     //glm::mat4 directionalProjection = glm::perspective(0.628319f, 1.0f, 0.1f, 10.0f);
-        //     glm::vec3 eye = -normalizedDirection * frustumSize * 1.2f;
-
-        //     glm::vec3 up(0.0f, 1.0f, 0.0f);
-        //     if (abs(glm::dot(up, normalizedDirection)) > 0.99f) {
-        //         // If the light is pointing straight up or down, we can't use the normal up vector
-        //         up = glm::vec3(1.0f, 0.0f, 0.0f);
-        //     }
-
-        //     glm::mat4 directionalView = glm::lookAt(eye, glm::vec3(0, 0, 0), up);
-        //     constantData->MVP = directionalProjection * directionalView;
-        // }
-    }
-};
-
 enum NodeType
 {
     NodeType_Mesh,
@@ -487,7 +454,8 @@ struct Node
     union
     {
         Mesh* mesh;
-        Light* light;
+        // LightStore handle
+        uint32_t light;
     };
 };
 
@@ -496,6 +464,32 @@ struct Scene
     std::vector<Node> nodes;
 };
 
+// Contiguous draw packets for every renderable primitive in the scene.
+// Rebuilt when the scene changes, the render threads only read it.
+struct DrawPacketList
+{
+    // Sorted by pass, then PSO, then vertex buffers.
+    std::vector<DrawPacket> packets;
+    // Parallel to packets, used to pull per-frame culling results.
+    std::vector<Primitive*> sourcePrimitives;
+    std::array<DrawPacketRange, DrawPass_Count> passRanges;
+
+    std::vector<D3D12_VERTEX_BUFFER_VIEW> vertexBufferViews;
+
+    // PSOs are held by reference so hot reloading still works,
+    // pipelineStates is resolved from them once per frame.
+    std::vector<ManagedPSORef> PSOs;
+    std::vector<ID3D12PipelineState*> pipelineStates;
+
+    std::atomic<bool> dirty = true;
+
+    std::span<const DrawPacket> PassPackets(DrawPass pass) const
+    {
+        const DrawPacketRange& range = passRanges[pass];
+        return std::span<const DrawPacket>(packets.data() + range.begin, range.end - range.begin);
+    }
+};
+
 typedef Pool<Primitive, 100> PrimitivePool;
 typedef Pool<Mesh, 32> MeshPool;
 
@@ -534,6 +528,46 @@ struct App
         long long lastFrameTimeNS = 0;
         long triangleCount = 0;
         std::atomic_uint drawCalls = 0;
+        float transformUpdateMS = 0.0f;
+        uint32_t dirtyTransforms = 0;
+        uint32_t uploadedTransforms = 0;
+        float lightBinningMS = 0.0f;
+        uint32_t clusterLightReferences = 0;
+        uint32_t visiblePointLights = 0;
+        uint32_t uploadedLights = 0;
+        float transparentPrepareMS = 0.0f;
+        uint32_t transparentDraws = 0;
+        uint32_t transparentLightReferences = 0;
+        uint32_t tlasPatchedInstances = 0;
+        uint32_t tlasBuildKind = 0;
+        uint64_t blasUncompactedBytes = 0;
+        uint64_t blasCompactedBytes = 0;
+        uint32_t blasBuildsIssued = 0;
+        uint64_t blasTrianglesIssued = 0;
+        float probeBakeMS = 0.0f;
+        bool probeBakeFromCache = false;
+        float assetLoadColdMS = 0.0f;
+        float assetLoadWarmMS = 0.0f;
+        float assetLoadCacheMissMS = 0.0f;
+        float assetLoadCacheHitMS = 0.0f;
+        uint32_t assetCacheBenchmarkHits = 0;
+        float assetCacheBenchmarkMB = 0.0f;
+        float assetReadStreamMS = 0.0f;
+        float assetReadMappedMS = 0.0f;
+        float assetReadAsyncMS = 0.0f;
+        float assetReadMB = 0.0f;
+        float glbLoadMS = 0.0f;
+        float glbAsGLTFLoadMS = 0.0f;
+        float cookedLoadMS = 0.0f;
+        float cookedSourceLoadMS = 0.0f;
+        // Of the last model loaded
+        uint32_t imageDecodeThreads = 0;
+        float imageDecodePeakMB = 0.0f;
+        // Summed over every texture in BenchmarkAssetIO
+        float imageDecodeMS = 0.0f;
+        float imageDecodeOldMS = 0.0f;
+        float imageBytesMovedKB = 0.0f;
+        float imageBytesMovedOldKB = 0.0f;
     } Stats;
 
     int windowWidth = 1920;
@@ -543,6 +577,10 @@ struct App
 
     struct {
         bool disableShadows = false;
+        BLASBuildScheduler::Budget blasBuildBudget;
+        int probesPerAxis = 16;
+        int probeSamples = 256;
+        int probeBounces = 2;
     } RenderSettings;
 
     PSOManager psoManager;
@@ -581,6 +619,27 @@ struct App
     Scene scene;
     std::vector<Model> models;
 
+    DrawPacketList drawPackets;
+    TransformStore transforms;
+
+    // World matrices of every mesh instance, written by App::transforms when they change.
+    // View and projection are applied once per pass from the view constants.
+    struct
+    {
+        ComPtr<ID3D12Resource> resource;
+        InstanceTransform* mappedPtr;
+        RangeAllocator allocator = RangeAllocator(MaxInstanceCount);
+
+        ComPtr<ID3D12Resource> viewConstantBuffer;
+        ViewConstantData* viewData;
+
+        // [0] is the instance buffer SRV, [1] the view constants CBV
+        UniqueDescriptors descriptors;
+
+        UINT SRVIndex() const { return descriptors.Index(); }
+        UINT ViewDataIndex() const { return descriptors.Index() + 1; }
+    } InstanceBuffer;
+
     unsigned int frameIdx;
 
     FenceEvent previousFrameEvent;
@@ -630,21 +689,87 @@ struct App
     struct
     {
         ComPtr<ID3D12Resource> constantBuffer;
-
-        // These two are stored in the same constant buffer.
-        // The lights are stored at offset (LightPassConstantData)
         LightPassConstantData* passData;
-        LightConstantData* lightConstantData;
 
-        UniqueDescriptors cbvHandle;
+        // Every light in LightStore slot order, grown on demand
+        ComPtr<ID3D12Resource> lightBuffer;
+        LightConstantData* mappedLights;
+        UINT capacity = 0;
+
+        // Pass data CBV at [0], light buffer SRV at [1]
+        UniqueDescriptors descriptors;
+
+        // Type ranges of the last upload, what the light pass draws
+        std::array<LightStore::Range, LightType_Count> ranges;
 
-        // Mesh* pointLightSphere;
-        // ConstantBufferVec<PrimitiveInstanceConstantData, MaxLightCount> pointSphereConstantData;
+        // Matrices the pass data inverses were computed from
+        glm::mat4 projection = glm::mat4(0.0f);
+        glm::mat4 view = glm::mat4(0.0f);
 
-        UINT count;
+        UINT PassDataIndex() const { return descriptors.Index(); }
+        UINT LightBufferIndex() const { return descriptors.Index() + 1; }
     } LightBuffer;
 
-    std::array<Light, MaxLightCount> lights;
+    LightStore lightStore;
+
+    // Point lights binned into view space froxels, read by the point light pass
+    struct
+    {
+        ComPtr<ID3D12Resource> clusterBuffer;
+        ComPtr<ID3D12Resource> indexBuffer;
+        glm::uvec2* mappedClusters;
+        uint32_t* mappedIndices;
+
+        // Cluster SRV at [0], light index SRV at [1]
+        UniqueDescriptors descriptors;
+
+        LightClusterBuilder builder;
+        std::vector<glm::vec4> viewSpheres;
+        std::vector<uint32_t> lightIds;
+    } LightClusters;
+
+    // Visible transparent primitives sorted back to front, each drawn once with its own light list
+    struct
+    {
+        ComPtr<ID3D12Resource> lightListBuffer;
+        uint32_t* mappedLightLists;
+        UniqueDescriptors descriptor;
+
+        std::vector<DrawPacket> packets;
+        // Parallel to packets, range of each packet's lights in the light list buffer
+        std::vector<DrawPacketLightRange> lightRanges;
+
+        // Scratch, kept around to avoid reallocating every frame
+        std::vector<SortItem> sortItems;
+        std::vector<SortItem> sortScratch;
+        std::vector<AABB> viewBounds;
+        SphereSoA objectLights;
+    } TransparentPass;
+
+    // CPU copy of every triangle primitive's geometry, only used for baking.
+    // Positions are local, each primitive is placed by each of its transforms.
+    struct BakePrimitive
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+        glm::vec3 albedo;
+        std::vector<uint32_t> transforms;
+    };
+
+    struct
+    {
+        std::mutex mutex;
+        std::vector<BakePrimitive> primitives;
+    } BakeGeometry;
+
+    // Probes baked by BakeIrradianceProbes, sampled by the environment lighting pass
+    struct
+    {
+        ComPtr<ID3D12Resource> buffer;
+        ProbeGPUData* mappedProbes;
+        UniqueDescriptors descriptor;
+        ProbeVolume volume;
+    } IrradianceProbes;
 
     struct
     {
@@ -671,12 +796,36 @@ struct App
 
     struct
     {
+        // Grow only, sized for capacity instances
         ComPtr<D3D12MA::Allocation> scratch;
         ComPtr<D3D12MA::Allocation> result;
         ComPtr<D3D12MA::Allocation> instancesUploadBuffer;
+        TLASInstanceDesc* mappedInstances = nullptr;
+        UINT capacity = 0;
         UniqueDescriptors descriptor;
+
+        TLASInstanceSet instanceSet;
+        // Scratch, gathered from the scene every frame
+        std::vector<TLASInstanceSource> instances;
     } TLAS;
 
+    // BLASes are queued by asset loading and built a few per frame, see UpdateBLASBuilds
+    struct
+    {
+        // Guards scheduler and requests, which loading threads add to
+        std::mutex mutex;
+        BLASBuildScheduler scheduler;
+        std::unordered_map<uint32_t, BLASBuildRequest> requests;
+        uint32_t nextRequestId = 0;
+
+        // Shared by every build, grows to fit each batch and is released once the queue drains
+        ComPtr<D3D12MA::Allocation> scratchArena;
+
+        // Recorded last frame, so complete once the previous frame's fence is
+        std::optional<BLASBuildBatch> building;
+        std::optional<BLASBuildBatch> compacting;
+    } BLASBuilds;
+
     // DXR 1.0
     // struct
     // {
@@ -693,13 +842,11 @@ struct App
         ComPtr<D3D12MA::Allocation> cubemap;
         ComPtr<D3D12MA::Allocation> vertexBuffer;
         ComPtr<D3D12MA::Allocation> indexBuffer;
-        ComPtr<D3D12MA::Allocation> perPrimitiveConstantBuffer;
-        ComPtr<D3D12MA::Allocation> irradianceCubeMap;
         ComPtr<D3D12MA::Allocation> prefilterMap;
-        UniqueDescriptors perPrimitiveCBV;
         UniqueDescriptors texcubeSRV;
-        UniqueDescriptors irradianceCubeSRV;
         UniqueDescriptors prefilterMapSRV;
+        // Sky radiance projected by ProjectSkyboxIrradiance, the lighting pass gets it cosine convolved
+        SHL2RGB radianceSH;
         PoolItem<Mesh> mesh;
 
         // LUT texture for environment BRDF split sum calculation.
@@ -724,6 +871,11 @@ struct App
 
         std::vector<std::unique_ptr<AssetLoadContext>> assetLoadInfo;
 
+        // Decoded and mipped model images, opened by StartAssetThread()
+        AssetCache cache;
+        // Reads external model images, created by StartAssetThread()
+        std::unique_ptr<AsyncFileReader> reader;
+
         std::mutex mutex;
         std::thread thread;
         std::condition_variable workEvent;
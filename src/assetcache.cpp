@@ -0,0 +1,223 @@
+#include "assetcache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static constexpr char AssetCacheMagic[4] = { 'M', 'D', 'X', 'C' };
+static constexpr uint32_t AssetCacheVersion = 1;
+
+// Padded so payloads start 64 byte aligned in the mapping
+struct AssetCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t payloadSize;
+    uint64_t keyLow;
+    uint64_t keyHigh;
+    uint8_t padding[32];
+};
+static_assert(sizeof(AssetCacheHeader) == 64);
+
+static const char* TempExtension = ".tmp";
+
+bool AssetCache::Open(const std::string& directoryPath, uint64_t maxSize)
+{
+    std::error_code ec;
+    fs::create_directories(directoryPath, ec);
+    if (!fs::is_directory(directoryPath, ec)) {
+        return false;
+    }
+
+    struct ScannedEntry
+    {
+        std::string name;
+        uint64_t size;
+        fs::file_time_type lastWrite;
+    };
+    std::vector<ScannedEntry> scanned;
+    for (const auto& file : fs::directory_iterator(directoryPath, ec)) {
+        if (!file.is_regular_file(ec)) {
+            continue;
+        }
+        // Left by a run that stopped partway through a store
+        if (file.path().extension() == TempExtension) {
+            fs::remove(file.path(), ec);
+            continue;
+        }
+        scanned.push_back({ file.path().filename().string(), file.file_size(ec), file.last_write_time(ec) });
+    }
+    std::sort(scanned.begin(), scanned.end(), [](const ScannedEntry& a, const ScannedEntry& b) {
+        return a.lastWrite < b.lastWrite;
+    });
+
+    std::lock_guard lock(mutex);
+    directory = directoryPath;
+    maxBytes = maxSize;
+    entries.clear();
+    totalBytes = 0;
+    for (const ScannedEntry& entry : scanned) {
+        entries[entry.name] = Entry{ entry.size, ++useCounter };
+        totalBytes += entry.size;
+    }
+    Evict();
+    return true;
+}
+
+bool AssetCache::Find(const ContentHash& key, MappedFile& entry, std::span<const uint8_t>& payload)
+{
+    std::string name = key.ToHex();
+    {
+        std::lock_guard lock(mutex);
+        if (!entries.contains(name)) {
+            misses++;
+            return false;
+        }
+    }
+
+    // The write time is the entry's recency for the next run, it's bumped before mapping as
+    // Windows doesn't allow changing it while the file is mapped
+    fs::path path = fs::path(directory) / name;
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+    AssetCacheHeader header;
+    bool isValid = entry.Open(path.string()) && entry.Bytes().size() >= sizeof(header);
+    if (isValid) {
+        memcpy(&header, entry.Bytes().data(), sizeof(header));
+        isValid = memcmp(header.magic, AssetCacheMagic, sizeof(AssetCacheMagic)) == 0 &&
+            header.version == AssetCacheVersion &&
+            header.payloadSize == entry.Bytes().size() - sizeof(header) &&
+            header.keyLow == key.low && header.keyHigh == key.high;
+    }
+
+    std::lock_guard lock(mutex);
+    if (!isValid) {
+        entry.Close();
+        misses++;
+        auto it = entries.find(name);
+        if (it != entries.end()) {
+            totalBytes -= it->second.size;
+            entries.erase(it);
+        }
+        fs::remove(path, ec);
+        return false;
+    }
+
+    hits++;
+    auto it = entries.find(name);
+    if (it != entries.end()) {
+        it->second.lastUse = ++useCounter;
+    }
+    payload = entry.Bytes().subspan(sizeof(header));
+    return true;
+}
+
+void AssetCache::Store(const ContentHash& key, size_t size, const std::function<void(uint8_t*)>& write)
+{
+    if (!IsOpen()) {
+        return;
+    }
+
+    std::vector<uint8_t> bytes(sizeof(AssetCacheHeader) + size);
+    AssetCacheHeader header = {};
+    memcpy(header.magic, AssetCacheMagic, sizeof(AssetCacheMagic));
+    header.version = AssetCacheVersion;
+    header.payloadSize = size;
+    header.keyLow = key.low;
+    header.keyHigh = key.high;
+    memcpy(bytes.data(), &header, sizeof(header));
+    write(bytes.data() + sizeof(header));
+
+    // Written under a temporary name and renamed into place, so a half written entry is never
+    // found, even when two threads store the same key
+    static std::atomic<uint32_t> tempCounter = 0;
+    std::string name = key.ToHex();
+    fs::path path = fs::path(directory) / name;
+    fs::path tempPath = fs::path(directory) / (name + "." + std::to_string(tempCounter++) + TempExtension);
+    {
+        std::ofstream file(tempPath, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        if (!file.good()) {
+            file.close();
+            std::error_code ec;
+            fs::remove(tempPath, ec);
+            return;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(tempPath, path, ec);
+    if (ec) {
+        // The existing entry is mapped by another load
+        fs::remove(tempPath, ec);
+        return;
+    }
+
+    std::lock_guard lock(mutex);
+    auto it = entries.find(name);
+    if (it != entries.end()) {
+        totalBytes -= it->second.size;
+    }
+    entries[name] = Entry{ bytes.size(), ++useCounter };
+    totalBytes += bytes.size();
+    Evict();
+}
+
+// Called with mutex held
+void AssetCache::Evict()
+{
+    if (totalBytes <= maxBytes) {
+        return;
+    }
+
+    std::vector<std::pair<uint64_t, std::string>> byAge;
+    byAge.reserve(entries.size());
+    for (const auto& [name, entry] : entries) {
+        byAge.push_back({ entry.lastUse, name });
+    }
+    std::sort(byAge.begin(), byAge.end());
+
+    for (const auto& [lastUse, name] : byAge) {
+        if (totalBytes <= maxBytes) {
+            break;
+        }
+        std::error_code ec;
+        if (!fs::remove(fs::path(directory) / name, ec) && ec) {
+            // Mapped on Windows, it's evicted on a later store or run instead
+            continue;
+        }
+        totalBytes -= entries[name].size;
+        entries.erase(name);
+        evictions++;
+    }
+}
+
+uint64_t AssetCache::Hits() const
+{
+    std::lock_guard lock(mutex);
+    return hits;
+}
+
+uint64_t AssetCache::Misses() const
+{
+    std::lock_guard lock(mutex);
+    return misses;
+}
+
+uint64_t AssetCache::Evictions() const
+{
+    std::lock_guard lock(mutex);
+    return evictions;
+}
+
+uint64_t AssetCache::SizeInBytes() const
+{
+    std::lock_guard lock(mutex);
+    return totalBytes;
+}
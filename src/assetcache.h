@@ -0,0 +1,66 @@
+#pragma once
+
+#include "contenthash.h"
+#include "mappedfile.h"
+
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+// Persistent cache of processed asset data, keyed by a ContentHash of the source bytes and
+// whatever settings the processing depends on.
+//
+// Each entry is a file named by its key in the cache directory, holding a small header and the
+// payload. Hits are mapped rather than read, so a cached texture goes from the file cache to
+// upload memory without an intermediate copy. When the entries add up to more than the size
+// limit the least recently used are deleted, recency being kept in the files' write times so it
+// carries over between runs. Entries that are mapped when they're evicted stay until next time.
+class AssetCache
+{
+public:
+    // Creates the directory if needed and indexes the entries already in it.
+    // Returns false if the directory can't be used, the cache then misses everything.
+    bool Open(const std::string& directory, uint64_t maxBytes);
+
+    bool IsOpen() const
+    {
+        return !directory.empty();
+    }
+
+    // Maps the entry for key into entry, with payload pointing at its bytes. Returns false if
+    // there's no entry or it's damaged. Safe to call from any thread.
+    bool Find(const ContentHash& key, MappedFile& entry, std::span<const uint8_t>& payload);
+
+    // Adds an entry of size bytes, which write fills in, then evicts entries until the cache fits
+    // in its limit. Safe to call from any thread.
+    void Store(const ContentHash& key, size_t size, const std::function<void(uint8_t*)>& write);
+
+    uint64_t Hits() const;
+    uint64_t Misses() const;
+    uint64_t Evictions() const;
+    uint64_t SizeInBytes() const;
+
+private:
+    struct Entry
+    {
+        uint64_t size;
+        // Higher is more recent
+        uint64_t lastUse;
+    };
+
+    void Evict();
+
+    std::string directory;
+    uint64_t maxBytes = 0;
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    uint64_t useCounter = 0;
+    uint64_t totalBytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
@@ -3,6 +3,14 @@
 #include "app.h"
 #include "d3dutils.h"
 #include "uploadbatch.h"
+#include "mappedfile.h"
+#include "assetcache.h"
+#include "asyncread.h"
+#include "cookedmodel.h"
+#include "decodepool.h"
+#include "imagedecode.h"
+#include "ktx2.h"
+#include "mipchain.h"
 
 #include <pix3.h>
 
@@ -11,12 +19,32 @@
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/euler_angles.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <filesystem>
 #include <fstream>
 #include <future>
+#include <numeric>
 
 std::mutex g_assetMutex;
 std::mutex g_punctualLightLock;
 
+// GLTF node hierarchy flattened so parents always come before their children.
+// Entry 0 is an extra root that every scene root node is parented to.
+struct GLTFTransformNode
+{
+    glm::mat4 local;
+    int parent;
+};
+
+// Indices into the flattened hierarchy of every instance of each GLTF mesh, indexed by GLTF mesh index.
+typedef std::vector<std::vector<uint32_t>> GLTFMeshInstances;
+
+// Bytes of each GLTF buffer, indexed by GLTF buffer index. These are read instead of
+// tinygltf::Buffer::data, since the BIN chunk of a .glb is used in place from the mapped file.
+typedef std::vector<std::span<const unsigned char>> GLTFBufferData;
+
 struct alignas(16) GenerateMipsConstantData
 {
     UINT texIdx;
@@ -41,25 +69,13 @@ static_assert((sizeof(ComputeSkyboxMapsConstantData) % 256) == 0, "Constant buff
 
 std::vector<unsigned char> LoadBinaryFile(const std::string& filePath)
 {
-    std::ifstream file(filePath, std::ios::binary);
-    std::vector<unsigned char> data;
-
-    if (!file.good()) {
-        return data;
+    MappedFile file;
+    if (!file.Open(filePath)) {
+        return {};
     }
 
-    file.unsetf(std::ios::skipws);
-
-    std::streampos fileSize;
-    file.seekg(0, std::ios::end);
-    fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    data.reserve(fileSize);
-
-    data.insert(data.begin(), std::istream_iterator<unsigned char>(file), std::istream_iterator<unsigned char>());
-
-    return data;
+    std::span<const uint8_t> bytes = file.Bytes();
+    return std::vector<unsigned char>(bytes.begin(), bytes.end());
 }
 
 
@@ -88,14 +104,15 @@ std::optional<tinygltf::Image> LoadImageFromMemory(const unsigned char* bytes, i
 
 std::optional<tinygltf::Image> LoadImageFile(const std::string& imagePath)
 {
-    auto fileData = LoadBinaryFile(imagePath);
+    MappedFile file;
 
-    if (fileData.empty()) {
-        DebugLog() << "Failed to load " << imagePath << ": " << stbi_failure_reason() << "\n";
+    if (!file.Open(imagePath) || file.Bytes().empty()) {
+        DebugLog() << "Failed to load " << imagePath << "\n";
         assert(false);
+        return {};
     }
 
-    return LoadImageFromMemory(fileData.data(), fileData.size());
+    return LoadImageFromMemory(file.Bytes().data(), (int)file.Bytes().size());
 }
 
 
@@ -103,7 +120,12 @@ std::optional<HDRImage> LoadHDRImage(const std::string& filePath)
 {
     HDRImage result;
 
-    float* data = stbi_loadf(filePath.c_str(), &result.width, &result.height, nullptr, STBI_rgb_alpha);
+    MappedFile file;
+    if (!file.Open(filePath)) {
+        return {};
+    }
+
+    float* data = stbi_loadf_from_memory(file.Bytes().data(), (int)file.Bytes().size(), &result.width, &result.height, nullptr, STBI_rgb_alpha);
 
     if (!data) {
         return {};
@@ -117,35 +139,13 @@ std::optional<HDRImage> LoadHDRImage(const std::string& filePath)
 
 void CreateModelDescriptors(
     App& app,
-    const tinygltf::Model& inputModel,
     Model& outputModel,
     const std::span<ComPtr<ID3D12Resource>> textureResources
 )
 {
-    // Allocate 1 descriptor for the constant buffer and the rest for the textures.
-    UINT numConstantBuffers = 0;
-    for (const auto& mesh : inputModel.meshes) {
-        numConstantBuffers += (UINT)mesh.primitives.size();
-    }
-    UINT numDescriptors = numConstantBuffers + (UINT)inputModel.textures.size();
-
     UINT incrementSize = G_IncrementSizes.CbvSrvUav;
 
-    // Create per-primitive constant buffer
-    ComPtr<ID3D12Resource> perPrimitiveConstantBuffer;
-    {
-        outputModel.primitiveDataDescriptors = AllocateDescriptorsUnique(app.descriptorPool, numConstantBuffers, "PerPrimitiveConstantBuffer");
-        auto cpuHandle = outputModel.primitiveDataDescriptors.CPUHandle();
-        CreateConstantBufferAndViews(
-            app.device.Get(),
-            perPrimitiveConstantBuffer,
-            sizeof(PrimitiveInstanceConstantData),
-            numConstantBuffers,
-            cpuHandle
-        );
-    }
-
-    // Create SRVs
+    // Per-instance data lives in App::InstanceBuffer, so only the textures need descriptors.
     if (textureResources.size() > 0) {
         auto descriptorRef = AllocateDescriptorsUnique(app.descriptorPool, (UINT)textureResources.size(), "MeshTextures");
         auto cpuHandle = descriptorRef.CPUHandle();
@@ -161,10 +161,6 @@ void CreateModelDescriptors(
         }
         outputModel.baseTextureDescriptor = std::move(descriptorRef);
     }
-
-    outputModel.perPrimitiveConstantBuffer = perPrimitiveConstantBuffer;
-    CD3DX12_RANGE readRange(0, 0);
-    ASSERT_HRESULT(perPrimitiveConstantBuffer->Map(0, &readRange, reinterpret_cast<void**>(&outputModel.perPrimitiveBufferPtr)));
 }
 
 
@@ -522,105 +518,261 @@ void GenerateMipMaps(App& app, const std::span<ComPtr<ID3D12Resource>>& textures
 }
 
 
-// Note: if I truely want to do things as efficiently as possible I will
-// Generate mips on demand as images load asynchronously.
+// Decoded images that haven't been uploaded yet may use up to this much memory
+// before the decode threads wait for uploads to catch up.
+const uint64_t ImageDecodeBudgetBytes = 256ull * 1024 * 1024;
+
+// Decoded and mipped images are kept in the asset cache up to this size in total
+const uint64_t AssetCacheMaxBytes = 4ull * 1024 * 1024 * 1024;
+
+// Part of the cache key of decoded images, bump it when decoding or mip generation changes their pixels
+const uint32_t ImageCacheVersion = 1;
+
+
+// The images of a model being decoded by BeginModelImageLoad()
+struct ImageLoadContext
+{
+    // Declared before pool so it outlives the decode threads
+    std::unique_ptr<DecodeBudget> budget;
+    // Bytes each image holds of budget until it's uploaded and released
+    std::vector<uint64_t> imageBytes;
+    // External images read by an AsyncFileReader, each freed once it's decoded
+    std::vector<std::vector<uint8_t>> readImages;
+    // Pixels and mips 1 and down of each image, parallel to the model's images
+    std::vector<DecodedImage> decodedImages;
+    std::vector<std::vector<uint8_t>> mipChains;
+    // Images found in the asset cache aren't decoded, their RGBA8 pixels followed by their mip chain
+    // are uploaded from the mapped entry instead. Empty for images that weren't in the cache.
+    std::vector<MappedFile> cacheEntries;
+    std::vector<std::span<const uint8_t>> cachedPixels;
+    // KTX2 images uploaded as they're stored, the format is Unsupported for every other image
+    std::vector<KTX2Image> ktx2Images;
+    // External KTX2 files stay mapped until their levels are uploaded
+    std::vector<MappedFile> ktx2Files;
+    // An image that's only the fallback of textures whose pre-transcoded KTX2 images are loaded
+    // instead isn't decoded. It shares the texture of the KTX2 image it holds the index of, or is -1.
+    std::vector<int> replacedBy;
+    std::unique_ptr<DecodePool> pool;
+};
+
+
+static D3D12_RESOURCE_DESC GetKTX2ResourceDesc(const KTX2Image& image)
+{
+    DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+    switch (image.format) {
+    case KTX2Format::RGBA8:
+        format = image.isSRGB ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+        break;
+    case KTX2Format::BC1:
+        format = image.isSRGB ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+        break;
+    case KTX2Format::BC2:
+        format = image.isSRGB ? DXGI_FORMAT_BC2_UNORM_SRGB : DXGI_FORMAT_BC2_UNORM;
+        break;
+    case KTX2Format::BC3:
+        format = image.isSRGB ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM;
+        break;
+    case KTX2Format::BC4:
+        format = DXGI_FORMAT_BC4_UNORM;
+        break;
+    case KTX2Format::BC5:
+        format = DXGI_FORMAT_BC5_UNORM;
+        break;
+    case KTX2Format::BC7:
+        format = image.isSRGB ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+        break;
+    default:
+        CHECK(false);
+    }
+    return CD3DX12_RESOURCE_DESC::Tex2D(format, image.width, image.height, 1, (UINT16)image.levels.size());
+}
+
+
+// Uploads each image with its whole mip chain as soon as the image's decode finishes, while the
+// rest are still decoding. Mips are generated on the CPU by the decode threads and written into
+// upload memory with everything else, so there are no staging textures or GPU passes.
 void LoadModelTextures(
     App& app,
     Model& outputModel,
     tinygltf::Model& inputModel,
     std::vector<CD3DX12_RESOURCE_BARRIER>& resourceBarriers,
     const std::vector<bool>& imageIsSRGB,
-    ID3D12GraphicsCommandList* commandList,
-    ID3D12CommandAllocator* commandAllocator,
-    FenceEvent& fenceEvent
+    FenceEvent& fenceEvent,
+    ImageLoadContext& imageLoadContext
 )
 {
-    // We generate mips on unordered access view textures, but these textures
-    // are slow for rendering, so we have to copy them to normal textures
-    // aftwards.
-    std::vector<ComPtr<ID3D12Resource>> stagingTexturesForMipMaps;
-    stagingTexturesForMipMaps.reserve(inputModel.images.size());
+    // Model textures are in image order, but images finish in any order
+    std::vector<ComPtr<ID3D12Resource>> textures(inputModel.images.size());
 
     UploadBatch uploadBatch;
     uploadBatch.Begin(app.mainAllocator.Get(), &app.copyQueue);
 
-    // Upload images to buffers
-    for (int i = 0; i < inputModel.images.size(); i++) {
-        const auto& gltfImage = inputModel.images[i];
-        ComPtr<ID3D12Resource> buffer;
+    while (std::optional<uint32_t> imageIdx = imageLoadContext.pool->WaitNext()) {
+        const int i = (int)*imageIdx;
+        if (imageLoadContext.replacedBy[i] != -1) {
+            continue;
+        }
+
+        auto& gltfImage = inputModel.images[i];
+        const KTX2Image& ktx2Image = imageLoadContext.ktx2Images[i];
+        ComPtr<ID3D12Resource> texture;
         CD3DX12_HEAP_PROPERTIES heapProps(D3D12_HEAP_TYPE_DEFAULT);
-        auto resourceDesc = GetImageResourceDesc(gltfImage, imageIsSRGB[i]);
-        auto resourceState = D3D12_RESOURCE_STATE_COMMON;
+        auto resourceDesc = ktx2Image.format != KTX2Format::Unsupported ? GetKTX2ResourceDesc(ktx2Image) : GetImageResourceDesc(gltfImage, imageIsSRGB[i]);
         ASSERT_HRESULT(
             app.device->CreateCommittedResource(
                 &heapProps,
                 D3D12_HEAP_FLAG_NONE,
                 &resourceDesc,
-                resourceState,
+                D3D12_RESOURCE_STATE_COMMON,
                 nullptr,
-                IID_PPV_ARGS(&buffer)
+                IID_PPV_ARGS(&texture)
             )
         );
 
-        D3D12_SUBRESOURCE_DATA subresourceData;
-        subresourceData.pData = gltfImage.image.data();
-        subresourceData.RowPitch = gltfImage.width * gltfImage.component;
-        subresourceData.SlicePitch = gltfImage.height * subresourceData.RowPitch;
-        uploadBatch.AddTexture(buffer.Get(), &subresourceData, 0, 1);
+#ifdef MDXR_DEBUG
+        {
+            std::wstring bufName = convert_to_wstring(
+                "Texture#" + std::to_string(i) + " " + gltfImage.name + ":" + gltfImage.uri
+            );
+            texture->SetName(bufName.c_str());
+        }
+#endif
+
+        if (ktx2Image.format != KTX2Format::Unsupported) {
+            // Levels are already in the texture's format, they only need their rows pitched
+            uploadBatch.AddTextureInPlace(texture.Get(), 0, resourceDesc.MipLevels, [&](int level, UINT8* dest, UINT rowPitch, UINT numRows) {
+                const KTX2Level& ktx2Level = ktx2Image.levels[level];
+                size_t rowBytes = KTX2RowBytes(ktx2Image.format, ktx2Level.width);
+                for (UINT row = 0; row < numRows; row++) {
+                    memcpy(dest + row * rowPitch, ktx2Level.data.data() + row * rowBytes, rowBytes);
+                }
+            });
+
+            textures[i] = texture;
+            resourceBarriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(
+                texture.Get(),
+                D3D12_RESOURCE_STATE_COPY_DEST,
+                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE
+            ));
+            imageLoadContext.ktx2Files[i].Close();
+            continue;
+        }
+
+        const std::span<const uint8_t> cached = imageLoadContext.cachedPixels[i];
+        if (!cached.empty()) {
+            std::vector<MipLevel> mipLevels = MipChainLevels(gltfImage.width, gltfImage.height);
+            const uint8_t* cachedMipChain = cached.data() + (size_t)gltfImage.width * gltfImage.height * 4;
+            uploadBatch.AddTextureInPlace(texture.Get(), 0, resourceDesc.MipLevels, [&](int mip, UINT8* dest, UINT rowPitch, UINT numRows) {
+                const uint8_t* src = mip == 0 ? cached.data() : cachedMipChain + mipLevels[mip - 1].offset;
+                size_t levelPitch = (size_t)std::max(gltfImage.width >> mip, 1) * 4;
+                for (UINT y = 0; y < numRows; y++) {
+                    memcpy(dest + y * rowPitch, src + y * levelPitch, levelPitch);
+                }
+            });
+
+            textures[i] = texture;
+            resourceBarriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(
+                texture.Get(),
+                D3D12_RESOURCE_STATE_COPY_DEST,
+                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE
+            ));
+            imageLoadContext.cacheEntries[i].Close();
+            gltfImage.image.clear();
+            gltfImage.image.shrink_to_fit();
+            continue;
+        }
+
+        // Mip 0 is expanded to RGBA straight into upload memory, the only copy the decoded pixels get
+        DecodedImage& decoded = imageLoadContext.decodedImages[i];
+        std::vector<uint8_t>& mipChain = imageLoadContext.mipChains[i];
+        std::vector<MipLevel> mipLevels = MipChainLevels(decoded.Width(), decoded.Height());
+        uploadBatch.AddTextureInPlace(texture.Get(), 0, resourceDesc.MipLevels, [&](int mip, UINT8* dest, UINT rowPitch, UINT) {
+            if (mip == 0) {
+                decoded.WriteRGBA8(dest, rowPitch);
+                return;
+            }
 
-        stagingTexturesForMipMaps.push_back(buffer);
-    }
+            const MipLevel& level = mipLevels[mip - 1];
+            size_t levelPitch = (size_t)level.width * 4;
+            for (uint32_t y = 0; y < level.height; y++) {
+                memcpy(dest + y * rowPitch, mipChain.data() + level.offset + y * levelPitch, levelPitch);
+            }
+        });
 
-    FenceEvent uploadEvent = uploadBatch.Finish();
+        textures[i] = texture;
+        resourceBarriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(
+            texture.Get(),
+            D3D12_RESOURCE_STATE_COPY_DEST,
+            D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE
+        ));
 
-    app.copyQueue.WaitForEventCPU(uploadEvent);
+        // Data URI images still hold their encoded bytes
+        decoded.Free();
+        mipChain.clear();
+        mipChain.shrink_to_fit();
+        gltfImage.image.clear();
+        gltfImage.image.shrink_to_fit();
+        imageLoadContext.budget->Release(imageLoadContext.imageBytes[i]);
+    }
 
-    // Now that the images are uploaded these can be free'd
-    for (auto& image : inputModel.images) {
-        image.image.clear();
-        image.image.shrink_to_fit();
+    for (size_t i = 0; i < textures.size(); i++) {
+        if (imageLoadContext.replacedBy[i] != -1) {
+            textures[i] = textures[imageLoadContext.replacedBy[i]];
+        }
     }
 
-    GenerateMipMaps(app, stagingTexturesForMipMaps, imageIsSRGB, uploadEvent);
+    app.Stats.imageDecodeThreads = imageLoadContext.pool->ThreadCount();
+    app.Stats.imageDecodePeakMB = imageLoadContext.budget->PeakBytes() / (1024.0f * 1024.0f);
 
-    D3D12MA::Budget localBudget;
-    app.mainAllocator->GetBudget(&localBudget, nullptr);
+    outputModel.resources.insert(outputModel.resources.end(), textures.begin(), textures.end());
 
-    // Only use up to 75% remaining memory on these uploads
-    size_t maxUploadBytes = localBudget.BudgetBytes / 2;
-    size_t pendingUploadBytes = 0;
+    fenceEvent = uploadBatch.Finish();
+}
 
-    // Copy mip map textures to non-UAV textures for the model.
-    for (int textureIdx = 0; textureIdx < inputModel.images.size(); textureIdx++) {
-        // FIXME: This would be much better with aliased resources, but that will 
-        // require switching the model to use the D3D12MA system for placed resources.
-        ComPtr<ID3D12Resource> destResource;
-        CD3DX12_HEAP_PROPERTIES heapProps(D3D12_HEAP_TYPE_DEFAULT);
-        auto& inputImage = inputModel.images[textureIdx];
-        auto resourceDesc = GetImageResourceDesc(inputImage, imageIsSRGB[textureIdx]);
-
-        auto allocInfo = app.device->GetResourceAllocationInfo(0, 1, &resourceDesc);
-        if (pendingUploadBytes > 0 && allocInfo.SizeInBytes + pendingUploadBytes > maxUploadBytes) {
-            // Flush the upload
-            ASSERT_HRESULT(commandList->Close());
-            app.copyQueue.ExecuteCommandListsBlocking({ commandList });
-
-            // Clear the previous staging textures to free memory
-            for (int stageIdx = 0; stageIdx < textureIdx; stageIdx++) {
-                stagingTexturesForMipMaps[stageIdx] = nullptr;
-            }
 
-            ASSERT_HRESULT(commandAllocator->Reset());
-            ASSERT_HRESULT(
-                commandList->Reset(
-                    commandAllocator,
-                    nullptr
-                )
-            );
+static DXGI_FORMAT CookedTextureDXGIFormat(const CookedTexture& texture)
+{
+    switch (texture.format) {
+    case CookedTextureFormat_BC1:
+        return texture.isSRGB ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+    case CookedTextureFormat_BC4:
+        return DXGI_FORMAT_BC4_UNORM;
+    case CookedTextureFormat_BC5:
+        return DXGI_FORMAT_BC5_UNORM;
+    case CookedTextureFormat_BC7:
+        return texture.isSRGB ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+    default:
+        return texture.isSRGB ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+    }
+}
 
-            pendingUploadBytes = 0;
-        }
 
+// Cooked textures already have every mip, laid out the way the copy queue reads them, so the
+// mips are copied straight from the mapped file into upload memory. No mips are generated
+// and no staging textures are needed.
+void LoadCookedModelTextures(
+    App& app,
+    Model& outputModel,
+    std::span<const CookedTexture> textures,
+    std::vector<CD3DX12_RESOURCE_BARRIER>& resourceBarriers,
+    FenceEvent& fenceEvent
+)
+{
+    UploadBatch uploadBatch;
+    uploadBatch.Begin(app.mainAllocator.Get(), &app.copyQueue);
+
+    for (size_t textureIdx = 0; textureIdx < textures.size(); textureIdx++) {
+        const CookedTexture& texture = textures[textureIdx];
+
+        ComPtr<ID3D12Resource> destResource;
+        CD3DX12_HEAP_PROPERTIES heapProps(D3D12_HEAP_TYPE_DEFAULT);
+        auto resourceDesc = CD3DX12_RESOURCE_DESC::Tex2D(
+            CookedTextureDXGIFormat(texture),
+            texture.width,
+            texture.height,
+            1,
+            (UINT16)texture.mips.size()
+        );
         ASSERT_HRESULT(
             app.device->CreateCommittedResource(
                 &heapProps,
@@ -632,63 +784,52 @@ void LoadModelTextures(
             )
         );
 
-        pendingUploadBytes += allocInfo.SizeInBytes;
-
 #ifdef MDXR_DEBUG
         {
-            std::wstring bufName = convert_to_wstring(
-                "Texture#" + std::to_string(textureIdx) + " " + inputImage.name + ":" + inputImage.uri
-            );
+            std::wstring bufName = convert_to_wstring("Cooked Texture#" + std::to_string(textureIdx));
             destResource->SetName(bufName.c_str());
         }
 #endif
 
-        commandList->CopyResource(destResource.Get(), stagingTexturesForMipMaps[textureIdx].Get());
+        std::vector<D3D12_SUBRESOURCE_DATA> subresourceData;
+        for (const CookedMip& mip : texture.mips) {
+            D3D12_SUBRESOURCE_DATA data;
+            data.pData = mip.data.data();
+            data.RowPitch = mip.rowPitch;
+            data.SlicePitch = mip.data.size();
+            subresourceData.push_back(data);
+        }
+        uploadBatch.AddTexture(destResource.Get(), subresourceData.data(), 0, (int)subresourceData.size());
+
         outputModel.resources.push_back(destResource);
 
         resourceBarriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(
-            outputModel.resources.back().Get(),
+            destResource.Get(),
             D3D12_RESOURCE_STATE_COPY_DEST,
             D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE
         ));
     }
 
-    commandList->Close();
-    app.copyQueue.ExecuteCommandLists({ commandList }, fenceEvent);
-    for (auto& texture : stagingTexturesForMipMaps) {
-        if (texture != nullptr) {
-            fenceEvent.TrackObject(texture.Get());
-        }
-    }
-}
-
-
-// Gets a vector of booleans parallel to inputModel.images to determine which
-// images are SRGB. This information is needed to generate the mipmaps properly.
-std::vector<bool> DetermineSRGBTextures(const tinygltf::Model& inputModel)
-{
-    std::vector<bool> imageIsSRGB(inputModel.images.size(), false);
-
-    // The only textures in a GLTF model that are SRGB are the base color textures.
-    for (const auto& material : inputModel.materials) {
-        auto textureIndex = material.pbrMetallicRoughness.baseColorTexture.index;
-        if (textureIndex != -1) {
-            auto imageIndex = inputModel.textures[textureIndex].source;
-            imageIsSRGB[imageIndex] = true;
-        }
-    }
-
-    return imageIsSRGB;
+    fenceEvent = uploadBatch.Finish();
 }
 
 
-typedef std::vector<std::thread> ImageLoadContext;
-
-
-void WaitForModelImages(ImageLoadContext& threads)
+// Drains the decode pool without uploading anything, freeing each image as it finishes.
+// Images from the asset cache are read through once, as their upload would, so they're timed fairly.
+void WaitForModelImages(tinygltf::Model& model, ImageLoadContext& imageLoadContext)
 {
-    for (auto& thread : threads) {
-        thread.join();
+    volatile uint64_t cachedSum = 0;
+    while (std::optional<uint32_t> imageIdx = imageLoadContext.pool->WaitNext()) {
+        std::span<const uint8_t> cached = imageLoadContext.cachedPixels[*imageIdx];
+        cachedSum = cachedSum + std::accumulate(cached.begin(), cached.end(), (uint64_t)0);
+        imageLoadContext.decodedImages[*imageIdx].Free();
+        imageLoadContext.ktx2Files[*imageIdx].Close();
+        imageLoadContext.cacheEntries[*imageIdx].Close();
+        imageLoadContext.mipChains[*imageIdx].clear();
+        imageLoadContext.mipChains[*imageIdx].shrink_to_fit();
+        model.images[*imageIdx].image.clear();
+        model.images[*imageIdx].image.shrink_to_fit();
+        imageLoadContext.budget->Release(imageLoadContext.imageBytes[*imageIdx]);
     }
 }
 
@@ -697,13 +838,13 @@ std::vector<ComPtr<ID3D12Resource>> UploadModelBuffers(
     Model& outputModel,
     App& app,
     tinygltf::Model& inputModel,
-    ID3D12GraphicsCommandList* copyCommandList,
-    ID3D12CommandAllocator* copyCommandAllocator,
+    const GLTFBufferData& bufferData,
     const std::vector<UINT64>& uploadOffsets,
     std::span<ComPtr<ID3D12Resource>>& outGeometryResources,
     std::span<ComPtr<ID3D12Resource>>& outTextureResources,
     FenceEvent& fenceEvent,
     ImageLoadContext& imageLoadContext,
+    std::span<const CookedTexture> cookedTextures,
     AssetLoadContext* context
 )
 {
@@ -722,10 +863,10 @@ std::vector<ComPtr<ID3D12Resource>> UploadModelBuffers(
 
     // Copy all the gltf buffer data to a dedicated geometry buffer
     for (size_t bufferIdx = 0; bufferIdx < inputModel.buffers.size(); bufferIdx++) {
-        const auto& gltfBuffer = inputModel.buffers[bufferIdx];
+        std::span<const unsigned char> gltfBuffer = bufferData[bufferIdx];
         ComPtr<ID3D12Resource> geometryBuffer;
         CD3DX12_HEAP_PROPERTIES heapProps(D3D12_HEAP_TYPE_DEFAULT);
-        auto resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(gltfBuffer.data.size());
+        auto resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(gltfBuffer.size());
         auto resourceState = D3D12_RESOURCE_STATE_COMMON;
         ASSERT_HRESULT(
             app.device->CreateCommittedResource(
@@ -738,7 +879,7 @@ std::vector<ComPtr<ID3D12Resource>> UploadModelBuffers(
             )
         );
 
-        uploadBatch.AddBuffer(geometryBuffer.Get(), 0, (void*)gltfBuffer.data.data(), gltfBuffer.data.size());
+        uploadBatch.AddBuffer(geometryBuffer.Get(), 0, gltfBuffer.data(), gltfBuffer.size());
 
 #ifdef MDXR_DEBUG
         {
@@ -761,18 +902,19 @@ std::vector<ComPtr<ID3D12Resource>> UploadModelBuffers(
     context->currentTask = "Loading model textures";
     context->overallPercent = 0.30f;
 
-    WaitForModelImages(imageLoadContext);
-
-    LoadModelTextures(
-        app,
-        outputModel,
-        inputModel,
-        resourceBarriers,
-        imageIsSRGB,
-        copyCommandList,
-        copyCommandAllocator,
-        fenceEvent
-    );
+    if (!cookedTextures.empty()) {
+        LoadCookedModelTextures(app, outputModel, cookedTextures, resourceBarriers, fenceEvent);
+    } else {
+        LoadModelTextures(
+            app,
+            outputModel,
+            inputModel,
+            resourceBarriers,
+            imageIsSRGB,
+            fenceEvent,
+            imageLoadContext
+        );
+    }
 
     auto endGeometryBuffer = resourceBuffers.begin() + inputModel.buffers.size();
     outGeometryResources = std::span(resourceBuffers.begin(), endGeometryBuffer);
@@ -825,19 +967,127 @@ struct GLTFLightTransform {
 };
 
 
-void TraverseNode(const tinygltf::Model& model, const tinygltf::Node& node, std::vector<PoolItem<Mesh>>& meshes, std::vector<GLTFLightTransform>& lights, const glm::mat4& accumulator, const glm::vec3& translateAccum, const glm::quat& rotAccum, const glm::vec3& scaleAccum)
+// Read element idx of an EXT_mesh_gpu_instancing attribute as a float vector.
+// Rotations are allowed to be normalized bytes/shorts, so those are converted here.
+glm::vec4 ReadInstanceAttribute(const tinygltf::Model& model, const GLTFBufferData& bufferData, const tinygltf::Accessor& accessor, size_t idx)
+{
+    const auto& bufferView = model.bufferViews[accessor.bufferView];
+    size_t stride = (size_t)accessor.ByteStride(bufferView);
+    const unsigned char* element = bufferData[bufferView.buffer].data() + bufferView.byteOffset + accessor.byteOffset + idx * stride;
+    int componentCount = std::min(tinygltf::GetNumComponentsInType(accessor.type), 4);
+
+    glm::vec4 result(0.0f);
+    for (int i = 0; i < componentCount; i++) {
+        switch (accessor.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT:
+            result[i] = reinterpret_cast<const float*>(element)[i];
+            break;
+        case TINYGLTF_COMPONENT_TYPE_BYTE:
+            result[i] = std::max(reinterpret_cast<const int8_t*>(element)[i] / 127.0f, -1.0f);
+            break;
+        case TINYGLTF_COMPONENT_TYPE_SHORT:
+            result[i] = std::max(reinterpret_cast<const int16_t*>(element)[i] / 32767.0f, -1.0f);
+            break;
+        default:
+            DebugLog() << "Unsupported EXT_mesh_gpu_instancing component type " << accessor.componentType << "\n";
+            return result;
+        }
+    }
+
+    return result;
+}
+
+
+// Adds one instance for a node referencing a mesh, or one instance per
+// entry in the node's EXT_mesh_gpu_instancing attributes. Those are children of the node.
+void AddNodeMeshInstances(const tinygltf::Model& model, const GLTFBufferData& bufferData, const tinygltf::Node& node, int nodeTransform, std::vector<GLTFTransformNode>& transforms, std::vector<uint32_t>& instances)
+{
+    auto extension = node.extensions.find("EXT_mesh_gpu_instancing");
+    if (extension == node.extensions.end() || !extension->second.Has("attributes")) {
+        instances.push_back((uint32_t)nodeTransform);
+        return;
+    }
+
+    const tinygltf::Value& attributes = extension->second.Get("attributes");
+
+    auto FindAccessor = [&](const char* name) -> const tinygltf::Accessor*
+    {
+        if (!attributes.Has(name)) {
+            return nullptr;
+        }
+
+        int accessorIdx = attributes.Get(name).GetNumberAsInt();
+        if (accessorIdx < 0 || accessorIdx >= (int)model.accessors.size()) {
+            return nullptr;
+        }
+
+        const auto& accessor = model.accessors[accessorIdx];
+        if (accessor.bufferView < 0 || accessor.sparse.isSparse) {
+            DebugLog() << "Sparse or empty EXT_mesh_gpu_instancing accessors are not supported " << name << "\n";
+            return nullptr;
+        }
+        return &accessor;
+    };
+
+    const tinygltf::Accessor* translations = FindAccessor("TRANSLATION");
+    const tinygltf::Accessor* rotations = FindAccessor("ROTATION");
+    const tinygltf::Accessor* scales = FindAccessor("SCALE");
+
+    // All attribute accessors are required to have the same count.
+    size_t count = 0;
+    for (const tinygltf::Accessor* accessor : { translations, rotations, scales }) {
+        if (accessor) {
+            count = count == 0 ? accessor->count : std::min(count, accessor->count);
+        }
+    }
+
+    instances.reserve(instances.size() + count);
+    transforms.reserve(transforms.size() + count);
+
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 translate(0.0f);
+        glm::quat rotation = glm::quat_identity<float, glm::defaultp>();
+        glm::vec3 scale(1.0f);
+
+        if (translations) {
+            translate = glm::vec3(ReadInstanceAttribute(model, bufferData, *translations, i));
+        }
+        if (rotations) {
+            // GLTF quaternions are stored XYZW
+            glm::vec4 rotationData = ReadInstanceAttribute(model, bufferData, *rotations, i);
+            rotation = glm::normalize(glm::make_quat(glm::value_ptr(rotationData)));
+        }
+        if (scales) {
+            scale = glm::vec3(ReadInstanceAttribute(model, bufferData, *scales, i));
+        }
+
+        glm::mat4 T = glm::translate(glm::mat4(1.0f), translate);
+        glm::mat4 S = glm::scale(glm::mat4(1.0f), scale);
+        glm::mat4 R = glm::toMat4(rotation);
+
+        instances.push_back((uint32_t)transforms.size());
+        transforms.push_back(GLTFTransformNode{ T * R * S, nodeTransform });
+    }
+}
+
+
+void TraverseNode(const tinygltf::Model& model, const GLTFBufferData& bufferData, const tinygltf::Node& node, int parent, std::vector<GLTFTransformNode>& transforms, GLTFMeshInstances& meshInstances, std::vector<GLTFLightTransform>& lights, const glm::vec3& translateAccum, const glm::quat& rotAccum, const glm::vec3& scaleAccum)
 {
     glm::vec3 translate;
     glm::quat rotate;
     glm::vec3 scale;
     bool hasTRS;
-    glm::mat4 transform = accumulator * GetNodeTransfomMatrix(node, translate, rotate, scale, hasTRS);
+
+    // Pre-order, so the parent is always already in the list
+    int transform = (int)transforms.size();
+    transforms.push_back(GLTFTransformNode{ GetNodeTransfomMatrix(node, translate, rotate, scale, hasTRS), parent });
+
     translate = translate + translateAccum;
     rotate = rotAccum * rotate;
     scale = scaleAccum * scale;
 
     if (node.mesh != -1) {
-        meshes[node.mesh]->baseModelTransform = transform;
+        AddNodeMeshInstances(model, bufferData, node, transform, transforms, meshInstances[node.mesh]);
     } else if (node.extensions.contains("KHR_lights_punctual")) {
         if (hasTRS) {
             GLTFLightTransform transform;
@@ -852,25 +1102,39 @@ void TraverseNode(const tinygltf::Model& model, const tinygltf::Node& node, std:
     }
 
     for (const auto& child : node.children) {
-        TraverseNode(model, model.nodes[child], meshes, lights, transform, translate, rotate, scale);
+        TraverseNode(model, bufferData, model.nodes[child], transform, transforms, meshInstances, lights, translate, rotate, scale);
     }
 }
 
 
-// Traverse the GLTF scene to get the correct model matrix for each mesh.
+// Traverse the GLTF scene to flatten the node hierarchy and find the transform of every instance of each mesh.
+// A mesh referenced by N nodes gets N instances.
 void ResolveModelTransforms(
     const tinygltf::Model& model,
-    std::vector<PoolItem<Mesh>>& meshes,
+    const GLTFBufferData& bufferData,
+    std::vector<GLTFTransformNode>& transforms,
+    GLTFMeshInstances& meshInstances,
     std::vector<GLTFLightTransform>& lightTransforms
 )
 {
+    transforms.clear();
+    transforms.push_back(GLTFTransformNode{ glm::mat4(1.0f), -1 });
+
+    meshInstances.clear();
+    meshInstances.resize(model.meshes.size());
+
     if (model.scenes.size() == 0) {
+        // No scene to place the meshes, so just show each mesh once at the origin.
+        for (auto& instances : meshInstances) {
+            instances.push_back((uint32_t)transforms.size());
+            transforms.push_back(GLTFTransformNode{ glm::mat4(1.0f), 0 });
+        }
         return;
     }
 
-    int scene = model.defaultScene != 0 ? model.defaultScene : 0;
+    int scene = model.defaultScene >= 0 ? model.defaultScene : 0;
     for (const auto& node : model.scenes[scene].nodes) {
-        TraverseNode(model, model.nodes[node], meshes, lightTransforms, glm::mat4(1.0f), glm::vec3(0.0f), glm::quat_identity<float, glm::defaultp>(), glm::vec3(1.0f));
+        TraverseNode(model, bufferData, model.nodes[node], 0, transforms, meshInstances, lightTransforms, glm::vec3(0.0f), glm::quat_identity<float, glm::defaultp>(), glm::vec3(1.0f));
     }
 }
 
@@ -939,9 +1203,8 @@ void AssignPSOToPrimitive(
 }
 
 
-void CreatePrimitiveBLAS(
-    App& app,
-    GraphicsCommandList* commandList,
+void AddPrimitiveBLAS(
+    std::vector<BLASBuildRequest>& blasRequests,
     Primitive* primitive,
     DXGI_FORMAT posVertexFormat,
     int positionVertexBufferViewIndex
@@ -963,41 +1226,90 @@ void CreatePrimitiveBLAS(
 
     geometry.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
 
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS asInputs = {};
-    asInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-    asInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-    asInputs.NumDescs = 1;
-    asInputs.pGeometryDescs = &geometry;
+    blasRequests.push_back({ primitive, geometry });
+}
 
-    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
+// Hands a model's BLASes to the scheduler. Only call once the geometry has been uploaded.
+void QueueBLASBuilds(App& app, std::span<const BLASBuildRequest> blasRequests)
+{
+    std::scoped_lock lock(app.BLASBuilds.mutex);
 
-    app.device->GetRaytracingAccelerationStructurePrebuildInfo(
-        &asInputs,
-        &prebuildInfo
-    );
+    for (const BLASBuildRequest& request : blasRequests) {
+        uint32_t id = app.BLASBuilds.nextRequestId++;
+        app.BLASBuilds.requests[id] = request;
+        app.BLASBuilds.scheduler.Enqueue(id, request.primitive->indexCount / 3);
+    }
+}
 
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
-    desc.Inputs = asInputs;
 
-    ComPtr<D3D12MA::Allocation> blasScratch;
-    ComPtr<D3D12MA::Allocation> blasResult;
+// Average linear color of an RGBA8 sRGB image, looking at up to about 64k texels
+glm::vec3 AverageImageColor(const tinygltf::Image& image)
+{
+    const size_t MaxSamples = 65536;
 
-    CreateAccelerationStructureBuffers(
-        app.mainAllocator.Get(),
-        prebuildInfo,
-        blasScratch,
-        blasResult
-    );
-    blasScratch->SetName(L"BlasScratch");
-    blasResult->SetName(L"BlasResult");
+    size_t texelCount = (size_t)image.width * image.height;
+    if (texelCount == 0 || image.component != 4 || image.image.size() < texelCount * 4) {
+        return glm::vec3(1.0f);
+    }
+
+    size_t step = std::max(texelCount / MaxSamples, (size_t)1);
+    glm::vec3 sum(0.0f);
+    size_t sampleCount = 0;
+    for (size_t texel = 0; texel < texelCount; texel += step) {
+        const unsigned char* rgba = image.image.data() + texel * 4;
+        sum += glm::pow(glm::vec3(rgba[0], rgba[1], rgba[2]) / 255.0f, glm::vec3(2.2f));
+        sampleCount++;
+    }
+    return sum / (float)sampleCount;
+}
+
+// Keeps a CPU copy of a triangle primitive's geometry for baking, with a single albedo
+// from the material's base color factor and the average of its base color texture.
+void AddBakePrimitive(App& app, const tinygltf::Model& inputModel, const GLTFBufferData& bufferData, const tinygltf::Primitive& inputPrimitive, const std::vector<uint32_t>& instanceTransforms)
+{
+    auto positionAttribute = inputPrimitive.attributes.find("POSITION");
+    if (inputPrimitive.mode != TINYGLTF_MODE_TRIANGLES || inputPrimitive.indices < 0 || positionAttribute == inputPrimitive.attributes.end()) {
+        return;
+    }
 
-    primitive->blasScratch = blasScratch;
-    primitive->blasResult = blasResult;
+    App::BakePrimitive bake;
+    bake.transforms = instanceTransforms;
 
-    desc.ScratchAccelerationStructureData = blasScratch->GetResource()->GetGPUVirtualAddress();
-    desc.DestAccelerationStructureData = blasResult->GetResource()->GetGPUVirtualAddress();
+    const tinygltf::Accessor& positions = inputModel.accessors[positionAttribute->second];
+    const tinygltf::BufferView& positionView = inputModel.bufferViews[positions.bufferView];
+    const unsigned char* positionData = bufferData[positionView.buffer].data() + positionView.byteOffset + positions.byteOffset;
+    size_t positionStride = (size_t)positions.ByteStride(positionView);
+    bake.positions.resize(positions.count);
+    for (size_t i = 0; i < positions.count; i++) {
+        memcpy(&bake.positions[i], positionData + i * positionStride, sizeof(glm::vec3));
+    }
+
+    const tinygltf::Accessor& indices = inputModel.accessors[inputPrimitive.indices];
+    const tinygltf::BufferView& indexView = inputModel.bufferViews[indices.bufferView];
+    const unsigned char* indexData = bufferData[indexView.buffer].data() + indexView.byteOffset + indices.byteOffset;
+    bake.indices.resize(indices.count);
+    for (size_t i = 0; i < indices.count; i++) {
+        if (indices.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+            bake.indices[i] = reinterpret_cast<const uint16_t*>(indexData)[i];
+        } else {
+            bake.indices[i] = reinterpret_cast<const uint32_t*>(indexData)[i];
+        }
+    }
+
+    bake.albedo = glm::vec3(1.0f);
+    if (inputPrimitive.material >= 0) {
+        const tinygltf::PbrMetallicRoughness& pbr = inputModel.materials[inputPrimitive.material].pbrMetallicRoughness;
+        bake.albedo = glm::vec3(pbr.baseColorFactor[0], pbr.baseColorFactor[1], pbr.baseColorFactor[2]);
+        if (pbr.baseColorTexture.index >= 0) {
+            int imageIndex = inputModel.textures[pbr.baseColorTexture.index].source;
+            if (imageIndex >= 0) {
+                bake.albedo *= AverageImageColor(inputModel.images[imageIndex]);
+            }
+        }
+    }
 
-    commandList->BuildRaytracingAccelerationStructure(&desc, 0, nullptr);
+    std::scoped_lock lock(app.BakeGeometry.mutex);
+    app.BakeGeometry.primitives.push_back(std::move(bake));
 }
 
 
@@ -1008,8 +1320,8 @@ PoolItem<Primitive> CreateModelPrimitive(
     const tinygltf::Mesh& inputMesh,
     const tinygltf::Primitive& inputPrimitive,
     const std::vector<SharedPoolItem<Material>>& modelMaterials,
-    int perPrimitiveDescriptorIdx,
-    GraphicsCommandList* commandList
+    int instanceCount,
+    std::vector<BLASBuildRequest>& blasRequests
 )
 {
     // Just storing these strings so that we don't have to keep the Model object around.
@@ -1039,10 +1351,6 @@ PoolItem<Primitive> CreateModelPrimitive(
 
     auto primitive = app.primitivePool.AllocateUnique();
 
-    primitive->perPrimitiveDescriptor = outputModel.primitiveDataDescriptors.Ref(perPrimitiveDescriptorIdx);
-    primitive->constantData = &outputModel.perPrimitiveBufferPtr[perPrimitiveDescriptorIdx];
-    perPrimitiveDescriptorIdx++;
-
     std::vector<D3D12_VERTEX_BUFFER_VIEW>& vertexBufferViews = primitive->vertexBufferViews;
 
     // Save a reference to this one for when we build the raytracing geometry desc.
@@ -1194,7 +1502,7 @@ PoolItem<Primitive> CreateModelPrimitive(
 
     }
 
-    primitive->instanceCount = 1;
+    primitive->instanceCount = instanceCount;
 
     if (inputPrimitive.material != -1) {
         auto& material = modelMaterials[inputPrimitive.material];
@@ -1234,15 +1542,14 @@ PoolItem<Primitive> CreateModelPrimitive(
 
     primitive->indexCount = (UINT)accessor.count;
 
-    CreatePrimitiveBLAS(
-        app,
-        commandList,
+    AddPrimitiveBLAS(
+        blasRequests,
         primitive.get(),
         posVertexFormat,
         positionVertexBufferViewIndex
     );
 
-    app.Stats.triangleCount += primitive->indexCount;
+    app.Stats.triangleCount += primitive->indexCount * instanceCount;
 
     return primitive;
 }
@@ -1276,13 +1583,12 @@ void AddPunctualLights(App& app, const tinygltf::Model& inputModel, std::vector<
                 glm::vec3 position = lightTransform.position;
                 glm::vec3 direction = lightTransform.rotation * glm::vec3(0.0f, 0.0f, -1.0f);
 
-                app.lights[app.LightBuffer.count].color = color;
-                app.lights[app.LightBuffer.count].direction = direction;
-                app.lights[app.LightBuffer.count].position = position;
-                app.lights[app.LightBuffer.count].range = inputLight.range;
-                app.lights[app.LightBuffer.count].intensity = inputLight.intensity;
-                app.lights[app.LightBuffer.count].lightType = lightType;
-                app.LightBuffer.count++;
+                uint32_t light = app.lightStore.Add(lightType);
+                app.lightStore.SetColor(light, color);
+                app.lightStore.SetDirection(light, direction);
+                app.lightStore.SetPosition(light, position);
+                app.lightStore.SetRange(light, (float)inputLight.range);
+                app.lightStore.SetIntensity(light, (float)inputLight.intensity);
             }
         }
     }
@@ -1293,21 +1599,57 @@ void FinalizeModel(
     Model& outputModel,
     App& app,
     const tinygltf::Model& inputModel,
+    const GLTFBufferData& bufferData,
     const std::vector<SharedPoolItem<Material>>& modelMaterials,
-    GraphicsCommandList* computeCommandList
+    const std::vector<GLTFTransformNode>& transformNodes,
+    const GLTFMeshInstances& meshInstances,
+    const std::vector<GLTFLightTransform>& lightTransforms,
+    std::vector<BLASBuildRequest>& blasRequests
 )
 {
     const std::vector<ComPtr<ID3D12Resource>>& resourceBuffers = outputModel.resources;
 
-    int perPrimitiveDescriptorIdx = 0;
+    // One contiguous range keeps the hierarchy's parent before child order
+    outputModel.transformCount = (uint32_t)transformNodes.size();
+    outputModel.firstTransform = app.transforms.Allocate(outputModel.transformCount);
+    outputModel.rootTransform = outputModel.firstTransform;
+    for (uint32_t i = 0; i < outputModel.transformCount; i++) {
+        const GLTFTransformNode& node = transformNodes[i];
+        app.transforms.SetBase(outputModel.firstTransform + i, node.local);
+        if (node.parent >= 0) {
+            app.transforms.SetParent(outputModel.firstTransform + i, outputModel.firstTransform + node.parent);
+        }
+    }
 
-    for (const auto& inputMesh : inputModel.meshes) {
+    for (size_t meshIdx = 0; meshIdx < inputModel.meshes.size(); meshIdx++) {
+        const auto& inputMesh = inputModel.meshes[meshIdx];
         outputModel.meshes.emplace_back(std::move(app.meshPool.AllocateUnique()));
 
         PoolItem<Mesh>& mesh = outputModel.meshes.back();
         mesh->name = inputMesh.name;
         std::vector<PoolItem<Primitive>>& primitives = mesh->primitives;
 
+        // Mesh isn't placed anywhere in the scene, don't bother creating GPU data for it.
+        if (meshInstances[meshIdx].empty()) {
+            continue;
+        }
+
+        int instanceCount = (int)meshInstances[meshIdx].size();
+        mesh->firstInstance = app.InstanceBuffer.allocator.Allocate(instanceCount);
+        if (mesh->firstInstance == RangeAllocator::InvalidIndex) {
+            DebugLog() << "Instance buffer is full, can't place " << instanceCount << " instances of mesh " << inputMesh.name << "\n";
+            abort();
+        }
+
+        // Every primitive of the mesh shares the same instance buffer slots
+        std::vector<uint32_t> instanceTransforms;
+        for (int i = 0; i < instanceCount; i++) {
+            uint32_t transformIndex = outputModel.firstTransform + meshInstances[meshIdx][i];
+            instanceTransforms.push_back(transformIndex);
+            mesh->instances.push_back(MeshInstance{ transformIndex });
+            app.transforms.AddDestination(transformIndex, &app.InstanceBuffer.mappedPtr[mesh->firstInstance + i]);
+        }
+
         for (int primitiveIdx = 0; primitiveIdx < inputMesh.primitives.size(); primitiveIdx++) {
             const auto& inputPrimitive = inputMesh.primitives[primitiveIdx];
 
@@ -1318,28 +1660,24 @@ void FinalizeModel(
                 inputMesh,
                 inputPrimitive,
                 modelMaterials,
-                perPrimitiveDescriptorIdx,
-                computeCommandList
+                instanceCount,
+                blasRequests
             );
 
             if (primitive != nullptr) {
+                primitive->boundsIndex = app.transforms.AddBounds(primitive->localBoundingBox, instanceTransforms);
+                AddBakePrimitive(app, inputModel, bufferData, inputPrimitive, instanceTransforms);
                 mesh->primitives.emplace_back(std::move(primitive));
-                perPrimitiveDescriptorIdx++;
             }
         }
     }
 
-    std::vector<GLTFLightTransform> lightTransforms;
-    ResolveModelTransforms(inputModel, outputModel.meshes, lightTransforms);
     AddPunctualLights(app, inputModel, lightTransforms);
 
+    // Rasterized straight away, ray traced once the scheduler gets to their BLASes
     for (auto& mesh : outputModel.meshes) {
         mesh->isReadyForRender = true;
     }
-
-    // Build BLAS
-    computeCommandList->Close();
-    app.computeQueue.ExecuteCommandListsBlocking({ computeCommandList });
 }
 
 
@@ -1378,8 +1716,32 @@ bool ValidateSkyboxAssets(const SkyboxAssets& assets)
 }
 
 
-// Renders all the lighting maps for the skybox, including diffuse irradiance,
-// prefilter map, and the BRDF lut.
+// Diffuse irradiance only needs the low frequencies of the sky, so the faces are projected onto
+// L2 spherical harmonics on the CPU rather than rendered into another cubemap.
+void ProjectSkyboxIrradiance(App& app, const SkyboxAssets& assets, AssetLoadContext* context)
+{
+    ScopedPerformanceTracker perf(__func__, PerformancePrecision::Milliseconds);
+
+    context->currentTask = "Projecting diffuse irradiance";
+
+    std::array<SHCubemapFace, CubeImage_Count> faces;
+    for (UINT i = 0; i < CubeImage_Count; i++) {
+        const HDRImage& image = assets.images[i];
+        faces[i] = SHCubemapFace{ image.data, (uint32_t)image.width, (uint32_t)image.height };
+    }
+
+    SHL2RGB radiance = ProjectCubemap(faces);
+    ProbeGPUData irradiance = PackProbe(radiance.ConvolveCosine());
+
+    // The lighting pass of the previous frame may still be reading the pass data
+    auto lock = LockRenderThread(app);
+    app.graphicsQueue.WaitForEventCPU(app.previousFrameEvent);
+
+    app.Skybox.radianceSH = radiance;
+    std::copy(std::begin(irradiance.coefficients), std::end(irradiance.coefficients), app.LightBuffer.passData->skyIrradiance);
+}
+
+// Renders the prefilter map for the skybox's specular lighting.
 void RenderSkyboxEnvironmentLightMaps(App& app, const SkyboxAssets& assets, FenceEvent& cubemapUploadEvent, AssetLoadContext* context)
 {
     // IMPORTANT: If this gets changed, PREFILTER_MAP_MIPCOUNT in common.hlsli must also be changed
@@ -1387,7 +1749,7 @@ void RenderSkyboxEnvironmentLightMaps(App& app, const SkyboxAssets& assets, Fenc
 
     ScopedPerformanceTracker perf(__func__, PerformancePrecision::Milliseconds);
 
-    context->currentTask = "Rendering diffuse irradiance map";
+    context->currentTask = "Rendering prefilter map";
 
     if (app.graphicsAnalysis) {
         app.graphicsAnalysis->BeginCapture();
@@ -1412,24 +1774,12 @@ void RenderSkyboxEnvironmentLightMaps(App& app, const SkyboxAssets& assets, Fenc
         )
     );
 
-    // Create a new cubemap matching the skybox's cubemap resource.
+    // The prefilter map matches the skybox's cubemap resource, with mips for the roughness levels.
     auto cubemapDesc = app.Skybox.cubemap->GetResource()->GetDesc();
     cubemapDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
     {
         D3D12MA::ALLOCATION_DESC allocDesc{};
         allocDesc.HeapType = D3D12_HEAP_TYPE_DEFAULT;
-        ASSERT_HRESULT(
-            app.mainAllocator->CreateResource(
-                &allocDesc,
-                &cubemapDesc,
-                D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-                nullptr,
-                &app.Skybox.irradianceCubeMap,
-                IID_NULL, nullptr
-            )
-        );
-
-
         auto prefilterMapDesc = cubemapDesc;
         prefilterMapDesc.MipLevels = PrefilterMipCount;
         ASSERT_HRESULT(
@@ -1444,15 +1794,6 @@ void RenderSkyboxEnvironmentLightMaps(App& app, const SkyboxAssets& assets, Fenc
         );
     }
 
-
-    auto diffuseIrradianceUAV = AllocateDescriptorsUnique(app.descriptorPool, 1, "Diffuse radiance UAV");
-    D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc{};
-    uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2DARRAY;
-    uavDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-    uavDesc.Texture2DArray.FirstArraySlice = 0;
-    uavDesc.Texture2DArray.ArraySize = CubeImage_Count;
-    app.device->CreateUnorderedAccessView(app.Skybox.irradianceCubeMap->GetResource(), nullptr, &uavDesc, diffuseIrradianceUAV.CPUHandle());
-
     // Create UAVs for each mip on the prefilter map
     auto prefilterMapUAVs = AllocateDescriptorsUnique(app.descriptorPool, PrefilterMipCount, "Prefilter map UAVs");
     for (UINT i = 0; i < PrefilterMipCount; i++) {
@@ -1473,8 +1814,6 @@ void RenderSkyboxEnvironmentLightMaps(App& app, const SkyboxAssets& assets, Fenc
         app.Skybox.inputLayout
     );
 
-    glm::vec2 texelSize = glm::vec2(1.0f / (float)cubemapDesc.Width, 1.0f / (float)cubemapDesc.Height);
-
     Primitive* primitive = app.Skybox.mesh->primitives[0].get();
 
     CD3DX12_VIEWPORT viewport(0.0f, 0.0f, static_cast<float>(cubemapDesc.Width), static_cast<float>(cubemapDesc.Height));
@@ -1487,24 +1826,10 @@ void RenderSkyboxEnvironmentLightMaps(App& app, const SkyboxAssets& assets, Fenc
 
     for (UINT i = 0; i < CubeImage_Count; i++)
     {
-        context->currentTask = "Diffuse Irradiance Image " + std::to_string(i);
+        context->currentTask = "Prefilter Image " + std::to_string(i);
 
         PIXScopedEvent(commandList.Get(), 0, ("CubeImage#" + std::to_string(i)).c_str());
 
-        float roughness = 1.0f;
-        float isDiffuse = 1.0f;
-        UINT constantValues[7] = {
-            app.Skybox.texcubeSRV.Index(),
-            diffuseIrradianceUAV.Index(),
-            i,
-            *reinterpret_cast<UINT*>(&isDiffuse),
-            *reinterpret_cast<UINT*>(&roughness),
-            *reinterpret_cast<UINT*>(&texelSize[0]),
-            *reinterpret_cast<UINT*>(&texelSize[1])
-        };
-        commandList->SetComputeRoot32BitConstants(0, _countof(constantValues), constantValues, 0);
-        commandList->Dispatch(static_cast<UINT>(cubemapDesc.Width) / 8, static_cast<UINT>(cubemapDesc.Height) / 8, 1);
-
         UINT mipWidth = static_cast<UINT>(cubemapDesc.Width);
         UINT mipHeight = static_cast<UINT>(cubemapDesc.Height);
         for (UINT mip = 0; mip < PrefilterMipCount; mip++)
@@ -1532,7 +1857,7 @@ void RenderSkyboxEnvironmentLightMaps(App& app, const SkyboxAssets& assets, Fenc
     // FIXME: this barrier would need to be done on the graphics queue.
     // Also need to research if the UAVs should be copied to a new resource without the UAV flag...
     auto barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-        app.Skybox.irradianceCubeMap->GetResource(),
+        app.Skybox.prefilterMap->GetResource(),
         D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE
     );
 
@@ -1543,19 +1868,11 @@ void RenderSkyboxEnvironmentLightMaps(App& app, const SkyboxAssets& assets, Fenc
     srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
     srvDesc.Format = cubemapDesc.Format;
     srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURECUBE;
-    srvDesc.TextureCube.MipLevels = 1;
+    srvDesc.TextureCube.MipLevels = PrefilterMipCount;
 
-    app.Skybox.irradianceCubeSRV = AllocateDescriptorsUnique(app.descriptorPool, 1, "Diffuse Irradiance Cubemap SRV");
+    app.Skybox.prefilterMapSRV = AllocateDescriptorsUnique(app.descriptorPool, 1, "Prefilter Map SRV");
     app.device->CreateShaderResourceView(
-        app.Skybox.irradianceCubeMap->GetResource(),
-        &srvDesc,
-        app.Skybox.irradianceCubeSRV.CPUHandle()
-    );
-
-    app.Skybox.prefilterMapSRV = AllocateDescriptorsUnique(app.descriptorPool, 1, "Prefilter Map SRV");
-    srvDesc.TextureCube.MipLevels = PrefilterMipCount;
-    app.device->CreateShaderResourceView(
-        app.Skybox.prefilterMap->GetResource(),
+        app.Skybox.prefilterMap->GetResource(),
         &srvDesc,
         app.Skybox.prefilterMapSRV.CPUHandle()
     );
@@ -1629,18 +1946,24 @@ void FreeSkybox(App& app)
 
     app.Skybox.prefilterMapSRV = UniqueDescriptors();
     app.Skybox.cubemap = nullptr;
-    app.Skybox.irradianceCubeMap = nullptr;
 
     app.Skybox.cubemap = nullptr;
     app.Skybox.vertexBuffer = nullptr;
     app.Skybox.indexBuffer = nullptr;
-    app.Skybox.perPrimitiveConstantBuffer = nullptr;
-    app.Skybox.irradianceCubeMap = nullptr;
     app.Skybox.prefilterMap = nullptr;
-    app.Skybox.perPrimitiveCBV = UniqueDescriptors();
     app.Skybox.texcubeSRV = UniqueDescriptors();
-    app.Skybox.irradianceCubeSRV = UniqueDescriptors();
+    app.Skybox.radianceSH = SHL2RGB();
     app.Skybox.prefilterMapSRV = UniqueDescriptors();
+
+    std::erase_if(app.scene.nodes, [&](const Node& node) {
+        return node.nodeType == NodeType_Mesh && node.mesh == app.Skybox.mesh.get();
+    });
+    app.drawPackets.dirty = true;
+
+    for (const MeshInstance& instance : app.Skybox.mesh->instances) {
+        app.transforms.Free(instance.transformIndex, 1);
+    }
+    app.InstanceBuffer.allocator.Free(app.Skybox.mesh->firstInstance, 1);
     app.Skybox.mesh = nullptr;
 
     // LUT texture for environment BRDF split sum calculation.
@@ -1663,7 +1986,6 @@ void CreateSkybox(App& app, const SkyboxAssets& asset, AssetLoadContext* context
     ComPtr<D3D12MA::Allocation> cubemap;
     ComPtr<D3D12MA::Allocation> vertexBuffer;
     ComPtr<D3D12MA::Allocation> indexBuffer;
-    ComPtr<D3D12MA::Allocation> perPrimitiveBuffer;
 
     auto cubemapDesc = GetHDRImageDesc(asset.images[0].width, asset.images[0].height);
     cubemapDesc.DepthOrArraySize = CubeImage_Count;
@@ -1683,29 +2005,6 @@ void CreateSkybox(App& app, const SkyboxAssets& asset, AssetLoadContext* context
         );
     }
 
-    {
-        auto resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeof(PrimitiveInstanceConstantData));
-
-        D3D12MA::ALLOCATION_DESC allocDesc{};
-        allocDesc.HeapType = D3D12_HEAP_TYPE_UPLOAD;
-        ASSERT_HRESULT(
-            app.mainAllocator->CreateResource(
-                &allocDesc,
-                &resourceDesc,
-                D3D12_RESOURCE_STATE_GENERIC_READ,
-                nullptr,
-                &perPrimitiveBuffer,
-                IID_NULL, nullptr
-            )
-        );
-    }
-
-    UniqueDescriptors perPrimitiveCBV = AllocateDescriptorsUnique(app.descriptorPool, 1, "Skybox PerPrimitive CBV");
-    D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
-    cbvDesc.BufferLocation = perPrimitiveBuffer->GetResource()->GetGPUVirtualAddress();
-    cbvDesc.SizeInBytes = sizeof(PrimitiveInstanceConstantData);
-    app.device->CreateConstantBufferView(&cbvDesc, perPrimitiveCBV.CPUHandle());
-
     UploadBatch uploadBatch;
     uploadBatch.Begin(app.mainAllocator.Get(), &app.copyQueue);
 
@@ -1860,8 +2159,6 @@ void CreateSkybox(App& app, const SkyboxAssets& asset, AssetLoadContext* context
         app.Skybox.inputLayout
     );
 
-    primitive->perPrimitiveDescriptor = perPrimitiveCBV.Ref();
-
     primitive->primitiveTopology = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
     primitive->indexCount = _countof(indices);
 
@@ -1870,58 +2167,347 @@ void CreateSkybox(App& app, const SkyboxAssets& asset, AssetLoadContext* context
     // Exclude skybox from frustum culling.
     primitive->localBoundingBox = AABB{ glm::vec4(-FLT_MAX), glm::vec4(FLT_MAX) };
 
-    perPrimitiveBuffer->GetResource()->Map(0, nullptr, reinterpret_cast<void**>(&primitive->constantData));
-
     app.Skybox.mesh = app.meshPool.AllocateUnique();
     app.Skybox.mesh->primitives.emplace_back(std::move(primitive));
-    app.Skybox.mesh->baseModelTransform = glm::scale(glm::mat4(1.0f), glm::vec3(50.0f));
+    uint32_t skyboxTransform = app.transforms.Allocate(1);
+    app.transforms.SetBase(skyboxTransform, glm::scale(glm::mat4(1.0f), glm::vec3(50.0f)));
+    app.Skybox.mesh->firstInstance = app.InstanceBuffer.allocator.Allocate(1);
+    if (app.Skybox.mesh->firstInstance == RangeAllocator::InvalidIndex) {
+        DebugLog() << "Instance buffer is full\n";
+        abort();
+    }
+    app.transforms.AddDestination(skyboxTransform, &app.InstanceBuffer.mappedPtr[app.Skybox.mesh->firstInstance]);
+    app.Skybox.mesh->instances.push_back(MeshInstance{ skyboxTransform });
     app.Skybox.mesh->name = "Skybox";
 
     app.Skybox.cubemap = cubemap;
     app.Skybox.indexBuffer = indexBuffer;
     app.Skybox.vertexBuffer = vertexBuffer;
-    app.Skybox.perPrimitiveConstantBuffer = perPrimitiveBuffer;
-    app.Skybox.perPrimitiveCBV = std::move(perPrimitiveCBV);
 
     app.Skybox.mesh->isReadyForRender = true;
 
-    app.scene.nodes.emplace_back(
-        Node{
-            NodeType_Mesh,
-            app.Skybox.mesh.get()
-        }
-    );
+    {
+        auto lock = LockRenderThread(app);
+        app.scene.nodes.emplace_back(
+            Node{
+                NodeType_Mesh,
+                app.Skybox.mesh.get()
+            }
+        );
+        app.drawPackets.dirty = true;
+    }
 
+    ProjectSkyboxIrradiance(app, asset, context);
     RenderSkyboxEnvironmentLightMaps(app, asset, cubemapUpload, context);
 }
 
 
-void GLTFImageLoaderThread(
-    tinygltf::Image* out
+// Decodes an image from its encoded bytes, which are either in place in a glTF buffer, copied out
+// of a data URI by TinyGLTFImageLoader, or in an external file when filePath is set.
+// The decoded size with mips is acquired from budget first, and returned so it can be released after upload.
+// out only gets the image's size, the pixels stay in decoded and mipChain until they're written to upload memory.
+// With a cache, an image that was decoded before is mapped into cacheEntry instead, with cachedPixels pointing
+// at its pixels and mips, and nothing is acquired from budget. Images that weren't are added to the cache.
+uint64_t DecodeModelImage(
+    tinygltf::Image* out,
+    DecodedImage* decoded,
+    std::vector<uint8_t>* mipChain,
+    bool isSRGB,
+    std::span<const unsigned char> encoded,
+    const std::string& filePath,
+    DecodeBudget& budget,
+    AssetCache* cache,
+    MappedFile* cacheEntry,
+    std::span<const uint8_t>* cachedPixels
 )
 {
-    auto maybeImage = LoadImageFromMemory(out->image.data(), out->image.size());
+    MappedFile file;
+    if (!filePath.empty()) {
+        if (!file.Open(filePath)) {
+            DebugLog() << "Failed to open image " << filePath << "\n";
+        }
+        encoded = file.Bytes();
+    }
+
+    // The pixels depend on the encoded bytes, whether mips are filtered in sRGB, and the code producing them
+    struct
+    {
+        ContentHash content;
+        uint32_t version;
+        uint32_t isSRGB;
+    } keyData = { HashContent(encoded.data(), encoded.size()), ImageCacheVersion, isSRGB };
+    ContentHash cacheKey = HashContent(&keyData, sizeof(keyData));
+
+    std::span<const uint8_t> payload;
+    if (cache && !encoded.empty() && cache->Find(cacheKey, *cacheEntry, payload)) {
+        uint32_t size[2];
+        if (payload.size() >= sizeof(size)) {
+            memcpy(size, payload.data(), sizeof(size));
+        }
+        if (payload.size() >= sizeof(size) && payload.size() == sizeof(size) + (uint64_t)size[0] * size[1] * 4 + MipChainSize(size[0], size[1])) {
+            *cachedPixels = payload.subspan(sizeof(size));
+            out->width = (int)size[0];
+            out->height = (int)size[1];
+            out->component = STBI_rgb_alpha;
+            out->bits = 8;
+            out->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+            out->as_is = false;
+            return 0;
+        }
+        cacheEntry->Close();
+    }
+
+    uint64_t decodedBytes = 0;
+    uint32_t width, height, components;
+    if (ReadImageInfo(encoded, width, height, components)) {
+        decodedBytes = (uint64_t)width * height * components + MipChainSize(width, height);
+    }
+    budget.Acquire(decodedBytes);
+
+    if (decoded->Decode(encoded)) {
+        mipChain->resize(MipChainSize(decoded->Width(), decoded->Height()));
+        decoded->GenerateMipChain(isSRGB, mipChain->data());
+
+        if (cache) {
+            uint32_t size[2] = { decoded->Width(), decoded->Height() };
+            size_t pixelBytes = (size_t)size[0] * size[1] * 4;
+            cache->Store(cacheKey, sizeof(size) + pixelBytes + mipChain->size(), [&](uint8_t* dest) {
+                memcpy(dest, size, sizeof(size));
+                decoded->WriteRGBA8(dest + sizeof(size), (size_t)size[0] * 4);
+                memcpy(dest + sizeof(size) + pixelBytes, mipChain->data(), mipChain->size());
+            });
+        }
 
-    if (maybeImage) {
-        *out = *maybeImage;
+        out->width = (int)decoded->Width();
+        out->height = (int)decoded->Height();
+        out->component = STBI_rgb_alpha;
+        out->bits = 8;
+        out->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+        out->as_is = false;
     } else {
         // Indicate that the image load has failed
-        out->image.clear();
         out->width = 0;
         out->height = 0;
     }
+
+    return decodedBytes;
 }
 
 
-ImageLoadContext BeginModelImageLoad(tinygltf::Model& model)
+// glTF URIs are percent encoded
+static std::string DecodeURI(const std::string& uri)
 {
-    std::vector<std::thread> imageLoadThreads;
-    imageLoadThreads.reserve(model.images.size());
-    for (auto& image : model.images) {
-        imageLoadThreads.push_back(std::thread(GLTFImageLoaderThread, &image));
+    std::string result;
+    result.reserve(uri.size());
+    for (size_t i = 0; i < uri.size(); i++) {
+        if (uri[i] == '%' && i + 2 < uri.size() && isxdigit((unsigned char)uri[i + 1]) && isxdigit((unsigned char)uri[i + 2])) {
+            result.push_back((char)std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            result.push_back(uri[i]);
+        }
     }
+    return result;
+}
+
 
-    return imageLoadThreads;
+// Finds the encoded bytes of every image. External images get a path to map instead.
+static void FindEncodedModelImages(
+    const tinygltf::Model& model,
+    const GLTFBufferData& bufferData,
+    const std::string& baseDir,
+    std::vector<std::span<const unsigned char>>& encodedImages,
+    std::vector<std::string>& imagePaths
+)
+{
+    encodedImages.assign(model.images.size(), {});
+    imagePaths.assign(model.images.size(), {});
+    for (size_t imageIdx = 0; imageIdx < model.images.size(); imageIdx++) {
+        const auto& image = model.images[imageIdx];
+        encodedImages[imageIdx] = image.image;
+        if (image.bufferView != -1) {
+            const tinygltf::BufferView& bufferView = model.bufferViews[image.bufferView];
+            encodedImages[imageIdx] = bufferData[bufferView.buffer].subspan(bufferView.byteOffset, bufferView.byteLength);
+        } else if (image.image.empty() && !image.uri.empty()) {
+            // External images are skipped by tinygltf (TINYGLTF_NO_EXTERNAL_IMAGE) and mapped here instead
+            imagePaths[imageIdx] = (std::filesystem::path(baseDir) / DecodeURI(image.uri)).string();
+        }
+    }
+}
+
+
+// Points textures at the KTX2 image their KHR_texture_basisu extension names when it holds
+// pre-transcoded BC or RGBA8 levels, otherwise they keep their fallback image. Basis Universal
+// payloads aren't transcoded, see ktx2.h. Only the KTX2 headers are read, so this is quick enough
+// to do before the decode threads start, and lets fallbacks nothing else uses skip decoding.
+static void ResolveKTX2Textures(
+    tinygltf::Model& model,
+    std::vector<std::span<const unsigned char>>& encodedImages,
+    std::vector<std::string>& imagePaths,
+    ImageLoadContext& context
+)
+{
+    context.ktx2Images.resize(model.images.size());
+    context.ktx2Files.resize(model.images.size());
+    context.replacedBy.assign(model.images.size(), -1);
+
+    for (size_t imageIdx = 0; imageIdx < model.images.size(); imageIdx++) {
+        const tinygltf::Image& image = model.images[imageIdx];
+        if (image.mimeType != "image/ktx2" && std::filesystem::path(image.uri).extension() != ".ktx2") {
+            continue;
+        }
+
+        if (!imagePaths[imageIdx].empty()) {
+            if (!context.ktx2Files[imageIdx].Open(imagePaths[imageIdx])) {
+                DebugLog() << "Failed to open image " << imagePaths[imageIdx] << "\n";
+            }
+            encodedImages[imageIdx] = context.ktx2Files[imageIdx].Bytes();
+            imagePaths[imageIdx].clear();
+        }
+
+        std::string error;
+        if (!ParseKTX2(encodedImages[imageIdx], context.ktx2Images[imageIdx], error)) {
+            DebugLog() << "KTX2 image " << image.name << image.uri << " isn't pre-transcoded BC or RGBA8, " << error << "\n";
+            context.ktx2Files[imageIdx].Close();
+        }
+    }
+
+    std::vector<std::pair<int, int>> fallbacks;
+    for (auto& texture : model.textures) {
+        auto extension = texture.extensions.find("KHR_texture_basisu");
+        if (extension == texture.extensions.end() || !extension->second.Has("source")) {
+            continue;
+        }
+        int ktx2Source = extension->second.Get("source").GetNumberAsInt();
+        if (ktx2Source < 0 || ktx2Source >= (int)model.images.size()) {
+            continue;
+        }
+        if (context.ktx2Images[ktx2Source].format != KTX2Format::Unsupported) {
+            if (texture.source >= 0 && texture.source != ktx2Source) {
+                fallbacks.push_back({ texture.source, ktx2Source });
+            }
+            texture.source = ktx2Source;
+        } else if (texture.source < 0) {
+            // No fallback, so it fails to decode like any other unsupported image
+            texture.source = ktx2Source;
+        }
+    }
+
+    std::vector<bool> isSource(model.images.size(), false);
+    for (const auto& texture : model.textures) {
+        if (texture.source >= 0 && texture.source < (int)model.images.size()) {
+            isSource[texture.source] = true;
+        }
+    }
+    for (auto [fallback, ktx2Source] : fallbacks) {
+        if (!isSource[fallback]) {
+            context.replacedBy[fallback] = ktx2Source;
+        }
+    }
+}
+
+
+// cache may be null to decode every image. With a reader, external images are read through it and
+// each is decoded when its read finishes, otherwise they're mapped by the decode threads.
+ImageLoadContext BeginModelImageLoad(
+    tinygltf::Model& model,
+    const GLTFBufferData& bufferData,
+    const std::string& baseDir,
+    AssetCache* cache,
+    AsyncFileReader* reader
+)
+{
+    std::vector<std::span<const unsigned char>> encodedImages;
+    std::vector<std::string> imagePaths;
+    FindEncodedModelImages(model, bufferData, baseDir, encodedImages, imagePaths);
+
+    ImageLoadContext context;
+    context.budget = std::make_unique<DecodeBudget>(ImageDecodeBudgetBytes);
+    context.imageBytes.resize(model.images.size());
+    context.decodedImages.resize(model.images.size());
+    context.mipChains.resize(model.images.size());
+    context.cacheEntries.resize(model.images.size());
+    context.cachedPixels.resize(model.images.size());
+    context.readImages.resize(model.images.size());
+    ResolveKTX2Textures(model, encodedImages, imagePaths, context);
+
+    std::vector<std::string> readPaths(model.images.size());
+    if (reader) {
+        for (size_t imageIdx = 0; imageIdx < model.images.size(); imageIdx++) {
+            if (context.replacedBy[imageIdx] == -1) {
+                readPaths[imageIdx] = std::move(imagePaths[imageIdx]);
+                imagePaths[imageIdx].clear();
+            }
+        }
+    }
+
+    DecodeBudget* budget = context.budget.get();
+    uint64_t* imageBytes = context.imageBytes.data();
+    DecodedImage* decodedImages = context.decodedImages.data();
+    std::vector<uint8_t>* mipChains = context.mipChains.data();
+    MappedFile* cacheEntries = context.cacheEntries.data();
+    std::span<const uint8_t>* cachedPixels = context.cachedPixels.data();
+    std::vector<uint8_t>* readImages = context.readImages.data();
+    const KTX2Image* ktx2Images = context.ktx2Images.data();
+    const int* replacedBy = context.replacedBy.data();
+    std::vector<bool> imageIsSRGB = DetermineSRGBTextures(model);
+    context.pool = std::make_unique<DecodePool>(
+        (uint32_t)model.images.size(),
+        [&model, budget, imageBytes, decodedImages, mipChains, cache, cacheEntries, cachedPixels, readImages, ktx2Images, replacedBy, imageIsSRGB = std::move(imageIsSRGB), encodedImages = std::move(encodedImages), imagePaths = std::move(imagePaths)](uint32_t imageIdx) {
+            // KTX2 levels are uploaded from where they are, so there's nothing to decode
+            if (ktx2Images[imageIdx].format != KTX2Format::Unsupported) {
+                model.images[imageIdx].width = (int)ktx2Images[imageIdx].width;
+                model.images[imageIdx].height = (int)ktx2Images[imageIdx].height;
+                return;
+            }
+            if (replacedBy[imageIdx] != -1) {
+                return;
+            }
+
+            std::span<const unsigned char> encoded = encodedImages[imageIdx];
+            if (!readImages[imageIdx].empty()) {
+                encoded = readImages[imageIdx];
+            }
+            imageBytes[imageIdx] = DecodeModelImage(
+                &model.images[imageIdx],
+                &decodedImages[imageIdx],
+                &mipChains[imageIdx],
+                imageIsSRGB[imageIdx],
+                encoded,
+                imagePaths[imageIdx],
+                *budget,
+                cache,
+                &cacheEntries[imageIdx],
+                &cachedPixels[imageIdx]
+            );
+            readImages[imageIdx].clear();
+            readImages[imageIdx].shrink_to_fit();
+        },
+        0,
+        true
+    );
+
+    // Images already in memory can start decoding now, external ones as soon as they're read
+    DecodePool* pool = context.pool.get();
+    for (uint32_t imageIdx = 0; imageIdx < model.images.size(); imageIdx++) {
+        if (readPaths[imageIdx].empty()) {
+            pool->Ready(imageIdx);
+        }
+    }
+    for (uint32_t imageIdx = 0; imageIdx < model.images.size(); imageIdx++) {
+        if (readPaths[imageIdx].empty()) {
+            continue;
+        }
+        reader->Read(readPaths[imageIdx], [pool, readImages, imageIdx, path = readPaths[imageIdx]](bool ok, std::vector<uint8_t>&& bytes) {
+            if (!ok) {
+                DebugLog() << "Failed to read image " << path << "\n";
+            }
+            readImages[imageIdx] = std::move(bytes);
+            pool->Ready(imageIdx);
+        });
+    }
+
+    return context;
 }
 
 
@@ -1937,7 +2523,11 @@ bool TinyGLTFImageLoader(
     void* user_pointer
 )
 {
-    image->image.assign(bytes, bytes + size);
+    // Images in buffer views are decoded in place from the buffer, see BeginModelImageLoad().
+    // Data URIs are decoded into a temporary by tinygltf, so those still need a copy.
+    if (image->bufferView == -1) {
+        image->image.assign(bytes, bytes + size);
+    }
 
     image->width = req_width;
     image->height = req_height;
@@ -1949,15 +2539,84 @@ bool TinyGLTFImageLoader(
 }
 
 
-void LoadGLTFThread(App& app, const GLTFLoadEntry& loadEntry, AssetLoadContext* context)
+// tinygltf keeps buffers in vectors, so external buffers are copied once out of the mapping
+bool ReadMappedFile(std::vector<unsigned char>* out, std::string* err, const std::string& filePath, void* userData)
 {
-    const auto& gltfFile = loadEntry.assetPath;
+    MappedFile file;
+    if (!file.Open(filePath)) {
+        if (err) {
+            *err += "Failed to open " + filePath + "\n";
+        }
+        return false;
+    }
 
-    auto perfName = "Loading " + gltfFile;
-    ScopedPerformanceTracker perf(perfName.c_str(), PerformancePrecision::Milliseconds);
+    out->assign(file.Bytes().begin(), file.Bytes().end());
+    return true;
+}
+
+
+static bool ValidateGLTFBufferViews(const tinygltf::Model& model, const GLTFBufferData& bufferData)
+{
+    for (const auto& bufferView : model.bufferViews) {
+        if (bufferView.buffer < 0 || bufferView.buffer >= (int)bufferData.size() ||
+            bufferView.byteOffset + bufferView.byteLength > bufferData[bufferView.buffer].size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Finds the JSON and BIN chunks of a .glb. Returns false if bytes isn't a version 2 .glb,
+// bin is left empty if there is no BIN chunk.
+static bool ParseGLBChunks(std::span<const uint8_t> bytes, std::span<const uint8_t>& json, std::span<const uint8_t>& bin)
+{
+    const uint32_t GLBMagic = 0x46546C67; // "glTF"
+    const uint32_t ChunkTypeJSON = 0x4E4F534A;
+    const uint32_t ChunkTypeBIN = 0x004E4942;
+
+    uint32_t header[3];
+    if (bytes.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(header, bytes.data(), sizeof(header));
+    if (header[0] != GLBMagic || header[1] != 2 || header[2] > bytes.size()) {
+        return false;
+    }
+
+    json = {};
+    bin = {};
+    size_t offset = sizeof(header);
+    size_t length = header[2];
+    while (offset + 8 <= length) {
+        uint32_t chunk[2];
+        memcpy(chunk, bytes.data() + offset, sizeof(chunk));
+        offset += sizeof(chunk);
+        if (chunk[0] > length - offset) {
+            return false;
+        }
+
+        // The JSON chunk comes first and there is at most one BIN chunk, anything else is skipped
+        if (chunk[1] == ChunkTypeJSON && json.empty()) {
+            json = bytes.subspan(offset, chunk[0]);
+        } else if (chunk[1] == ChunkTypeBIN && bin.empty()) {
+            bin = bytes.subspan(offset, chunk[0]);
+        }
+        offset += chunk[0];
+    }
+
+    return !json.empty();
+}
 
+
+// Parses a .gltf or .glb file and loads its buffers, images are left to BeginModelImageLoad().
+//
+// tinygltf always copies the BIN chunk of a .glb into its buffer. That copy is freed straight
+// after parsing and the BIN chunk is used in place, which is why file must stay open for as long
+// as bufferData is read.
+bool LoadGLTFFile(const std::string& gltfFile, tinygltf::Model& gltfModel, MappedFile& file, GLTFBufferData& bufferData)
+{
     tinygltf::TinyGLTF loader;
-    tinygltf::Model gltfModel;
     std::string err;
     std::string warn;
 
@@ -1965,41 +2624,163 @@ void LoadGLTFThread(App& app, const GLTFLoadEntry& loadEntry, AssetLoadContext*
         TinyGLTFImageLoader,
         nullptr
     );
+    loader.SetFsCallbacks(
+        tinygltf::FsCallbacks{
+            &tinygltf::FileExists,
+            &tinygltf::ExpandFilePath,
+            ReadMappedFile,
+            &tinygltf::WriteWholeFile,
+            nullptr
+        }
+    );
+
+    if (!file.Open(gltfFile)) {
+        DebugLog() << "Failed to open GLTF file " << gltfFile << "\n";
+        return false;
+    }
+
+    std::span<const uint8_t> json;
+    std::span<const uint8_t> bin;
+    bool isGLB = ParseGLBChunks(file.Bytes(), json, bin);
+
+    std::string baseDir = std::filesystem::path(gltfFile).parent_path().string();
+    bool loaded = isGLB ?
+        loader.LoadBinaryFromMemory(&gltfModel, &err, &warn, file.Bytes().data(), (unsigned int)file.Bytes().size(), baseDir) :
+        loader.LoadASCIIFromString(&gltfModel, &err, &warn, reinterpret_cast<const char*>(file.Bytes().data()), (unsigned int)file.Bytes().size(), baseDir);
+    if (!loaded) {
+        DebugLog() << "Failed to load GLTF file " << gltfFile << ":";
+        DebugLog() << err;
+        return false;
+    }
+    DebugLog() << warn;
+
+    // The buffer without a uri is the BIN chunk
+    bool hasBINBuffer = isGLB && !gltfModel.buffers.empty() && gltfModel.buffers[0].uri.empty();
+
+    bufferData.clear();
+    for (auto& buffer : gltfModel.buffers) {
+        bufferData.push_back(buffer.data);
+    }
+    if (hasBINBuffer) {
+        auto& binBuffer = gltfModel.buffers[0];
+        if (binBuffer.data.size() > bin.size()) {
+            DebugLog() << "Failed to load GLTF file " << gltfFile << ": BIN chunk is smaller than its buffer\n";
+            return false;
+        }
+        bufferData[0] = bin.first(binBuffer.data.size());
+        std::vector<unsigned char>().swap(binBuffer.data);
+    }
+
+    if (!ValidateGLTFBufferViews(gltfModel, bufferData)) {
+        DebugLog() << "Failed to load GLTF file " << gltfFile << ": buffer view is out of bounds\n";
+        return false;
+    }
+
+    // Only a .glb still points into the file
+    if (!hasBINBuffer) {
+        file.Close();
+    }
+
+    return true;
+}
+
+
+// Parses a cooked model made by mdxrcook. Its buffers and textures stay in the mapped file,
+// which must stay open for as long as bufferData and textures are read.
+bool LoadCookedModelFile(const std::string& path, tinygltf::Model& gltfModel, MappedFile& file, GLTFBufferData& bufferData, std::vector<CookedTexture>& textures)
+{
+    CookedModel cooked;
+    if (!file.Open(path) || !ReadCookedModel(file.Bytes(), cooked)) {
+        DebugLog() << "Failed to load cooked model " << path << ": not a cooked model, or cooked by another version of mdxrcook\n";
+        return false;
+    }
+
+    tinygltf::TinyGLTF loader;
+    std::string err;
+    std::string warn;
+    loader.SetImageLoader(
+        TinyGLTFImageLoader,
+        nullptr
+    );
+
+    if (!loader.LoadASCIIFromString(&gltfModel, &err, &warn, cooked.json.data(), (unsigned int)cooked.json.size(), "")) {
+        DebugLog() << "Failed to load cooked model " << path << ":";
+        DebugLog() << err;
+        return false;
+    }
+
+    if (gltfModel.buffers.size() != cooked.buffers.size() || gltfModel.images.size() != cooked.textures.size()) {
+        DebugLog() << "Failed to load cooked model " << path << ": buffer or texture count doesn't match the GLTF\n";
+        return false;
+    }
+
+    // Drop the placeholders
+    for (auto& buffer : gltfModel.buffers) {
+        buffer.data.clear();
+    }
+    bufferData.assign(cooked.buffers.begin(), cooked.buffers.end());
+    textures = std::move(cooked.textures);
+
+    if (!ValidateGLTFBufferViews(gltfModel, bufferData)) {
+        DebugLog() << "Failed to load cooked model " << path << ": buffer view is out of bounds\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+static bool IsCookedModelPath(const std::string& path)
+{
+    return std::filesystem::path(path).extension() == CookedModelExtension;
+}
+
+
+void LoadGLTFThread(App& app, const GLTFLoadEntry& loadEntry, AssetLoadContext* context)
+{
+    const auto& gltfFile = loadEntry.assetPath;
+
+    auto perfName = "Loading " + gltfFile;
+    ScopedPerformanceTracker perf(perfName.c_str(), PerformancePrecision::Milliseconds);
+
+    tinygltf::Model gltfModel;
+    // Holds the BIN chunk of a .glb or everything of a cooked model, until the model is finalized
+    MappedFile gltfMapping;
+    GLTFBufferData bufferData;
+    std::vector<CookedTexture> cookedTextures;
+    bool isCooked = IsCookedModelPath(gltfFile);
 
     context->assetPath = gltfFile;
 
     context->currentTask = "Loading GLTF file";
     context->overallPercent = 0.0f;
 
-    if (!loader.LoadASCIIFromFile(&gltfModel, &err, &warn, gltfFile)) {
-        DebugLog() << "Failed to load GLTF file " << gltfFile << ":";
-        DebugLog() << err;
+    if (isCooked ? !LoadCookedModelFile(gltfFile, gltfModel, gltfMapping, bufferData, cookedTextures) : !LoadGLTFFile(gltfFile, gltfModel, gltfMapping, bufferData)) {
         return;
     }
-    DebugLog() << warn;
 
     if (!ValidateGLTFModel(gltfModel)) {
         context->isFinished = true;
         return;
     }
 
-    auto imageLoadContext = BeginModelImageLoad(gltfModel);
+    // Cooked textures are ready to upload as they are
+    ImageLoadContext imageLoadContext;
+    if (!isCooked) {
+        imageLoadContext = BeginModelImageLoad(
+            gltfModel,
+            bufferData,
+            std::filesystem::path(gltfFile).parent_path().string(),
+            &app.AssetThread.cache,
+            app.AssetThread.reader.get()
+        );
+    }
 
     std::vector<UINT64> uploadOffsets;
     std::span<ComPtr<ID3D12Resource>> geometryBuffers;
     std::span<ComPtr<ID3D12Resource>> textureBuffers;
     Model model;
 
-    auto [copyCommandList, copyCommandAllocator] = EasyCreateGraphicsCommandList(
-        app,
-        D3D12_COMMAND_LIST_TYPE_COPY
-    );
-
-    auto [computeCommandList, computeCommandAllocator] = EasyCreateGraphicsCommandList(
-        app,
-        D3D12_COMMAND_LIST_TYPE_COMPUTE
-    );
-
     FenceEvent fenceEvent;
 
     // Can only call this ONCE before command list executed
@@ -2008,24 +2789,28 @@ void LoadGLTFThread(App& app, const GLTFLoadEntry& loadEntry, AssetLoadContext*
         model,
         app,
         gltfModel,
-        copyCommandList.Get(),
-        copyCommandAllocator.Get(),
+        bufferData,
         uploadOffsets,
         geometryBuffers,
         textureBuffers,
         fenceEvent,
         imageLoadContext,
+        cookedTextures,
         context
     );
 
     std::vector<SharedPoolItem<Material>> modelMaterials;
 
+    std::vector<GLTFTransformNode> transformNodes;
+    GLTFMeshInstances meshInstances;
+    std::vector<GLTFLightTransform> lightTransforms;
+    ResolveModelTransforms(gltfModel, bufferData, transformNodes, meshInstances, lightTransforms);
+
     context->currentTask = "Finalizing";
-    CreateModelDescriptors(app, gltfModel, model, textureBuffers);
+    CreateModelDescriptors(app, model, textureBuffers);
     CreateModelMaterials(app, gltfModel, model, modelMaterials);
-    FinalizeModel(model, app, gltfModel, modelMaterials, computeCommandList.Get());
-
-    app.computeQueue.ExecuteCommandListsBlocking({ computeCommandList.Get() });
+    std::vector<BLASBuildRequest> blasRequests;
+    FinalizeModel(model, app, gltfModel, bufferData, modelMaterials, transformNodes, meshInstances, lightTransforms, blasRequests);
 
     context->overallPercent = 1.0f;
 
@@ -2033,13 +2818,277 @@ void LoadGLTFThread(App& app, const GLTFLoadEntry& loadEntry, AssetLoadContext*
 
     app.copyQueue.WaitForEventCPU(fenceEvent);
 
+    QueueBLASBuilds(app, blasRequests);
+
     context->isFinished = true;
     loadEntry.finishCB(app, app.models.back());
 }
 
 
+// The reader assets used before MappedFile, kept to compare against
+static std::vector<unsigned char> LoadBinaryFileStream(const std::string& filePath)
+{
+    std::ifstream file(filePath, std::ios::binary);
+    std::vector<unsigned char> data;
+
+    if (!file.good()) {
+        return data;
+    }
+
+    file.unsetf(std::ios::skipws);
+
+    file.seekg(0, std::ios::end);
+    std::streampos fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    data.reserve(fileSize);
+    data.insert(data.begin(), std::istream_iterator<unsigned char>(file), std::istream_iterator<unsigned char>());
+
+    return data;
+}
+
+
+void BenchmarkAssetIO(App& app)
+{
+    std::vector<std::string> modelPaths;
+    std::vector<std::string> filePaths;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(app.dataDir)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+        if (extension == ".gltf" || extension == ".glb" || extension == CookedModelExtension) {
+            modelPaths.push_back(entry.path().string());
+        }
+        if (extension == ".gltf" || extension == ".glb" || extension == CookedModelExtension || extension == ".bin" || extension == ".png" ||
+            extension == ".jpg" || extension == ".jpeg" || extension == ".hdr") {
+            filePaths.push_back(entry.path().string());
+        }
+    }
+
+    // Parse and decode a model the way LoadGLTFThread does, without the GPU upload.
+    // Cooked models have nothing to decode, but every mip is read once like the upload would.
+    volatile uint64_t cookedSum = 0;
+    auto loadModel = [&](const std::string& path, AssetCache* cache = nullptr) {
+        auto start = std::chrono::steady_clock::now();
+        tinygltf::Model model;
+        MappedFile mapping;
+        GLTFBufferData bufferData;
+        if (IsCookedModelPath(path)) {
+            std::vector<CookedTexture> textures;
+            if (LoadCookedModelFile(path, model, mapping, bufferData, textures)) {
+                uint64_t sum = 0;
+                for (const CookedTexture& texture : textures) {
+                    for (const CookedMip& mip : texture.mips) {
+                        sum = std::accumulate(mip.data.begin(), mip.data.end(), sum);
+                    }
+                }
+                cookedSum = cookedSum + sum;
+            }
+        } else if (LoadGLTFFile(path, model, mapping, bufferData)) {
+            ImageLoadContext images = BeginModelImageLoad(
+                model,
+                bufferData,
+                std::filesystem::path(path).parent_path().string(),
+                cache,
+                app.AssetThread.reader.get()
+            );
+            WaitForModelImages(model, images);
+        }
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto loadModels = [&](AssetCache* cache = nullptr) {
+        float ms = 0.0f;
+        for (const std::string& path : modelPaths) {
+            ms += loadModel(path, cache);
+        }
+        return ms;
+    };
+
+    // Only as cold as the OS file cache allows, files loaded earlier in the session are already warm
+    app.Stats.assetLoadColdMS = loadModels();
+    app.Stats.assetLoadWarmMS = loadModels();
+
+    // The same loads through an empty asset cache, which decodes and stores every image, then
+    // again with every image a hit. Kept apart from the app's cache so it starts out empty.
+    const char* BenchmarkCacheDir = "assetcache_benchmark";
+    std::filesystem::remove_all(BenchmarkCacheDir);
+    {
+        AssetCache cache;
+        cache.Open(BenchmarkCacheDir, AssetCacheMaxBytes);
+        app.Stats.assetLoadCacheMissMS = loadModels(&cache);
+        app.Stats.assetLoadCacheHitMS = loadModels(&cache);
+        app.Stats.assetCacheBenchmarkHits = (uint32_t)cache.Hits();
+        app.Stats.assetCacheBenchmarkMB = cache.SizeInBytes() / (1024.0f * 1024.0f);
+    }
+    std::filesystem::remove_all(BenchmarkCacheDir);
+
+    // Models that ship as both a .glb and a .gltf next to each other, both warm by now
+    const int GLBLoadRepeats = 8;
+    app.Stats.glbLoadMS = 0.0f;
+    app.Stats.glbAsGLTFLoadMS = 0.0f;
+    uint32_t glbPairs = 0;
+    for (const std::string& path : modelPaths) {
+        std::filesystem::path gltfPath = std::filesystem::path(path).replace_extension(".gltf");
+        if (std::filesystem::path(path).extension() != ".glb" || !std::filesystem::exists(gltfPath)) {
+            continue;
+        }
+        for (int i = 0; i < GLBLoadRepeats; i++) {
+            app.Stats.glbLoadMS += loadModel(path) / GLBLoadRepeats;
+            app.Stats.glbAsGLTFLoadMS += loadModel(gltfPath.string()) / GLBLoadRepeats;
+        }
+        glbPairs++;
+    }
+
+    // Cooked models against the .gltf or .glb they were cooked from, which also generates mips
+    app.Stats.cookedLoadMS = 0.0f;
+    app.Stats.cookedSourceLoadMS = 0.0f;
+    uint32_t cookedPairs = 0;
+    for (const std::string& path : modelPaths) {
+        if (!IsCookedModelPath(path)) {
+            continue;
+        }
+        std::filesystem::path sourcePath = std::filesystem::path(path).replace_extension(".gltf");
+        if (!std::filesystem::exists(sourcePath)) {
+            sourcePath.replace_extension(".glb");
+        }
+        if (!std::filesystem::exists(sourcePath)) {
+            continue;
+        }
+        app.Stats.cookedLoadMS += loadModel(path);
+        app.Stats.cookedSourceLoadMS += loadModel(sourcePath.string());
+        cookedPairs++;
+    }
+
+    // Decoding every model image the old way, to RGBA8 in a tinygltf::Image that's then copied to upload
+    // memory, against DecodedImage expanding to RGBA8 as it writes into upload memory. Upload memory is
+    // stood in for by a buffer with the copy queue's row pitch. Bytes moved counts every pass that
+    // writes out the whole image: stb_image's own output, its expansion to RGBA8, the copy into the
+    // tinygltf::Image and the copy into upload memory.
+    uint64_t oldBytesMoved = 0;
+    uint64_t newBytesMoved = 0;
+    uint32_t textureCount = 0;
+    float oldDecodeMS = 0.0f;
+    float newDecodeMS = 0.0f;
+    std::vector<uint8_t> uploadMemory;
+    for (const std::string& path : modelPaths) {
+        tinygltf::Model model;
+        MappedFile mapping;
+        GLTFBufferData bufferData;
+        if (IsCookedModelPath(path) || !LoadGLTFFile(path, model, mapping, bufferData)) {
+            continue;
+        }
+
+        std::vector<std::span<const unsigned char>> encodedImages;
+        std::vector<std::string> imagePaths;
+        FindEncodedModelImages(model, bufferData, std::filesystem::path(path).parent_path().string(), encodedImages, imagePaths);
+
+        for (size_t imageIdx = 0; imageIdx < encodedImages.size(); imageIdx++) {
+            MappedFile imageFile;
+            std::span<const unsigned char> encoded = encodedImages[imageIdx];
+            if (!imagePaths[imageIdx].empty()) {
+                imageFile.Open(imagePaths[imageIdx]);
+                encoded = imageFile.Bytes();
+            }
+
+            uint32_t width, height, components;
+            if (!ReadImageInfo(encoded, width, height, components)) {
+                continue;
+            }
+            const size_t rowPitch = ((size_t)width * 4 + D3D12_TEXTURE_DATA_PITCH_ALIGNMENT - 1) & ~(size_t)(D3D12_TEXTURE_DATA_PITCH_ALIGNMENT - 1);
+            uploadMemory.resize(rowPitch * height);
+
+            auto oldStart = std::chrono::steady_clock::now();
+            auto image = LoadImageFromMemory(encoded.data(), (int)encoded.size());
+            if (image) {
+                for (uint32_t y = 0; y < height; y++) {
+                    memcpy(uploadMemory.data() + y * rowPitch, image->image.data() + (size_t)y * width * 4, (size_t)width * 4);
+                }
+            }
+            auto newStart = std::chrono::steady_clock::now();
+            DecodedImage decoded;
+            if (decoded.Decode(encoded)) {
+                decoded.WriteRGBA8(uploadMemory.data(), rowPitch);
+            }
+            auto newEnd = std::chrono::steady_clock::now();
+
+            const uint64_t decodedBytes = (uint64_t)width * height * components;
+            const uint64_t rgbaBytes = (uint64_t)width * height * 4;
+            oldBytesMoved += decodedBytes + (components != 4 ? rgbaBytes : 0) + rgbaBytes * 2;
+            newBytesMoved += decodedBytes + rgbaBytes;
+            oldDecodeMS += std::chrono::duration<float, std::milli>(newStart - oldStart).count();
+            newDecodeMS += std::chrono::duration<float, std::milli>(newEnd - newStart).count();
+            textureCount++;
+        }
+    }
+
+    app.Stats.imageDecodeOldMS = oldDecodeMS;
+    app.Stats.imageDecodeMS = newDecodeMS;
+    app.Stats.imageBytesMovedOldKB = textureCount > 0 ? oldBytesMoved / 1024.0f / textureCount : 0.0f;
+    app.Stats.imageBytesMovedKB = textureCount > 0 ? newBytesMoved / 1024.0f / textureCount : 0.0f;
+
+    // Raw reads of the same files, summing the bytes so both readers touch every page
+    uint64_t streamSum = 0;
+    uint64_t mappedSum = 0;
+    uint64_t totalBytes = 0;
+
+    auto streamStart = std::chrono::steady_clock::now();
+    for (const std::string& path : filePaths) {
+        std::vector<unsigned char> data = LoadBinaryFileStream(path);
+        streamSum = std::accumulate(data.begin(), data.end(), streamSum);
+    }
+    auto mappedStart = std::chrono::steady_clock::now();
+    for (const std::string& path : filePaths) {
+        MappedFile file;
+        if (file.Open(path)) {
+            mappedSum = std::accumulate(file.Bytes().begin(), file.Bytes().end(), mappedSum);
+            totalBytes += file.Bytes().size();
+        }
+    }
+    auto mappedEnd = std::chrono::steady_clock::now();
+
+    // Every file queued at once on the asset thread's reader
+    std::atomic<uint64_t> asyncSum = 0;
+    app.AssetThread.reader->Wait();
+    auto asyncStart = std::chrono::steady_clock::now();
+    for (const std::string& path : filePaths) {
+        app.AssetThread.reader->Read(path, [&](bool, std::vector<uint8_t>&& bytes) {
+            asyncSum += std::accumulate(bytes.begin(), bytes.end(), (uint64_t)0);
+        });
+    }
+    app.AssetThread.reader->Wait();
+    auto asyncEnd = std::chrono::steady_clock::now();
+
+    app.Stats.assetReadStreamMS = std::chrono::duration<float, std::milli>(mappedStart - streamStart).count();
+    app.Stats.assetReadMappedMS = std::chrono::duration<float, std::milli>(mappedEnd - mappedStart).count();
+    app.Stats.assetReadAsyncMS = std::chrono::duration<float, std::milli>(asyncEnd - asyncStart).count();
+    app.Stats.assetReadMB = totalBytes / (1024.0f * 1024.0f);
+
+    DebugLog() << "Asset I/O: " << modelPaths.size() << " models loaded in "
+        << app.Stats.assetLoadColdMS << "ms cold, " << app.Stats.assetLoadWarmMS << "ms warm, "
+        << app.Stats.assetLoadCacheMissMS << "ms filling the asset cache (" << app.Stats.assetCacheBenchmarkMB << "MB), "
+        << app.Stats.assetLoadCacheHitMS << "ms from it with " << app.Stats.assetCacheBenchmarkHits << " hits. "
+        << filePaths.size() << " files (" << app.Stats.assetReadMB << "MB) read in "
+        << app.Stats.assetReadStreamMS << "ms streamed, " << app.Stats.assetReadMappedMS << "ms mapped, "
+        << app.Stats.assetReadAsyncMS << "ms async ("
+        << (app.AssetThread.reader->Backend() == AsyncReadBackend::IOUring ? "io_uring" : "thread pool") << ")"
+        << (streamSum != mappedSum || asyncSum != mappedSum ? ", CONTENTS DIFFER" : "") << ". "
+        << glbPairs << " models as .glb " << app.Stats.glbLoadMS << "ms, as .gltf " << app.Stats.glbAsGLTFLoadMS << "ms. "
+        << cookedPairs << " models cooked " << app.Stats.cookedLoadMS << "ms, from source " << app.Stats.cookedSourceLoadMS << "ms. "
+        << textureCount << " textures decoded to upload memory moving " << app.Stats.imageBytesMovedKB << "KB each in "
+        << app.Stats.imageDecodeMS << "ms, through a tinygltf::Image " << app.Stats.imageBytesMovedOldKB << "KB each in "
+        << app.Stats.imageDecodeOldMS << "ms\n";
+}
+
+
 void StartAssetThread(App& app)
 {
+    if (!app.AssetThread.cache.Open("assetcache", AssetCacheMaxBytes)) {
+        DebugLog() << "Failed to open the asset cache, images will always be decoded\n";
+    }
+    app.AssetThread.reader = std::make_unique<AsyncFileReader>();
     app.AssetThread.thread = std::thread(AssetLoadThread, std::ref(app));
 }
 
@@ -33,6 +33,7 @@ std::vector<unsigned char> LoadBinaryFile(const std::string& filePath);
 std::optional<tinygltf::Image> LoadImageFromMemory(const unsigned char* bytes, int size);
 std::optional<tinygltf::Image> LoadImageFile(const std::string& imagePath);
 std::optional<HDRImage> LoadHDRImage(const std::string& filePath);
+void BenchmarkAssetIO(App& app);
 void ProcessAssets(App& app, AssetBundle& assets);
 
 void StartAssetThread(App& app);
@@ -0,0 +1,450 @@
+#include "asyncread.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Files bigger than this are read as several chunks in flight at once
+static constexpr uint64_t ChunkBytes = 512 * 1024;
+// io_uring stops opening files while the ones being read add up to this much. Plenty of small files
+// still fit, and a large one has all its chunks in flight. Buffers are allocated when a file is
+// opened, and once enough of them are freed together glibc trims its heap and the next buffers are
+// fresh pages that all fault in. At 16 chunks every page of the large files in data/ faulted and
+// warm reads took 3x as long as blocking reads, at 8 there are no faults and cold reads are no slower.
+static constexpr uint64_t MaxBytesInFlight = 8 * ChunkBytes;
+
+#ifdef __linux__
+// liburing isn't needed for the little of io_uring used here: the rings are mapped and driven
+// with the raw system calls.
+struct AsyncFileReader::IOUring
+{
+    int fd = -1;
+    // Read() writes to it to wake the ring thread, which always has a read of it queued
+    int eventFd = -1;
+
+    void* sqMapping = nullptr;
+    size_t sqMappingSize = 0;
+    void* cqMapping = nullptr;
+    size_t cqMappingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    ~IOUring()
+    {
+        if (sqes) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqMapping && cqMapping != sqMapping) {
+            munmap(cqMapping, cqMappingSize);
+        }
+        if (sqMapping) {
+            munmap(sqMapping, sqMappingSize);
+        }
+        if (eventFd != -1) {
+            close(eventFd);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+};
+#endif
+
+AsyncFileReader::AsyncFileReader(AsyncReadBackend backend, uint32_t maxInFlight, uint32_t threadCount)
+    : backend(backend)
+{
+    if (backend == AsyncReadBackend::IOUring) {
+#ifdef __linux__
+        if (StartIOUring(std::max(maxInFlight, 2u))) {
+            threads.emplace_back(&AsyncFileReader::IOUringWork, this);
+            return;
+        }
+#endif
+        this->backend = AsyncReadBackend::ThreadPool;
+    }
+
+    for (uint32_t t = 0; t < std::max(threadCount, 1u); t++) {
+        threads.emplace_back(&AsyncFileReader::ThreadPoolWork, this);
+    }
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+    {
+        std::scoped_lock lock(mutex);
+        stopping = true;
+    }
+    requestQueued.notify_all();
+#ifdef __linux__
+    if (ring) {
+        WakeIOUring();
+    }
+#endif
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+#ifdef __linux__
+    delete ring;
+#endif
+}
+
+void AsyncFileReader::Read(const std::string& path, Callback callback)
+{
+    {
+        std::scoped_lock lock(mutex);
+        requests.push_back(Request{ path, std::move(callback) });
+        outstanding++;
+    }
+#ifdef __linux__
+    if (ring) {
+        WakeIOUring();
+        return;
+    }
+#endif
+    requestQueued.notify_one();
+}
+
+void AsyncFileReader::Wait()
+{
+    std::unique_lock lock(mutex);
+    idle.wait(lock, [&]() { return outstanding == 0; });
+}
+
+void AsyncFileReader::Finished()
+{
+    // Notified under the lock, so a reader destroyed as soon as Wait() returns isn't touched after
+    std::scoped_lock lock(mutex);
+    if (--outstanding == 0) {
+        idle.notify_all();
+    }
+}
+
+static bool ReadWholeFile(const std::string& path, std::vector<uint8_t>& bytes)
+{
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return false;
+    }
+
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    bytes.resize(size);
+    bool ok = std::fread(bytes.data(), 1, size, file) == size;
+    std::fclose(file);
+    if (!ok) {
+        bytes.clear();
+    }
+    return ok;
+}
+
+void AsyncFileReader::ThreadPoolWork()
+{
+    for (;;) {
+        Request request;
+        {
+            std::unique_lock lock(mutex);
+            requestQueued.wait(lock, [&]() { return stopping || !requests.empty(); });
+            if (requests.empty()) {
+                return;
+            }
+            request = std::move(requests.front());
+            requests.pop_front();
+        }
+
+        std::vector<uint8_t> bytes;
+        bool ok = ReadWholeFile(request.path, bytes);
+        request.callback(ok, std::move(bytes));
+        Finished();
+    }
+}
+
+#ifdef __linux__
+template<typename T>
+static T* RingField(void* mapping, uint32_t offset)
+{
+    return reinterpret_cast<T*>(static_cast<uint8_t*>(mapping) + offset);
+}
+
+bool AsyncFileReader::StartIOUring(uint32_t maxInFlight)
+{
+    io_uring_params params = {};
+    int fd = (int)syscall(__NR_io_uring_setup, maxInFlight, &params);
+    if (fd < 0) {
+        // Old kernels, and sandboxes that block io_uring
+        return false;
+    }
+
+    auto newRing = std::make_unique<IOUring>();
+    newRing->fd = fd;
+    // IORING_OP_READ came a kernel before fast poll, so this rules out kernels without it
+    if (!(params.features & IORING_FEAT_FAST_POLL)) {
+        return false;
+    }
+
+    newRing->sqMappingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    newRing->cqMappingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMapping = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMapping) {
+        newRing->sqMappingSize = newRing->cqMappingSize = std::max(newRing->sqMappingSize, newRing->cqMappingSize);
+    }
+
+    void* sqMapping = mmap(nullptr, newRing->sqMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqMapping == MAP_FAILED) {
+        return false;
+    }
+    newRing->sqMapping = sqMapping;
+
+    void* cqMapping = sqMapping;
+    if (!singleMapping) {
+        cqMapping = mmap(nullptr, newRing->cqMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqMapping == MAP_FAILED) {
+            return false;
+        }
+    }
+    newRing->cqMapping = cqMapping;
+
+    newRing->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, newRing->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    newRing->sqes = static_cast<io_uring_sqe*>(sqes);
+
+    newRing->sqTail = RingField<unsigned>(sqMapping, params.sq_off.tail);
+    newRing->sqArray = RingField<unsigned>(sqMapping, params.sq_off.array);
+    newRing->sqMask = *RingField<unsigned>(sqMapping, params.sq_off.ring_mask);
+    newRing->sqEntries = params.sq_entries;
+    newRing->cqHead = RingField<unsigned>(cqMapping, params.cq_off.head);
+    newRing->cqTail = RingField<unsigned>(cqMapping, params.cq_off.tail);
+    newRing->cqMask = *RingField<unsigned>(cqMapping, params.cq_off.ring_mask);
+    newRing->cqes = RingField<io_uring_cqe>(cqMapping, params.cq_off.cqes);
+
+    newRing->eventFd = eventfd(0, EFD_CLOEXEC);
+    if (newRing->eventFd == -1) {
+        return false;
+    }
+
+    ring = newRing.release();
+    return true;
+}
+
+void AsyncFileReader::WakeIOUring()
+{
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(ring->eventFd, &one, sizeof(one));
+}
+
+void AsyncFileReader::IOUringWork()
+{
+    struct FileRead
+    {
+        int fd;
+        std::vector<uint8_t> bytes;
+        uint64_t submittedBytes = 0;
+        uint64_t completedBytes = 0;
+        uint32_t chunksInFlight = 0;
+        bool failed = false;
+        Callback callback;
+    };
+    struct ChunkRead
+    {
+        FileRead* file;
+        uint64_t offset;
+        uint32_t length;
+    };
+
+    // One ring entry is kept for the eventfd read, the rest are chunk slots.
+    // A CQE's user_data is its chunk slot + 1, 0 is the eventfd.
+    const uint32_t slotCount = ring->sqEntries - 1;
+    std::vector<ChunkRead> slots(slotCount);
+    std::vector<uint32_t> freeSlots(slotCount);
+    for (uint32_t i = 0; i < slotCount; i++) {
+        freeSlots[i] = slotCount - 1 - i;
+    }
+    // Slots to submit again, after a short or interrupted read
+    std::vector<uint32_t> retrySlots;
+
+    std::vector<std::unique_ptr<FileRead>> active;
+    bool eventFdQueued = false;
+    uint64_t eventFdValue = 0;
+    unsigned unsubmitted = 0;
+
+    auto queueRead = [&](int fd, void* dest, uint32_t length, uint64_t offset, uint64_t userData) {
+        unsigned tail = *ring->sqTail;
+        unsigned index = tail & ring->sqMask;
+        io_uring_sqe& sqe = ring->sqes[index];
+        sqe = {};
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(dest);
+        sqe.len = length;
+        sqe.off = offset;
+        sqe.user_data = userData;
+        ring->sqArray[index] = index;
+        std::atomic_ref<unsigned>(*ring->sqTail).store(tail + 1, std::memory_order_release);
+        unsubmitted++;
+    };
+    auto queueChunk = [&](uint32_t slot) {
+        ChunkRead& chunk = slots[slot];
+        queueRead(chunk.file->fd, chunk.file->bytes.data() + chunk.offset, chunk.length, chunk.offset, slot + 1);
+    };
+
+    // Bytes of the files being read, no more are opened while it's over MaxBytesInFlight
+    uint64_t activeBytes = 0;
+
+    for (;;) {
+        {
+            std::scoped_lock lock(mutex);
+            if (stopping && requests.empty() && active.empty()) {
+                return;
+            }
+        }
+
+        // Opening is done here rather than through the ring, it's quick next to the reads
+        while (active.size() < slotCount && (active.empty() || activeBytes < MaxBytesInFlight)) {
+            Request request;
+            {
+                std::scoped_lock lock(mutex);
+                if (requests.empty()) {
+                    break;
+                }
+                request = std::move(requests.front());
+                requests.pop_front();
+            }
+
+            int fd = open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat fileStat;
+            if (fd == -1 || fstat(fd, &fileStat) != 0) {
+                if (fd != -1) {
+                    close(fd);
+                }
+                request.callback(false, {});
+                Finished();
+                continue;
+            }
+            if (fileStat.st_size == 0) {
+                close(fd);
+                request.callback(true, {});
+                Finished();
+                continue;
+            }
+
+            auto file = std::make_unique<FileRead>();
+            file->fd = fd;
+            file->bytes.resize((size_t)fileStat.st_size);
+            file->callback = std::move(request.callback);
+            activeBytes += file->bytes.size();
+            active.push_back(std::move(file));
+        }
+
+        // Interrupted chunks first, then new chunks in the order their files were queued
+        for (uint32_t slot : retrySlots) {
+            queueChunk(slot);
+        }
+        retrySlots.clear();
+        for (auto& file : active) {
+            while (!file->failed && file->submittedBytes < file->bytes.size() && !freeSlots.empty()) {
+                uint32_t slot = freeSlots.back();
+                freeSlots.pop_back();
+                uint32_t length = (uint32_t)std::min<uint64_t>(ChunkBytes, file->bytes.size() - file->submittedBytes);
+                slots[slot] = ChunkRead{ file.get(), file->submittedBytes, length };
+                file->submittedBytes += length;
+                file->chunksInFlight++;
+                queueChunk(slot);
+            }
+        }
+        if (!eventFdQueued) {
+            queueRead(ring->eventFd, &eventFdValue, sizeof(eventFdValue), 0, 0);
+            eventFdQueued = true;
+        }
+
+        // The eventfd read is always queued, so there's always something to wait for
+        int entered = (int)syscall(__NR_io_uring_enter, ring->fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (entered < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            // The ring is unusable, which shouldn't happen once it's set up
+            std::abort();
+        }
+        unsubmitted -= (unsigned)entered;
+
+        unsigned head = *ring->cqHead;
+        unsigned tail = std::atomic_ref<unsigned>(*ring->cqTail).load(std::memory_order_acquire);
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = ring->cqes[head & ring->cqMask];
+            if (cqe.user_data == 0) {
+                eventFdQueued = false;
+                continue;
+            }
+
+            uint32_t slot = (uint32_t)(cqe.user_data - 1);
+            ChunkRead& chunk = slots[slot];
+            if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                retrySlots.push_back(slot);
+                continue;
+            }
+            if (cqe.res > 0 && (uint32_t)cqe.res < chunk.length) {
+                chunk.file->completedBytes += cqe.res;
+                chunk.offset += cqe.res;
+                chunk.length -= cqe.res;
+                retrySlots.push_back(slot);
+                continue;
+            }
+            if (cqe.res <= 0) {
+                // An error, or the file got shorter since it was opened
+                chunk.file->failed = true;
+            } else {
+                chunk.file->completedBytes += cqe.res;
+            }
+            chunk.file->chunksInFlight--;
+            freeSlots.push_back(slot);
+        }
+        std::atomic_ref<unsigned>(*ring->cqHead).store(head, std::memory_order_release);
+
+        // Call back for files with nothing left in flight, keeping the rest in order
+        auto finished = std::stable_partition(active.begin(), active.end(), [](const std::unique_ptr<FileRead>& file) {
+            return file->chunksInFlight > 0 || (!file->failed && file->completedBytes < file->bytes.size());
+        });
+        for (auto it = finished; it != active.end(); it++) {
+            FileRead& file = **it;
+            close(file.fd);
+            activeBytes -= file.bytes.size();
+            if (file.failed) {
+                file.callback(false, {});
+            } else {
+                file.callback(true, std::move(file.bytes));
+            }
+            Finished();
+        }
+        active.erase(finished, active.end());
+    }
+}
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads whole files in the background, calling back as each one finishes.
+//
+// On Linux reads go through io_uring: one thread keeps up to maxInFlight reads queued in the
+// kernel, splitting large files into chunks so they're read in parallel too. Elsewhere, or when
+// the kernel doesn't allow io_uring, a pool of threads does blocking reads, one file each.
+//
+// Callbacks run on the reader's threads, with io_uring all of them on the same one, so they
+// should hand the bytes off rather than process them, e.g. to a DecodePool with DecodePool::Ready().
+
+enum class AsyncReadBackend
+{
+    IOUring,
+    ThreadPool,
+};
+
+class AsyncFileReader
+{
+public:
+    // ok is false if the file couldn't be opened or read, bytes is then empty
+    using Callback = std::function<void(bool ok, std::vector<uint8_t>&& bytes)>;
+
+    // maxInFlight is the most chunk reads io_uring has queued at once, threadCount the size of the pool
+    explicit AsyncFileReader(AsyncReadBackend backend = AsyncReadBackend::IOUring, uint32_t maxInFlight = 64, uint32_t threadCount = 4);
+    // Finishes every read that was queued
+    ~AsyncFileReader();
+
+    AsyncFileReader(const AsyncFileReader&) = delete;
+    AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+    // Queues a read of the whole file. Safe to call from any thread, including from a callback.
+    void Read(const std::string& path, Callback callback);
+
+    // Blocks until every read queued so far has called back
+    void Wait();
+
+    // IOUring falls back to ThreadPool when io_uring isn't available
+    AsyncReadBackend Backend() const
+    {
+        return backend;
+    }
+
+private:
+    struct Request
+    {
+        std::string path;
+        Callback callback;
+    };
+
+    void ThreadPoolWork();
+    void Finished();
+
+    AsyncReadBackend backend;
+
+    std::mutex mutex;
+    std::condition_variable requestQueued;
+    std::condition_variable idle;
+    std::deque<Request> requests;
+    // Queued reads that haven't called back yet
+    uint64_t outstanding = 0;
+    bool stopping = false;
+
+    std::vector<std::thread> threads;
+
+#ifdef __linux__
+    struct IOUring;
+    bool StartIOUring(uint32_t maxInFlight);
+    void IOUringWork();
+    void WakeIOUring();
+
+    IOUring* ring = nullptr;
+#endif
+};
@@ -0,0 +1,1688 @@
+// Headless checks and benchmarks of the renderer's CPU side, the parts that don't need D3D12.
+//
+// Usage: mdxrbench <name>, each name is a ctest test. Prints timings and returns non-zero if
+// any check failed.
+
+#include "blasscheduler.h"
+#include "contenthash.h"
+#include "cpubvh.h"
+#include "drawpacket.h"
+#include "instancedata.h"
+#include "ktx2.h"
+#include "lightclusters.h"
+#include "probevolume.h"
+#include "radixsort.h"
+#include "sphericalharmonics.h"
+#include "tlas.h"
+#include "transforms.h"
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/euler_angles.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+
+static uint32_t failures = 0;
+
+#define EXPECT(condition) \
+    if (!(condition)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": " << #condition << " failed\n"; \
+        failures++; \
+    }
+
+static float Milliseconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<float, std::milli>(duration).count();
+}
+
+static glm::mat4 RandomTransform(std::mt19937& random)
+{
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+    std::uniform_real_distribution<float> scale(0.1f, 10.0f);
+    glm::vec3 axis = glm::normalize(glm::vec3(position(random), position(random), position(random)) + glm::vec3(0.01f));
+    glm::mat4 matrix = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random), position(random)));
+    matrix = glm::rotate(matrix, angle(random), axis);
+    return glm::scale(matrix, glm::vec3(scale(random), scale(random), scale(random)));
+}
+
+// Base, translation, euler and scale of a transform, and its parent or InvalidIndex
+struct TestTransform
+{
+    glm::mat4 base;
+    glm::vec3 translation;
+    glm::vec3 euler;
+    glm::vec3 scale;
+    uint32_t parent;
+};
+
+// World matrices the way the scene built them before TransformStore, ApplyStandardTransforms
+// (util.h isn't headless) under the parent's world, in double precision
+static std::vector<glm::dmat4> ReferenceWorldMatrices(const std::vector<TestTransform>& transforms)
+{
+    std::vector<glm::dmat4> world(transforms.size());
+    for (size_t i = 0; i < transforms.size(); i++) {
+        const TestTransform& transform = transforms[i];
+        glm::dmat4 local = glm::dmat4(transform.base);
+        local = glm::translate(local, glm::dvec3(transform.translation));
+        local = glm::scale(local, glm::dvec3(transform.scale));
+        local = local * glm::eulerAngleXYZ((double)transform.euler.x, (double)transform.euler.y, (double)transform.euler.z);
+        world[i] = transform.parent == TransformStore::InvalidIndex ? local : world[transform.parent] * local;
+    }
+    return world;
+}
+
+// Largest element difference, relative to the largest element of expected
+static double MatrixError(const glm::mat4& matrix, const glm::dmat4& expected)
+{
+    double scale = 1.0;
+    double maxError = 0.0;
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            scale = std::max(scale, std::abs(expected[c][r]));
+            maxError = std::max(maxError, std::abs(matrix[c][r] - expected[c][r]));
+        }
+    }
+    return maxError / scale;
+}
+
+// Updates random transforms in shallow hierarchies through the SIMD and scalar paths, checking
+// both against glm, that a change only updates and uploads the changed subtree, and that bounds
+// follow their transforms
+static void Transforms()
+{
+    std::mt19937 random(28);
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> angle(-glm::pi<float>(), glm::pi<float>());
+    std::uniform_real_distribution<float> scale(0.8f, 1.25f);
+
+    // Not a multiple of BatchWidth, so the last batch is partly unused
+    const uint32_t TransformCount = 1003;
+    const uint32_t MaxDepth = 4;
+    const double Tolerance = 1e-5;
+
+    TransformStore store;
+    uint32_t first = store.Allocate(TransformCount);
+    EXPECT(first == 0);
+
+    std::vector<TestTransform> transforms(TransformCount);
+    std::vector<uint32_t> depth(TransformCount, 0);
+    AlignedVector<InstanceTransform> destinations(TransformCount);
+    for (uint32_t i = 0; i < TransformCount; i++) {
+        TestTransform& transform = transforms[i];
+        transform.base = RandomTransform(random);
+        transform.translation = glm::vec3(position(random), position(random), position(random));
+        transform.euler = glm::vec3(angle(random), angle(random), angle(random));
+        transform.scale = glm::vec3(scale(random), scale(random), scale(random));
+        transform.parent = TransformStore::InvalidIndex;
+        // Parents are often in the same batch, some chains cross batches
+        if (i > 0 && random() % 3 != 0) {
+            uint32_t parent = i - 1 - random() % std::min(i, 12u);
+            if (depth[parent] < MaxDepth) {
+                transform.parent = parent;
+                depth[i] = depth[parent] + 1;
+            }
+        }
+        // The base is what the hierarchy scales, keep it to rotation and translation
+        transform.base[0] = glm::normalize(transform.base[0]);
+        transform.base[1] = glm::vec4(glm::normalize(glm::cross(glm::vec3(transform.base[2]), glm::vec3(transform.base[0]))), 0.0f);
+        transform.base[2] = glm::vec4(glm::cross(glm::vec3(transform.base[0]), glm::vec3(transform.base[1])), 0.0f);
+
+        store.SetBase(i, transform.base);
+        store.SetTranslation(i, transform.translation);
+        store.SetEuler(i, transform.euler);
+        store.SetScale(i, transform.scale);
+        store.SetParent(i, transform.parent);
+        store.AddDestination(i, &destinations[i]);
+    }
+    EXPECT(store.GetParent(5) == transforms[5].parent);
+    EXPECT(store.GetEuler(7) == transforms[7].euler);
+
+    // Bounds under a few transforms each
+    const AABB LocalBounds = { glm::vec3(-1.0f, -2.0f, -0.5f), glm::vec3(3.0f, 1.0f, 0.5f) };
+    std::vector<std::vector<uint32_t>> boundsTransforms(200);
+    std::vector<uint32_t> boundsIndices;
+    for (std::vector<uint32_t>& boundsTransform : boundsTransforms) {
+        for (uint32_t i = 0; i < 1 + random() % 3; i++) {
+            boundsTransform.push_back(random() % TransformCount);
+        }
+        boundsIndices.push_back(store.AddBounds(LocalBounds, boundsTransform));
+    }
+
+    std::vector<glm::dmat4> reference = ReferenceWorldMatrices(transforms);
+
+    // Bounds from the eight corners of the box under each reference matrix
+    auto boundsErrors = [&]() {
+        uint32_t errors = 0;
+        for (size_t b = 0; b < boundsTransforms.size(); b++) {
+            glm::dvec3 expectedMin(DBL_MAX);
+            glm::dvec3 expectedMax(-DBL_MAX);
+            for (uint32_t transformIndex : boundsTransforms[b]) {
+                for (int corner = 0; corner < 8; corner++) {
+                    glm::dvec3 point(corner & 1 ? LocalBounds.max.x : LocalBounds.min.x, corner & 2 ? LocalBounds.max.y : LocalBounds.min.y, corner & 4 ? LocalBounds.max.z : LocalBounds.min.z);
+                    glm::dvec3 transformed = glm::dvec3(reference[transformIndex] * glm::dvec4(point, 1.0));
+                    expectedMin = glm::min(expectedMin, transformed);
+                    expectedMax = glm::max(expectedMax, transformed);
+                }
+            }
+            const AABB& bounds = store.WorldBounds(boundsIndices[b]);
+            double scale = std::max(1.0, std::max(glm::length(expectedMin), glm::length(expectedMax)));
+            errors += glm::length(glm::dvec3(bounds.min) - expectedMin) > Tolerance * scale ||
+                glm::length(glm::dvec3(bounds.max) - expectedMax) > Tolerance * scale;
+        }
+        return errors;
+    };
+
+    auto countErrors = [&](std::span<const uint32_t> indices) {
+        uint32_t errors = 0;
+        for (uint32_t i : indices) {
+            InstanceTransform uploaded = PackInstanceTransform(store.World(i));
+            errors += MatrixError(store.World(i), reference[i]) > Tolerance ||
+                memcmp(&destinations[i], &uploaded, sizeof(uploaded)) != 0;
+        }
+        return errors;
+    };
+    std::vector<uint32_t> all(TransformCount);
+    std::iota(all.begin(), all.end(), 0);
+
+    // Every path agrees with glm, and with each other
+    TransformStore::UpdateStats stats = store.Update(true);
+    EXPECT(stats.dirtyTransforms == TransformCount);
+    EXPECT(stats.uploadedTransforms == TransformCount);
+    EXPECT(stats.dirtyBounds == boundsTransforms.size());
+    EXPECT(countErrors(all) == 0);
+    EXPECT(boundsErrors() == 0);
+    std::vector<glm::mat4> simdWorld(store.WorldMatrices().begin(), store.WorldMatrices().end());
+
+    store.MarkAllDirty();
+    stats = store.Update(false);
+    EXPECT(stats.dirtyTransforms == TransformCount);
+    EXPECT(countErrors(all) == 0);
+    EXPECT(boundsErrors() == 0);
+    uint32_t pathMismatches = 0;
+    for (uint32_t i = 0; i < TransformCount; i++) {
+        pathMismatches += MatrixError(store.World(i), glm::dmat4(simdWorld[i])) > Tolerance;
+    }
+    EXPECT(pathMismatches == 0);
+
+    // Nothing changed, nothing is updated
+    stats = store.Update(true);
+    EXPECT(stats.dirtyTransforms == 0 && stats.uploadedTransforms == 0 && stats.dirtyBounds == 0);
+    EXPECT(store.UpdatedTransforms().empty());
+
+    // Clean transforms in a dirty batch are recomputed without being uploaded, which only gives
+    // what was uploaded on the same path, so everything is uploaded from the SIMD path first
+    store.MarkAllDirty();
+    store.Update();
+
+    // Changing a transform updates exactly it and its descendants, and only their destinations
+    // and bounds are written
+    for (int change = 0; change < 50; change++) {
+        uint32_t changed = random() % TransformCount;
+        TestTransform& transform = transforms[changed];
+        switch (change % 4) {
+        case 0:
+            transform.translation = glm::vec3(position(random), position(random), position(random));
+            store.SetTranslation(changed, transform.translation);
+            break;
+        case 1:
+            transform.euler = glm::vec3(angle(random), angle(random), angle(random));
+            store.SetEuler(changed, transform.euler);
+            break;
+        case 2:
+            transform.scale = glm::vec3(scale(random), scale(random), scale(random));
+            store.SetScale(changed, transform.scale);
+            break;
+        default:
+            transform.base = glm::translate(transform.base, glm::vec3(position(random)));
+            store.SetBase(changed, transform.base);
+            break;
+        }
+        reference = ReferenceWorldMatrices(transforms);
+
+        std::vector<uint8_t> isExpected(TransformCount, 0);
+        std::vector<uint32_t> expected;
+        for (uint32_t i = changed; i < TransformCount; i++) {
+            isExpected[i] = i == changed || (transforms[i].parent != TransformStore::InvalidIndex && isExpected[transforms[i].parent]);
+            if (isExpected[i]) {
+                expected.push_back(i);
+            }
+        }
+        uint32_t expectedBounds = 0;
+        for (const std::vector<uint32_t>& boundsTransform : boundsTransforms) {
+            expectedBounds += std::any_of(boundsTransform.begin(), boundsTransform.end(), [&](uint32_t i) { return isExpected[i]; });
+        }
+
+        std::vector<InstanceTransform> before(destinations.begin(), destinations.end());
+        stats = store.Update();
+        EXPECT(std::equal(store.UpdatedTransforms().begin(), store.UpdatedTransforms().end(), expected.begin(), expected.end()));
+        EXPECT(stats.uploadedTransforms == expected.size());
+        EXPECT(stats.dirtyBounds == expectedBounds);
+        EXPECT(countErrors(all) == 0);
+        EXPECT(boundsErrors() == 0);
+        uint32_t unexpectedWrites = 0;
+        for (uint32_t i = 0; i < TransformCount; i++) {
+            unexpectedWrites += !isExpected[i] && memcmp(&before[i], &destinations[i], sizeof(InstanceTransform)) != 0;
+        }
+        EXPECT(unexpectedWrites == 0);
+    }
+
+    // Freed transforms come back as identity roots
+    store.Free(10, 20);
+    EXPECT(store.Allocate(20) == 10);
+    EXPECT(store.GetParent(15) == TransformStore::InvalidIndex);
+    EXPECT(store.GetScale(15) == glm::vec3(1.0f));
+
+    // Timings of a full update of 100k transforms, half of them children of a nearby transform
+    const uint32_t BenchmarkCount = 100000;
+    const int Iterations = 20;
+    TransformStore benchmarkStore;
+    benchmarkStore.Allocate(BenchmarkCount);
+    AlignedVector<InstanceTransform> benchmarkDestinations(BenchmarkCount);
+    for (uint32_t i = 0; i < BenchmarkCount; i++) {
+        benchmarkStore.SetBase(i, glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random), position(random))));
+        benchmarkStore.SetTranslation(i, glm::vec3(position(random), position(random), position(random)));
+        benchmarkStore.SetEuler(i, glm::vec3(angle(random), angle(random), angle(random)));
+        benchmarkStore.SetScale(i, glm::vec3(scale(random), scale(random), scale(random)));
+        benchmarkStore.AddDestination(i, &benchmarkDestinations[i]);
+        if (i > 0 && random() % 2 == 0) {
+            benchmarkStore.SetParent(i, i - 1 - random() % std::min(i, 16u));
+        }
+    }
+    auto timeUpdate = [&](bool useSIMD) {
+        // The first update also builds the destination table
+        benchmarkStore.Update(useSIMD);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < Iterations; i++) {
+            benchmarkStore.MarkAllDirty();
+            benchmarkStore.Update(useSIMD);
+        }
+        return Milliseconds(std::chrono::steady_clock::now() - start) / Iterations;
+    };
+    float scalarMS = timeUpdate(false);
+    float simdMS = timeUpdate(true);
+    std::cout << BenchmarkCount << " transforms: " << simdMS << "ms SIMD, " << scalarMS << "ms scalar\n";
+}
+
+// Packing matches the row major layout, streaming matches packing, and the allocator hands out
+// disjoint ranges and merges them back together when they're freed
+static void InstanceData()
+{
+    std::mt19937 random(1);
+
+    constexpr uint32_t TransformCount = 1 << 16;
+    std::vector<glm::mat4> matrices(TransformCount);
+    for (glm::mat4& matrix : matrices) {
+        matrix = RandomTransform(random);
+    }
+
+    uint32_t layoutMismatches = 0;
+    uint32_t roundTripMismatches = 0;
+    for (const glm::mat4& matrix : matrices) {
+        InstanceTransform packed = PackInstanceTransform(matrix);
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 4; c++) {
+                layoutMismatches += packed.rows[r][c] != matrix[c][r];
+            }
+        }
+        glm::mat4 unpacked = UnpackInstanceTransform(packed);
+        roundTripMismatches += unpacked[0][3] != 0.0f || unpacked[1][3] != 0.0f || unpacked[2][3] != 0.0f || unpacked[3][3] != 1.0f;
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 3; r++) {
+                roundTripMismatches += unpacked[c][r] != matrix[c][r];
+            }
+        }
+    }
+    EXPECT(layoutMismatches == 0);
+    EXPECT(roundTripMismatches == 0);
+
+    std::vector<InstanceTransform> packed(TransformCount);
+    std::vector<InstanceTransform> streamed(TransformCount);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < TransformCount; i++) {
+        packed[i] = PackInstanceTransform(matrices[i]);
+    }
+    auto packEnd = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < TransformCount; i++) {
+        StreamInstanceTransform(matrices[i], &streamed[i]);
+    }
+    StreamFence();
+    auto streamEnd = std::chrono::steady_clock::now();
+    EXPECT(memcmp(packed.data(), streamed.data(), packed.size() * sizeof(InstanceTransform)) == 0);
+    std::cout << TransformCount << " transforms: " << Milliseconds(packEnd - start) << "ms packed, "
+        << Milliseconds(streamEnd - packEnd) << "ms streamed\n";
+
+    // First fit, and no range is handed out when none is large enough
+    RangeAllocator allocator(100);
+    EXPECT(allocator.Capacity() == 100);
+    uint32_t a = allocator.Allocate(30);
+    uint32_t b = allocator.Allocate(30);
+    uint32_t c = allocator.Allocate(30);
+    EXPECT(a == 0 && b == 30 && c == 60);
+    EXPECT(allocator.Used() == 90);
+    EXPECT(allocator.Allocate(11) == RangeAllocator::InvalidIndex);
+
+    // A hole is reused before the tail
+    allocator.Free(b, 30);
+    EXPECT(allocator.Allocate(40) == RangeAllocator::InvalidIndex);
+    EXPECT(allocator.Allocate(10) == 30);
+    allocator.Free(30, 10);
+
+    // Freeing the neighbours of a hole merges all three, from either side
+    allocator.Free(a, 30);
+    EXPECT(allocator.Allocate(60) == 0);
+    allocator.Free(0, 60);
+    allocator.Free(c, 30);
+    EXPECT(allocator.Used() == 0);
+    EXPECT(allocator.Allocate(100) == 0);
+    allocator.Free(0, 100);
+
+    // Random allocations and frees against a map of which slots are taken
+    constexpr uint32_t Capacity = 4096;
+    RangeAllocator stress(Capacity);
+    std::vector<bool> taken(Capacity, false);
+    std::vector<std::pair<uint32_t, uint32_t>> live;
+    uint32_t overlaps = 0;
+    uint32_t usedMismatches = 0;
+    uint32_t takenCount = 0;
+    for (uint32_t i = 0; i < 20000; i++) {
+        if (live.empty() || random() % 3 != 0) {
+            uint32_t count = 1 + random() % 64;
+            uint32_t first = stress.Allocate(count);
+            if (first == RangeAllocator::InvalidIndex) {
+                continue;
+            }
+            for (uint32_t slot = first; slot < first + count; slot++) {
+                overlaps += slot >= Capacity || taken[slot];
+                if (slot < Capacity) {
+                    taken[slot] = true;
+                }
+            }
+            takenCount += count;
+            live.emplace_back(first, count);
+        } else {
+            size_t index = random() % live.size();
+            auto [first, count] = live[index];
+            live[index] = live.back();
+            live.pop_back();
+            for (uint32_t slot = first; slot < first + count; slot++) {
+                taken[slot] = false;
+            }
+            takenCount -= count;
+            stress.Free(first, count);
+        }
+        usedMismatches += stress.Used() != takenCount;
+    }
+    EXPECT(overlaps == 0);
+    EXPECT(usedMismatches == 0);
+
+    for (auto [first, count] : live) {
+        stress.Free(first, count);
+    }
+    EXPECT(stress.Used() == 0);
+    EXPECT(stress.Allocate(Capacity) == 0);
+}
+
+// Clusters that don't list exactly the same lights, in the same order, as the reference
+static uint32_t CountMismatchedClusters(const LightClusterBuilder& builder, const std::vector<glm::uvec2>& referenceClusters, const std::vector<uint32_t>& referenceIndices)
+{
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < LightClusterCount; i++) {
+        glm::uvec2 cluster = builder.Clusters()[i];
+        glm::uvec2 reference = referenceClusters[i];
+        bool equal = cluster.y == reference.y && std::equal(
+            builder.LightIndices().begin() + cluster.x,
+            builder.LightIndices().begin() + cluster.x + cluster.y,
+            referenceIndices.begin() + reference.x
+        );
+        mismatches += !equal;
+    }
+    return mismatches;
+}
+
+// Builds a KTX2 file with one level index entry per level and the levels' bytes after a 44 byte
+// data format descriptor, whose color model is at byte 12 as in a Basis Universal file
+static std::vector<uint8_t> MakeKTX2(uint32_t vkFormat, uint32_t width, uint32_t height, const std::vector<uint32_t>& levelSizes,
+    uint32_t supercompression = 0, uint8_t colorModel = 0)
+{
+    const uint8_t Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    const uint32_t HeaderSize = 80;
+    const uint32_t DFDSize = 44;
+
+    uint32_t dfdOffset = HeaderSize + (uint32_t)levelSizes.size() * 24;
+    uint32_t header[17] = { vkFormat, 1, width, height, 0, 0, 1, (uint32_t)levelSizes.size(), supercompression, dfdOffset, DFDSize, 0, 0 };
+    std::vector<uint8_t> file(dfdOffset + DFDSize);
+    memcpy(file.data(), Identifier, sizeof(Identifier));
+    memcpy(file.data() + sizeof(Identifier), header, sizeof(header));
+    file[dfdOffset + 12] = colorModel;
+
+    for (size_t level = 0; level < levelSizes.size(); level++) {
+        uint64_t index[3] = { file.size(), levelSizes[level], levelSizes[level] };
+        memcpy(file.data() + HeaderSize + level * sizeof(index), index, sizeof(index));
+        for (uint32_t i = 0; i < levelSizes[level]; i++) {
+            file.push_back((uint8_t)(level * 16 + i));
+        }
+    }
+    return file;
+}
+
+// Parses KTX2 headers of the formats that upload as stored, and rejects the ones that can't be used
+static void KTX2()
+{
+    KTX2Image image;
+    std::string error;
+
+    // 8x8 BC7 sRGB with its full chain, the last 3 levels are a single block each
+    std::vector<uint8_t> bc7 = MakeKTX2(146, 8, 8, { 64, 16, 16, 16 });
+    EXPECT(IsKTX2(bc7));
+    EXPECT(ParseKTX2(bc7, image, error));
+    EXPECT(image.format == KTX2Format::BC7 && image.isSRGB && image.width == 8 && image.height == 8);
+    EXPECT(image.levels.size() == 4);
+    uint64_t expectedOffset = 80 + 4 * 24 + 44;
+    for (size_t level = 0; level < image.levels.size(); level++) {
+        const KTX2Level& ktxLevel = image.levels[level];
+        EXPECT(ktxLevel.width == std::max(8u >> level, 1u) && ktxLevel.height == std::max(8u >> level, 1u));
+        EXPECT((uint64_t)(ktxLevel.data.data() - bc7.data()) == expectedOffset && ktxLevel.data[0] == level * 16);
+        EXPECT(ktxLevel.data.size() == (size_t)KTX2RowBytes(image.format, ktxLevel.width) * KTX2RowCount(image.format, ktxLevel.height));
+        expectedOffset += ktxLevel.data.size();
+    }
+
+    // RGBA8 doesn't need whole blocks, and 0 levels stores just the base level
+    EXPECT(ParseKTX2(MakeKTX2(37, 5, 3, { 60, 8 }), image, error));
+    EXPECT(image.format == KTX2Format::RGBA8 && !image.isSRGB && image.levels.size() == 2 && image.levels[1].width == 2 && image.levels[1].height == 1);
+    std::vector<uint8_t> baseOnly = MakeKTX2(139, 4, 4, { 8 });
+    uint32_t noLevels = 0;
+    memcpy(baseOnly.data() + 40, &noLevels, sizeof(noLevels));
+    EXPECT(ParseKTX2(baseOnly, image, error));
+    EXPECT(image.format == KTX2Format::BC4 && image.levels.size() == 1);
+
+    // Every prefix of a valid file is truncated somewhere
+    uint32_t acceptedPrefixes = 0;
+    for (size_t size = 0; size < bc7.size(); size++) {
+        acceptedPrefixes += ParseKTX2(std::span(bc7.data(), size), image, error);
+    }
+    EXPECT(acceptedPrefixes == 0);
+    EXPECT(!ParseKTX2(std::span(bc7.data(), 79), image, error) && error == "not a KTX2 file");
+
+    // Basis Universal payloads have no VkFormat and say which codec they are in the descriptor
+    EXPECT(!ParseKTX2(MakeKTX2(0, 8, 8, { 100 }, 0, 166), image, error) && error.find("UASTC") != std::string::npos);
+    EXPECT(!ParseKTX2(MakeKTX2(0, 8, 8, { 100 }, 1, 163), image, error) && error.find("ETC1S") != std::string::npos);
+    EXPECT(!ParseKTX2(MakeKTX2(0, 8, 8, { 100 }, 1, 0), image, error) && error.find("ETC1S") != std::string::npos);
+    EXPECT(!ParseKTX2(MakeKTX2(0, 8, 8, { 100 }), image, error) && error == "no VkFormat");
+    EXPECT(!ParseKTX2(MakeKTX2(145, 8, 8, { 40 }, 2), image, error) && error.find("zstd") != std::string::npos);
+
+    // Formats and shapes D3D12 can't take as stored
+    EXPECT(!ParseKTX2(MakeKTX2(145, 6, 6, { 64 }), image, error) && error.find("multiple of 4") != std::string::npos);
+    EXPECT(!ParseKTX2(MakeKTX2(97, 4, 4, { 128 }), image, error) && error.find("VkFormat 97") != std::string::npos);
+    EXPECT(!ParseKTX2(MakeKTX2(145, 8, 8, { 64, 16, 15 }), image, error) && error.find("level 2") != std::string::npos);
+    std::vector<uint8_t> cube = MakeKTX2(145, 8, 8, { 64 });
+    uint32_t faces = 6;
+    memcpy(cube.data() + 36, &faces, sizeof(faces));
+    EXPECT(!ParseKTX2(cube, image, error) && error == "only 2D textures are supported");
+    std::vector<uint8_t> notKTX = bc7;
+    notKTX[1] = 'k';
+    EXPECT(!IsKTX2(notKTX) && !ParseKTX2(notKTX, image, error));
+}
+
+// Bins 16k lights with every build path and checks each against the brute force reference,
+// with the app's default camera
+static void LightClusters()
+{
+    const uint32_t LightCount = 16384;
+    const int Iterations = 20;
+
+    LightClusterBuilder builder;
+    const float nearZ = 0.1f;
+    const float farZ = 1000.0f;
+    glm::mat4 projection = glm::perspective(glm::pi<float>() * 0.2f, 16.0f / 9.0f, nearZ, farZ);
+    builder.SetProjection(projection, nearZ, farZ);
+
+    // Scattered in front of the camera with a few behind it, then a second set around the
+    // camera with large radii, so lights straddle the near plane and cover whole slices
+    std::mt19937 random(1337);
+    std::uniform_real_distribution<float> spread(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> depth(-300.0f, 10.0f);
+    std::uniform_real_distribution<float> radius(0.5f, 10.0f);
+    std::uniform_real_distribution<float> near(-5.0f, 5.0f);
+    std::uniform_real_distribution<float> largeRadius(1.0f, 20.0f);
+
+    std::vector<glm::vec4> scattered(LightCount);
+    std::vector<glm::vec4> surrounding(256);
+    for (glm::vec4& sphere : scattered) {
+        sphere = glm::vec4(spread(random), spread(random) * 0.25f, depth(random), radius(random));
+    }
+    for (glm::vec4& sphere : surrounding) {
+        sphere = glm::vec4(near(random), near(random), near(random), largeRadius(random));
+    }
+
+    for (const std::vector<glm::vec4>* viewSpheres : { &scattered, &surrounding }) {
+        std::vector<uint32_t> lightIds(viewSpheres->size());
+        for (uint32_t i = 0; i < lightIds.size(); i++) {
+            lightIds[i] = i;
+        }
+
+        auto referenceStart = std::chrono::steady_clock::now();
+        builder.BuildReference(*viewSpheres, lightIds);
+        auto referenceEnd = std::chrono::steady_clock::now();
+        std::vector<glm::uvec2> referenceClusters = builder.Clusters();
+        std::vector<uint32_t> referenceIndices = builder.LightIndices();
+        EXPECT(builder.Overflow() == 0);
+
+        auto timeBuild = [&](bool useSIMD, uint32_t threadCount) {
+            builder.Build(*viewSpheres, lightIds, useSIMD, threadCount);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < Iterations; i++) {
+                builder.Build(*viewSpheres, lightIds, useSIMD, threadCount);
+            }
+            auto end = std::chrono::steady_clock::now();
+            EXPECT(CountMismatchedClusters(builder, referenceClusters, referenceIndices) == 0);
+            return Milliseconds(end - start) / Iterations;
+        };
+
+        float scalarMS = timeBuild(false, 1);
+        float simdMS = timeBuild(true, 1);
+        float threadedMS = timeBuild(true, 0);
+
+        std::cout << viewSpheres->size() << " lights, " << builder.VisibleLights().size() << " visible, "
+            << builder.LightIndices().size() << " references: "
+            << threadedMS << "ms SIMD threaded, " << simdMS << "ms SIMD, " << scalarMS << "ms scalar, "
+            << Milliseconds(referenceEnd - referenceStart) << "ms brute force\n";
+    }
+}
+
+// RadixSort on a copy of items against std::stable_sort, returns the number of misplaced items
+static uint32_t CountRadixSortMismatches(const std::vector<SortItem>& items, uint32_t threadCount)
+{
+    std::vector<SortItem> sorted = items;
+    std::vector<SortItem> scratch;
+    RadixSort(sorted, scratch, threadCount);
+
+    std::vector<SortItem> reference = items;
+    std::stable_sort(reference.begin(), reference.end(), [](const SortItem& a, const SortItem& b) {
+        return a.key < b.key;
+    });
+
+    uint32_t mismatches = (uint32_t)(std::max(sorted.size(), reference.size()) - std::min(sorted.size(), reference.size()));
+    for (size_t i = 0; i < std::min(sorted.size(), reference.size()); i++) {
+        mismatches += sorted[i].key != reference[i].key || sorted[i].value != reference[i].value;
+    }
+    return mismatches;
+}
+
+// Sorts with several thread counts and checks every result is stable and matches
+// std::stable_sort, with sizes on both sides of the threading threshold and keys that skip passes
+static void RadixSortTest()
+{
+    std::mt19937 random(34);
+
+    // Values are the original positions, so any reordering of equal keys shows up
+    auto makeItems = [](uint32_t count, auto&& key) {
+        std::vector<SortItem> items(count);
+        for (uint32_t i = 0; i < count; i++) {
+            items[i] = { key(i), i };
+        }
+        return items;
+    };
+
+    const uint32_t threadCounts[] = { 0, 1, 2, 3, 8 };
+    // Empty, single items, fewer than one thread's worth, and several threads' worth with an uneven split
+    const uint32_t counts[] = { 0, 1, 2, 1000, 16383, 3 * 16384 + 7, 200003 };
+    for (uint32_t count : counts) {
+        std::vector<std::vector<SortItem>> inputs = {
+            // Many duplicates
+            makeItems(count, [&](uint32_t) { return (uint32_t)(random() % 1000); }),
+            makeItems(count, [&](uint32_t) { return (uint32_t)random(); }),
+            // Every pass is skipped
+            makeItems(count, [](uint32_t) { return 0xABCDEF01u; }),
+            // Only the top byte differs, so three passes are skipped and the result lands in scratch
+            makeItems(count, [&](uint32_t) { return (uint32_t)(random() % 7) << 24 | 0x123456u; }),
+            // Already sorted, and reversed
+            makeItems(count, [](uint32_t i) { return i; }),
+            makeItems(count, [&](uint32_t i) { return count - i; }),
+        };
+        for (const std::vector<SortItem>& items : inputs) {
+            for (uint32_t threadCount : threadCounts) {
+                EXPECT(CountRadixSortMismatches(items, threadCount) == 0);
+            }
+        }
+    }
+
+    // Depths either side of zero, back to front as the transparent pass sorts them
+    std::uniform_real_distribution<float> depth(-1000.0f, 1000.0f);
+    std::vector<float> depths(100000);
+    for (float& value : depths) {
+        value = random() % 100 == 0 ? 0.0f : depth(random);
+    }
+    depths[0] = -0.0f;
+    depths[1] = -FLT_MAX;
+    depths[2] = FLT_MAX;
+    depths[3] = -FLT_MIN;
+    std::vector<SortItem> items = makeItems((uint32_t)depths.size(), [&](uint32_t i) { return ~FloatToSortKey(depths[i]); });
+    for (uint32_t threadCount : threadCounts) {
+        EXPECT(CountRadixSortMismatches(items, threadCount) == 0);
+    }
+    std::vector<SortItem> scratch;
+    RadixSort(items, scratch);
+    uint32_t misordered = 0;
+    for (size_t i = 1; i < items.size(); i++) {
+        misordered += depths[items[i - 1].value] < depths[items[i].value];
+    }
+    EXPECT(misordered == 0);
+
+    // Timings for a million depths
+    const uint32_t BenchmarkCount = 1 << 20;
+    std::vector<SortItem> benchmarkItems = makeItems(BenchmarkCount, [&](uint32_t) { return ~FloatToSortKey(depth(random)); });
+    std::vector<SortItem> reference = benchmarkItems;
+    auto start = std::chrono::steady_clock::now();
+    RadixSort(benchmarkItems, scratch);
+    auto radixEnd = std::chrono::steady_clock::now();
+    std::stable_sort(reference.begin(), reference.end(), [](const SortItem& a, const SortItem& b) {
+        return a.key < b.key;
+    });
+    auto stdEnd = std::chrono::steady_clock::now();
+    EXPECT(memcmp(benchmarkItems.data(), reference.data(), BenchmarkCount * sizeof(SortItem)) == 0);
+    std::cout << BenchmarkCount << " items: " << Milliseconds(radixEnd - start) << "ms radix, "
+        << Milliseconds(stdEnd - radixEnd) << "ms std::stable_sort\n";
+}
+
+// Drives BLASBuildScheduler with synthetic queues, checking it issues builds visible first then
+// nearest first, keeps batches within the budget, and eventually issues builds that keep being
+// skipped for not fitting
+static void BLASScheduler()
+{
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> distance(0.0f, 1000.0f);
+
+    std::vector<BLASBuildScheduler::Priority> priorities;
+    auto priorityOf = [&](uint32_t id) {
+        return priorities[id];
+    };
+
+    // Builds that always fit come out in priority order, queue order breaking ties
+    {
+        BLASBuildScheduler scheduler;
+        priorities.clear();
+        for (uint32_t id = 0; id < 200; id++) {
+            // Some equal distances so ties happen
+            priorities.push_back({ random() % 2 == 0, (float)(random() % 50) });
+            scheduler.Enqueue(id, 100);
+        }
+        EXPECT(scheduler.PendingCount() == 200);
+        EXPECT(scheduler.PendingTriangles() == 200 * 100);
+
+        std::vector<uint32_t> expected(priorities.size());
+        std::iota(expected.begin(), expected.end(), 0);
+        std::stable_sort(expected.begin(), expected.end(), [&](uint32_t a, uint32_t b) {
+            if (priorities[a].visible != priorities[b].visible) {
+                return priorities[a].visible;
+            }
+            return priorities[a].distance < priorities[b].distance;
+        });
+
+        BLASBuildScheduler::Budget budget;
+        budget.builds = 16;
+        std::vector<uint32_t> issued;
+        while (scheduler.PendingCount() > 0) {
+            std::vector<uint32_t> batch = scheduler.NextBatch(budget, priorityOf);
+            EXPECT(batch.size() == std::min(16u, (uint32_t)expected.size() - (uint32_t)issued.size()));
+            issued.insert(issued.end(), batch.begin(), batch.end());
+        }
+        EXPECT(issued == expected);
+        EXPECT(scheduler.PendingTriangles() == 0);
+    }
+
+    // Random sizes, some larger than the whole budget, with builds removed before they're issued
+    {
+        BLASBuildScheduler scheduler;
+        priorities.clear();
+        std::vector<uint32_t> triangleCounts;
+        std::uniform_int_distribution<uint32_t> triangleCount(1000, 400000);
+        for (uint32_t id = 0; id < 500; id++) {
+            priorities.push_back({ random() % 4 == 0, distance(random) });
+            triangleCounts.push_back(id % 50 == 0 ? 1500000 : triangleCount(random));
+            scheduler.Enqueue(id, triangleCounts.back());
+        }
+        std::vector<uint32_t> issueCount(priorities.size(), 0);
+        for (uint32_t id = 1; id < priorities.size(); id += 97) {
+            scheduler.Remove(id);
+            issueCount[id] = 1;
+        }
+
+        BLASBuildScheduler::Budget budget;
+        uint32_t overBudget = 0;
+        uint32_t batches = 0;
+        while (scheduler.PendingCount() > 0 && batches < 10000) {
+            std::vector<uint32_t> batch = scheduler.NextBatch(budget, priorityOf);
+            uint64_t triangles = 0;
+            for (uint32_t id : batch) {
+                triangles += triangleCounts[id];
+                issueCount[id]++;
+            }
+            EXPECT(!batch.empty() && batch.size() <= budget.builds);
+            overBudget += batch.size() > 1 && triangles > budget.triangles;
+            batches++;
+        }
+        EXPECT(overBudget == 0);
+        EXPECT(std::all_of(issueCount.begin(), issueCount.end(), [](uint32_t count) { return count == 1; }));
+        EXPECT(scheduler.PendingTriangles() == 0);
+    }
+
+    // A far off build that never fits alongside the nearer builds streaming in every frame
+    {
+        BLASBuildScheduler scheduler;
+        BLASBuildScheduler::Budget budget;
+        budget.maxSkips = 8;
+
+        const uint32_t LargeBuilds = 2;
+        priorities.clear();
+        priorities.push_back({ false, 1000.0f });
+        priorities.push_back({ true, 500.0f });
+        scheduler.Enqueue(0, 3000000);
+        scheduler.Enqueue(1, 600000);
+
+        std::vector<uint32_t> issuedFrame(LargeBuilds, UINT32_MAX);
+        for (uint32_t frame = 0; frame < 100; frame++) {
+            for (uint32_t i = 0; i < 10; i++) {
+                scheduler.Enqueue((uint32_t)priorities.size(), 60000);
+                priorities.push_back({ true, distance(random) * 0.1f });
+            }
+            for (uint32_t id : scheduler.NextBatch(budget, priorityOf)) {
+                if (id < LargeBuilds) {
+                    issuedFrame[id] = frame;
+                }
+            }
+        }
+        for (uint32_t frame : issuedFrame) {
+            EXPECT(frame <= budget.maxSkips + 1);
+        }
+        std::cout << "Builds skipped for the budget issued after " << issuedFrame[0] << " and " << issuedFrame[1] << " frames\n";
+    }
+}
+
+// Descs that don't hold their instance's BLAS, id and current world matrix
+static uint32_t CountStaleInstanceDescs(std::span<const TLASInstanceSource> instances, const TransformStore& transforms, const TLASInstanceDesc* descs)
+{
+    uint32_t stale = 0;
+    for (uint32_t i = 0; i < (uint32_t)instances.size(); i++) {
+        InstanceTransform transform = PackInstanceTransform(transforms.World(instances[i].transformIndex));
+        stale += descs[i].accelerationStructure != instances[i].blasAddress ||
+            (descs[i].instanceIdAndMask & 0xFFFFFF) != i ||
+            memcmp(&descs[i].transform, &transform, sizeof(transform)) != 0;
+    }
+    return stale;
+}
+
+// Drives TLASInstanceSet with a TransformStore's updates, checking each kind of build is picked
+// when it should be and the descs always match the scene
+static void TLAS()
+{
+    TransformStore transforms;
+    const uint32_t TransformCount = 64;
+    uint32_t firstTransform = transforms.Allocate(TransformCount);
+
+    // Two BLASes per transform, like a mesh of two primitives, and some transforms without instances
+    std::vector<TLASInstanceSource> instances;
+    for (uint32_t t = firstTransform; t < firstTransform + TransformCount; t += 2) {
+        instances.push_back({ 0x1000, t });
+        instances.push_back({ 0x2000, t });
+    }
+    std::vector<TLASInstanceDesc> descs(instances.size() * 2);
+
+    TLASInstanceSet set;
+    auto update = [&](std::span<const TLASInstanceSource> updateInstances) {
+        transforms.Update();
+        return set.Update(updateInstances, transforms.WorldMatrices(), transforms.UpdatedTransforms(), descs.data());
+    };
+
+    // The first update writes everything
+    TLASInstanceSet::UpdateResult result = update(instances);
+    EXPECT(result.kind == TLASInstanceSet::BuildKind_Rebuild);
+    EXPECT(result.patchedInstances == instances.size());
+    EXPECT(set.Count() == instances.size());
+    EXPECT(CountStaleInstanceDescs(instances, transforms, descs.data()) == 0);
+
+    // Nothing moved
+    result = update(instances);
+    EXPECT(result.kind == TLASInstanceSet::BuildKind_None);
+    EXPECT(result.patchedInstances == 0);
+
+    // Moving a transform patches both of its instances, moving one with no instances patches nothing
+    transforms.SetTranslation(firstTransform + 4, glm::vec3(1.0f, 2.0f, 3.0f));
+    result = update(instances);
+    EXPECT(result.kind == TLASInstanceSet::BuildKind_Refit);
+    EXPECT(result.patchedInstances == 2);
+    EXPECT(CountStaleInstanceDescs(instances, transforms, descs.data()) == 0);
+
+    transforms.SetTranslation(firstTransform + 5, glm::vec3(1.0f, 2.0f, 3.0f));
+    result = update(instances);
+    EXPECT(result.kind == TLASInstanceSet::BuildKind_None);
+
+    // Moving a parent moves its children through the hierarchy
+    transforms.SetParent(firstTransform + 10, firstTransform + 8);
+    transforms.SetParent(firstTransform + 12, firstTransform + 10);
+    update(instances);
+    transforms.SetEuler(firstTransform + 8, glm::vec3(0.5f, 0.0f, 0.0f));
+    result = update(instances);
+    EXPECT(result.kind == TLASInstanceSet::BuildKind_Refit);
+    EXPECT(result.patchedInstances == 6);
+    EXPECT(CountStaleInstanceDescs(instances, transforms, descs.data()) == 0);
+
+    // Refits degrade the TLAS, so every so often one becomes a rebuild
+    uint32_t rebuilds = 0;
+    for (uint32_t frame = 0; frame < TLASInstanceSet::RefitsBeforeRebuild * 2; frame++) {
+        transforms.SetScale(firstTransform, glm::vec3(1.0f + frame * 0.01f));
+        result = update(instances);
+        EXPECT(result.kind != TLASInstanceSet::BuildKind_None);
+        rebuilds += result.kind == TLASInstanceSet::BuildKind_Rebuild;
+    }
+    EXPECT(rebuilds == 2);
+    EXPECT(CountStaleInstanceDescs(instances, transforms, descs.data()) == 0);
+
+    // A different BLAS, a different transform, or a new instance rebuilds
+    instances[3].blasAddress = 0x3000;
+    EXPECT(update(instances).kind == TLASInstanceSet::BuildKind_Rebuild);
+    instances[3].transformIndex = firstTransform + 1;
+    EXPECT(update(instances).kind == TLASInstanceSet::BuildKind_Rebuild);
+    EXPECT(CountStaleInstanceDescs(instances, transforms, descs.data()) == 0);
+    transforms.SetTranslation(firstTransform + 1, glm::vec3(-1.0f));
+    result = update(instances);
+    EXPECT(result.kind == TLASInstanceSet::BuildKind_Refit);
+    EXPECT(result.patchedInstances == 1);
+    instances.push_back({ 0x1000, firstTransform + 3 });
+    EXPECT(update(instances).kind == TLASInstanceSet::BuildKind_Rebuild);
+    EXPECT(CountStaleInstanceDescs(instances, transforms, descs.data()) == 0);
+
+    // Transforms allocated after the last rebuild have no instances yet
+    uint32_t newTransform = transforms.Allocate(1);
+    transforms.SetTranslation(newTransform, glm::vec3(5.0f));
+    EXPECT(update(instances).kind == TLASInstanceSet::BuildKind_None);
+
+    // Invalidating rewrites everything
+    std::fill(descs.begin(), descs.end(), TLASInstanceDesc{});
+    set.Invalidate();
+    result = update(instances);
+    EXPECT(result.kind == TLASInstanceSet::BuildKind_Rebuild);
+    EXPECT(CountStaleInstanceDescs(instances, transforms, descs.data()) == 0);
+
+    // Losing every instance rebuilds an empty TLAS rather than leaving the old one bound, once
+    result = update({});
+    EXPECT(result.kind == TLASInstanceSet::BuildKind_Rebuild);
+    EXPECT(result.patchedInstances == 0);
+    EXPECT(set.Count() == 0);
+    transforms.SetTranslation(firstTransform, glm::vec3(2.0f));
+    EXPECT(update({}).kind == TLASInstanceSet::BuildKind_None);
+    EXPECT(update(instances).kind == TLASInstanceSet::BuildKind_Rebuild);
+    EXPECT(CountStaleInstanceDescs(instances, transforms, descs.data()) == 0);
+}
+
+// HashContent is XXH3_128bits, checked against the reference implementation's outputs
+static void ContentHashTest()
+{
+    std::vector<uint8_t> data(2048 + 64);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 131 + 7);
+    }
+
+    // From the xxhash Python package, xxh3_128(data[:length]), low then high 64 bits
+    const struct
+    {
+        size_t length;
+        uint64_t low;
+        uint64_t high;
+    } vectors[] = {
+        { 0, 0x6001c324468d497full, 0x99aa06d3014798d8ull },
+        { 1, 0x4c5cca45d0f4811full, 0x495b62073ef70ca4ull },
+        { 3, 0x6e3e2670e61106acull, 0x390cdc5b4a895dd7ull },
+        { 4, 0x3d668af6f2a44d77ull, 0xaa6e2f274640a3f4ull },
+        { 8, 0x61ddbe7f31a6100dull, 0x6a86a3bda6af4e3dull },
+        { 9, 0x8c7b67fd458a936bull, 0x664c7ca18afd6255ull },
+        { 16, 0xe2ce54a7c19c730dull, 0x7f9a218b0425449aull },
+        { 17, 0x8d96ef110fcdebb4ull, 0x66fc23f6439dbd77ull },
+        { 128, 0xff361dec1385710aull, 0xaec730751478556cull },
+        { 129, 0x4545b3a09738e31aull, 0x98cd36ccbb557926ull },
+        { 240, 0x3f2c53e72293711full, 0x5293e17bf553903dull },
+        { 241, 0x956cae592c67279eull, 0xb53840fe3fedf161ull },
+        { 1024, 0x70bd377d9574f4bbull, 0xf69630613f24324dull },
+        { 2048, 0x8b46caa67dab3a30ull, 0x56b77f207158a2baull },
+    };
+    for (const auto& vector : vectors) {
+        EXPECT(HashContent(data.data(), vector.length) == (ContentHash{ vector.low, vector.high }));
+    }
+    EXPECT(HashContent(data.data(), 2048, 0x123456789) == (ContentHash{ 0xdf63f70fdf22fdbaull, 0x6b61e34c5ae1ccf4ull }));
+    EXPECT(HashContent(nullptr, 0).ToHex() == "99aa06d3014798d86001c324468d497f");
+    ContentHash empty = HashContent(nullptr, 0);
+    EXPECT(HashContent32(nullptr, 0) == (uint32_t)(empty.low ^ (empty.low >> 32)));
+
+    // Only the bytes matter, not where they are
+    uint32_t misalignedMismatches = 0;
+    for (size_t offset = 1; offset < 64; offset++) {
+        std::vector<uint8_t> shifted(data.size() + offset);
+        memcpy(shifted.data() + offset, data.data(), data.size());
+        for (size_t length = 0; length <= 2048; length += offset) {
+            misalignedMismatches += HashContent(shifted.data() + offset, length) != HashContent(data.data(), length);
+        }
+    }
+    EXPECT(misalignedMismatches == 0);
+
+    const size_t Size = 256ull * 1024 * 1024;
+    std::vector<uint64_t> large(Size / sizeof(uint64_t));
+    std::mt19937_64 random(49);
+    for (uint64_t& value : large) {
+        value = random();
+    }
+    auto start = std::chrono::steady_clock::now();
+    ContentHash hash = HashContent(large.data(), Size);
+    float ms = Milliseconds(std::chrono::steady_clock::now() - start);
+    EXPECT(hash != HashContent(large.data(), Size - 1));
+    std::cout << Size / (1024 * 1024) << "MB: " << ms << "ms, " << Size / (ms * 1e6) << " GB/s\n";
+}
+
+// Nearest hit of a ray against every triangle, with the same test as CPUBVH
+static float ClosestHitReference(std::span<const glm::vec3> positions, std::span<const uint32_t> indices, const glm::vec3& origin, const glm::vec3& direction)
+{
+    float closest = FLT_MAX;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        glm::vec3 v0 = positions[indices[i]];
+        glm::vec3 edge1 = positions[indices[i + 1]] - v0;
+        glm::vec3 edge2 = positions[indices[i + 2]] - v0;
+        glm::vec3 p = glm::cross(direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (determinant == 0.0f) {
+            continue;
+        }
+        float inverseDeterminant = 1.0f / determinant;
+        glm::vec3 s = origin - v0;
+        float u = glm::dot(s, p) * inverseDeterminant;
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(direction, q) * inverseDeterminant;
+        float t = glm::dot(edge2, q) * inverseDeterminant;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < closest) {
+            closest = t;
+        }
+    }
+    return closest;
+}
+
+// Builds a BVH over a procedural scene and traces a million shadow rays through it, checking
+// packet traversal against single rays, both against brute force, and closest hits against
+// brute force too
+static void CPUBVHTest()
+{
+    const int GridSize = 256;
+    const int BoxCount = 20000;
+    const uint32_t RaysPerSide = 1024;
+
+    // Rolling terrain with boxes scattered over it
+    auto terrainHeight = [](float x, float z) {
+        return sinf(x * 0.1f) * cosf(z * 0.1f);
+    };
+
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+    for (int z = 0; z <= GridSize; z++) {
+        for (int x = 0; x <= GridSize; x++) {
+            positions.push_back(glm::vec3(x - GridSize * 0.5f, terrainHeight((float)x, (float)z), z - GridSize * 0.5f));
+        }
+    }
+    for (int z = 0; z < GridSize; z++) {
+        for (int x = 0; x < GridSize; x++) {
+            uint32_t a = z * (GridSize + 1) + x;
+            uint32_t b = a + GridSize + 1;
+            indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+        }
+    }
+
+    std::mt19937 random(1337);
+    std::uniform_real_distribution<float> spread(-GridSize * 0.5f, GridSize * 0.5f);
+    std::uniform_real_distribution<float> halfSize(0.25f, 2.0f);
+    const uint32_t BoxIndices[36] = { 0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1, 2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3 };
+    for (int i = 0; i < BoxCount; i++) {
+        glm::vec3 center(spread(random), 2.0f, spread(random));
+        float extent = halfSize(random);
+        uint32_t base = (uint32_t)positions.size();
+        for (int corner = 0; corner < 8; corner++) {
+            positions.push_back(center + glm::vec3(corner & 1 ? extent : -extent, corner & 2 ? extent : -extent, corner & 4 ? extent : -extent));
+        }
+        for (uint32_t index : BoxIndices) {
+            indices.push_back(base + index);
+        }
+    }
+
+    // One shadow ray per point of a grid laid over the terrain, towards a low sun
+    glm::vec3 toLight = glm::normalize(glm::vec3(0.3f, 1.0f, 0.2f));
+    RaySoA rays;
+    for (uint32_t z = 0; z < RaysPerSide; z++) {
+        for (uint32_t x = 0; x < RaysPerSide; x++) {
+            float gridX = (float)x / RaysPerSide * GridSize;
+            float gridZ = (float)z / RaysPerSide * GridSize;
+            glm::vec3 origin(gridX - GridSize * 0.5f, terrainHeight(gridX, gridZ) + 0.01f, gridZ - GridSize * 0.5f);
+            rays.Push(origin, toLight, 0.0f, FLT_MAX);
+        }
+    }
+    rays.Pad();
+
+    // The threaded build is checked by tracing against it, the single threaded one by comparing results
+    CPUBVH singleThreadBVH;
+    CPUBVH bvh;
+    auto buildStart = std::chrono::steady_clock::now();
+    singleThreadBVH.Build(positions, indices, 1);
+    auto singleThreadEnd = std::chrono::steady_clock::now();
+    bvh.Build(positions, indices, 0);
+    auto threadedEnd = std::chrono::steady_clock::now();
+    EXPECT(bvh.TriangleCount() == indices.size() / 3);
+
+    std::vector<uint8_t> packetResults(rays.count);
+    std::vector<uint8_t> scalarResults(rays.count);
+    std::vector<uint8_t> singleThreadResults(rays.count);
+
+    auto packetStart = std::chrono::steady_clock::now();
+    bvh.OccludedPacket(rays, packetResults, true);
+    auto packetEnd = std::chrono::steady_clock::now();
+    bvh.OccludedPacket(rays, scalarResults, false);
+    auto scalarEnd = std::chrono::steady_clock::now();
+    singleThreadBVH.OccludedPacket(rays, singleThreadResults, true);
+
+    uint32_t packetMismatches = 0;
+    uint32_t buildMismatches = 0;
+    uint32_t occluded = 0;
+    for (uint32_t i = 0; i < rays.count; i++) {
+        occluded += packetResults[i];
+        packetMismatches += packetResults[i] != scalarResults[i];
+        buildMismatches += packetResults[i] != singleThreadResults[i];
+    }
+    EXPECT(packetMismatches == 0);
+    EXPECT(buildMismatches == 0);
+    // Both outcomes have to be exercised for the comparison to mean anything
+    EXPECT(occluded > 0 && occluded < rays.count);
+
+    // Brute force is far too slow for every ray, so only check a sample
+    const uint32_t ReferenceStride = 8191;
+    uint32_t referenceMismatches = 0;
+    for (uint32_t i = 0; i < rays.count; i += ReferenceStride) {
+        glm::vec3 origin(rays.origin[0][i], rays.origin[1][i], rays.origin[2][i]);
+        referenceMismatches += bvh.OccludedReference(origin, toLight, 0.0f, FLT_MAX) != (bool)scalarResults[i];
+    }
+    EXPECT(referenceMismatches == 0);
+
+    // Closest hits of rays fired down into the scene from random points above it
+    std::uniform_real_distribution<float> tilt(-0.5f, 0.5f);
+    uint32_t closestMismatches = 0;
+    for (uint32_t i = 0; i < 64; i++) {
+        glm::vec3 origin(spread(random), 10.0f, spread(random));
+        glm::vec3 direction = glm::normalize(glm::vec3(tilt(random), -1.0f, tilt(random)));
+        float reference = ClosestHitReference(positions, indices, origin, direction);
+        CPUBVH::Hit hit;
+        bool isHit = bvh.Intersect(origin, direction, 0.0f, FLT_MAX, hit);
+        if (isHit != (reference != FLT_MAX) || (isHit && fabsf(hit.t - reference) > 1e-4f * reference)) {
+            closestMismatches++;
+            continue;
+        }
+        if (isHit) {
+            // The hit triangle and barycentrics have to land on the hit point
+            glm::vec3 v0 = positions[indices[hit.triangle * 3]];
+            glm::vec3 v1 = positions[indices[hit.triangle * 3 + 1]];
+            glm::vec3 v2 = positions[indices[hit.triangle * 3 + 2]];
+            glm::vec3 point = v0 + (v1 - v0) * hit.u + (v2 - v0) * hit.v;
+            closestMismatches += glm::length(point - (origin + direction * hit.t)) > 1e-3f;
+        }
+    }
+    EXPECT(closestMismatches == 0);
+
+    float packetSeconds = std::chrono::duration<float>(packetEnd - packetStart).count();
+    float scalarSeconds = std::chrono::duration<float>(scalarEnd - packetEnd).count();
+    std::cout << bvh.TriangleCount() << " triangles, " << bvh.Nodes().size() << " nodes, SAH cost " << bvh.SAHCost() << ", "
+        << Milliseconds(threadedEnd - singleThreadEnd) << "ms build threaded, "
+        << Milliseconds(singleThreadEnd - buildStart) << "ms build single threaded, "
+        << rays.count / packetSeconds / 1e6f << "M rays/s packets, "
+        << rays.count / scalarSeconds / 1e6f << "M rays/s single rays, "
+        << occluded << " of " << rays.count << " occluded\n";
+}
+
+// A cubemap with each face's texels filled by radiance(direction)
+struct TestCubemap
+{
+    uint32_t size;
+    std::array<std::vector<float>, 6> texels;
+    std::array<SHCubemapFace, 6> faces;
+};
+
+// Direction through (s, t) in [-1, 1] of a D3D cube face, t growing downwards
+static glm::dvec3 CubeFaceDirection(uint32_t face, double s, double t)
+{
+    switch (face) {
+    case 0: return { 1.0, -t, -s };
+    case 1: return { -1.0, -t, s };
+    case 2: return { s, 1.0, t };
+    case 3: return { s, -1.0, -t };
+    case 4: return { s, -t, 1.0 };
+    default: return { -s, -t, -1.0 };
+    }
+}
+
+template<class Radiance>
+static void FillCubemap(TestCubemap& cubemap, uint32_t size, Radiance&& radiance)
+{
+    cubemap.size = size;
+    for (uint32_t face = 0; face < 6; face++) {
+        cubemap.texels[face].resize((size_t)size * size * 4);
+        for (uint32_t y = 0; y < size; y++) {
+            for (uint32_t x = 0; x < size; x++) {
+                glm::dvec3 direction = glm::normalize(CubeFaceDirection(face, 2.0 * (x + 0.5) / size - 1.0, 2.0 * (y + 0.5) / size - 1.0));
+                glm::vec3 value = radiance(glm::vec3(direction));
+                float* texel = &cubemap.texels[face][((size_t)y * size + x) * 4];
+                texel[0] = value.x;
+                texel[1] = value.y;
+                texel[2] = value.z;
+                texel[3] = 1.0f;
+            }
+        }
+        cubemap.faces[face] = { cubemap.texels[face], size, size };
+    }
+}
+
+// Integrates each texel's constant radiance against the basis by supersampling the texel, each
+// sample weighted by the solid angle of its patch of the cube face
+static SHL2RGB ProjectCubemapBruteForce(const TestCubemap& cubemap)
+{
+    const uint32_t Subsamples = 4;
+    std::array<glm::dvec3, SHCoefficientCount> sums = {};
+    double patchArea = (2.0 / (cubemap.size * Subsamples)) * (2.0 / (cubemap.size * Subsamples));
+    for (uint32_t face = 0; face < 6; face++) {
+        for (uint32_t y = 0; y < cubemap.size * Subsamples; y++) {
+            for (uint32_t x = 0; x < cubemap.size * Subsamples; x++) {
+                double s = 2.0 * (x + 0.5) / (cubemap.size * Subsamples) - 1.0;
+                double t = 2.0 * (y + 0.5) / (cubemap.size * Subsamples) - 1.0;
+                glm::dvec3 direction = CubeFaceDirection(face, s, t);
+                double length = glm::length(direction);
+                direction /= length;
+                double solidAngle = patchArea / (length * length * length);
+
+                const float* texel = &cubemap.texels[face][((size_t)(y / Subsamples) * cubemap.size + x / Subsamples) * 4];
+                glm::dvec3 radiance(texel[0], texel[1], texel[2]);
+                double basis[SHCoefficientCount] = {
+                    0.28209479177387814,
+                    0.4886025119029199 * direction.y,
+                    0.4886025119029199 * direction.z,
+                    0.4886025119029199 * direction.x,
+                    1.0925484305920792 * direction.x * direction.y,
+                    1.0925484305920792 * direction.y * direction.z,
+                    0.31539156525252005 * (3.0 * direction.z * direction.z - 1.0),
+                    1.0925484305920792 * direction.x * direction.z,
+                    0.5462742152960396 * (direction.x * direction.x - direction.y * direction.y),
+                };
+                for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+                    sums[i] += radiance * basis[i] * solidAngle;
+                }
+            }
+        }
+    }
+
+    SHL2RGB result;
+    for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+        result.coefficients[i] = glm::vec3(sums[i]);
+    }
+    return result;
+}
+
+// Largest coefficient difference, relative to the expected DC term
+static float SHError(const SHL2RGB& sh, const SHL2RGB& expected)
+{
+    float scale = std::max(glm::length(expected.coefficients[0]), FLT_MIN);
+    float maxError = 0.0f;
+    for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+        maxError = std::max(maxError, glm::length(sh.coefficients[i] - expected.coefficients[i]) / scale);
+    }
+    return maxError;
+}
+
+// Projects cubemaps with known integrals and checks every ProjectCubemap path against them
+static void SphericalHarmonics()
+{
+    // Approximate texel solid angles overestimate the sphere by about 0.25 / size^2, and taking
+    // the basis at texel centers costs about as much again, which is still 0.8% on an 8x8 face.
+    // The reference uses exact solid angles, so it's only off for radiance that isn't constant.
+    auto projectTolerance = [](uint32_t size) {
+        return 0.6f / (size * size) + 1e-5f;
+    };
+    const float ReferenceTolerance = 1e-5f;
+
+    auto projectAll = [&](const TestCubemap& cubemap, const SHL2RGB& expected) {
+        float tolerance = projectTolerance(cubemap.size);
+        EXPECT(SHError(ProjectCubemap(cubemap.faces, true), expected) < tolerance);
+        EXPECT(SHError(ProjectCubemap(cubemap.faces, true, 1), expected) < tolerance);
+        EXPECT(SHError(ProjectCubemap(cubemap.faces, false), expected) < tolerance);
+        EXPECT(SHError(ProjectCubemap(cubemap.faces, false, 1), expected) < tolerance);
+    };
+
+    // Constant radiance L only has a DC term, 4 pi Y00 L
+    const glm::vec3 constant(0.5f, 1.0f, 2.0f);
+    SHL2RGB constantSH;
+    constantSH.coefficients[0] = constant * (4.0f * glm::pi<float>() * 0.28209479f);
+    for (uint32_t size : { 8u, 16u, 61u, 128u }) {
+        TestCubemap cubemap;
+        FillCubemap(cubemap, size, [&](const glm::vec3&) { return constant; });
+        projectAll(cubemap, constantSH);
+        EXPECT(SHError(ProjectCubemapReference(cubemap.faces), constantSH) < ReferenceTolerance);
+    }
+    EXPECT(SHError(SHL2RGB::Constant(constant), constantSH) < 1e-6f);
+
+    // Radiance of z only projects onto Y10, as 4 pi / 3 * 0.488603
+    SHL2RGB linearSH;
+    linearSH.coefficients[2] = glm::vec3(4.0f * glm::pi<float>() / 3.0f * 0.48860251f);
+    {
+        TestCubemap cubemap;
+        FillCubemap(cubemap, 64, [](const glm::vec3& direction) { return glm::vec3(direction.z); });
+        // There's no DC term to be relative to
+        linearSH.coefficients[0] = glm::vec3(1.0f);
+        SHL2RGB reference = ProjectCubemapReference(cubemap.faces);
+        reference.coefficients[0] += glm::vec3(1.0f);
+        EXPECT(SHError(reference, linearSH) < projectTolerance(cubemap.size));
+        for (bool useSIMD : { true, false }) {
+            SHL2RGB projected = ProjectCubemap(cubemap.faces, useSIMD);
+            projected.coefficients[0] += glm::vec3(1.0f);
+            EXPECT(SHError(projected, linearSH) < projectTolerance(cubemap.size));
+        }
+    }
+
+    // Noise has energy in every band, and is compared against the brute force integral
+    std::mt19937 random(40);
+    std::uniform_real_distribution<float> noise(0.0f, 4.0f);
+    for (uint32_t size : { 8u, 32u, 100u }) {
+        TestCubemap cubemap;
+        FillCubemap(cubemap, size, [&](const glm::vec3&) { return glm::vec3(noise(random), noise(random), noise(random)); });
+        SHL2RGB bruteForce = ProjectCubemapBruteForce(cubemap);
+        projectAll(cubemap, bruteForce);
+        EXPECT(SHError(ProjectCubemapReference(cubemap.faces), bruteForce) < projectTolerance(size));
+    }
+
+    // A sky sized cubemap for the timings
+    TestCubemap sky;
+    FillCubemap(sky, 512, [&](const glm::vec3& direction) { return glm::vec3(1.0f + direction.y, 0.5f, noise(random)); });
+    auto start = std::chrono::steady_clock::now();
+    SHL2RGB simd = ProjectCubemap(sky.faces, true);
+    auto simdEnd = std::chrono::steady_clock::now();
+    SHL2RGB scalar = ProjectCubemap(sky.faces, false);
+    auto scalarEnd = std::chrono::steady_clock::now();
+    SHL2RGB reference = ProjectCubemapReference(sky.faces);
+    auto referenceEnd = std::chrono::steady_clock::now();
+    EXPECT(SHError(simd, reference) < projectTolerance(sky.size));
+    EXPECT(SHError(scalar, reference) < projectTolerance(sky.size));
+    std::cout << "6x512x512 texels: " << Milliseconds(simdEnd - start) << "ms SIMD, " << Milliseconds(scalarEnd - simdEnd) << "ms scalar, "
+        << Milliseconds(referenceEnd - scalarEnd) << "ms reference, " << SHError(simd, reference) << " max error\n";
+}
+
+// Bakes, samples and round trips probe volumes
+static void ProbeVolumeTest()
+{
+    const AABB bounds = { glm::vec3(-4.0f, 0.0f, -2.0f), glm::vec3(4.0f, 3.0f, 2.0f) };
+
+    // Spacing follows the longest axis, and every axis keeps at least the two end probes
+    EXPECT(ChooseProbeCounts(bounds, 9) == glm::uvec3(9, 4, 5));
+    EXPECT(ChooseProbeCounts(bounds, 2) == glm::uvec3(2, 2, 2));
+    EXPECT(ChooseProbeCounts(AABB{ glm::vec3(0.0f), glm::vec3(10.0f, 0.0f, 0.0f) }, 16) == glm::uvec3(16, 2, 2));
+    std::mt19937 random(39);
+    std::uniform_real_distribution<float> extent(0.01f, 100.0f);
+    for (int i = 0; i < 1000; i++) {
+        AABB box = { glm::vec3(0.0f), glm::vec3(extent(random), extent(random), extent(random)) };
+        uint32_t maxProbes = 2 + random() % 30;
+        glm::uvec3 counts = ChooseProbeCounts(box, maxProbes);
+        EXPECT(glm::all(glm::greaterThanEqual(counts, glm::uvec3(2))) && glm::all(glm::lessThanEqual(counts, glm::uvec3(maxProbes))));
+        float longest = std::max(std::max(box.max.x, box.max.y), box.max.z);
+        EXPECT(std::max(std::max(counts.x, counts.y), counts.z) == maxProbes);
+        glm::vec3 spacing = box.max / (glm::vec3(counts) - 1.0f);
+        EXPECT(glm::all(glm::lessThanEqual(spacing, glm::vec3(longest / (maxProbes - 1) * 1.0001f))));
+    }
+
+    // Trilinear blending reproduces a linear function exactly, and clamps outside the bounds
+    ProbeVolume linear;
+    linear.bounds = bounds;
+    linear.counts = glm::uvec3(5, 3, 4);
+    auto linearValue = [](const glm::vec3& position) {
+        return glm::vec3(position.x + 2.0f * position.y - position.z + 10.0f, 1.0f, 0.5f * position.z + 3.0f);
+    };
+    for (uint32_t z = 0; z < linear.counts.z; z++) {
+        for (uint32_t y = 0; y < linear.counts.y; y++) {
+            for (uint32_t x = 0; x < linear.counts.x; x++) {
+                linear.probes.push_back(SHL2RGB::Constant(linearValue(linear.ProbePosition(glm::uvec3(x, y, z)))));
+            }
+        }
+    }
+    EXPECT(linear.ProbePosition(glm::uvec3(0)) == bounds.min);
+    EXPECT(linear.ProbePosition(linear.counts - 1u) == bounds.max);
+    std::uniform_real_distribution<float> unit(-0.25f, 1.25f);
+    for (int i = 0; i < 1000; i++) {
+        glm::vec3 position = glm::mix(bounds.min, bounds.max, glm::vec3(unit(random), unit(random), unit(random)));
+        glm::vec3 normal = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) - 0.5f);
+        glm::vec3 expected = linearValue(glm::clamp(position, bounds.min, bounds.max));
+        EXPECT(glm::length(linear.SampleIrradiance(position, normal) - expected) < 1e-4f * glm::length(expected));
+    }
+
+    // With nothing to hit, every probe sees the constant sky, and irradiance of constant radiance L is L
+    const glm::vec3 skyRadiance(0.25f, 0.5f, 1.0f);
+    ProbeBakeScene empty;
+    CPUBVH emptyBVH;
+    emptyBVH.Build(empty.positions, empty.indices);
+    ProbeBakeSettings settings;
+    settings.samplesPerProbe = 4096;
+    settings.sky = SHL2RGB::Constant(skyRadiance);
+    glm::uvec3 counts(3, 2, 2);
+    ProbeVolume sky = BakeProbeVolume(emptyBVH, empty, bounds, counts, settings);
+    EXPECT(sky.counts == counts && sky.probes.size() == 12);
+    for (const SHL2RGB& probe : sky.probes) {
+        // The DC term is exact, the higher bands only hold sampling noise
+        glm::vec3 dc = SHL2RGB::Constant(skyRadiance).coefficients[0];
+        EXPECT(glm::length(probe.coefficients[0] - dc) < 1e-4f * glm::length(dc));
+        for (const glm::vec3& normal : { glm::vec3(1, 0, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0.6f, 0.8f) }) {
+            EXPECT(glm::length(probe.Evaluate(normal) - skyRadiance) < 0.05f * glm::length(skyRadiance));
+        }
+    }
+
+    // A floor under a light, baked on one thread and on every core gives the same probes
+    ProbeBakeScene floor;
+    floor.positions = { glm::vec3(-8, -0.5f, -8), glm::vec3(8, -0.5f, -8), glm::vec3(8, -0.5f, 8), glm::vec3(-8, -0.5f, 8) };
+    floor.indices = { 0, 1, 2, 0, 2, 3 };
+    floor.triangleAlbedo = { glm::vec3(0.8f, 0.2f, 0.2f), glm::vec3(0.8f, 0.2f, 0.2f) };
+    CPUBVH floorBVH;
+    floorBVH.Build(floor.positions, floor.indices);
+    settings.samplesPerProbe = 64;
+    settings.lights = { ProbeBakeLight{ glm::normalize(glm::vec3(0.3f, -1.0f, 0.2f)), glm::vec3(3.0f) } };
+    auto bakeStart = std::chrono::steady_clock::now();
+    ProbeVolume lit = BakeProbeVolume(floorBVH, floor, bounds, counts, settings);
+    auto bakeEnd = std::chrono::steady_clock::now();
+    ProbeVolume singleThread = BakeProbeVolume(floorBVH, floor, bounds, counts, settings, 1);
+    EXPECT(memcmp(lit.probes.data(), singleThread.probes.data(), lit.probes.size() * sizeof(SHL2RGB)) == 0);
+    // Light bounced off the red floor comes from below
+    glm::vec3 up = lit.SampleIrradiance(glm::vec3(0.0f), glm::vec3(0, 1, 0));
+    glm::vec3 down = lit.SampleIrradiance(glm::vec3(0.0f), glm::vec3(0, -1, 0));
+    EXPECT(down.x > up.x && down.x > down.y);
+
+    // The hash covers every input, and a saved volume only loads back with its own hash
+    uint32_t hash = HashProbeBake(floor, bounds, counts, settings);
+    EXPECT(HashProbeBake(floor, bounds, counts, settings) == hash);
+    ProbeBakeSettings otherSettings = settings;
+    otherSettings.bounces++;
+    EXPECT(HashProbeBake(floor, bounds, counts, otherSettings) != hash);
+    otherSettings = settings;
+    otherSettings.lights[0].radiance.y += 1.0f;
+    EXPECT(HashProbeBake(floor, bounds, counts, otherSettings) != hash);
+    ProbeBakeScene otherFloor = floor;
+    otherFloor.triangleAlbedo[1].z = 0.5f;
+    EXPECT(HashProbeBake(otherFloor, bounds, counts, settings) != hash);
+    EXPECT(HashProbeBake(floor, bounds, counts + glm::uvec3(1, 0, 0), settings) != hash);
+
+    std::string path = (std::filesystem::temp_directory_path() / "mdxrbench.probevolume").string();
+    EXPECT(SaveProbeVolume(path, lit, hash));
+    std::optional<ProbeVolume> loaded = LoadProbeVolume(path, hash);
+    EXPECT(loaded.has_value());
+    if (loaded) {
+        EXPECT(loaded->counts == lit.counts && loaded->bounds.min == lit.bounds.min && loaded->bounds.max == lit.bounds.max);
+        EXPECT(loaded->probes.size() == lit.probes.size() &&
+            memcmp(loaded->probes.data(), lit.probes.data(), lit.probes.size() * sizeof(SHL2RGB)) == 0);
+    }
+    EXPECT(!LoadProbeVolume(path, hash + 1));
+
+    // Truncated files are rejected
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    EXPECT(!LoadProbeVolume(path, hash));
+    std::filesystem::remove(path);
+    EXPECT(!LoadProbeVolume(path, hash));
+
+    std::cout << counts.x * counts.y * counts.z << " probes x " << settings.samplesPerProbe << " samples: " << Milliseconds(bakeEnd - bakeStart) << "ms\n";
+}
+
+// Command list that keeps the state a GPU would see, and snapshots it at every draw
+struct StateTrackingCommandList
+{
+    struct Draw
+    {
+        UINT constants[6];
+        UINT topology;
+        ID3D12PipelineState* pso;
+        const D3D12_VERTEX_BUFFER_VIEW* vertexBuffers;
+        UINT vertexBufferCount;
+        D3D12_INDEX_BUFFER_VIEW indexBuffer;
+        UINT indexCount;
+        UINT instanceCount;
+    };
+
+    Draw state = {};
+    std::vector<Draw> draws;
+    uint32_t topologyChanges = 0;
+    uint32_t psoChanges = 0;
+    uint32_t vertexBufferChanges = 0;
+    uint32_t indexBufferChanges = 0;
+
+    void SetGraphicsRoot32BitConstants(UINT rootParameter, UINT count, const void* values, UINT offset)
+    {
+        EXPECT(rootParameter == 0 && offset == 0 && count == _countof(state.constants));
+        memcpy(state.constants, values, sizeof(state.constants));
+    }
+    void IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology)
+    {
+        state.topology = topology;
+        topologyChanges++;
+    }
+    void SetPipelineState(ID3D12PipelineState* pso)
+    {
+        state.pso = pso;
+        psoChanges++;
+    }
+    void IASetVertexBuffers(UINT startSlot, UINT count, const D3D12_VERTEX_BUFFER_VIEW* views)
+    {
+        EXPECT(startSlot == 0);
+        state.vertexBuffers = views;
+        state.vertexBufferCount = count;
+        vertexBufferChanges++;
+    }
+    void IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* view)
+    {
+        state.indexBuffer = *view;
+        indexBufferChanges++;
+    }
+    void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+    {
+        EXPECT(startIndex == 0 && baseVertex == 0 && startInstance == 0);
+        state.indexCount = indexCount;
+        state.instanceCount = instanceCount;
+        draws.push_back(state);
+    }
+};
+
+// Stand-in for GraphicsCommandList that only counts calls, to time the packet walk alone
+struct CountingCommandList
+{
+    UINT64 calls = 0;
+
+    void SetGraphicsRoot32BitConstants(UINT, UINT, const void*, UINT) { calls++; }
+    void IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY) { calls++; }
+    void SetPipelineState(ID3D12PipelineState*) { calls++; }
+    void IASetVertexBuffers(UINT, UINT, const D3D12_VERTEX_BUFFER_VIEW*) { calls++; }
+    void IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW*) { calls++; }
+    void DrawIndexedInstanced(UINT, UINT, UINT, INT, UINT) { calls++; }
+};
+
+// Records random packet lists, sorted like BuildDrawPackets sorts them and not, checking every
+// draw sees the state its packet asks for, culled packets are skipped, and state is only set
+// when it changes
+static void DrawPackets()
+{
+    std::mt19937 random(27);
+
+    const UINT PSOCount = 8;
+    const UINT VertexBufferViewCount = 64;
+    const UINT IndexBufferCount = 16;
+    // Never dereferenced, they only need to be distinct
+    std::vector<ID3D12PipelineState*> pipelineStates(PSOCount);
+    for (UINT i = 0; i < PSOCount; i++) {
+        pipelineStates[i] = reinterpret_cast<ID3D12PipelineState*>((uintptr_t)(i + 1) * 64);
+    }
+    std::vector<D3D12_VERTEX_BUFFER_VIEW> vertexBufferViews(VertexBufferViewCount);
+    for (UINT i = 0; i < VertexBufferViewCount; i++) {
+        vertexBufferViews[i] = { 0x10000ull * (i + 1), 4096, 12 };
+    }
+
+    auto makePackets = [&](uint32_t count, bool sorted) {
+        std::vector<DrawPacket> packets(count);
+        for (DrawPacket& packet : packets) {
+            packet = {};
+            UINT indexBuffer = random() % IndexBufferCount;
+            // Views of the same buffer can differ in size alone, like primitives sharing a buffer
+            packet.indexBufferView = { 0x1000000ull * (indexBuffer + 1), 65536u >> (random() % 2), random() % 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT };
+            packet.indexCount = 3 * (1 + random() % 1000);
+            packet.instanceCount = 1 + random() % 4;
+            packet.firstInstance = random() % 10000;
+            packet.materialDataIndex = random() % 500;
+            packet.miscDescriptorIndex = random() % 500;
+            // Views are interned, so a range always has the same length wherever it's used
+            packet.firstVertexBufferView = random() % (VertexBufferViewCount - 4);
+            packet.vertexBufferViewCount = (UINT16)(1 + packet.firstVertexBufferView % 4);
+            packet.psoIndex = (UINT16)(random() % PSOCount);
+            packet.primitiveTopology = random() % 8 == 0 ? D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP : D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+            packet.culled = random() % 5 == 0;
+        }
+        if (sorted) {
+            std::sort(packets.begin(), packets.end(), [](const DrawPacket& a, const DrawPacket& b) {
+                if (a.psoIndex != b.psoIndex) {
+                    return a.psoIndex < b.psoIndex;
+                }
+                return a.firstVertexBufferView < b.firstVertexBufferView;
+            });
+        }
+        return packets;
+    };
+
+    const UINT ViewDataIndex = 77;
+    for (bool sorted : { false, true }) {
+        for (bool withLights : { false, true }) {
+            std::vector<DrawPacket> packets = makePackets(5000, sorted);
+            std::vector<DrawPacketLightRange> lightRanges(packets.size());
+            for (DrawPacketLightRange& range : lightRanges) {
+                range = { (UINT)(random() % 100000), (UINT)(random() % 64) };
+            }
+
+            StateTrackingCommandList commandList;
+            UINT drawCount = RecordDrawPackets(&commandList, packets, vertexBufferViews.data(), pipelineStates.data(), ViewDataIndex, withLights ? lightRanges.data() : nullptr);
+
+            // The fewest state changes that still give every draw its state
+            std::vector<uint32_t> visible;
+            uint32_t expectedTopologyChanges = 0;
+            uint32_t expectedPSOChanges = 0;
+            uint32_t expectedVertexBufferChanges = 0;
+            uint32_t expectedIndexBufferChanges = 0;
+            for (uint32_t i = 0; i < packets.size(); i++) {
+                if (packets[i].culled) {
+                    continue;
+                }
+                const DrawPacket* last = visible.empty() ? nullptr : &packets[visible.back()];
+                expectedTopologyChanges += !last || last->primitiveTopology != packets[i].primitiveTopology;
+                expectedPSOChanges += !last || last->psoIndex != packets[i].psoIndex;
+                expectedVertexBufferChanges += !last || last->firstVertexBufferView != packets[i].firstVertexBufferView;
+                expectedIndexBufferChanges += !last || last->indexBufferView.BufferLocation != packets[i].indexBufferView.BufferLocation ||
+                    last->indexBufferView.SizeInBytes != packets[i].indexBufferView.SizeInBytes ||
+                    last->indexBufferView.Format != packets[i].indexBufferView.Format;
+                visible.push_back(i);
+            }
+
+            EXPECT(drawCount == visible.size());
+            EXPECT(commandList.draws.size() == visible.size());
+            EXPECT(commandList.topologyChanges == expectedTopologyChanges);
+            EXPECT(commandList.psoChanges == expectedPSOChanges);
+            EXPECT(commandList.vertexBufferChanges == expectedVertexBufferChanges);
+            EXPECT(commandList.indexBufferChanges == expectedIndexBufferChanges);
+
+            uint32_t wrongState = 0;
+            for (size_t d = 0; d < std::min(commandList.draws.size(), visible.size()); d++) {
+                const StateTrackingCommandList::Draw& draw = commandList.draws[d];
+                const DrawPacket& packet = packets[visible[d]];
+                DrawPacketLightRange lights = withLights ? lightRanges[visible[d]] : DrawPacketLightRange{ 0, 0 };
+                UINT constants[6] = { packet.firstInstance, packet.materialDataIndex, lights.first, lights.count, packet.miscDescriptorIndex, ViewDataIndex };
+                wrongState += memcmp(draw.constants, constants, sizeof(constants)) != 0 ||
+                    draw.topology != packet.primitiveTopology ||
+                    draw.pso != pipelineStates[packet.psoIndex] ||
+                    draw.vertexBuffers != vertexBufferViews.data() + packet.firstVertexBufferView ||
+                    draw.vertexBufferCount != packet.vertexBufferViewCount ||
+                    draw.indexBuffer.BufferLocation != packet.indexBufferView.BufferLocation ||
+                    draw.indexBuffer.SizeInBytes != packet.indexBufferView.SizeInBytes ||
+                    draw.indexBuffer.Format != packet.indexBufferView.Format ||
+                    draw.indexCount != packet.indexCount ||
+                    draw.instanceCount != packet.instanceCount;
+            }
+            EXPECT(wrongState == 0);
+        }
+    }
+
+    // Nothing to draw records nothing
+    {
+        StateTrackingCommandList commandList;
+        EXPECT(RecordDrawPackets(&commandList, std::span<const DrawPacket>(), vertexBufferViews.data(), pipelineStates.data(), ViewDataIndex) == 0);
+        std::vector<DrawPacket> culled = makePackets(100, false);
+        for (DrawPacket& packet : culled) {
+            packet.culled = 1;
+        }
+        EXPECT(RecordDrawPackets(&commandList, culled, vertexBufferViews.data(), pipelineStates.data(), ViewDataIndex) == 0);
+        EXPECT(commandList.draws.empty() && commandList.psoChanges == 0 && commandList.topologyChanges == 0);
+    }
+
+    // The cost of the walk itself on a sorted scene
+    std::vector<DrawPacket> packets = makePackets(100000, true);
+    const int Iterations = 20;
+    CountingCommandList countingCommandList;
+    UINT64 drawCount = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < Iterations; i++) {
+        drawCount += RecordDrawPackets(&countingCommandList, packets, vertexBufferViews.data(), pipelineStates.data(), ViewDataIndex);
+    }
+    auto end = std::chrono::steady_clock::now();
+    float totalNS = (float)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout << packets.size() << " packets: " << totalNS / (float)std::max<UINT64>(drawCount, 1) << "ns per draw, "
+        << countingCommandList.calls / Iterations << " commands per iteration\n";
+}
+
+int main(int argc, char** argv)
+{
+    struct Test
+    {
+        const char* name;
+        void (*run)();
+    };
+    const Test tests[] = {
+        { "blasscheduler", BLASScheduler },
+        { "contenthash", ContentHashTest },
+        { "cpubvh", CPUBVHTest },
+        { "drawpacket", DrawPackets },
+        { "instancedata", InstanceData },
+        { "ktx2", KTX2 },
+        { "lightclusters", LightClusters },
+        { "probevolume", ProbeVolumeTest },
+        { "radixsort", RadixSortTest },
+        { "sphericalharmonics", SphericalHarmonics },
+        { "tlas", TLAS },
+        { "transforms", Transforms },
+    };
+
+    for (const Test& test : tests) {
+        if (argc == 2 && test.name == std::string(argv[1])) {
+            test.run();
+            if (failures > 0) {
+                std::cerr << test.name << ": " << failures << " checks failed\n";
+                return 1;
+            }
+            return 0;
+        }
+    }
+
+    std::cerr << "Usage: mdxrbench <name>, one of:";
+    for (const Test& test : tests) {
+        std::cerr << " " << test.name;
+    }
+    std::cerr << "\n";
+    return 1;
+}
@@ -0,0 +1,76 @@
+#include "blasscheduler.h"
+
+#include <algorithm>
+
+void BLASBuildScheduler::Enqueue(uint32_t id, uint32_t triangleCount)
+{
+    pending.push_back({ id, triangleCount, 0 });
+    pendingTriangles += triangleCount;
+}
+
+void BLASBuildScheduler::Remove(uint32_t id)
+{
+    auto iter = std::find_if(pending.begin(), pending.end(), [&](const Request& request) {
+        return request.id == id;
+    });
+    if (iter != pending.end()) {
+        pendingTriangles -= iter->triangleCount;
+        pending.erase(iter);
+    }
+}
+
+std::vector<uint32_t> BLASBuildScheduler::NextBatch(const Budget& budget, const std::function<Priority(uint32_t id)>& priorityOf)
+{
+    std::vector<uint32_t> batch;
+    if (pending.empty() || budget.builds == 0) {
+        return batch;
+    }
+
+    ordered.clear();
+    for (uint32_t i = 0; i < (uint32_t)pending.size(); i++) {
+        ordered.emplace_back(priorityOf(pending[i].id), i);
+    }
+
+    // Stable so equally important builds keep their queue order
+    std::stable_sort(ordered.begin(), ordered.end(), [&](const auto& a, const auto& b) {
+        bool aStarved = pending[a.second].skips >= budget.maxSkips;
+        bool bStarved = pending[b.second].skips >= budget.maxSkips;
+        if (aStarved != bStarved) {
+            return aStarved;
+        }
+        if (a.first.visible != b.first.visible) {
+            return a.first.visible;
+        }
+        return a.first.distance < b.first.distance;
+    });
+
+    // Take builds in priority order, skipping any that would go over the budget
+    uint64_t triangles = 0;
+    std::vector<uint8_t> taken(pending.size(), 0);
+    for (const auto& [priority, index] : ordered) {
+        Request& request = pending[index];
+        if (!batch.empty() && triangles + request.triangleCount > budget.triangles) {
+            request.skips++;
+            continue;
+        }
+
+        batch.push_back(request.id);
+        taken[index] = 1;
+        triangles += request.triangleCount;
+
+        if (batch.size() >= budget.builds || triangles >= budget.triangles) {
+            break;
+        }
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < (uint32_t)pending.size(); i++) {
+        if (!taken[i]) {
+            pending[kept++] = pending[i];
+        }
+    }
+    pending.resize(kept);
+    pendingTriangles -= triangles;
+
+    return batch;
+}
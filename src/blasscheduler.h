@@ -0,0 +1,63 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+// Decides which queued BLAS builds to issue each frame.
+//
+// Builds are ordered visible first, then nearest first, and issued in batches that fit
+// a per-frame triangle budget, so streaming in a large model never stalls a frame on one
+// huge batch. The first build of a batch is always issued, so a build larger than the
+// budget still happens eventually. A build skipped for not fitting goes to the front once it
+// has been skipped maxSkips times, so a steady stream of more important builds can't starve it.
+//
+// Only deals in ids so it can be driven by a simulated queue, it isn't thread safe.
+class BLASBuildScheduler
+{
+public:
+    struct Priority
+    {
+        bool visible = false;
+        float distance = 0.0f;
+    };
+
+    struct Budget
+    {
+        uint64_t triangles = 1000000;
+        uint32_t builds = 64;
+        uint32_t maxSkips = 8;
+    };
+
+    void Enqueue(uint32_t id, uint32_t triangleCount);
+    void Remove(uint32_t id);
+
+    // Removes the most important builds that fit within budget from the queue and returns their ids.
+    // priorityOf is called once per queued build.
+    std::vector<uint32_t> NextBatch(const Budget& budget, const std::function<Priority(uint32_t id)>& priorityOf);
+
+    uint32_t PendingCount() const
+    {
+        return (uint32_t)pending.size();
+    }
+
+    uint64_t PendingTriangles() const
+    {
+        return pendingTriangles;
+    }
+
+private:
+    struct Request
+    {
+        uint32_t id;
+        uint32_t triangleCount;
+        // Batches this build didn't fit in
+        uint32_t skips;
+    };
+
+    std::vector<Request> pending;
+    uint64_t pendingTriangles = 0;
+
+    // Scratch for NextBatch
+    std::vector<std::pair<Priority, uint32_t>> ordered;
+};
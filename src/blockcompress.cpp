@@ -0,0 +1,669 @@
+#include "blockcompress.h"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// BC7 4 bit index interpolation weights, out of 64
+static constexpr uint8_t BC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BlockTexels
+{
+    uint8_t rgba[16][4];
+};
+
+typedef uint8_t PaletteEntry[4];
+
+uint32_t BlockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+static void LoadBlock(const uint8_t* rgba, size_t rowPitch, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, BlockTexels& block)
+{
+    for (uint32_t y = 0; y < 4; y++) {
+        const uint8_t* row = rgba + std::min(blockY * 4 + y, height - 1) * rowPitch;
+        for (uint32_t x = 0; x < 4; x++) {
+            memcpy(block.rgba[y * 4 + x], row + std::min(blockX * 4 + x, width - 1) * 4, 4);
+        }
+    }
+}
+
+// Squared RGBA distance from each texel to each palette entry, keeping the first nearest entry.
+// Returns the total error of the block.
+static uint32_t SelectIndicesScalar(const BlockTexels& block, const PaletteEntry* palette, uint32_t paletteSize, uint8_t* indices)
+{
+    uint32_t totalError = 0;
+    for (uint32_t i = 0; i < 16; i++) {
+        int32_t bestError = INT32_MAX;
+        for (uint32_t entry = 0; entry < paletteSize; entry++) {
+            int32_t error = 0;
+            for (uint32_t c = 0; c < 4; c++) {
+                int32_t difference = (int32_t)block.rgba[i][c] - palette[entry][c];
+                error += difference * difference;
+            }
+            if (error < bestError) {
+                bestError = error;
+                indices[i] = (uint8_t)entry;
+            }
+        }
+        totalError += (uint32_t)bestError;
+    }
+    return totalError;
+}
+
+#ifdef __AVX2__
+// Same as SelectIndicesScalar, 8 texels at a time
+static uint32_t SelectIndicesAVX2(const BlockTexels& block, const PaletteEntry* palette, uint32_t paletteSize, uint8_t* indices)
+{
+    // 16 bit red/green and blue/alpha pairs, so madd gives r*r + g*g and b*b + a*a per texel
+    __m256i redGreen[2];
+    __m256i blueAlpha[2];
+    const __m256i splitRG = _mm256_setr_epi8(
+        0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1,
+        0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1
+    );
+    const __m256i splitBA = _mm256_setr_epi8(
+        2, -1, 3, -1, 6, -1, 7, -1, 10, -1, 11, -1, 14, -1, 15, -1,
+        2, -1, 3, -1, 6, -1, 7, -1, 10, -1, 11, -1, 14, -1, 15, -1
+    );
+    for (uint32_t half = 0; half < 2; half++) {
+        __m256i texels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block.rgba[half * 8]));
+        redGreen[half] = _mm256_shuffle_epi8(texels, splitRG);
+        blueAlpha[half] = _mm256_shuffle_epi8(texels, splitBA);
+    }
+
+    __m256i bestError[2] = { _mm256_set1_epi32(INT32_MAX), _mm256_set1_epi32(INT32_MAX) };
+    __m256i bestIndex[2] = { _mm256_setzero_si256(), _mm256_setzero_si256() };
+
+    for (uint32_t entry = 0; entry < paletteSize; entry++) {
+        __m256i paletteRG = _mm256_set1_epi32(palette[entry][0] | (palette[entry][1] << 16));
+        __m256i paletteBA = _mm256_set1_epi32(palette[entry][2] | (palette[entry][3] << 16));
+        __m256i entryIndex = _mm256_set1_epi32((int)entry);
+        for (uint32_t half = 0; half < 2; half++) {
+            __m256i rg = _mm256_sub_epi16(redGreen[half], paletteRG);
+            __m256i ba = _mm256_sub_epi16(blueAlpha[half], paletteBA);
+            __m256i error = _mm256_add_epi32(_mm256_madd_epi16(rg, rg), _mm256_madd_epi16(ba, ba));
+            __m256i better = _mm256_cmpgt_epi32(bestError[half], error);
+            bestError[half] = _mm256_min_epi32(bestError[half], error);
+            bestIndex[half] = _mm256_blendv_epi8(bestIndex[half], entryIndex, better);
+        }
+    }
+
+    alignas(32) int32_t errors[16];
+    alignas(32) int32_t chosen[16];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(errors), bestError[0]);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(errors + 8), bestError[1]);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(chosen), bestIndex[0]);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(chosen + 8), bestIndex[1]);
+
+    uint32_t totalError = 0;
+    for (uint32_t i = 0; i < 16; i++) {
+        indices[i] = (uint8_t)chosen[i];
+        totalError += (uint32_t)errors[i];
+    }
+    return totalError;
+}
+#endif
+
+static uint32_t SelectIndices(const BlockTexels& block, const PaletteEntry* palette, uint32_t paletteSize, uint8_t* indices, bool useSIMD)
+{
+#ifdef __AVX2__
+    if (useSIMD) {
+        return SelectIndicesAVX2(block, palette, paletteSize, indices);
+    }
+#endif
+    return SelectIndicesScalar(block, palette, paletteSize, indices);
+}
+
+// Extremes of the block's texels along their principal axis, over the first channelCount channels
+static void PrincipalAxisEndpoints(const BlockTexels& block, uint32_t channelCount, float endpoint0[4], float endpoint1[4])
+{
+    float mean[4] = {};
+    for (uint32_t i = 0; i < 16; i++) {
+        for (uint32_t c = 0; c < channelCount; c++) {
+            mean[c] += block.rgba[i][c] / 16.0f;
+        }
+    }
+
+    float covariance[4][4] = {};
+    for (uint32_t i = 0; i < 16; i++) {
+        for (uint32_t a = 0; a < channelCount; a++) {
+            for (uint32_t b = 0; b < channelCount; b++) {
+                covariance[a][b] += (block.rgba[i][a] - mean[a]) * (block.rgba[i][b] - mean[b]);
+            }
+        }
+    }
+
+    // Power iteration, starting from the diagonal as grey ramps are the usual case
+    float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {};
+        float length = 0.0f;
+        for (uint32_t a = 0; a < channelCount; a++) {
+            for (uint32_t b = 0; b < channelCount; b++) {
+                next[a] += covariance[a][b] * axis[b];
+            }
+            length += next[a] * next[a];
+        }
+        if (length < 1e-12f) {
+            break;
+        }
+        length = sqrtf(length);
+        for (uint32_t c = 0; c < channelCount; c++) {
+            axis[c] = next[c] / length;
+        }
+    }
+
+    float minProjection = FLT_MAX;
+    float maxProjection = -FLT_MAX;
+    for (uint32_t i = 0; i < 16; i++) {
+        float projection = 0.0f;
+        for (uint32_t c = 0; c < channelCount; c++) {
+            projection += (block.rgba[i][c] - mean[c]) * axis[c];
+        }
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+
+    for (uint32_t c = 0; c < 4; c++) {
+        endpoint0[c] = c < channelCount ? std::clamp(mean[c] + axis[c] * minProjection, 0.0f, 255.0f) : 0.0f;
+        endpoint1[c] = c < channelCount ? std::clamp(mean[c] + axis[c] * maxProjection, 0.0f, 255.0f) : 0.0f;
+    }
+}
+
+// Least squares endpoints for texels interpolated by weights[index] from endpoint0 to endpoint1.
+// Returns false if every texel has the same weight.
+static bool FitEndpoints(const BlockTexels& block, const uint8_t* indices, const float* weights, uint32_t channelCount, float endpoint0[4], float endpoint1[4])
+{
+    float a = 0.0f;
+    float b = 0.0f;
+    float c = 0.0f;
+    float x0[4] = {};
+    float x1[4] = {};
+    for (uint32_t i = 0; i < 16; i++) {
+        float t = weights[indices[i]];
+        float s = 1.0f - t;
+        a += s * s;
+        b += s * t;
+        c += t * t;
+        for (uint32_t channel = 0; channel < channelCount; channel++) {
+            x0[channel] += s * block.rgba[i][channel];
+            x1[channel] += t * block.rgba[i][channel];
+        }
+    }
+
+    float determinant = a * c - b * b;
+    if (fabsf(determinant) < 1e-6f) {
+        return false;
+    }
+
+    for (uint32_t channel = 0; channel < channelCount; channel++) {
+        endpoint0[channel] = std::clamp((c * x0[channel] - b * x1[channel]) / determinant, 0.0f, 255.0f);
+        endpoint1[channel] = std::clamp((a * x1[channel] - b * x0[channel]) / determinant, 0.0f, 255.0f);
+    }
+    return true;
+}
+
+static uint32_t RefinementCount(BlockQuality quality)
+{
+    return quality == BlockQuality::Fast ? 0 : quality == BlockQuality::Normal ? 1 : 3;
+}
+
+static void WriteBits(uint8_t* block, uint32_t& bit, uint32_t value, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++, bit++) {
+        block[bit / 8] |= (uint8_t)(((value >> i) & 1) << (bit % 8));
+    }
+}
+
+static uint32_t ReadBits(const uint8_t* block, uint32_t& bit, uint32_t count)
+{
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < count; i++, bit++) {
+        value |= ((block[bit / 8] >> (bit % 8)) & 1u) << i;
+    }
+    return value;
+}
+
+// BC1
+
+static uint16_t PackRGB565(const float color[4])
+{
+    uint32_t r = (uint32_t)(color[0] * 31.0f / 255.0f + 0.5f);
+    uint32_t g = (uint32_t)(color[1] * 63.0f / 255.0f + 0.5f);
+    uint32_t b = (uint32_t)(color[2] * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void UnpackRGB565(uint16_t packed, uint8_t color[4])
+{
+    uint32_t r = (packed >> 11) & 31;
+    uint32_t g = (packed >> 5) & 63;
+    uint32_t b = packed & 31;
+    color[0] = (uint8_t)((r << 3) | (r >> 2));
+    color[1] = (uint8_t)((g << 2) | (g >> 4));
+    color[2] = (uint8_t)((b << 3) | (b >> 2));
+    color[3] = 0;
+}
+
+// Returns the palette size, 3 when the endpoints are equal (the fourth entry would be transparent black)
+static uint32_t BC1Palette(uint16_t color0, uint16_t color1, PaletteEntry* palette)
+{
+    UnpackRGB565(color0, palette[0]);
+    UnpackRGB565(color1, palette[1]);
+    for (uint32_t c = 0; c < 4; c++) {
+        if (color0 > color1) {
+            palette[2][c] = (uint8_t)((2 * palette[0][c] + palette[1][c] + 1) / 3);
+            palette[3][c] = (uint8_t)((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+        } else {
+            palette[2][c] = (uint8_t)((palette[0][c] + palette[1][c]) / 2);
+            palette[3][c] = 0;
+        }
+    }
+    return color0 > color1 ? 4 : 3;
+}
+
+static void CompressBC1(BlockTexels block, uint8_t* dest, BlockQuality quality, bool useSIMD)
+{
+    // Alpha is dropped, so zero it where it would count towards the error
+    for (auto& texel : block.rgba) {
+        texel[3] = 0;
+    }
+
+    static constexpr float Weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+    float endpoint0[4];
+    float endpoint1[4];
+    PrincipalAxisEndpoints(block, 3, endpoint0, endpoint1);
+
+    uint32_t bestError = UINT32_MAX;
+    uint16_t bestColors[2] = {};
+    uint8_t bestIndices[16] = {};
+    for (uint32_t refinement = 0; refinement <= RefinementCount(quality); refinement++) {
+        uint16_t color0 = PackRGB565(endpoint0);
+        uint16_t color1 = PackRGB565(endpoint1);
+        if (color0 < color1) {
+            std::swap(color0, color1);
+            std::swap(endpoint0, endpoint1);
+        }
+
+        PaletteEntry palette[4];
+        uint32_t paletteSize = BC1Palette(color0, color1, palette);
+        uint8_t indices[16];
+        uint32_t error = SelectIndices(block, palette, paletteSize, indices, useSIMD);
+        if (error < bestError) {
+            bestError = error;
+            bestColors[0] = color0;
+            bestColors[1] = color1;
+            memcpy(bestIndices, indices, sizeof(indices));
+        }
+
+        if (error == 0 || paletteSize != 4 || !FitEndpoints(block, indices, Weights, 3, endpoint0, endpoint1)) {
+            break;
+        }
+    }
+
+    memcpy(dest, &bestColors[0], 2);
+    memcpy(dest + 2, &bestColors[1], 2);
+    uint32_t packedIndices = 0;
+    for (uint32_t i = 0; i < 16; i++) {
+        packedIndices |= (uint32_t)bestIndices[i] << (i * 2);
+    }
+    memcpy(dest + 4, &packedIndices, 4);
+}
+
+static void DecompressBC1(const uint8_t* block, uint8_t texels[16][4])
+{
+    uint16_t color0;
+    uint16_t color1;
+    uint32_t packedIndices;
+    memcpy(&color0, block, 2);
+    memcpy(&color1, block + 2, 2);
+    memcpy(&packedIndices, block + 4, 4);
+
+    PaletteEntry palette[4];
+    BC1Palette(color0, color1, palette);
+    for (uint32_t i = 0; i < 16; i++) {
+        memcpy(texels[i], palette[(packedIndices >> (i * 2)) & 3], 4);
+        texels[i][3] = 255;
+    }
+}
+
+// BC4, one channel
+
+static void BC4Palette(uint8_t value0, uint8_t value1, PaletteEntry* palette)
+{
+    uint32_t values[8] = { value0, value1 };
+    if (value0 > value1) {
+        for (uint32_t i = 2; i < 8; i++) {
+            values[i] = ((8 - i) * value0 + (i - 1) * value1) / 7;
+        }
+    } else {
+        for (uint32_t i = 2; i < 6; i++) {
+            values[i] = ((6 - i) * value0 + (i - 1) * value1) / 5;
+        }
+        values[6] = 0;
+        values[7] = 255;
+    }
+    for (uint32_t i = 0; i < 8; i++) {
+        palette[i][0] = (uint8_t)values[i];
+        palette[i][1] = 0;
+        palette[i][2] = 0;
+        palette[i][3] = 0;
+    }
+}
+
+static void CompressBC4(const BlockTexels& source, uint32_t channel, uint8_t* dest, BlockQuality quality, bool useSIMD)
+{
+    BlockTexels block = {};
+    for (uint32_t i = 0; i < 16; i++) {
+        block.rgba[i][0] = source.rgba[i][channel];
+    }
+
+    static constexpr float Weights[8] = { 0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f };
+
+    float endpoint0[4] = {};
+    float endpoint1[4] = {};
+    PrincipalAxisEndpoints(block, 1, endpoint0, endpoint1);
+
+    uint32_t bestError = UINT32_MAX;
+    uint8_t bestValues[2] = {};
+    uint8_t bestIndices[16] = {};
+    for (uint32_t refinement = 0; refinement <= RefinementCount(quality); refinement++) {
+        // Largest first for the 8 value mode, which is the only one the fit below describes
+        uint8_t value0 = (uint8_t)(std::max(endpoint0[0], endpoint1[0]) + 0.5f);
+        uint8_t value1 = (uint8_t)(std::min(endpoint0[0], endpoint1[0]) + 0.5f);
+        if (endpoint0[0] < endpoint1[0]) {
+            std::swap(endpoint0, endpoint1);
+        }
+
+        PaletteEntry palette[8];
+        BC4Palette(value0, value1, palette);
+        uint8_t indices[16];
+        uint32_t error = SelectIndices(block, palette, 8, indices, useSIMD);
+        if (error < bestError) {
+            bestError = error;
+            bestValues[0] = value0;
+            bestValues[1] = value1;
+            memcpy(bestIndices, indices, sizeof(indices));
+        }
+
+        if (error == 0 || value0 == value1 || !FitEndpoints(block, indices, Weights, 1, endpoint0, endpoint1)) {
+            break;
+        }
+    }
+
+    dest[0] = bestValues[0];
+    dest[1] = bestValues[1];
+    uint64_t packedIndices = 0;
+    for (uint32_t i = 0; i < 16; i++) {
+        packedIndices |= (uint64_t)bestIndices[i] << (i * 3);
+    }
+    memcpy(dest + 2, &packedIndices, 6);
+}
+
+static void DecompressBC4(const uint8_t* block, uint32_t channel, uint8_t texels[16][4])
+{
+    PaletteEntry palette[8];
+    BC4Palette(block[0], block[1], palette);
+    uint64_t packedIndices = 0;
+    memcpy(&packedIndices, block + 2, 6);
+    for (uint32_t i = 0; i < 16; i++) {
+        texels[i][channel] = palette[(packedIndices >> (i * 3)) & 7][0];
+    }
+}
+
+// BC7 mode 6
+
+struct BC7Endpoints
+{
+    // 7 bits per channel
+    uint8_t colors[2][4];
+    uint8_t pBits[2];
+};
+
+static void BC7QuantizeEndpoint(const float endpoint[4], uint8_t pBit, uint8_t color[4])
+{
+    for (uint32_t c = 0; c < 4; c++) {
+        color[c] = (uint8_t)std::clamp((int)((endpoint[c] - pBit) / 2.0f + 0.5f), 0, 127);
+    }
+}
+
+static void BC7Palette(const BC7Endpoints& endpoints, PaletteEntry* palette)
+{
+    uint32_t values[2][4];
+    for (uint32_t e = 0; e < 2; e++) {
+        for (uint32_t c = 0; c < 4; c++) {
+            values[e][c] = (endpoints.colors[e][c] << 1) | endpoints.pBits[e];
+        }
+    }
+    for (uint32_t i = 0; i < 16; i++) {
+        for (uint32_t c = 0; c < 4; c++) {
+            palette[i][c] = (uint8_t)(((64 - BC7Weights[i]) * values[0][c] + BC7Weights[i] * values[1][c] + 32) >> 6);
+        }
+    }
+}
+
+static void CompressBC7(const BlockTexels& block, uint8_t* dest, BlockQuality quality, bool useSIMD)
+{
+    static const std::array<float, 16> Weights = []() {
+        std::array<float, 16> weights;
+        for (uint32_t i = 0; i < 16; i++) {
+            weights[i] = BC7Weights[i] / 64.0f;
+        }
+        return weights;
+    }();
+
+    float endpoint0[4];
+    float endpoint1[4];
+    PrincipalAxisEndpoints(block, 4, endpoint0, endpoint1);
+
+    uint32_t bestError = UINT32_MAX;
+    BC7Endpoints bestEndpoints = {};
+    uint8_t bestIndices[16] = {};
+    for (uint32_t refinement = 0; refinement <= RefinementCount(quality); refinement++) {
+        uint8_t currentIndices[16] = {};
+        uint32_t currentError = UINT32_MAX;
+        // Fast takes the shared bit closest to each endpoint's mean rather than trying all four
+        uint32_t pBitCombinations = quality == BlockQuality::Fast ? 1 : 4;
+        for (uint32_t pBits = 0; pBits < pBitCombinations; pBits++) {
+            BC7Endpoints endpoints;
+            endpoints.pBits[0] = pBits & 1;
+            endpoints.pBits[1] = pBits >> 1;
+            if (quality == BlockQuality::Fast) {
+                float mean0 = (endpoint0[0] + endpoint0[1] + endpoint0[2] + endpoint0[3]) / 4.0f;
+                float mean1 = (endpoint1[0] + endpoint1[1] + endpoint1[2] + endpoint1[3]) / 4.0f;
+                endpoints.pBits[0] = (uint8_t)((int)(mean0 + 0.5f) & 1);
+                endpoints.pBits[1] = (uint8_t)((int)(mean1 + 0.5f) & 1);
+            }
+            BC7QuantizeEndpoint(endpoint0, endpoints.pBits[0], endpoints.colors[0]);
+            BC7QuantizeEndpoint(endpoint1, endpoints.pBits[1], endpoints.colors[1]);
+
+            PaletteEntry palette[16];
+            BC7Palette(endpoints, palette);
+            uint8_t indices[16];
+            uint32_t error = SelectIndices(block, palette, 16, indices, useSIMD);
+            if (error < currentError) {
+                currentError = error;
+                memcpy(currentIndices, indices, sizeof(indices));
+            }
+            if (error < bestError) {
+                bestError = error;
+                bestEndpoints = endpoints;
+                memcpy(bestIndices, indices, sizeof(indices));
+            }
+        }
+
+        if (bestError == 0 || !FitEndpoints(block, currentIndices, Weights.data(), 4, endpoint0, endpoint1)) {
+            break;
+        }
+    }
+
+    // The first texel's index has an implied 0 top bit, so the endpoints swap if it's set
+    if (bestIndices[0] >= 8) {
+        std::swap(bestEndpoints.colors[0], bestEndpoints.colors[1]);
+        std::swap(bestEndpoints.pBits[0], bestEndpoints.pBits[1]);
+        for (uint8_t& index : bestIndices) {
+            index = 15 - index;
+        }
+    }
+
+    memset(dest, 0, 16);
+    uint32_t bit = 0;
+    WriteBits(dest, bit, 1 << 6, 7);
+    for (uint32_t c = 0; c < 4; c++) {
+        WriteBits(dest, bit, bestEndpoints.colors[0][c], 7);
+        WriteBits(dest, bit, bestEndpoints.colors[1][c], 7);
+    }
+    WriteBits(dest, bit, bestEndpoints.pBits[0], 1);
+    WriteBits(dest, bit, bestEndpoints.pBits[1], 1);
+    for (uint32_t i = 0; i < 16; i++) {
+        WriteBits(dest, bit, bestIndices[i], i == 0 ? 3 : 4);
+    }
+}
+
+static void DecompressBC7(const uint8_t* block, uint8_t texels[16][4])
+{
+    uint32_t bit = 0;
+    if (ReadBits(block, bit, 7) != 1 << 6) {
+        for (uint32_t i = 0; i < 16; i++) {
+            texels[i][0] = 255;
+            texels[i][1] = 0;
+            texels[i][2] = 255;
+            texels[i][3] = 255;
+        }
+        return;
+    }
+
+    BC7Endpoints endpoints;
+    for (uint32_t c = 0; c < 4; c++) {
+        endpoints.colors[0][c] = (uint8_t)ReadBits(block, bit, 7);
+        endpoints.colors[1][c] = (uint8_t)ReadBits(block, bit, 7);
+    }
+    endpoints.pBits[0] = (uint8_t)ReadBits(block, bit, 1);
+    endpoints.pBits[1] = (uint8_t)ReadBits(block, bit, 1);
+
+    PaletteEntry palette[16];
+    BC7Palette(endpoints, palette);
+    for (uint32_t i = 0; i < 16; i++) {
+        memcpy(texels[i], palette[ReadBits(block, bit, i == 0 ? 3 : 4)], 4);
+    }
+}
+
+void CompressBlocks(
+    BlockFormat format,
+    const uint8_t* rgba,
+    size_t rowPitch,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* dest,
+    size_t destRowPitch,
+    BlockQuality quality,
+    bool useSIMD,
+    uint32_t threadCount
+)
+{
+    // Enough rows of blocks that a thread has more work than it costs to start it
+    const uint32_t MinBlockRowsPerThread = 8;
+
+    uint32_t blocksWide = (width + 3) / 4;
+    uint32_t blocksHigh = (height + 3) / 4;
+    uint32_t blockBytes = BlockBytes(format);
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threadCount = std::clamp(blocksHigh / MinBlockRowsPerThread, 1u, threadCount);
+
+    auto compressRows = [&](uint32_t firstRow, uint32_t endRow) {
+        BlockTexels block;
+        for (uint32_t blockY = firstRow; blockY < endRow; blockY++) {
+            uint8_t* destRow = dest + blockY * destRowPitch;
+            for (uint32_t blockX = 0; blockX < blocksWide; blockX++) {
+                LoadBlock(rgba, rowPitch, width, height, blockX, blockY, block);
+                uint8_t* destBlock = destRow + blockX * blockBytes;
+                switch (format) {
+                case BlockFormat::BC1:
+                    CompressBC1(block, destBlock, quality, useSIMD);
+                    break;
+                case BlockFormat::BC4:
+                    CompressBC4(block, 0, destBlock, quality, useSIMD);
+                    break;
+                case BlockFormat::BC5:
+                    CompressBC4(block, 0, destBlock, quality, useSIMD);
+                    CompressBC4(block, 1, destBlock + 8, quality, useSIMD);
+                    break;
+                case BlockFormat::BC7:
+                    CompressBC7(block, destBlock, quality, useSIMD);
+                    break;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < threadCount; t++) {
+        threads.emplace_back(compressRows, blocksHigh * t / threadCount, blocksHigh * (t + 1) / threadCount);
+    }
+    compressRows(0, blocksHigh / threadCount);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void DecompressBlocks(
+    BlockFormat format,
+    const uint8_t* blocks,
+    size_t blockRowPitch,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* rgba,
+    size_t rowPitch
+)
+{
+    uint32_t blocksWide = (width + 3) / 4;
+    uint32_t blocksHigh = (height + 3) / 4;
+    uint32_t blockBytes = BlockBytes(format);
+
+    for (uint32_t blockY = 0; blockY < blocksHigh; blockY++) {
+        for (uint32_t blockX = 0; blockX < blocksWide; blockX++) {
+            const uint8_t* block = blocks + blockY * blockRowPitch + blockX * blockBytes;
+            uint8_t texels[16][4] = {};
+            for (auto& texel : texels) {
+                texel[3] = 255;
+            }
+
+            switch (format) {
+            case BlockFormat::BC1:
+                DecompressBC1(block, texels);
+                break;
+            case BlockFormat::BC4:
+                DecompressBC4(block, 0, texels);
+                break;
+            case BlockFormat::BC5:
+                DecompressBC4(block, 0, texels);
+                DecompressBC4(block + 8, 1, texels);
+                break;
+            case BlockFormat::BC7:
+                DecompressBC7(block, texels);
+                break;
+            }
+
+            for (uint32_t y = 0; y < 4 && blockY * 4 + y < height; y++) {
+                for (uint32_t x = 0; x < 4 && blockX * 4 + x < width; x++) {
+                    memcpy(rgba + (blockY * 4 + y) * rowPitch + (blockX * 4 + x) * 4, texels[y * 4 + x], 4);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Block compression of RGBA8 images to the BC formats the GPU samples directly.
+//
+// Images are cut into 4x4 blocks. Blocks that run past the right or bottom edge repeat the last
+// column or row. Each block's endpoints start at the extremes of its colors along their principal
+// axis, and are refined with least squares fits of the chosen indices at the higher qualities.
+// Index selection runs 8 texels at a time with AVX2, giving the same indices as the scalar path.
+//
+// BC1 keeps RGB and drops alpha, BC4 keeps red, BC5 keeps red and green. BC7 is always written as
+// mode 6 (one subset, RGBA endpoints with a shared bit, 4 bit indices), which handles alpha and
+// smooth gradients well but is weaker than a full mode search on blocks with sharp color edges.
+
+enum class BlockFormat : uint32_t
+{
+    BC1,
+    BC4,
+    BC5,
+    BC7,
+};
+
+enum class BlockQuality : uint32_t
+{
+    // Principal axis endpoints only
+    Fast,
+    // One least squares refinement, and every shared bit combination for BC7
+    Normal,
+    // Three least squares refinements
+    High,
+};
+
+// Bytes in one 4x4 block
+uint32_t BlockBytes(BlockFormat format);
+
+// Compresses an RGBA8 image into rows of blocks, destRowPitch bytes apart.
+// Rows of blocks are split across threads, 0 picks a count based on the number of rows.
+void CompressBlocks(
+    BlockFormat format,
+    const uint8_t* rgba,
+    size_t rowPitch,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* dest,
+    size_t destRowPitch,
+    BlockQuality quality,
+    bool useSIMD = true,
+    uint32_t threadCount = 1
+);
+
+// Decodes blocks back to RGBA8, to measure the error of CompressBlocks(). Channels a format drops
+// decode as 0, with alpha as 255. Only BC7 mode 6 is decoded, other BC7 modes decode as magenta.
+void DecompressBlocks(
+    BlockFormat format,
+    const uint8_t* blocks,
+    size_t blockRowPitch,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* rgba,
+    size_t rowPitch
+);
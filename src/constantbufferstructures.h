@@ -1,14 +1,16 @@
 #include <glm/glm.hpp>
 
-struct PrimitiveInstanceConstantData
+// Per pass camera matrices. Instances only store their world matrix in the instance buffer.
+struct ViewConstantData
 {
-    // MVP & MV are PerMesh, but most meshes only have one primitive.
-    glm::mat4 MVP;
-    glm::mat4 MV;
-    glm::mat4 M;
-    float padding[16];
+    glm::mat4 viewProjection;
+    glm::mat4 view;
+    UINT instanceBufferIndex;
+    UINT lightBufferIndex;
+    UINT transparentLightListIndex;
+    float pad[29];
 };
-static_assert((sizeof(PrimitiveInstanceConstantData) % 256) == 0, "Constant buffer must be 256-byte aligned");
+static_assert((sizeof(ViewConstantData) % 256) == 0, "Constant buffer must be 256-byte aligned");
 
 struct MaterialConstantData
 {
@@ -33,34 +35,29 @@ struct LightPassConstantData
     glm::vec4 eyePosWorld;
     UINT baseGBufferIndex;
     UINT debug;
-    float pad[22];
-};
-static_assert((sizeof(LightPassConstantData) % 256) == 0, "Constant buffer must be 256-byte aligned");
-
-struct LightConstantData
-{
-    glm::vec4 position;
-    glm::vec4 direction;
 
-    glm::vec4 positionViewSpace;
-    glm::vec4 directionViewSpace;
+    // Light cluster lookup, see lightclusters.h
+    UINT clusterBufferIndex;
+    UINT clusterLightIndicesIndex;
+    float clusterDepthScale;
+    float clusterDepthBias;
+    UINT clusterCountX;
+    UINT clusterCountY;
+    UINT clusterCountZ;
 
-    glm::vec4 colorIntensity;
+    // Baked irradiance probes, see probevolume.h
+    UINT probeVolumeIndex;
+    UINT probeVolumeEnabled;
+    UINT pad;
+    glm::vec4 probeVolumeMin;
+    glm::vec4 probeVolumeInverseSize;
+    glm::uvec4 probeVolumeCounts;
 
-    // MVP used for rendering.
-    // For spot lights, this is the spot lights point of view.
-    // For point lights, this transforms the sphere into the world.
-    glm::mat4 MVP;
-
-    float range;
-    UINT shadowMapDescriptorIdx;
-    UINT lightType;
-
-    UINT castsShadow;
-
-    float pad[24];
+    // Cosine convolved L2 SH of the skybox radiance, packed like ProbeGPUData in probevolume.h
+    glm::vec4 skyIrradiance[7];
+    glm::vec4 pad2[9];
 };
-static_assert((sizeof(LightConstantData) % 256) == 0, "Constant buffer must be 256-byte aligned");
+static_assert((sizeof(LightPassConstantData) % 256) == 0, "Constant buffer must be 256-byte aligned");
 
 struct RayTraceInfoConstantData
 {
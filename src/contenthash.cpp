@@ -0,0 +1,28 @@
+#include "contenthash.h"
+
+// Header only, so the hash inlines into this file and nothing else sees the XXH names
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+ContentHash HashContent(const void* data, size_t size, uint64_t seed)
+{
+    XXH128_hash_t hash = XXH3_128bits_withSeed(data, size, seed);
+    return ContentHash{ hash.low64, hash.high64 };
+}
+
+uint32_t HashContent32(const void* data, size_t size)
+{
+    ContentHash hash = HashContent(data, size);
+    return (uint32_t)(hash.low ^ (hash.low >> 32));
+}
+
+std::string ContentHash::ToHex() const
+{
+    static constexpr char Digits[] = "0123456789abcdef";
+    std::string hex(32, '0');
+    for (int i = 0; i < 16; i++) {
+        hex[15 - i] = Digits[(high >> (i * 4)) & 0xF];
+        hex[31 - i] = Digits[(low >> (i * 4)) & 0xF];
+    }
+    return hex;
+}
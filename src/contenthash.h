@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Fast 128 bit hash of a byte range, for recognising content that was already processed.
+//
+// It's XXH3_128bits from the vendored xxHash (thirdparty/include/xxhash.h), which picks its AVX2
+// path when the build enables AVX2. It's not a cryptographic hash.
+
+struct ContentHash
+{
+    uint64_t low = 0;
+    uint64_t high = 0;
+
+    bool operator==(const ContentHash&) const = default;
+
+    // 32 hex digits
+    std::string ToHex() const;
+};
+
+ContentHash HashContent(const void* data, size_t size, uint64_t seed = 0);
+
+// HashContent() folded to 32 bits, for hash tables and file headers that only keep that much
+uint32_t HashContent32(const void* data, size_t size);
@@ -0,0 +1,556 @@
+#include "cookedmodel.h"
+#include "decodepool.h"
+#include "mipchain.h"
+
+#include <json.hpp>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+static constexpr char CookedModelMagic[4] = { 'M', 'D', 'C', 'M' };
+static constexpr uint32_t CookedModelVersion = 2;
+
+// Buffers only need to be aligned for the CPU reads of the loader
+static constexpr uint64_t CookedBufferAlignment = 16;
+
+struct CookedModelFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t bufferCount;
+    uint32_t textureCount;
+    uint32_t mipCount;
+    uint32_t jsonSize;
+    uint64_t jsonOffset;
+};
+
+struct CookedBufferEntry
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct CookedTextureEntry
+{
+    uint32_t format;
+    uint32_t isSRGB;
+    uint32_t width;
+    uint32_t height;
+    uint32_t firstMip;
+    uint32_t mipCount;
+};
+
+struct CookedMipEntry
+{
+    uint64_t offset;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowPitch;
+    uint32_t padding;
+};
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+std::vector<bool> DetermineSRGBTextures(const tinygltf::Model& model)
+{
+    std::vector<bool> imageIsSRGB(model.images.size(), false);
+
+    // The only textures in a GLTF model that are SRGB are the base color textures.
+    for (const auto& material : model.materials) {
+        auto textureIndex = material.pbrMetallicRoughness.baseColorTexture.index;
+        if (textureIndex != -1) {
+            auto imageIndex = model.textures[textureIndex].source;
+            if (imageIndex != -1) {
+                imageIsSRGB[imageIndex] = true;
+            }
+        }
+    }
+
+    return imageIsSRGB;
+}
+
+uint32_t CookedRowCount(CookedTextureFormat format, uint32_t height)
+{
+    return format == CookedTextureFormat_RGBA8 ? height : (height + 3) / 4;
+}
+
+uint32_t CookedRowBytes(CookedTextureFormat format, uint32_t width)
+{
+    switch (format) {
+    case CookedTextureFormat_BC1:
+    case CookedTextureFormat_BC4:
+        return (width + 3) / 4 * 8;
+    case CookedTextureFormat_BC5:
+    case CookedTextureFormat_BC7:
+        return (width + 3) / 4 * 16;
+    default:
+        return width * 4;
+    }
+}
+
+static BlockFormat ToBlockFormat(CookedTextureFormat format)
+{
+    switch (format) {
+    case CookedTextureFormat_BC1:
+        return BlockFormat::BC1;
+    case CookedTextureFormat_BC4:
+        return BlockFormat::BC4;
+    case CookedTextureFormat_BC5:
+        return BlockFormat::BC5;
+    default:
+        return BlockFormat::BC7;
+    }
+}
+
+// Picks each image's format from the channels its materials read. An image used more than
+// one way gets BC7, which keeps every channel.
+static std::vector<CookedTextureFormat> ChooseTextureFormats(const tinygltf::Model& model)
+{
+    enum ImageUsage : uint32_t
+    {
+        ImageUsage_BaseColor = 1 << 0,
+        ImageUsage_MetallicRoughness = 1 << 1,
+        ImageUsage_Normal = 1 << 2,
+        ImageUsage_Occlusion = 1 << 3,
+        ImageUsage_Emissive = 1 << 4,
+    };
+
+    std::vector<uint32_t> usage(model.images.size(), 0);
+    auto addUsage = [&](int textureIndex, uint32_t flag) {
+        if (textureIndex >= 0 && textureIndex < (int)model.textures.size()) {
+            int imageIndex = model.textures[textureIndex].source;
+            if (imageIndex >= 0 && imageIndex < (int)usage.size()) {
+                usage[imageIndex] |= flag;
+            }
+        }
+    };
+    for (const auto& material : model.materials) {
+        addUsage(material.pbrMetallicRoughness.baseColorTexture.index, ImageUsage_BaseColor);
+        addUsage(material.pbrMetallicRoughness.metallicRoughnessTexture.index, ImageUsage_MetallicRoughness);
+        addUsage(material.normalTexture.index, ImageUsage_Normal);
+        addUsage(material.occlusionTexture.index, ImageUsage_Occlusion);
+        addUsage(material.emissiveTexture.index, ImageUsage_Emissive);
+    }
+
+    std::vector<CookedTextureFormat> formats(model.images.size(), CookedTextureFormat_BC7);
+    for (size_t i = 0; i < model.images.size(); i++) {
+        const tinygltf::Image& image = model.images[i];
+        if (image.width % 4 != 0 || image.height % 4 != 0) {
+            formats[i] = CookedTextureFormat_RGBA8;
+        } else if (usage[i] == ImageUsage_Normal) {
+            // Only x and y are stored, the shader rebuilds z
+            formats[i] = CookedTextureFormat_BC5;
+        } else if (usage[i] == ImageUsage_Occlusion) {
+            formats[i] = CookedTextureFormat_BC4;
+        } else if (usage[i] != 0 && (usage[i] & ~(ImageUsage_MetallicRoughness | ImageUsage_Occlusion | ImageUsage_Emissive)) == 0) {
+            // None of these read alpha
+            formats[i] = CookedTextureFormat_BC1;
+        }
+    }
+    return formats;
+}
+
+// Address of element i of an accessor in the model's buffers
+static const unsigned char* AccessorElement(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t i)
+{
+    const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+    return model.buffers[view.buffer].data.data() + view.byteOffset + accessor.byteOffset + i * (size_t)accessor.ByteStride(view);
+}
+
+static bool IsFloatAccessor(const tinygltf::Model& model, int accessorIndex, int type)
+{
+    if (accessorIndex < 0 || accessorIndex >= (int)model.accessors.size()) {
+        return false;
+    }
+    const tinygltf::Accessor& accessor = model.accessors[accessorIndex];
+    return accessor.bufferView >= 0 && accessor.type == type && accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && !accessor.sparse.isSparse;
+}
+
+// Per vertex tangents from the UV gradients of each triangle, summed over the triangles sharing the vertex
+// (Lengyel's method). It isn't MikkTSpace, but matches it closely enough on the UV layouts models ship with.
+// The tangents are appended to a new buffer, one buffer view and accessor per primitive.
+static void GenerateTangents(tinygltf::Model& model)
+{
+    std::vector<unsigned char> tangentData;
+    int tangentBuffer = (int)model.buffers.size();
+
+    for (auto& mesh : model.meshes) {
+        for (auto& primitive : mesh.primitives) {
+            auto position = primitive.attributes.find("POSITION");
+            auto normal = primitive.attributes.find("NORMAL");
+            auto texcoord = primitive.attributes.find("TEXCOORD_0");
+            if (texcoord == primitive.attributes.end()) {
+                texcoord = primitive.attributes.find("TEXCOORD");
+            }
+            if (primitive.mode != TINYGLTF_MODE_TRIANGLES || primitive.indices < 0 ||
+                primitive.attributes.contains("TANGENT") ||
+                position == primitive.attributes.end() || normal == primitive.attributes.end() || texcoord == primitive.attributes.end() ||
+                !IsFloatAccessor(model, position->second, TINYGLTF_TYPE_VEC3) ||
+                !IsFloatAccessor(model, normal->second, TINYGLTF_TYPE_VEC3) ||
+                !IsFloatAccessor(model, texcoord->second, TINYGLTF_TYPE_VEC2)) {
+                continue;
+            }
+
+            const tinygltf::Accessor& positions = model.accessors[position->second];
+            const tinygltf::Accessor& normals = model.accessors[normal->second];
+            const tinygltf::Accessor& texcoords = model.accessors[texcoord->second];
+            const tinygltf::Accessor& indices = model.accessors[primitive.indices];
+            if (indices.bufferView < 0 || normals.count != positions.count || texcoords.count != positions.count) {
+                continue;
+            }
+
+            auto readVec3 = [&](const tinygltf::Accessor& accessor, size_t i) {
+                glm::vec3 v;
+                memcpy(&v, AccessorElement(model, accessor, i), sizeof(v));
+                return v;
+            };
+            auto readVec2 = [&](const tinygltf::Accessor& accessor, size_t i) {
+                glm::vec2 v;
+                memcpy(&v, AccessorElement(model, accessor, i), sizeof(v));
+                return v;
+            };
+            auto readIndex = [&](size_t i) -> uint32_t {
+                const unsigned char* element = AccessorElement(model, indices, i);
+                switch (indices.componentType) {
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                    return *element;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                    return *reinterpret_cast<const uint16_t*>(element);
+                default:
+                    return *reinterpret_cast<const uint32_t*>(element);
+                }
+            };
+
+            size_t vertexCount = positions.count;
+            std::vector<glm::vec3> uTangents(vertexCount, glm::vec3(0.0f));
+            std::vector<glm::vec3> vTangents(vertexCount, glm::vec3(0.0f));
+
+            for (size_t triangle = 0; triangle + 2 < indices.count; triangle += 3) {
+                uint32_t i0 = readIndex(triangle + 0);
+                uint32_t i1 = readIndex(triangle + 1);
+                uint32_t i2 = readIndex(triangle + 2);
+                if (i0 >= vertexCount || i1 >= vertexCount || i2 >= vertexCount) {
+                    continue;
+                }
+
+                glm::vec3 p0 = readVec3(positions, i0);
+                glm::vec3 e1 = readVec3(positions, i1) - p0;
+                glm::vec3 e2 = readVec3(positions, i2) - p0;
+                glm::vec2 uv0 = readVec2(texcoords, i0);
+                glm::vec2 d1 = readVec2(texcoords, i1) - uv0;
+                glm::vec2 d2 = readVec2(texcoords, i2) - uv0;
+
+                float determinant = d1.x * d2.y - d2.x * d1.y;
+                if (fabsf(determinant) < 1e-12f) {
+                    continue;
+                }
+                float r = 1.0f / determinant;
+                glm::vec3 uDirection = (e1 * d2.y - e2 * d1.y) * r;
+                glm::vec3 vDirection = (e2 * d1.x - e1 * d2.x) * r;
+
+                for (uint32_t vertex : { i0, i1, i2 }) {
+                    uTangents[vertex] += uDirection;
+                    vTangents[vertex] += vDirection;
+                }
+            }
+
+            size_t byteOffset = tangentData.size();
+            tangentData.resize(byteOffset + vertexCount * sizeof(glm::vec4));
+            glm::vec4* tangents = reinterpret_cast<glm::vec4*>(tangentData.data() + byteOffset);
+
+            for (size_t vertex = 0; vertex < vertexCount; vertex++) {
+                glm::vec3 n = readVec3(normals, vertex);
+                glm::vec3 t = uTangents[vertex] - n * glm::dot(n, uTangents[vertex]);
+                if (glm::dot(t, t) < 1e-20f) {
+                    // No UV gradient, any direction perpendicular to the normal will do
+                    t = glm::cross(n, fabsf(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f));
+                }
+                t = glm::normalize(t);
+                // GLTF UVs start at the top of the image, so the bitangent points towards decreasing v
+                float handedness = glm::dot(glm::cross(n, t), vTangents[vertex]) > 0.0f ? -1.0f : 1.0f;
+                tangents[vertex] = glm::vec4(t, handedness);
+            }
+
+            tinygltf::BufferView bufferView;
+            bufferView.buffer = tangentBuffer;
+            bufferView.byteOffset = byteOffset;
+            bufferView.byteLength = vertexCount * sizeof(glm::vec4);
+            bufferView.byteStride = sizeof(glm::vec4);
+            bufferView.target = TINYGLTF_TARGET_ARRAY_BUFFER;
+            model.bufferViews.push_back(bufferView);
+
+            tinygltf::Accessor accessor;
+            accessor.bufferView = (int)model.bufferViews.size() - 1;
+            accessor.byteOffset = 0;
+            accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+            accessor.type = TINYGLTF_TYPE_VEC4;
+            accessor.count = vertexCount;
+            model.accessors.push_back(accessor);
+
+            primitive.attributes["TANGENT"] = (int)model.accessors.size() - 1;
+        }
+    }
+
+    if (!tangentData.empty()) {
+        tinygltf::Buffer buffer;
+        buffer.name = "Cooked tangents";
+        buffer.data = std::move(tangentData);
+        model.buffers.push_back(std::move(buffer));
+    }
+}
+
+bool CookModel(tinygltf::Model& model, const CookSettings& settings, std::vector<uint8_t>& out, std::string& error)
+{
+    if (settings.generateTangents) {
+        GenerateTangents(model);
+    }
+
+    std::vector<bool> imageIsSRGB = DetermineSRGBTextures(model);
+    std::vector<CookedTextureFormat> imageFormats = settings.compressTextures
+        ? ChooseTextureFormats(model)
+        : std::vector<CookedTextureFormat>(model.images.size(), CookedTextureFormat_RGBA8);
+
+    struct CookedImage
+    {
+        CookedTextureEntry entry;
+        // Mip 0, taken out of the model's image
+        std::vector<unsigned char> pixels;
+        std::vector<MipLevel> mipLevels;
+        std::vector<uint8_t> mipChain;
+        // Every mip with rows of blocks packed together, if the format is block compressed
+        std::vector<std::vector<uint8_t>> compressedMips;
+    };
+    std::vector<CookedImage> images;
+    images.reserve(model.images.size());
+    uint32_t mipCount = 0;
+
+    for (size_t i = 0; i < model.images.size(); i++) {
+        const tinygltf::Image& image = model.images[i];
+        size_t expectedSize = (size_t)image.width * image.height * 4;
+        if (image.width <= 0 || image.height <= 0 || image.component != 4 || image.bits != 8 || image.image.size() != expectedSize) {
+            error = "Image " + std::to_string(i) + " (" + image.name + image.uri + ") isn't decoded to RGBA8";
+            return false;
+        }
+
+        CookedImage cooked;
+        cooked.pixels = std::move(model.images[i].image);
+        cooked.mipLevels = MipChainLevels((uint32_t)image.width, (uint32_t)image.height);
+        cooked.entry.format = imageFormats[i];
+        cooked.entry.isSRGB = imageIsSRGB[i];
+        cooked.entry.width = (uint32_t)image.width;
+        cooked.entry.height = (uint32_t)image.height;
+        cooked.entry.firstMip = mipCount;
+        cooked.entry.mipCount = (uint32_t)cooked.mipLevels.size() + 1;
+        mipCount += cooked.entry.mipCount;
+        images.push_back(std::move(cooked));
+    }
+
+    // One image per thread, each image's rows are on the same thread. Mips are compressed
+    // on the same thread too, while the image is still in cache.
+    {
+        DecodePool mipPool((uint32_t)images.size(), [&](uint32_t i) {
+            CookedImage& cooked = images[i];
+            cooked.mipChain.resize(MipChainSize(cooked.entry.width, cooked.entry.height));
+            GenerateMipChain(cooked.pixels.data(), (size_t)cooked.entry.width * 4, cooked.entry.width, cooked.entry.height, cooked.entry.isSRGB, cooked.mipChain.data());
+
+            CookedTextureFormat format = (CookedTextureFormat)cooked.entry.format;
+            if (format == CookedTextureFormat_RGBA8) {
+                return;
+            }
+            cooked.compressedMips.resize(cooked.entry.mipCount);
+            for (uint32_t mip = 0; mip < cooked.entry.mipCount; mip++) {
+                uint32_t width = mip == 0 ? cooked.entry.width : cooked.mipLevels[mip - 1].width;
+                uint32_t height = mip == 0 ? cooked.entry.height : cooked.mipLevels[mip - 1].height;
+                const uint8_t* source = mip == 0 ? cooked.pixels.data() : cooked.mipChain.data() + cooked.mipLevels[mip - 1].offset;
+                uint32_t rowBytes = CookedRowBytes(format, width);
+                cooked.compressedMips[mip].resize((size_t)rowBytes * CookedRowCount(format, height));
+                CompressBlocks(ToBlockFormat(format), source, (size_t)width * 4, width, height, cooked.compressedMips[mip].data(), rowBytes, settings.compressionQuality);
+            }
+        });
+        while (mipPool.WaitNext()) {
+        }
+    }
+
+    // Buffer contents and images go in the tables. A 1 byte buffer is written as a data URI,
+    // which tinygltf will parse without any files or copies.
+    std::vector<std::vector<unsigned char>> buffers;
+    for (auto& buffer : model.buffers) {
+        buffers.push_back(std::move(buffer.data));
+        buffer.data = { 0 };
+        buffer.uri.clear();
+    }
+    std::vector<std::string> imageNames;
+    for (const auto& image : model.images) {
+        imageNames.push_back(image.name);
+    }
+    model.images.clear();
+
+    std::stringstream gltfStream;
+    tinygltf::TinyGLTF writer;
+    if (!writer.WriteGltfSceneToStream(&model, gltfStream, false, false)) {
+        error = "Failed to serialize the GLTF JSON";
+        return false;
+    }
+
+    auto document = nlohmann::json::parse(gltfStream.str(), nullptr, false);
+    if (document.is_discarded()) {
+        error = "Failed to serialize the GLTF JSON";
+        return false;
+    }
+    if (!imageNames.empty()) {
+        // With TINYGLTF_NO_EXTERNAL_IMAGE an image with an empty uri is left untouched
+        auto& jsonImages = document["images"] = nlohmann::json::array();
+        for (const std::string& name : imageNames) {
+            nlohmann::json image = { { "uri", "" } };
+            if (!name.empty()) {
+                image["name"] = name;
+            }
+            jsonImages.push_back(std::move(image));
+        }
+    }
+    std::string json = document.dump();
+
+    // Lay out the file: header, tables, JSON, buffers, then mips
+    CookedModelFileHeader header = {};
+    memcpy(header.magic, CookedModelMagic, sizeof(header.magic));
+    header.version = CookedModelVersion;
+    header.bufferCount = (uint32_t)buffers.size();
+    header.textureCount = (uint32_t)images.size();
+    header.mipCount = mipCount;
+    header.jsonSize = (uint32_t)json.size();
+
+    uint64_t offset = sizeof(header) + buffers.size() * sizeof(CookedBufferEntry) + images.size() * sizeof(CookedTextureEntry) + mipCount * sizeof(CookedMipEntry);
+    header.jsonOffset = offset;
+    offset += json.size();
+
+    std::vector<CookedBufferEntry> bufferEntries;
+    for (const auto& buffer : buffers) {
+        offset = AlignUp(offset, CookedBufferAlignment);
+        bufferEntries.push_back(CookedBufferEntry{ offset, buffer.size() });
+        offset += buffer.size();
+    }
+
+    std::vector<CookedMipEntry> mipEntries;
+    for (const auto& image : images) {
+        CookedTextureFormat format = (CookedTextureFormat)image.entry.format;
+        uint32_t width = image.entry.width;
+        uint32_t height = image.entry.height;
+        for (uint32_t mip = 0; mip < image.entry.mipCount; mip++) {
+            offset = AlignUp(offset, CookedMipAlignment);
+            uint32_t rowPitch = (uint32_t)AlignUp(CookedRowBytes(format, width), CookedRowPitchAlignment);
+            mipEntries.push_back(CookedMipEntry{ offset, width, height, rowPitch, 0 });
+            offset += (uint64_t)rowPitch * CookedRowCount(format, height);
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+        }
+    }
+
+    out.assign(offset, 0);
+    uint8_t* file = out.data();
+    uint64_t tableOffset = 0;
+    auto writeTable = [&](const void* data, size_t size) {
+        memcpy(file + tableOffset, data, size);
+        tableOffset += size;
+    };
+    writeTable(&header, sizeof(header));
+    writeTable(bufferEntries.data(), bufferEntries.size() * sizeof(CookedBufferEntry));
+    for (const auto& image : images) {
+        writeTable(&image.entry, sizeof(image.entry));
+    }
+    writeTable(mipEntries.data(), mipEntries.size() * sizeof(CookedMipEntry));
+
+    memcpy(file + header.jsonOffset, json.data(), json.size());
+    for (size_t i = 0; i < buffers.size(); i++) {
+        memcpy(file + bufferEntries[i].offset, buffers[i].data(), buffers[i].size());
+    }
+
+    size_t mipEntry = 0;
+    for (const auto& image : images) {
+        CookedTextureFormat format = (CookedTextureFormat)image.entry.format;
+        for (uint32_t mip = 0; mip < image.entry.mipCount; mip++) {
+            const CookedMipEntry& entry = mipEntries[mipEntry++];
+            const uint8_t* source = !image.compressedMips.empty() ? image.compressedMips[mip].data()
+                : mip == 0 ? image.pixels.data()
+                : image.mipChain.data() + image.mipLevels[mip - 1].offset;
+            size_t rowSize = CookedRowBytes(format, entry.width);
+            for (uint32_t y = 0; y < CookedRowCount(format, entry.height); y++) {
+                memcpy(file + entry.offset + (uint64_t)y * entry.rowPitch, source + y * rowSize, rowSize);
+            }
+        }
+    }
+
+    return true;
+}
+
+bool ReadCookedModel(std::span<const uint8_t> bytes, CookedModel& cooked)
+{
+    CookedModelFileHeader header;
+    if (bytes.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (memcmp(header.magic, CookedModelMagic, sizeof(header.magic)) != 0 || header.version != CookedModelVersion) {
+        return false;
+    }
+
+    auto inBounds = [&](uint64_t offset, uint64_t size) {
+        return offset <= bytes.size() && size <= bytes.size() - offset;
+    };
+
+    uint64_t tableSize = (uint64_t)header.bufferCount * sizeof(CookedBufferEntry) +
+        (uint64_t)header.textureCount * sizeof(CookedTextureEntry) +
+        (uint64_t)header.mipCount * sizeof(CookedMipEntry);
+    if (!inBounds(sizeof(header), tableSize) || !inBounds(header.jsonOffset, header.jsonSize)) {
+        return false;
+    }
+
+    const uint8_t* table = bytes.data() + sizeof(header);
+    std::vector<CookedBufferEntry> bufferEntries(header.bufferCount);
+    std::vector<CookedTextureEntry> textureEntries(header.textureCount);
+    std::vector<CookedMipEntry> mipEntries(header.mipCount);
+    memcpy(bufferEntries.data(), table, bufferEntries.size() * sizeof(CookedBufferEntry));
+    table += bufferEntries.size() * sizeof(CookedBufferEntry);
+    memcpy(textureEntries.data(), table, textureEntries.size() * sizeof(CookedTextureEntry));
+    table += textureEntries.size() * sizeof(CookedTextureEntry);
+    memcpy(mipEntries.data(), table, mipEntries.size() * sizeof(CookedMipEntry));
+
+    cooked.json = std::span(reinterpret_cast<const char*>(bytes.data() + header.jsonOffset), header.jsonSize);
+
+    cooked.buffers.clear();
+    for (const auto& entry : bufferEntries) {
+        if (!inBounds(entry.offset, entry.size)) {
+            return false;
+        }
+        cooked.buffers.push_back(bytes.subspan(entry.offset, entry.size));
+    }
+
+    cooked.textures.clear();
+    for (const auto& entry : textureEntries) {
+        if (entry.format > CookedTextureFormat_BC7 || entry.mipCount == 0 || entry.firstMip > header.mipCount || entry.mipCount > header.mipCount - entry.firstMip) {
+            return false;
+        }
+
+        CookedTexture texture;
+        texture.format = (CookedTextureFormat)entry.format;
+        texture.isSRGB = entry.isSRGB != 0;
+        texture.width = entry.width;
+        texture.height = entry.height;
+        for (uint32_t mip = entry.firstMip; mip < entry.firstMip + entry.mipCount; mip++) {
+            const CookedMipEntry& mipEntry = mipEntries[mip];
+            uint64_t size = (uint64_t)mipEntry.rowPitch * CookedRowCount(texture.format, mipEntry.height);
+            if (mipEntry.rowPitch < CookedRowBytes(texture.format, mipEntry.width) || !inBounds(mipEntry.offset, size)) {
+                return false;
+            }
+            texture.mips.push_back(CookedMip{ mipEntry.width, mipEntry.height, mipEntry.rowPitch, bytes.subspan(mipEntry.offset, size) });
+        }
+        cooked.textures.push_back(std::move(texture));
+    }
+
+    return true;
+}
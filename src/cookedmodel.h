@@ -0,0 +1,91 @@
+#pragma once
+
+#include "blockcompress.h"
+
+#include <tiny_gltf.h>
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// A cooked model (.mdxrmodel) is a GLTF model with the load time processing already done.
+//
+// The file holds the GLTF JSON, every buffer, and every image as a full mip chain. Each mip is
+// stored with the row pitch and placement the D3D12 copy queue reads textures with, so the loader
+// maps the file and copies buffers and mips straight into upload memory. Images are not decoded and
+// mips are not generated when loading. Triangle primitives with normals and UVs but no tangents have
+// tangents generated, so they can be shaded with their normal maps.
+//
+// Images are block compressed by how the materials use them: normal maps to BC5, occlusion to BC4,
+// metallic roughness and emissive to BC1, and base color or anything else to BC7. Images whose size
+// isn't a multiple of 4 stay RGBA8, as D3D12 needs the top mip of a block compressed texture to be.
+//
+// The JSON is plain GLTF that tinygltf parses, except the buffers are 1 byte placeholders and the
+// images are empty. Their contents are in the buffer and texture tables instead.
+
+constexpr const char* CookedModelExtension = ".mdxrmodel";
+
+// D3D12_TEXTURE_DATA_PITCH_ALIGNMENT and D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT
+constexpr uint32_t CookedRowPitchAlignment = 256;
+constexpr uint32_t CookedMipAlignment = 512;
+
+enum CookedTextureFormat : uint32_t
+{
+    CookedTextureFormat_RGBA8 = 0,
+    CookedTextureFormat_BC1 = 1,
+    CookedTextureFormat_BC4 = 2,
+    CookedTextureFormat_BC5 = 3,
+    CookedTextureFormat_BC7 = 4,
+};
+
+struct CookedMip
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowPitch;
+    // Rows of rowPitch bytes, one per row of texels or of 4x4 blocks
+    std::span<const uint8_t> data;
+};
+
+struct CookedTexture
+{
+    CookedTextureFormat format;
+    bool isSRGB;
+    uint32_t width;
+    uint32_t height;
+    std::vector<CookedMip> mips;
+};
+
+// A cooked model read from a file. Every span points into the file's bytes.
+struct CookedModel
+{
+    std::span<const char> json;
+    // Indexed by GLTF buffer index
+    std::vector<std::span<const uint8_t>> buffers;
+    // Indexed by GLTF image index
+    std::vector<CookedTexture> textures;
+};
+
+struct CookSettings
+{
+    bool generateTangents = true;
+    // RGBA8 for every image if false
+    bool compressTextures = true;
+    BlockQuality compressionQuality = BlockQuality::Normal;
+};
+
+// Gets a vector of booleans parallel to model.images to determine which
+// images are SRGB. This information is needed to generate the mipmaps properly.
+std::vector<bool> DetermineSRGBTextures(const tinygltf::Model& model);
+
+// Rows of data in a mip of the format, and the bytes in each before padding to CookedRowPitchAlignment
+uint32_t CookedRowCount(CookedTextureFormat format, uint32_t height);
+uint32_t CookedRowBytes(CookedTextureFormat format, uint32_t width);
+
+// Cooks a loaded GLTF model into the bytes of a .mdxrmodel file.
+// Images must already be decoded to RGBA8. model is modified along the way and shouldn't be used afterwards.
+bool CookModel(tinygltf::Model& model, const CookSettings& settings, std::vector<uint8_t>& out, std::string& error);
+
+// Returns false if bytes isn't a cooked model of the current version or is truncated
+bool ReadCookedModel(std::span<const uint8_t> bytes, CookedModel& cooked);
@@ -0,0 +1,770 @@
+// mdxrcook: cooks .gltf and .glb files into .mdxrmodel files, see cookedmodel.h.
+//
+// Usage: mdxrcook [--quality fast|normal|high] [--uncompressed] <input.gltf|input.glb> [output.mdxrmodel]
+// The output defaults to the input path with the .mdxrmodel extension.
+//
+// mdxrcook --benchmark [--quality fast|normal|high] <input.gltf|input.glb|image>
+// Block compresses every image to every format without writing anything, and prints the speed
+// of the AVX2 and scalar compressors and the error of each format.
+//
+// mdxrcook --benchmark-io <directory>
+// Reads every file under the directory with blocking reads, the AsyncFileReader thread pool and
+// io_uring, small and large files apart, and prints the throughput of each warm and cold.
+//
+// mdxrcook --benchmark-mips
+// Generates mips of synthetic sRGB and linear images with every GenerateMipChain path, prints the
+// speed of each, and fails unless they all agree and stay within 1 of the double precision filter.
+// Images with 1 to 4 channels must also give the same mips through DecodedImage as expanded to RGBA8.
+//
+// mdxrcook --check <input.gltf|input.glb>...
+// Cooks each model with and without block compression, reads it back and fails unless every buffer,
+// mip size, row pitch, format and texel matches, and truncated or other version copies are rejected.
+
+#include "cookedmodel.h"
+#include "asyncread.h"
+#include "imagedecode.h"
+#include "mipchain.h"
+
+// Unlike the app (see tiny_gltf_impl.cpp) the cooker lets tinygltf load external images itself
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <tiny_gltf.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Decodes every image to RGBA8, the only format the cooker takes
+static bool DecodeImage(
+    tinygltf::Image* image,
+    const int imageIndex,
+    std::string* /*err*/,
+    std::string* warn,
+    int /*requestedWidth*/,
+    int /*requestedHeight*/,
+    const unsigned char* bytes,
+    int size,
+    void* /*userData*/
+)
+{
+    int width, height;
+    unsigned char* pixels = stbi_load_from_memory(bytes, size, &width, &height, nullptr, STBI_rgb_alpha);
+    if (!pixels) {
+        if (warn) {
+            *warn += "Failed to decode image " + std::to_string(imageIndex) + ": " + stbi_failure_reason() + "\n";
+        }
+        return true;
+    }
+
+    image->width = width;
+    image->height = height;
+    image->component = STBI_rgb_alpha;
+    image->bits = 8;
+    image->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+    image->image.assign(pixels, pixels + (size_t)width * height * STBI_rgb_alpha);
+    stbi_image_free(pixels);
+    return true;
+}
+
+static bool LoadModel(const std::filesystem::path& inputPath, tinygltf::Model& model)
+{
+    tinygltf::TinyGLTF loader;
+    loader.SetImageLoader(DecodeImage, nullptr);
+
+    std::string err;
+    std::string warn;
+    bool loaded = inputPath.extension() == ".glb"
+        ? loader.LoadBinaryFromFile(&model, &err, &warn, inputPath.string())
+        : loader.LoadASCIIFromFile(&model, &err, &warn, inputPath.string());
+    if (!warn.empty()) {
+        std::cerr << warn;
+    }
+    if (!loaded) {
+        std::cerr << "Failed to load " << inputPath.string() << ":\n" << err;
+        return false;
+    }
+
+    // The app can't load a model with an image missing, so stand in a white texel like an untextured material
+    for (auto& image : model.images) {
+        if (image.image.empty()) {
+            std::cerr << "Image " << image.name << image.uri << " is missing, it will be cooked as 1x1 white\n";
+            image.width = 1;
+            image.height = 1;
+            image.component = 4;
+            image.bits = 8;
+            image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+            image.image.assign(4, 255);
+        }
+    }
+    return true;
+}
+
+static float Milliseconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<float, std::milli>(duration).count();
+}
+
+// Compresses every image of a model, or a single image file, to each block format at one quality
+static int Benchmark(const std::filesystem::path& inputPath, BlockQuality quality)
+{
+    tinygltf::Model model;
+    std::string extension = inputPath.extension().string();
+    if (extension == ".gltf" || extension == ".glb") {
+        if (!LoadModel(inputPath, model)) {
+            return 1;
+        }
+    } else {
+        int width, height;
+        unsigned char* pixels = stbi_load(inputPath.string().c_str(), &width, &height, nullptr, STBI_rgb_alpha);
+        if (!pixels) {
+            std::cerr << "Failed to load " << inputPath.string() << ": " << stbi_failure_reason() << "\n";
+            return 1;
+        }
+        tinygltf::Image image;
+        image.width = width;
+        image.height = height;
+        image.image.assign(pixels, pixels + (size_t)width * height * STBI_rgb_alpha);
+        stbi_image_free(pixels);
+        model.images.push_back(std::move(image));
+    }
+
+    struct FormatInfo
+    {
+        BlockFormat format;
+        const char* name;
+        // Channels the format keeps, the only ones the error is measured over
+        uint32_t channels;
+    };
+    const FormatInfo formats[] = {
+        { BlockFormat::BC1, "BC1", 3 },
+        { BlockFormat::BC4, "BC4", 1 },
+        { BlockFormat::BC5, "BC5", 2 },
+        { BlockFormat::BC7, "BC7", 4 },
+    };
+
+    uint32_t threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    const char* qualityNames[] = { "fast", "normal", "high" };
+    std::cout << "Compressing " << model.images.size() << " images at " << qualityNames[(uint32_t)quality] << " quality, "
+        << threadCount << " threads\n";
+
+    bool mismatch = false;
+    for (const FormatInfo& info : formats) {
+        double pixelCount = 0.0;
+        double squaredError = 0.0;
+        float threadedMS = 0.0f;
+        float singleThreadMS = 0.0f;
+        float scalarMS = 0.0f;
+
+        for (const tinygltf::Image& image : model.images) {
+            uint32_t width = (uint32_t)image.width;
+            uint32_t height = (uint32_t)image.height;
+            size_t blockRowPitch = (size_t)(width + 3) / 4 * BlockBytes(info.format);
+            size_t blocksSize = blockRowPitch * ((height + 3) / 4);
+            std::vector<uint8_t> threaded(blocksSize);
+            std::vector<uint8_t> singleThread(blocksSize);
+            std::vector<uint8_t> scalar(blocksSize);
+
+            auto start = std::chrono::steady_clock::now();
+            CompressBlocks(info.format, image.image.data(), (size_t)width * 4, width, height, threaded.data(), blockRowPitch, quality, true, 0);
+            auto threadedEnd = std::chrono::steady_clock::now();
+            CompressBlocks(info.format, image.image.data(), (size_t)width * 4, width, height, singleThread.data(), blockRowPitch, quality, true, 1);
+            auto singleThreadEnd = std::chrono::steady_clock::now();
+            CompressBlocks(info.format, image.image.data(), (size_t)width * 4, width, height, scalar.data(), blockRowPitch, quality, false, 1);
+            auto scalarEnd = std::chrono::steady_clock::now();
+
+            threadedMS += Milliseconds(threadedEnd - start);
+            singleThreadMS += Milliseconds(singleThreadEnd - threadedEnd);
+            scalarMS += Milliseconds(scalarEnd - singleThreadEnd);
+            mismatch |= threaded != singleThread || threaded != scalar;
+
+            std::vector<uint8_t> decoded((size_t)width * height * 4);
+            DecompressBlocks(info.format, threaded.data(), blockRowPitch, width, height, decoded.data(), (size_t)width * 4);
+            for (size_t i = 0; i < (size_t)width * height; i++) {
+                for (uint32_t c = 0; c < info.channels; c++) {
+                    double difference = (double)image.image[i * 4 + c] - decoded[i * 4 + c];
+                    squaredError += difference * difference;
+                }
+            }
+            pixelCount += (double)width * height;
+        }
+
+        double meanSquaredError = squaredError / std::max(pixelCount * info.channels, 1.0);
+        double psnr = meanSquaredError > 0.0 ? 10.0 * log10(255.0 * 255.0 / meanSquaredError) : INFINITY;
+        auto megapixelsPerSecond = [&](float ms) {
+            return ms > 0.0f ? pixelCount / (ms * 1000.0) : 0.0;
+        };
+        std::cout << info.name << ": " << threadedMS << "ms, " << megapixelsPerSecond(threadedMS) << " MPix/s threaded, "
+            << megapixelsPerSecond(singleThreadMS) << " MPix/s single thread, " << megapixelsPerSecond(scalarMS) << " MPix/s scalar, "
+            << "RMSE " << sqrt(meanSquaredError) << ", PSNR " << psnr << "dB\n";
+    }
+
+    if (mismatch) {
+        std::cerr << "The AVX2, scalar and threaded compressors gave different blocks\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Drops a file's pages from the OS file cache so the next read comes from disk. Only Linux
+// allows this without privileges, elsewhere it does nothing and cold reads are warm.
+static void EvictFromFileCache(const std::string& path)
+{
+#ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+}
+
+// Reads files far enough apart to check every reader got the same bytes, without the check
+// costing as much as the read
+static uint64_t SampleBytes(const std::vector<uint8_t>& bytes)
+{
+    uint64_t sum = bytes.size();
+    for (size_t i = 0; i < bytes.size(); i += 4096) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+static int BenchmarkIO(const std::filesystem::path& directory)
+{
+    // Around the size of a glTF, a small texture or a chunk of geometry, and the rest
+    const uint64_t SmallFileBytes = 256 * 1024;
+    const uint32_t MaxInFlight = 64;
+    const uint32_t ThreadCount = 4;
+
+    std::vector<std::string> smallFiles;
+    std::vector<std::string> largeFiles;
+    uint64_t smallBytes = 0;
+    uint64_t largeBytes = 0;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(directory, ec)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+        uint64_t size = entry.file_size();
+        (size < SmallFileBytes ? smallFiles : largeFiles).push_back(entry.path().string());
+        (size < SmallFileBytes ? smallBytes : largeBytes) += size;
+    }
+    if (smallFiles.empty() && largeFiles.empty()) {
+        std::cerr << "No files in " << directory.string() << "\n";
+        return 1;
+    }
+
+    auto blockingRead = [](const std::vector<std::string>& files) {
+        uint64_t sum = 0;
+        for (const std::string& path : files) {
+            std::vector<uint8_t> bytes(std::filesystem::file_size(path));
+            std::FILE* file = std::fopen(path.c_str(), "rb");
+            if (file) {
+                bytes.resize(std::fread(bytes.data(), 1, bytes.size(), file));
+                std::fclose(file);
+            }
+            sum += SampleBytes(bytes);
+        }
+        return sum;
+    };
+    auto asyncRead = [](AsyncFileReader& reader, const std::vector<std::string>& files) {
+        std::atomic<uint64_t> sum = 0;
+        for (const std::string& path : files) {
+            reader.Read(path, [&](bool, std::vector<uint8_t>&& bytes) {
+                sum += SampleBytes(bytes);
+            });
+        }
+        reader.Wait();
+        return sum.load();
+    };
+
+    AsyncFileReader threadPool(AsyncReadBackend::ThreadPool, MaxInFlight, ThreadCount);
+    AsyncFileReader ioUring(AsyncReadBackend::IOUring, MaxInFlight, ThreadCount);
+    if (ioUring.Backend() != AsyncReadBackend::IOUring) {
+        std::cout << "io_uring isn't available, the io_uring results are the thread pool\n";
+    }
+
+    struct Method
+    {
+        const char* name;
+        std::function<uint64_t(const std::vector<std::string>&)> read;
+    };
+    const Method methods[] = {
+        { "blocking", blockingRead },
+        { "thread pool", [&](const std::vector<std::string>& files) { return asyncRead(threadPool, files); } },
+        { "io_uring", [&](const std::vector<std::string>& files) { return asyncRead(ioUring, files); } },
+    };
+
+    std::cout << "Reading " << smallFiles.size() << " small files (" << smallBytes / 1024 << "KB) and " << largeFiles.size()
+        << " large files (" << largeBytes / (1024 * 1024) << "MB), " << MaxInFlight << " reads in flight for io_uring, "
+        << ThreadCount << " pool threads\n";
+
+    bool mismatch = false;
+    const struct
+    {
+        const char* name;
+        const std::vector<std::string>& files;
+        uint64_t bytes;
+    } groups[] = { { "small", smallFiles, smallBytes }, { "large", largeFiles, largeBytes } };
+    for (const auto& group : groups) {
+        if (group.files.empty()) {
+            continue;
+        }
+        uint64_t expectedSum = blockingRead(group.files);
+        for (bool cold : { true, false }) {
+            for (const Method& method : methods) {
+                if (cold) {
+                    for (const std::string& path : group.files) {
+                        EvictFromFileCache(path);
+                    }
+                }
+                auto start = std::chrono::steady_clock::now();
+                uint64_t sum = method.read(group.files);
+                float ms = Milliseconds(std::chrono::steady_clock::now() - start);
+                mismatch |= sum != expectedSum;
+
+                std::cout << group.name << (cold ? " cold " : " warm ") << method.name << ": " << ms << "ms, "
+                    << group.bytes / (1024.0 * 1024.0) / (ms / 1000.0) << " MB/s, "
+                    << group.files.size() / (ms / 1000.0) << " files/s\n";
+            }
+        }
+    }
+
+    if (mismatch) {
+        std::cerr << "The readers read different bytes\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Noise over a gradient, so both the table lookups and the rounding see every value
+static std::vector<uint8_t> MakeMipTestImage(uint32_t width, uint32_t height)
+{
+    std::mt19937 random(1234);
+    std::vector<uint8_t> image((size_t)width * height * 4);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint8_t* texel = &image[((size_t)y * width + x) * 4];
+            texel[0] = (uint8_t)((x * 255 / width + random() % 32) & 0xFF);
+            texel[1] = (uint8_t)((y * 255 / height + random() % 32) & 0xFF);
+            texel[2] = (uint8_t)(random() & 0xFF);
+            texel[3] = (uint8_t)(random() & 0xFF);
+        }
+    }
+    return image;
+}
+
+// Generates the mips of an image with every path, returns false if they disagree with each
+// other or any mip is more than 1 away from filtering the mip above it in double precision
+static bool BenchmarkMipImage(uint32_t width, uint32_t height, bool isSRGB)
+{
+    std::vector<uint8_t> image = MakeMipTestImage(width, height);
+
+    size_t chainSize = MipChainSize(width, height);
+    std::vector<uint8_t> simd(chainSize);
+    std::vector<uint8_t> singleThread(chainSize);
+    std::vector<uint8_t> scalar(chainSize);
+
+    auto start = std::chrono::steady_clock::now();
+    GenerateMipChain(image.data(), (size_t)width * 4, width, height, isSRGB, simd.data(), true, 0);
+    auto simdEnd = std::chrono::steady_clock::now();
+    GenerateMipChain(image.data(), (size_t)width * 4, width, height, isSRGB, singleThread.data(), true, 1);
+    auto singleThreadEnd = std::chrono::steady_clock::now();
+    GenerateMipChain(image.data(), (size_t)width * 4, width, height, isSRGB, scalar.data(), false, 1);
+    auto scalarEnd = std::chrono::steady_clock::now();
+
+    // Every path has to give the same bytes
+    bool pathsAgree = simd == scalar && singleThread == scalar;
+
+    // Rounding differences compound down a chain, so each mip is compared against the reference
+    // filter of the mip above it rather than of the image
+    std::vector<MipLevel> levels = MipChainLevels(width, height);
+    int maxError = 0;
+    std::vector<uint8_t> reference;
+    for (size_t i = 0; i < levels.size(); i++) {
+        const uint8_t* source = i == 0 ? image.data() : simd.data() + levels[i - 1].offset;
+        uint32_t sourceWidth = i == 0 ? width : levels[i - 1].width;
+        uint32_t sourceHeight = i == 0 ? height : levels[i - 1].height;
+        reference.resize(MipChainSize(sourceWidth, sourceHeight));
+        GenerateMipChainReference(source, (size_t)sourceWidth * 4, sourceWidth, sourceHeight, isSRGB, reference.data());
+        for (size_t b = 0; b < (size_t)levels[i].width * levels[i].height * 4; b++) {
+            maxError = std::max(maxError, std::abs((int)simd[levels[i].offset + b] - (int)reference[b]));
+        }
+    }
+
+    float simdMS = Milliseconds(simdEnd - start);
+    auto megapixelsPerSecond = [&](float ms) {
+        return ms > 0.0f ? (double)width * height / (ms * 1000.0) : 0.0;
+    };
+    std::cout << width << "x" << height << (isSRGB ? " sRGB: " : " linear: ") << simdMS << "ms, "
+        << megapixelsPerSecond(simdMS) << " MPix/s threaded, "
+        << megapixelsPerSecond(Milliseconds(singleThreadEnd - simdEnd)) << " MPix/s single thread, "
+        << megapixelsPerSecond(Milliseconds(scalarEnd - singleThreadEnd)) << " MPix/s scalar, "
+        << (pathsAgree ? "paths agree, " : "PATHS DISAGREE, ") << maxError << " max error against double precision\n";
+
+    return pathsAgree && maxError <= 1;
+}
+
+// Generates the mips of an image stored with 1 to 4 channels with DecodedImage::GenerateMipChain, which
+// expands rows as it goes, and returns false unless it gives the same bytes as expanding the image first
+static bool BenchmarkDecodedImageMips(uint32_t width, uint32_t height, bool isSRGB)
+{
+    std::vector<uint8_t> image = MakeMipTestImage(width, height);
+    bool passed = true;
+
+    for (uint32_t components = 1; components <= 4; components++) {
+        // The first channels of the test image, the last one is alpha with 2 channels
+        std::vector<uint8_t> stored((size_t)width * height * components);
+        for (size_t i = 0; i < (size_t)width * height; i++) {
+            for (uint32_t c = 0; c < components; c++) {
+                stored[i * components + c] = image[i * 4 + (components == 2 && c == 1 ? 3 : c)];
+            }
+        }
+        // TGA keeps every channel count and is quick to write
+        std::vector<uint8_t> tga;
+        stbi_write_tga_to_func([](void* context, void* data, int size) {
+            auto* bytes = static_cast<std::vector<uint8_t>*>(context);
+            bytes->insert(bytes->end(), static_cast<uint8_t*>(data), static_cast<uint8_t*>(data) + size);
+        }, &tga, (int)width, (int)height, (int)components, stored.data());
+
+        DecodedImage decoded;
+        if (!decoded.Decode(tga) || decoded.Components() != components) {
+            std::cerr << "Failed to decode the " << components << " channel test image\n";
+            passed = false;
+            continue;
+        }
+
+        size_t chainSize = MipChainSize(width, height);
+        std::vector<uint8_t> expanded((size_t)width * height * 4);
+        std::vector<uint8_t> expandedChain(chainSize);
+        std::vector<uint8_t> threaded(chainSize);
+        std::vector<uint8_t> singleThread(chainSize);
+
+        auto start = std::chrono::steady_clock::now();
+        decoded.WriteRGBA8(expanded.data(), (size_t)width * 4);
+        GenerateMipChain(expanded.data(), (size_t)width * 4, width, height, isSRGB, expandedChain.data(), true, 0);
+        auto expandedEnd = std::chrono::steady_clock::now();
+        // A fixed count, so the row split is checked on any machine
+        decoded.GenerateMipChain(isSRGB, threaded.data(), 4);
+        auto threadedEnd = std::chrono::steady_clock::now();
+        decoded.GenerateMipChain(isSRGB, singleThread.data(), 1);
+        auto singleThreadEnd = std::chrono::steady_clock::now();
+
+        bool identical = threaded == expandedChain && singleThread == expandedChain;
+        passed &= identical;
+        std::cout << width << "x" << height << (isSRGB ? " sRGB " : " linear ") << components << " channels: "
+            << Milliseconds(expandedEnd - start) << "ms expanded first, " << Milliseconds(threadedEnd - expandedEnd) << "ms in place on 4 threads, "
+            << Milliseconds(singleThreadEnd - threadedEnd) << "ms single thread, " << (identical ? "identical" : "DIFFERENT") << "\n";
+    }
+
+    return passed;
+}
+
+static int BenchmarkMips()
+{
+    bool passed = BenchmarkMipImage(2048, 2048, true);
+    passed &= BenchmarkMipImage(2048, 2048, false);
+    // Odd edges reuse their last row or column
+    passed &= BenchmarkMipImage(1000, 333, true);
+    passed &= BenchmarkMipImage(1, 77, true);
+
+    passed &= BenchmarkDecodedImageMips(1024, 1024, true);
+    passed &= BenchmarkDecodedImageMips(1000, 333, false);
+    passed &= BenchmarkDecodedImageMips(333, 1, true);
+    passed &= BenchmarkDecodedImageMips(1, 77, true);
+
+    // Black and white checkers average to half the light, which is 188 in sRGB rather than 128
+    const uint32_t CheckerSize = 64;
+    std::vector<uint8_t> checker((size_t)CheckerSize * CheckerSize * 4);
+    for (uint32_t y = 0; y < CheckerSize; y++) {
+        for (uint32_t x = 0; x < CheckerSize; x++) {
+            uint8_t value = (x + y) % 2 ? 255 : 0;
+            memset(&checker[((size_t)y * CheckerSize + x) * 4], value, 4);
+        }
+    }
+    std::vector<uint8_t> checkerMips(MipChainSize(CheckerSize, CheckerSize));
+    GenerateMipChain(checker.data(), CheckerSize * 4, CheckerSize, CheckerSize, true, checkerMips.data());
+    std::cout << "50% checkers filter to " << (int)checkerMips[0] << " in sRGB, alpha to " << (int)checkerMips[3] << "\n";
+    passed &= checkerMips[0] == 188 && checkerMips[3] == 128;
+
+    if (!passed) {
+        std::cerr << "Mip generation failed its checks\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Cooks a model, reads it back and compares every buffer and mip against the loaded model,
+// returns false if anything differs or ReadCookedModel accepts a damaged copy of the file
+static bool CheckCookedModel(const std::filesystem::path& inputPath, const CookSettings& settings)
+{
+    tinygltf::Model model;
+    if (!LoadModel(inputPath, model)) {
+        return false;
+    }
+    // CookModel takes the model apart
+    const tinygltf::Model original = model;
+    std::vector<bool> imageIsSRGB = DetermineSRGBTextures(original);
+
+    std::vector<uint8_t> bytes;
+    std::string error;
+    if (!CookModel(model, settings, bytes, error)) {
+        std::cerr << "Failed to cook " << inputPath.string() << ": " << error << "\n";
+        return false;
+    }
+
+    std::vector<std::string> failures;
+    auto expect = [&](bool condition, const std::string& what) {
+        if (!condition) {
+            failures.push_back(what);
+        }
+    };
+
+    CookedModel cooked;
+    if (!ReadCookedModel(bytes, cooked)) {
+        std::cerr << inputPath.string() << ": ReadCookedModel rejected the cooked bytes\n";
+        return false;
+    }
+
+    // The JSON still parses as GLTF, with the buffers and images in the tables instead
+    tinygltf::TinyGLTF loader;
+    loader.SetImageLoader([](tinygltf::Image*, const int, std::string*, std::string*, int, int, const unsigned char*, int, void*) { return true; }, nullptr);
+    tinygltf::Model parsed;
+    std::string warn;
+    expect(loader.LoadASCIIFromString(&parsed, &error, &warn, cooked.json.data(), (unsigned int)cooked.json.size(), ""), "JSON parses: " + error);
+    expect(parsed.buffers.size() == cooked.buffers.size(), "JSON buffer count");
+    expect(parsed.images.size() == original.images.size(), "JSON image count");
+    expect(parsed.meshes.size() == original.meshes.size() && parsed.accessors.size() >= original.accessors.size(), "JSON meshes and accessors");
+
+    // Generated tangents are the only buffer added
+    expect(cooked.buffers.size() == original.buffers.size() || cooked.buffers.size() == original.buffers.size() + 1, "buffer count");
+    for (size_t i = 0; i < std::min(cooked.buffers.size(), original.buffers.size()); i++) {
+        const std::vector<unsigned char>& data = original.buffers[i].data;
+        expect(cooked.buffers[i].size() == data.size() && std::equal(data.begin(), data.end(), cooked.buffers[i].begin()), "buffer " + std::to_string(i));
+    }
+
+    expect(cooked.textures.size() == original.images.size(), "texture count");
+    for (size_t i = 0; i < std::min(cooked.textures.size(), original.images.size()); i++) {
+        const CookedTexture& texture = cooked.textures[i];
+        const tinygltf::Image& image = original.images[i];
+        std::string name = "texture " + std::to_string(i) + " ";
+        uint32_t width = (uint32_t)image.width;
+        uint32_t height = (uint32_t)image.height;
+        bool blockAligned = width % 4 == 0 && height % 4 == 0;
+
+        expect(texture.width == width && texture.height == height, name + "size");
+        expect(texture.isSRGB == imageIsSRGB[i], name + "sRGB");
+        expect(settings.compressTextures && blockAligned ? texture.format != CookedTextureFormat_RGBA8 : texture.format == CookedTextureFormat_RGBA8, name + "format");
+
+        std::vector<MipLevel> levels = MipChainLevels(width, height);
+        std::vector<uint8_t> mipChain(MipChainSize(width, height));
+        GenerateMipChain(image.image.data(), (size_t)width * 4, width, height, imageIsSRGB[i], mipChain.data());
+        expect(texture.mips.size() == levels.size() + 1, name + "mip count");
+
+        for (size_t mip = 0; mip < std::min(texture.mips.size(), levels.size() + 1); mip++) {
+            const CookedMip& cookedMip = texture.mips[mip];
+            std::string mipName = name + "mip " + std::to_string(mip) + " ";
+            uint32_t mipWidth = mip == 0 ? width : levels[mip - 1].width;
+            uint32_t mipHeight = mip == 0 ? height : levels[mip - 1].height;
+            const uint8_t* source = mip == 0 ? image.image.data() : mipChain.data() + levels[mip - 1].offset;
+            uint32_t rowBytes = CookedRowBytes(texture.format, mipWidth);
+            uint32_t rowCount = CookedRowCount(texture.format, mipHeight);
+            expect(cookedMip.width == mipWidth && cookedMip.height == mipHeight, mipName + "size");
+            expect(cookedMip.rowPitch == (rowBytes + CookedRowPitchAlignment - 1) / CookedRowPitchAlignment * CookedRowPitchAlignment, mipName + "row pitch");
+            expect(cookedMip.data.size() == (size_t)cookedMip.rowPitch * rowCount, mipName + "data size");
+            expect((cookedMip.data.data() - bytes.data()) % CookedMipAlignment == 0, mipName + "placement");
+            if (cookedMip.width != mipWidth || cookedMip.height != mipHeight || cookedMip.data.size() != (size_t)cookedMip.rowPitch * rowCount) {
+                continue;
+            }
+
+            // Block compression is deterministic, so compressed mips are compared against compressing the expected mip
+            std::vector<uint8_t> expected((size_t)rowBytes * rowCount);
+            if (texture.format == CookedTextureFormat_RGBA8) {
+                memcpy(expected.data(), source, expected.size());
+            } else {
+                const BlockFormat blockFormats[] = { BlockFormat::BC1, BlockFormat::BC4, BlockFormat::BC5, BlockFormat::BC7 };
+                CompressBlocks(blockFormats[texture.format - CookedTextureFormat_BC1], source, (size_t)mipWidth * 4, mipWidth, mipHeight, expected.data(), rowBytes, settings.compressionQuality);
+            }
+            bool rowsMatch = true;
+            for (uint32_t row = 0; row < rowCount; row++) {
+                rowsMatch &= memcmp(cookedMip.data.data() + (size_t)row * cookedMip.rowPitch, expected.data() + (size_t)row * rowBytes, rowBytes) == 0;
+            }
+            expect(rowsMatch, mipName + "texels");
+        }
+    }
+
+    // Every byte of the file is used, so any truncation has to be caught
+    uint32_t acceptedPrefixes = 0;
+    for (size_t size = 0; size < bytes.size(); size++) {
+        CookedModel truncated;
+        acceptedPrefixes += ReadCookedModel(std::span(bytes.data(), size), truncated);
+    }
+    expect(acceptedPrefixes == 0, std::to_string(acceptedPrefixes) + " truncated files accepted");
+
+    // The version follows the 4 byte magic
+    for (int32_t bump : { 1, -1 }) {
+        std::vector<uint8_t> otherVersion = bytes;
+        uint32_t version;
+        memcpy(&version, otherVersion.data() + 4, sizeof(version));
+        version += bump;
+        memcpy(otherVersion.data() + 4, &version, sizeof(version));
+        CookedModel rejected;
+        expect(!ReadCookedModel(otherVersion, rejected), "version " + std::to_string(version) + " accepted");
+    }
+    std::vector<uint8_t> otherMagic = bytes;
+    otherMagic[0] ^= 0xFF;
+    CookedModel rejected;
+    expect(!ReadCookedModel(otherMagic, rejected), "bad magic accepted");
+
+    std::cout << inputPath.string() << (settings.compressTextures ? " compressed: " : " uncompressed: ") << bytes.size() / 1024 << "KB, "
+        << cooked.buffers.size() << " buffers, " << cooked.textures.size() << " textures, "
+        << (failures.empty() ? "round trips" : "FAILED") << "\n";
+    for (const std::string& failure : failures) {
+        std::cerr << "  " << failure << "\n";
+    }
+    return failures.empty();
+}
+
+static int CheckCook(const std::vector<std::string>& paths)
+{
+    bool passed = true;
+    for (const std::string& path : paths) {
+        for (bool compressTextures : { true, false }) {
+            CookSettings settings;
+            settings.compressTextures = compressTextures;
+            passed &= CheckCookedModel(path, settings);
+        }
+    }
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    const char* usage = "Usage: mdxrcook [--quality fast|normal|high] [--uncompressed] <input.gltf|input.glb> [output.mdxrmodel]\n"
+        "       mdxrcook --benchmark [--quality fast|normal|high] <input.gltf|input.glb|image>\n"
+        "       mdxrcook --benchmark-io <directory>\n"
+        "       mdxrcook --benchmark-mips\n"
+        "       mdxrcook --check <input.gltf|input.glb>...\n";
+
+    CookSettings settings;
+    bool benchmark = false;
+    bool benchmarkIO = false;
+    bool benchmarkMips = false;
+    bool check = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--benchmark") {
+            benchmark = true;
+        } else if (arg == "--benchmark-io") {
+            benchmarkIO = true;
+        } else if (arg == "--benchmark-mips") {
+            benchmarkMips = true;
+        } else if (arg == "--check") {
+            check = true;
+        } else if (arg == "--uncompressed") {
+            settings.compressTextures = false;
+        } else if (arg == "--quality" && i + 1 < argc) {
+            std::string quality = argv[++i];
+            if (quality == "fast") {
+                settings.compressionQuality = BlockQuality::Fast;
+            } else if (quality == "normal") {
+                settings.compressionQuality = BlockQuality::Normal;
+            } else if (quality == "high") {
+                settings.compressionQuality = BlockQuality::High;
+            } else {
+                std::cerr << usage;
+                return 1;
+            }
+        } else if (arg.starts_with("--")) {
+            std::cerr << usage;
+            return 1;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    if (benchmarkMips) {
+        if (!paths.empty()) {
+            std::cerr << usage;
+            return 1;
+        }
+        return BenchmarkMips();
+    }
+
+    if (check) {
+        if (paths.empty()) {
+            std::cerr << usage;
+            return 1;
+        }
+        return CheckCook(paths);
+    }
+
+    if (benchmarkIO) {
+        if (paths.size() != 1) {
+            std::cerr << usage;
+            return 1;
+        }
+        return BenchmarkIO(paths[0]);
+    }
+
+    if (benchmark) {
+        if (paths.size() != 1) {
+            std::cerr << usage;
+            return 1;
+        }
+        return Benchmark(paths[0], settings.compressionQuality);
+    }
+
+    if (paths.empty() || paths.size() > 2) {
+        std::cerr << usage;
+        return 1;
+    }
+
+    std::filesystem::path inputPath = paths[0];
+    std::filesystem::path outputPath = paths.size() == 2 ? std::filesystem::path(paths[1]) : std::filesystem::path(inputPath).replace_extension(CookedModelExtension);
+
+    auto start = std::chrono::steady_clock::now();
+
+    tinygltf::Model model;
+    if (!LoadModel(inputPath, model)) {
+        return 1;
+    }
+
+    auto loadEnd = std::chrono::steady_clock::now();
+
+    std::vector<uint8_t> cooked;
+    std::string error;
+    if (!CookModel(model, settings, cooked, error)) {
+        std::cerr << "Failed to cook " << inputPath.string() << ": " << error << "\n";
+        return 1;
+    }
+
+    auto cookEnd = std::chrono::steady_clock::now();
+
+    std::ofstream file(outputPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(cooked.data()), cooked.size());
+    if (!file.good()) {
+        std::cerr << "Failed to write " << outputPath.string() << "\n";
+        return 1;
+    }
+
+    std::cout << "Cooked " << inputPath.string() << " to " << outputPath.string() << " (" << cooked.size() / 1024 << "KB): "
+        << Milliseconds(loadEnd - start) << "ms loading, " << Milliseconds(cookEnd - loadEnd) << "ms cooking\n";
+
+    return 0;
+}
@@ -0,0 +1,619 @@
+#include "cpubvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+#include <thread>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Past this depth nodes become leaves regardless of cost, which bounds the traversal stacks
+static constexpr uint32_t MaxBVHDepth = 64;
+static constexpr uint32_t TraversalStackSize = MaxBVHDepth + 2;
+
+// Avoids 0 * inf in the slab test, which would make axis aligned rays miss everything
+static float SanitizeDirection(float d)
+{
+    const float MinComponent = 1e-20f;
+    if (std::abs(d) < MinComponent) {
+        return std::signbit(d) ? -MinComponent : MinComponent;
+    }
+    return d;
+}
+
+static float SurfaceArea(const AABB& box)
+{
+    glm::vec3 extent = box.max - box.min;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static void Grow(AABB& box, const AABB& other)
+{
+    box.min = glm::min(box.min, other.min);
+    box.max = glm::max(box.max, other.max);
+}
+
+static void Grow(AABB& box, const glm::vec3& point)
+{
+    box.min = glm::min(box.min, point);
+    box.max = glm::max(box.max, point);
+}
+
+static AABB EmptyAABB()
+{
+    return AABB{ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+}
+
+void RaySoA::Clear()
+{
+    for (int i = 0; i < 3; i++) {
+        origin[i].clear();
+        direction[i].clear();
+    }
+    tMin.clear();
+    tMax.clear();
+    count = 0;
+}
+
+void RaySoA::Push(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, float rayTMin, float rayTMax)
+{
+    for (int i = 0; i < 3; i++) {
+        origin[i].push_back(rayOrigin[i]);
+        direction[i].push_back(SanitizeDirection(rayDirection[i]));
+    }
+    tMin.push_back(rayTMin);
+    tMax.push_back(rayTMax);
+    count++;
+}
+
+void RaySoA::Pad()
+{
+    // An empty interval never hits anything
+    size_t padded = (count + 7) & ~7u;
+    for (int i = 0; i < 3; i++) {
+        origin[i].resize(padded, 0.0f);
+        direction[i].resize(padded, 1.0f);
+    }
+    tMin.resize(padded, 0.0f);
+    tMax.resize(padded, -1.0f);
+}
+
+uint32_t CPUBVH::BuildNode(BuildContext& context, std::vector<BVHNode>& output, uint32_t first, uint32_t count, uint32_t depth, uint32_t parallelDepth)
+{
+    // Below this many triangles a subtree builds quicker than a thread starts
+    const uint32_t MinParallelTriangles = 16384;
+    // Traversal step cost relative to one triangle test
+    const float TraversalCost = 1.0f;
+
+    uint32_t index = (uint32_t)output.size();
+    output.emplace_back();
+
+    AABB bounds = EmptyAABB();
+    AABB centroidBounds = EmptyAABB();
+    for (uint32_t i = first; i < first + count; i++) {
+        uint32_t triangle = context.order[i];
+        Grow(bounds, context.bounds[triangle]);
+        Grow(centroidBounds, context.centroids[triangle]);
+    }
+
+    auto makeLeaf = [&]() {
+        output[index] = BVHNode{ bounds.min, first, bounds.max, BVHNode::LeafFlag | count };
+        return index;
+    };
+
+    if (count == 1 || depth >= MaxBVHDepth) {
+        return makeLeaf();
+    }
+
+    // Bin centroids along each axis and sweep the bins for the cheapest split
+    struct Bin
+    {
+        AABB bounds;
+        uint32_t count;
+    };
+
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+        if (extent <= 0.0f) {
+            continue;
+        }
+        float scale = BinCount / extent;
+
+        std::array<Bin, BinCount> bins;
+        bins.fill(Bin{ EmptyAABB(), 0 });
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t triangle = context.order[i];
+            uint32_t bin = std::min(BinCount - 1, (uint32_t)((context.centroids[triangle][axis] - centroidBounds.min[axis]) * scale));
+            Grow(bins[bin].bounds, context.bounds[triangle]);
+            bins[bin].count++;
+        }
+
+        // Splitting after bin i puts bins [0, i] on the left
+        std::array<float, BinCount - 1> leftCosts;
+        AABB left = EmptyAABB();
+        uint32_t leftCount = 0;
+        for (uint32_t i = 0; i < BinCount - 1; i++) {
+            Grow(left, bins[i].bounds);
+            leftCount += bins[i].count;
+            leftCosts[i] = leftCount > 0 ? SurfaceArea(left) * leftCount : FLT_MAX;
+        }
+
+        AABB right = EmptyAABB();
+        uint32_t rightCount = 0;
+        for (uint32_t i = BinCount - 1; i > 0; i--) {
+            Grow(right, bins[i].bounds);
+            rightCount += bins[i].count;
+            if (rightCount == 0 || leftCosts[i - 1] == FLT_MAX) {
+                continue;
+            }
+
+            float cost = leftCosts[i - 1] + SurfaceArea(right) * rightCount;
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    uint32_t middle;
+    if (bestAxis < 0) {
+        // Every centroid is in the same spot, so any split is as good as another
+        if (count <= MaxLeafTriangles) {
+            return makeLeaf();
+        }
+        middle = first + count / 2;
+    } else {
+        float area = SurfaceArea(bounds);
+        float splitCost = TraversalCost + bestCost / std::max(area, FLT_MIN);
+        if (count <= MaxLeafTriangles && splitCost >= (float)count) {
+            return makeLeaf();
+        }
+
+        float minCentroid = centroidBounds.min[bestAxis];
+        float scale = BinCount / (centroidBounds.max[bestAxis] - minCentroid);
+        auto begin = context.order.begin() + first;
+        middle = (uint32_t)(std::partition(begin, begin + count, [&](uint32_t triangle) {
+            uint32_t bin = std::min(BinCount - 1, (uint32_t)((context.centroids[triangle][bestAxis] - minCentroid) * scale));
+            return bin < bestSplit;
+        }) - context.order.begin());
+    }
+
+    uint32_t leftCount = middle - first;
+    uint32_t rightCount = count - leftCount;
+
+    uint32_t leftChild;
+    uint32_t rightChild;
+    if (parallelDepth > 0 && count >= MinParallelTriangles) {
+        // The halves touch disjoint ranges of order, so the right one can build on its own thread
+        std::vector<BVHNode> rightNodes;
+        std::thread thread([&]() {
+            BuildNode(context, rightNodes, middle, rightCount, depth + 1, parallelDepth - 1);
+        });
+        leftChild = BuildNode(context, output, first, leftCount, depth + 1, parallelDepth - 1);
+        thread.join();
+
+        rightChild = (uint32_t)output.size();
+        for (BVHNode node : rightNodes) {
+            if (!node.IsLeaf()) {
+                node.leftOrFirst += rightChild;
+                node.rightOrCount += rightChild;
+            }
+            output.push_back(node);
+        }
+    } else {
+        leftChild = BuildNode(context, output, first, leftCount, depth + 1, 0);
+        rightChild = BuildNode(context, output, middle, rightCount, depth + 1, 0);
+    }
+
+    output[index] = BVHNode{ bounds.min, leftChild, bounds.max, rightChild };
+    return index;
+}
+
+void CPUBVH::Build(std::span<const glm::vec3> positions, std::span<const uint32_t> indices, uint32_t threadCount)
+{
+    const uint32_t MinTrianglesPerThread = 16384;
+
+    nodes.clear();
+    triangles.clear();
+    triangleIds.clear();
+
+    uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+    if (triangleCount == 0) {
+        return;
+    }
+
+    BuildContext context;
+    context.bounds.resize(triangleCount);
+    context.centroids.resize(triangleCount);
+    context.order.resize(triangleCount);
+    std::iota(context.order.begin(), context.order.end(), 0);
+
+    for (uint32_t i = 0; i < triangleCount; i++) {
+        const glm::vec3& a = positions[indices[i * 3 + 0]];
+        const glm::vec3& b = positions[indices[i * 3 + 1]];
+        const glm::vec3& c = positions[indices[i * 3 + 2]];
+        context.bounds[i] = AABB{ glm::min(glm::min(a, b), c), glm::max(glm::max(a, b), c) };
+        context.centroids[i] = (context.bounds[i].min + context.bounds[i].max) * 0.5f;
+    }
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threadCount = std::clamp(triangleCount / MinTrianglesPerThread, 1u, threadCount);
+
+    // Each parallel level doubles the number of threads building
+    uint32_t parallelDepth = 0;
+    while ((1u << parallelDepth) < threadCount) {
+        parallelDepth++;
+    }
+
+    nodes.reserve(triangleCount / 2);
+    BuildNode(context, nodes, 0, triangleCount, 0, parallelDepth);
+
+    triangles.resize(triangleCount);
+    triangleIds = context.order;
+    for (uint32_t i = 0; i < triangleCount; i++) {
+        uint32_t triangle = context.order[i];
+        const glm::vec3& a = positions[indices[triangle * 3 + 0]];
+        const glm::vec3& b = positions[indices[triangle * 3 + 1]];
+        const glm::vec3& c = positions[indices[triangle * 3 + 2]];
+        triangles[i] = Triangle{ a, b - a, c - a };
+    }
+}
+
+// Moller-Trumbore, two sided. Same operations in the same order as the AVX2 path.
+static bool IntersectTriangle(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    float tMin,
+    float tMax,
+    const glm::vec3& v0,
+    const glm::vec3& edge1,
+    const glm::vec3& edge2,
+    float& outT,
+    float& outU,
+    float& outV
+)
+{
+    glm::vec3 p = glm::cross(direction, edge2);
+    float determinant = glm::dot(edge1, p);
+    if (determinant == 0.0f) {
+        return false;
+    }
+    float inverseDeterminant = 1.0f / determinant;
+
+    glm::vec3 s = origin - v0;
+    float u = glm::dot(s, p) * inverseDeterminant;
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(direction, q) * inverseDeterminant;
+    float t = glm::dot(edge2, q) * inverseDeterminant;
+
+    if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > tMin && t < tMax) {
+        outT = t;
+        outU = u;
+        outV = v;
+        return true;
+    }
+    return false;
+}
+
+static bool IntersectTriangle(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax, const glm::vec3& v0, const glm::vec3& edge1, const glm::vec3& edge2)
+{
+    float t, u, v;
+    return IntersectTriangle(origin, direction, tMin, tMax, v0, edge1, edge2, t, u, v);
+}
+
+// Distance along the ray where it enters the box, or FLT_MAX if it misses within [tMin, tMax]
+static float IntersectBox(const glm::vec3& origin, const glm::vec3& inverseDirection, float tMin, float tMax, const BVHNode& node)
+{
+    glm::vec3 t0 = (node.min - origin) * inverseDirection;
+    glm::vec3 t1 = (node.max - origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, tMin));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= exit ? enter : FLT_MAX;
+}
+
+bool CPUBVH::Occluded(const glm::vec3& origin, const glm::vec3& rayDirection, float tMin, float tMax) const
+{
+    if (nodes.empty() || !(tMax > tMin)) {
+        return false;
+    }
+
+    glm::vec3 direction(SanitizeDirection(rayDirection.x), SanitizeDirection(rayDirection.y), SanitizeDirection(rayDirection.z));
+    glm::vec3 inverseDirection = 1.0f / direction;
+
+    std::array<uint32_t, TraversalStackSize> stack;
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        const BVHNode& node = nodes[stack[--stackSize]];
+        if (IntersectBox(origin, inverseDirection, tMin, tMax, node) == FLT_MAX) {
+            continue;
+        }
+
+        if (node.IsLeaf()) {
+            uint32_t end = node.leftOrFirst + node.TriangleCount();
+            for (uint32_t i = node.leftOrFirst; i < end; i++) {
+                const Triangle& triangle = triangles[i];
+                if (IntersectTriangle(origin, direction, tMin, tMax, triangle.v0, triangle.edge1, triangle.edge2)) {
+                    return true;
+                }
+            }
+        } else {
+            stack[stackSize++] = node.leftOrFirst;
+            stack[stackSize++] = node.rightOrCount;
+        }
+    }
+
+    return false;
+}
+
+bool CPUBVH::Intersect(const glm::vec3& origin, const glm::vec3& rayDirection, float tMin, float tMax, Hit& hit) const
+{
+    if (nodes.empty() || !(tMax > tMin)) {
+        return false;
+    }
+
+    glm::vec3 direction(SanitizeDirection(rayDirection.x), SanitizeDirection(rayDirection.y), SanitizeDirection(rayDirection.z));
+    glm::vec3 inverseDirection = 1.0f / direction;
+
+    if (IntersectBox(origin, inverseDirection, tMin, tMax, nodes[0]) == FLT_MAX) {
+        return false;
+    }
+
+    // Nodes are only pushed after their box test, entries are rechecked against the shrunk ray when popped
+    std::array<std::pair<uint32_t, float>, TraversalStackSize> stack;
+    uint32_t stackSize = 0;
+    stack[stackSize++] = { 0, tMin };
+
+    bool found = false;
+    while (stackSize > 0) {
+        auto [nodeIndex, enter] = stack[--stackSize];
+        if (enter >= tMax) {
+            continue;
+        }
+        const BVHNode& node = nodes[nodeIndex];
+
+        if (node.IsLeaf()) {
+            uint32_t end = node.leftOrFirst + node.TriangleCount();
+            for (uint32_t i = node.leftOrFirst; i < end; i++) {
+                const Triangle& triangle = triangles[i];
+                float t, u, v;
+                if (IntersectTriangle(origin, direction, tMin, tMax, triangle.v0, triangle.edge1, triangle.edge2, t, u, v)) {
+                    tMax = t;
+                    hit = Hit{ t, triangleIds[i], u, v };
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        uint32_t nearChild = node.leftOrFirst;
+        uint32_t farChild = node.rightOrCount;
+        float nearEnter = IntersectBox(origin, inverseDirection, tMin, tMax, nodes[nearChild]);
+        float farEnter = IntersectBox(origin, inverseDirection, tMin, tMax, nodes[farChild]);
+        if (farEnter < nearEnter) {
+            std::swap(nearChild, farChild);
+            std::swap(nearEnter, farEnter);
+        }
+
+        // Far child goes underneath so the near one is popped first
+        if (farEnter != FLT_MAX) {
+            stack[stackSize++] = { farChild, farEnter };
+        }
+        if (nearEnter != FLT_MAX) {
+            stack[stackSize++] = { nearChild, nearEnter };
+        }
+    }
+
+    return found;
+}
+
+bool CPUBVH::OccludedReference(const glm::vec3& origin, const glm::vec3& rayDirection, float tMin, float tMax) const
+{
+    glm::vec3 direction(SanitizeDirection(rayDirection.x), SanitizeDirection(rayDirection.y), SanitizeDirection(rayDirection.z));
+    for (const Triangle& triangle : triangles) {
+        if (IntersectTriangle(origin, direction, tMin, tMax, triangle.v0, triangle.edge1, triangle.edge2)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CPUBVH::OccludedPacket(const RaySoA& rays, std::span<uint8_t> occluded, bool useSIMD) const
+{
+    uint32_t i = 0;
+
+#ifdef __AVX2__
+    if (useSIMD && !nodes.empty()) {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+
+        for (; i < rays.count; i += 8) {
+            __m256 ox = _mm256_load_ps(rays.origin[0].data() + i);
+            __m256 oy = _mm256_load_ps(rays.origin[1].data() + i);
+            __m256 oz = _mm256_load_ps(rays.origin[2].data() + i);
+            __m256 dx = _mm256_load_ps(rays.direction[0].data() + i);
+            __m256 dy = _mm256_load_ps(rays.direction[1].data() + i);
+            __m256 dz = _mm256_load_ps(rays.direction[2].data() + i);
+            __m256 tMin = _mm256_load_ps(rays.tMin.data() + i);
+            __m256 tMax = _mm256_load_ps(rays.tMax.data() + i);
+            __m256 ix = _mm256_div_ps(one, dx);
+            __m256 iy = _mm256_div_ps(one, dy);
+            __m256 iz = _mm256_div_ps(one, dz);
+
+            // Lanes still looking for a hit
+            __m256 active = _mm256_cmp_ps(tMax, tMin, _CMP_GT_OQ);
+            __m256 hits = zero;
+
+            std::array<uint32_t, TraversalStackSize> stack;
+            uint32_t stackSize = 0;
+            stack[stackSize++] = 0;
+
+            // The packet visits a node if any active ray overlaps it
+            while (stackSize > 0 && _mm256_movemask_ps(active)) {
+                const BVHNode& node = nodes[stack[--stackSize]];
+
+                __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.min.x), ox), ix);
+                __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.max.x), ox), ix);
+                __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.min.y), oy), iy);
+                __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.max.y), oy), iy);
+                __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.min.z), oz), iz);
+                __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.max.z), oz), iz);
+                __m256 enter = _mm256_max_ps(
+                    _mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)),
+                    _mm256_max_ps(_mm256_min_ps(t0z, t1z), tMin)
+                );
+                __m256 exit = _mm256_min_ps(
+                    _mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)),
+                    _mm256_min_ps(_mm256_max_ps(t0z, t1z), tMax)
+                );
+                __m256 overlap = _mm256_and_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ), active);
+                if (!_mm256_movemask_ps(overlap)) {
+                    continue;
+                }
+
+                if (!node.IsLeaf()) {
+                    stack[stackSize++] = node.leftOrFirst;
+                    stack[stackSize++] = node.rightOrCount;
+                    continue;
+                }
+
+                uint32_t end = node.leftOrFirst + node.TriangleCount();
+                for (uint32_t triangleIndex = node.leftOrFirst; triangleIndex < end; triangleIndex++) {
+                    const Triangle& triangle = triangles[triangleIndex];
+                    __m256 e1x = _mm256_set1_ps(triangle.edge1.x);
+                    __m256 e1y = _mm256_set1_ps(triangle.edge1.y);
+                    __m256 e1z = _mm256_set1_ps(triangle.edge1.z);
+                    __m256 e2x = _mm256_set1_ps(triangle.edge2.x);
+                    __m256 e2y = _mm256_set1_ps(triangle.edge2.y);
+                    __m256 e2z = _mm256_set1_ps(triangle.edge2.z);
+
+                    // p = cross(direction, edge2)
+                    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+                    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+                    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+                    __m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+                    __m256 inverseDeterminant = _mm256_div_ps(one, determinant);
+
+                    __m256 sx = _mm256_sub_ps(ox, _mm256_set1_ps(triangle.v0.x));
+                    __m256 sy = _mm256_sub_ps(oy, _mm256_set1_ps(triangle.v0.y));
+                    __m256 sz = _mm256_sub_ps(oz, _mm256_set1_ps(triangle.v0.z));
+                    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inverseDeterminant);
+
+                    // q = cross(s, edge1)
+                    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+                    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+                    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+                    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inverseDeterminant);
+                    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inverseDeterminant);
+
+                    __m256 hit = _mm256_cmp_ps(determinant, zero, _CMP_NEQ_OQ);
+                    hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+                    hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+                    hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+                    hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, tMin, _CMP_GT_OQ));
+                    hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, tMax, _CMP_LT_OQ));
+                    hit = _mm256_and_ps(hit, active);
+
+                    hits = _mm256_or_ps(hits, hit);
+                    active = _mm256_andnot_ps(hit, active);
+                    if (!_mm256_movemask_ps(active)) {
+                        break;
+                    }
+                }
+            }
+
+            int mask = _mm256_movemask_ps(hits);
+            uint32_t laneCount = std::min(8u, rays.count - i);
+            for (uint32_t lane = 0; lane < laneCount; lane++) {
+                occluded[i + lane] = (mask >> lane) & 1;
+            }
+        }
+        return;
+    }
+#endif
+
+    for (; i < rays.count; i++) {
+        glm::vec3 origin(rays.origin[0][i], rays.origin[1][i], rays.origin[2][i]);
+        glm::vec3 direction(rays.direction[0][i], rays.direction[1][i], rays.direction[2][i]);
+        occluded[i] = Occluded(origin, direction, rays.tMin[i], rays.tMax[i]);
+    }
+}
+
+float CPUBVH::SAHCost() const
+{
+    if (nodes.empty()) {
+        return 0.0f;
+    }
+
+    float cost = 0.0f;
+    for (const BVHNode& node : nodes) {
+        float area = SurfaceArea(AABB{ node.min, node.max });
+        cost += node.IsLeaf() ? area * node.TriangleCount() : area;
+    }
+    return cost / std::max(SurfaceArea(AABB{ nodes[0].min, nodes[0].max }), FLT_MIN);
+}
+
+void BakeDirectionalVisibility(
+    const CPUBVH& bvh,
+    std::span<const glm::vec3> positions,
+    std::span<const glm::vec3> normals,
+    const glm::vec3& lightDirection,
+    float bias,
+    std::span<float> visibility,
+    uint32_t threadCount
+)
+{
+    const uint32_t MinPointsPerThread = 4096;
+
+    uint32_t count = (uint32_t)positions.size();
+    if (count == 0) {
+        return;
+    }
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threadCount = std::clamp(count / MinPointsPerThread, 1u, threadCount);
+
+    glm::vec3 toLight = -glm::normalize(lightDirection);
+
+    // Neighbouring points usually sit close together, so contiguous chunks keep packets coherent
+    auto bakeChunk = [&](uint32_t thread) {
+        uint32_t begin = (uint32_t)((uint64_t)count * thread / threadCount);
+        uint32_t end = (uint32_t)((uint64_t)count * (thread + 1) / threadCount);
+
+        RaySoA rays;
+        for (uint32_t i = begin; i < end; i++) {
+            rays.Push(positions[i] + normals[i] * bias, toLight, 0.0f, FLT_MAX);
+        }
+        rays.Pad();
+
+        std::vector<uint8_t> occluded(rays.count);
+        bvh.OccludedPacket(rays, occluded);
+        for (uint32_t i = begin; i < end; i++) {
+            visibility[i] = occluded[i - begin] ? 0.0f : 1.0f;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < threadCount; t++) {
+        threads.emplace_back(bakeChunk, t);
+    }
+    bakeChunk(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
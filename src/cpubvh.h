@@ -0,0 +1,142 @@
+#pragma once
+
+#include "transforms.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+// Flattened BVH node. Interior nodes reference both children, leaves a range of triangles.
+struct BVHNode
+{
+    static constexpr uint32_t LeafFlag = 0x80000000u;
+
+    glm::vec3 min;
+    // Left child, or first triangle for leaves
+    uint32_t leftOrFirst;
+    glm::vec3 max;
+    // Right child, or LeafFlag | triangle count for leaves
+    uint32_t rightOrCount;
+
+    bool IsLeaf() const
+    {
+        return rightOrCount & LeafFlag;
+    }
+
+    uint32_t TriangleCount() const
+    {
+        return rightOrCount & ~LeafFlag;
+    }
+};
+static_assert(sizeof(BVHNode) == 32, "Keep BVHNode at half a cache line");
+
+// Rays in SoA form.
+// Padded to a multiple of 8 with rays that never hit, so packet loops need no remainder.
+struct RaySoA
+{
+    std::array<AlignedVector<float>, 3> origin;
+    std::array<AlignedVector<float>, 3> direction;
+    AlignedVector<float> tMin;
+    AlignedVector<float> tMax;
+    uint32_t count = 0;
+
+    void Clear();
+    void Push(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax);
+    // Call after the last Push()
+    void Pad();
+};
+
+// Bounding volume hierarchy over a triangle list, for tracing rays on the CPU.
+//
+// Built top down with binned SAH. Once a node is split, its two halves are independent, so the
+// top of the tree hands subtrees to other threads and splices their nodes back in afterwards.
+// Triangles are stored in leaf order as (v0, edge1, edge2), ready for Moller-Trumbore.
+//
+// Occlusion queries stop at the first hit in any order, which is all shadows and visibility
+// baking need. Closest hit queries visit the nearer child first and shrink the ray as they go.
+class CPUBVH
+{
+public:
+    struct Hit
+    {
+        float t;
+        // Index into the triangle list the BVH was built from
+        uint32_t triangle;
+        // Barycentrics of the second and third vertices
+        float u;
+        float v;
+    };
+
+    static constexpr uint32_t BinCount = 16;
+    static constexpr uint32_t MaxLeafTriangles = 8;
+
+    // indices is a triangle list into positions.
+    // threadCount of 0 picks a count based on the number of triangles.
+    void Build(std::span<const glm::vec3> positions, std::span<const uint32_t> indices, uint32_t threadCount = 0);
+
+    // True if a triangle is hit at origin + direction * t, with tMin < t < tMax
+    bool Occluded(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax) const;
+
+    // Finds the nearest triangle hit with tMin < t < tMax, returns false on a miss
+    bool Intersect(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax, Hit& hit) const;
+
+    // Sets occluded[i] to 1 for each blocked ray, and 0 otherwise. occluded must hold rays.count items.
+    // Packets of 8 rays share one traversal with AVX2, otherwise each ray is traced by Occluded().
+    void OccludedPacket(const RaySoA& rays, std::span<uint8_t> occluded, bool useSIMD = true) const;
+
+    // Tests every triangle, only used to validate traversal
+    bool OccludedReference(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax) const;
+
+    const std::vector<BVHNode>& Nodes() const
+    {
+        return nodes;
+    }
+
+    uint32_t TriangleCount() const
+    {
+        return (uint32_t)triangles.size();
+    }
+
+    // Expected cost of a random ray relative to a single leaf, to compare builds
+    float SAHCost() const;
+
+private:
+    struct Triangle
+    {
+        glm::vec3 v0;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+    };
+
+    struct BuildContext
+    {
+        std::vector<AABB> bounds;
+        std::vector<glm::vec3> centroids;
+        std::vector<uint32_t> order;
+    };
+
+    // Appends the subtree over order[first, first + count) to output, returns its root
+    static uint32_t BuildNode(BuildContext& context, std::vector<BVHNode>& output, uint32_t first, uint32_t count, uint32_t depth, uint32_t parallelDepth);
+
+    std::vector<BVHNode> nodes;
+    std::vector<Triangle> triangles;
+    // Source triangle of each entry in triangles
+    std::vector<uint32_t> triangleIds;
+};
+
+// Visibility of a directional light at each point, 1 when lit and 0 when shadowed.
+// lightDirection points from the light into the scene. Rays start bias along the normal,
+// to avoid hitting the surface the point lies on.
+// threadCount of 0 picks a count based on the number of points.
+void BakeDirectionalVisibility(
+    const CPUBVH& bvh,
+    std::span<const glm::vec3> positions,
+    std::span<const glm::vec3> normals,
+    const glm::vec3& lightDirection,
+    float bias,
+    std::span<float> visibility,
+    uint32_t threadCount = 0
+);
@@ -1,20 +0,0 @@
-#pragma once
-
-// Adapted from:
-// https://stackoverflow.com/questions/21001659/crc32-algorithm-implementation-in-c-without-a-look-up-table-and-with-a-public-li
-static unsigned int crc32b(const unsigned char* const data, size_t len) {
-    int i, j;
-    unsigned int byte, crc, mask;
-
-    i = 0;
-    crc = 0xFFFFFFFF;
-    for (size_t i = 0; i < len; i++) {
-        byte = data[i];            // Get next byte.
-        crc = crc ^ byte;
-        for (j = 7; j >= 0; j--) {    // Do eight times.
-            mask = -(static_cast<signed>(crc & 1));
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);
-        }
-    }
-    return ~crc;
-}
\ No newline at end of file
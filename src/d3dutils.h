@@ -260,6 +260,34 @@ inline void CreateOrReallocateUploadBufferWithData(D3D12MA::Allocator* allocator
     }
 }
 
+inline ComPtr<D3D12MA::Allocation> CreateBufferAllocation(
+    D3D12MA::Allocator* allocator,
+    UINT64 size,
+    D3D12_HEAP_TYPE heapType,
+    D3D12_RESOURCE_STATES initialState,
+    D3D12_RESOURCE_FLAGS flags,
+    const wchar_t* name
+)
+{
+    CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(size, flags);
+
+    D3D12MA::ALLOCATION_DESC allocDesc = {};
+    allocDesc.HeapType = heapType;
+
+    ComPtr<D3D12MA::Allocation> allocation;
+    ASSERT_HRESULT(allocator->CreateResource(
+        &allocDesc,
+        &resourceDesc,
+        initialState,
+        nullptr,
+        &allocation,
+        IID_NULL, nullptr
+    ));
+    allocation->GetResource()->SetName(name);
+
+    return allocation;
+}
+
 inline void CreateAccelerationStructureBuffers(
     D3D12MA::Allocator* allocator,
     const D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO& prebuildInfo,
@@ -0,0 +1,100 @@
+#include "decodepool.h"
+
+#include <algorithm>
+
+void DecodeBudget::Acquire(uint64_t bytes)
+{
+    std::unique_lock lock(mutex);
+    released.wait(lock, [&]() { return heldBytes == 0 || heldBytes + bytes <= budgetBytes; });
+    heldBytes += bytes;
+    peakBytes = std::max(peakBytes, heldBytes);
+}
+
+void DecodeBudget::Release(uint64_t bytes)
+{
+    {
+        std::scoped_lock lock(mutex);
+        heldBytes -= std::min(bytes, heldBytes);
+    }
+    released.notify_all();
+}
+
+uint64_t DecodeBudget::PeakBytes() const
+{
+    std::scoped_lock lock(mutex);
+    return peakBytes;
+}
+
+DecodePool::DecodePool(uint32_t jobCount, std::function<void(uint32_t)> job, uint32_t threadCount, bool waitForReady)
+    : job(std::move(job))
+    , jobCount(jobCount)
+{
+    readyJobs.reserve(jobCount);
+    if (!waitForReady) {
+        for (uint32_t i = 0; i < jobCount; i++) {
+            readyJobs.push_back(i);
+        }
+    }
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threadCount = std::min(threadCount, jobCount);
+
+    finished.reserve(jobCount);
+    for (uint32_t t = 0; t < threadCount; t++) {
+        threads.emplace_back(&DecodePool::Work, this);
+    }
+}
+
+DecodePool::~DecodePool()
+{
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void DecodePool::Work()
+{
+    for (;;) {
+        uint32_t index;
+        {
+            std::unique_lock lock(mutex);
+            jobReady.wait(lock, [&]() { return nextJob == jobCount || nextJob < readyJobs.size(); });
+            if (nextJob == jobCount) {
+                return;
+            }
+            index = readyJobs[nextJob++];
+            // The threads still waiting have nothing left to start
+            if (nextJob == jobCount) {
+                jobReady.notify_all();
+            }
+        }
+
+        job(index);
+
+        {
+            std::scoped_lock lock(mutex);
+            finished.push_back(index);
+        }
+        jobFinished.notify_all();
+    }
+}
+
+void DecodePool::Ready(uint32_t index)
+{
+    // Notified under the lock, the pool may be destroyed as soon as the job runs
+    std::scoped_lock lock(mutex);
+    readyJobs.push_back(index);
+    jobReady.notify_one();
+}
+
+std::optional<uint32_t> DecodePool::WaitNext()
+{
+    std::unique_lock lock(mutex);
+    if (returnedCount == jobCount) {
+        return std::nullopt;
+    }
+    jobFinished.wait(lock, [&]() { return finished.size() > returnedCount; });
+    return finished[returnedCount++];
+}
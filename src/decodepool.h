@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Limits how many bytes of decoded data are alive at once.
+//
+// Decoders Acquire the size of their output before decoding, and whoever consumes the output
+// Releases it. Acquire blocks while the budget is used up, which holds decoders back until
+// the consumer catches up.
+class DecodeBudget
+{
+public:
+    explicit DecodeBudget(uint64_t budgetBytes)
+        : budgetBytes(budgetBytes)
+    {
+    }
+
+    // Lets anything through when nothing is held, so one item bigger than the budget can't deadlock
+    void Acquire(uint64_t bytes);
+    void Release(uint64_t bytes);
+
+    uint64_t PeakBytes() const;
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable released;
+    uint64_t budgetBytes;
+    uint64_t heldBytes = 0;
+    uint64_t peakBytes = 0;
+};
+
+// A fixed number of threads working through jobs 0 to jobCount - 1, which hands back the
+// index of each job as it finishes so its result can be used straight away.
+//
+// Jobs whose input comes from somewhere else, like an AsyncFileReader, can instead wait to be
+// marked Ready(), and are then started in the order they're marked.
+class DecodePool
+{
+public:
+    // threadCount of 0 uses every core. Never more threads than jobs are started.
+    // With waitForReady no job starts until it's passed to Ready().
+    DecodePool(uint32_t jobCount, std::function<void(uint32_t)> job, uint32_t threadCount = 0, bool waitForReady = false);
+    // Waits for the jobs that are still running
+    ~DecodePool();
+
+    DecodePool(const DecodePool&) = delete;
+    DecodePool& operator=(const DecodePool&) = delete;
+
+    // Blocks until a job that hasn't been returned yet finishes, and returns its index.
+    // Returns nothing once every job has been returned.
+    std::optional<uint32_t> WaitNext();
+
+    // Lets a job start, when the pool waits for ready. Safe to call from any thread, once per job.
+    void Ready(uint32_t index);
+
+    uint32_t ThreadCount() const
+    {
+        return (uint32_t)threads.size();
+    }
+
+private:
+    void Work();
+
+    std::function<void(uint32_t)> job;
+    uint32_t jobCount;
+
+    std::mutex mutex;
+    std::condition_variable jobFinished;
+    std::condition_variable jobReady;
+    // Jobs in the order they start, every job up front unless waiting for ready
+    std::vector<uint32_t> readyJobs;
+    uint32_t nextJob = 0;
+    uint32_t returnedCount = 0;
+    std::vector<uint32_t> finished;
+
+    std::vector<std::thread> threads;
+};
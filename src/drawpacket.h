@@ -0,0 +1,132 @@
+#pragma once
+
+#ifdef MDXR_HEADLESS
+#include "headlessd3d12.h"
+#else
+#include <directx/d3dx12.h>
+#endif
+
+#include <span>
+#include <type_traits>
+
+enum DrawPass : UINT8
+{
+    DrawPass_GBuffer,
+    DrawPass_AlphaBlend,
+    DrawPass_Unlit,
+    DrawPass_Count,
+};
+
+// Flattened copy of everything needed to record one Primitive's draw.
+//
+// Primitive is a fat object (vectors, shared_ptrs, ComPtrs) scattered around the pools,
+// which makes walking it per draw a cache miss fest. Packets are stored contiguously,
+// with vertex buffer views interned into a shared table and PSOs referenced by index.
+struct DrawPacket
+{
+    D3D12_INDEX_BUFFER_VIEW indexBufferView;
+    UINT indexCount;
+    UINT instanceCount;
+
+    // Root constant values. firstInstance is the mesh's first slot in the instance buffer.
+    UINT firstInstance;
+    UINT materialDataIndex;
+    UINT miscDescriptorIndex;
+
+    // Range in DrawPacketList::vertexBufferViews
+    UINT firstVertexBufferView;
+    UINT16 vertexBufferViewCount;
+
+    // Index into DrawPacketList::PSOs
+    UINT16 psoIndex;
+
+    UINT8 primitiveTopology;
+    UINT8 pass;
+    UINT8 culled;
+    UINT8 pad;
+};
+static_assert(std::is_trivially_copyable_v<DrawPacket>, "DrawPacket must be POD");
+static_assert(sizeof(DrawPacket) == 48, "Keep DrawPacket compact");
+
+struct DrawPacketRange
+{
+    UINT begin = 0;
+    UINT end = 0;
+};
+
+// Per packet light list for forward shaded passes, passed as the light root constants.
+struct DrawPacketLightRange
+{
+    UINT first;
+    UINT count;
+};
+
+// Records the draws of a packet range, only emitting state changes when the state differs
+// from the previous packet. Returns the number of draws recorded.
+// lightRanges is optional, and parallel to packets when given.
+//
+// Templated on the command list so the loop can be timed against a mock command list.
+template<class CommandList>
+UINT RecordDrawPackets(
+    CommandList* commandList,
+    std::span<const DrawPacket> packets,
+    const D3D12_VERTEX_BUFFER_VIEW* vertexBufferViews,
+    ID3D12PipelineState* const* pipelineStates,
+    UINT viewDataIndex,
+    const DrawPacketLightRange* lightRanges = nullptr
+)
+{
+    UINT drawCount = 0;
+
+    UINT lastPSO = UINT_MAX;
+    UINT lastTopology = UINT_MAX;
+    UINT lastFirstVertexBufferView = UINT_MAX;
+    D3D12_INDEX_BUFFER_VIEW lastIndexBuffer = {};
+
+    for (size_t i = 0; i < packets.size(); i++) {
+        const DrawPacket& packet = packets[i];
+        if (packet.culled) {
+            continue;
+        }
+
+        DrawPacketLightRange lights = lightRanges ? lightRanges[i] : DrawPacketLightRange{ 0, 0 };
+
+        UINT constantValues[6] = {
+            packet.firstInstance,
+            packet.materialDataIndex,
+            lights.first,
+            lights.count,
+            packet.miscDescriptorIndex,
+            viewDataIndex
+        };
+        commandList->SetGraphicsRoot32BitConstants(0, _countof(constantValues), constantValues, 0);
+
+        if (packet.primitiveTopology != lastTopology) {
+            commandList->IASetPrimitiveTopology(static_cast<D3D12_PRIMITIVE_TOPOLOGY>(packet.primitiveTopology));
+            lastTopology = packet.primitiveTopology;
+        }
+
+        if (packet.psoIndex != lastPSO) {
+            commandList->SetPipelineState(pipelineStates[packet.psoIndex]);
+            lastPSO = packet.psoIndex;
+        }
+
+        // Interned views, so the same offset means the same views.
+        if (packet.firstVertexBufferView != lastFirstVertexBufferView) {
+            commandList->IASetVertexBuffers(0, packet.vertexBufferViewCount, vertexBufferViews + packet.firstVertexBufferView);
+            lastFirstVertexBufferView = packet.firstVertexBufferView;
+        }
+
+        if (packet.indexBufferView.BufferLocation != lastIndexBuffer.BufferLocation ||
+            packet.indexBufferView.SizeInBytes != lastIndexBuffer.SizeInBytes ||
+            packet.indexBufferView.Format != lastIndexBuffer.Format) {
+            commandList->IASetIndexBuffer(&packet.indexBufferView);
+            lastIndexBuffer = packet.indexBufferView;
+        }
+
+        commandList->DrawIndexedInstanced(packet.indexCount, packet.instanceCount, 0, 0, 0);
+        drawCount++;
+    }
+
+    return drawCount;
+}
@@ -4,6 +4,7 @@
 #include "app.h"
 #include "assets.h"
 #include "scene.h"
+#include "renderer.h"
 
 #include <directx/d3dx12.h>
 #include <tinyfiledialogs.h>
@@ -59,11 +60,31 @@ void CleanImGui()
     ImGui::DestroyContext();
 }
 
+// Children in the transform hierarchy follow whatever is edited here.
+void DrawTransformEditor(App& app, uint32_t transformIndex)
+{
+    glm::vec3 translation = app.transforms.GetTranslation(transformIndex);
+    glm::vec3 eulerDegrees = glm::degrees(app.transforms.GetEuler(transformIndex));
+    glm::vec3 scale = app.transforms.GetScale(transformIndex);
+
+    if (ImGui::DragFloat3("Position", (float*)&translation, 0.1f)) {
+        app.transforms.SetTranslation(transformIndex, translation);
+    }
+    if (ImGui::DragFloat3("Euler", (float*)&eulerDegrees, 0.1f)) {
+        app.transforms.SetEuler(transformIndex, glm::radians(eulerDegrees));
+    }
+    if (ImGui::DragFloat3("Scale", (float*)&scale, 0.1f)) {
+        app.transforms.SetScale(transformIndex, scale);
+    }
+}
+
 void DrawMeshEditor(App& app)
 {
     static int selectedMeshIdx = -1;
+    static int selectedInstanceIdx = 0;
     if (ImGui::CollapsingHeader("Mesh Editor")) {
         Mesh* selectedMesh = nullptr;
+        Model* selectedModel = nullptr;
 
         if (ImGui::BeginListBox("Meshes")) {
             int meshIdx = 0;
@@ -74,11 +95,13 @@ void DrawMeshEditor(App& app)
 
                     if (isSelected) {
                         selectedMesh = mesh.get();
+                        selectedModel = &model;
                     }
 
                     ImGui::PushID(mesh.get());
                     if (ImGui::Selectable(label.c_str(), isSelected)) {
                         selectedMeshIdx = meshIdx;
+                        selectedInstanceIdx = 0;
                         ImGui::PopID();
                         break;
                     }
@@ -92,16 +115,24 @@ void DrawMeshEditor(App& app)
 
         ImGui::Separator();
 
-        if (selectedMesh != nullptr) {
-            glm::vec3 eulerDegrees = glm::degrees(selectedMesh->euler);
-
+        if (selectedMesh != nullptr && !selectedMesh->instances.empty()) {
             ImGui::PushID("Mesh");
 
-            ImGui::DragFloat3("Position", (float*)&selectedMesh->translation, 0.1f);
-            ImGui::DragFloat3("Euler", (float*)&eulerDegrees, 0.1f);
-            ImGui::DragFloat3("Scale", (float*)&selectedMesh->scale, 0.1f);
+            int instanceCount = (int)selectedMesh->instances.size();
+            if (instanceCount > 1) {
+                ImGui::SliderInt("Instance", &selectedInstanceIdx, 0, instanceCount - 1);
+            }
+            selectedInstanceIdx = std::clamp(selectedInstanceIdx, 0, instanceCount - 1);
 
-            selectedMesh->euler = glm::radians(eulerDegrees);
+            DrawTransformEditor(app, selectedMesh->instances[selectedInstanceIdx].transformIndex);
+
+            if (selectedModel->rootTransform != TransformStore::InvalidIndex) {
+                ImGui::Separator();
+                ImGui::Text("Model root:");
+                ImGui::PushID("Root");
+                DrawTransformEditor(app, selectedModel->rootTransform);
+                ImGui::PopID();
+            }
 
             ImGui::Separator();
             ImGui::Text("Culled primitives:");
@@ -176,16 +207,17 @@ void DrawMaterialEditor(App& app)
 
 void DrawLightEditor(App& app)
 {
-    static int selectedLightIdx = 0;
+    static uint32_t selectedLight = LightStore::InvalidHandle;
 
     if (ImGui::CollapsingHeader("Lights")) {
-        // const char* const* pLabels = (const char* const*)labels;
         if (ImGui::BeginListBox("Lights")) {
-            for (UINT i = 0; i < app.LightBuffer.count; i++) {
-                std::string label = "Light #" + std::to_string(i);
-                if (ImGui::Selectable(label.c_str(), i == selectedLightIdx))
+            // Listed in slot order, which groups lights by type
+            for (UINT slot = 0; slot < app.lightStore.Count(); slot++) {
+                uint32_t handle = app.lightStore.HandleAt(slot);
+                std::string label = "Light #" + std::to_string(handle);
+                if (ImGui::Selectable(label.c_str(), handle == selectedLight))
                 {
-                    selectedLightIdx = i;
+                    selectedLight = handle;
                     break;
                 }
             }
@@ -193,23 +225,24 @@ void DrawLightEditor(App& app)
         }
 
         if (ImGui::Button("New light")) {
-            app.LightBuffer.count = std::min(app.LightBuffer.count + 1, MaxLightCount);
-            selectedLightIdx = app.LightBuffer.count - 1;
+            selectedLight = AddDefaultLight(app);
         }
         ImGui::SameLine();
         if (ImGui::Button("Remove light")) {
-            if (app.LightBuffer.count > 0) {
-                app.LightBuffer.count--;
-            }
-            if (selectedLightIdx == app.LightBuffer.count) {
-                selectedLightIdx--;
+            if (selectedLight != LightStore::InvalidHandle) {
+                app.lightStore.Remove(selectedLight);
+                selectedLight = LightStore::InvalidHandle;
             }
         }
+        ImGui::SameLine();
+        if (ImGui::Button("Add 10k point lights")) {
+            AddRandomPointLights(app, 10000);
+        }
 
-        ImGui::Separator();
-        if (selectedLightIdx != -1) {
-            auto& light = app.lights[selectedLightIdx];
+        ImGui::Text("%d lights, %d uploaded last frame", (int)app.lightStore.Count(), (int)app.Stats.uploadedLights);
 
+        ImGui::Separator();
+        if (selectedLight != LightStore::InvalidHandle) {
             static const char* LightTypeLabels[] = {
                 "Point",
                 "Directional"
@@ -217,25 +250,46 @@ void DrawLightEditor(App& app)
 
             ImGui::PushID("Light");
 
-            if (ImGui::BeginCombo("Light Type", LightTypeLabels[light.lightType])) {
+            LightType lightType = app.lightStore.GetType(selectedLight);
+            if (ImGui::BeginCombo("Light Type", LightTypeLabels[lightType])) {
                 for (int i = 0; i < _countof(LightTypeLabels); i++) {
-                    if (ImGui::Selectable(LightTypeLabels[i], i == light.lightType)) {
-                        light.lightType = (LightType)i;
+                    if (ImGui::Selectable(LightTypeLabels[i], i == lightType)) {
+                        app.lightStore.SetType(selectedLight, (LightType)i);
+                        lightType = (LightType)i;
                     }
                 }
                 ImGui::EndCombo();
             }
 
-
-            ImGui::ColorEdit3("Color", (float*)&light.color, ImGuiColorEditFlags_PickerHueWheel);
-            if (light.lightType == LightType_Point) {
-                ImGui::DragFloat3("Position", (float*)&light.position, 0.1f);
+            // Only changed values are written back, so untouched lights aren't re-uploaded
+            glm::vec3 color = app.lightStore.GetColor(selectedLight);
+            if (ImGui::ColorEdit3("Color", (float*)&color, ImGuiColorEditFlags_PickerHueWheel)) {
+                app.lightStore.SetColor(selectedLight, color);
+            }
+            if (lightType == LightType_Point) {
+                glm::vec3 position = app.lightStore.GetPosition(selectedLight);
+                if (ImGui::DragFloat3("Position", (float*)&position, 0.1f)) {
+                    app.lightStore.SetPosition(selectedLight, position);
+                }
+            }
+            if (lightType == LightType_Directional) {
+                glm::vec3 direction = app.lightStore.GetDirection(selectedLight);
+                if (ImGui::DragFloat3("Direction", (float*)&direction, 0.1f)) {
+                    app.lightStore.SetDirection(selectedLight, direction);
+                }
+            }
+            float range = app.lightStore.GetRange(selectedLight);
+            if (ImGui::DragFloat("Range", &range, 0.1f, 0.0f, 1000.0f, nullptr, 1.0f)) {
+                app.lightStore.SetRange(selectedLight, range);
+            }
+            float intensity = app.lightStore.GetIntensity(selectedLight);
+            if (ImGui::DragFloat("Intensity", &intensity, 0.05f, 0.0f, 100.0f, nullptr, 1.0f)) {
+                app.lightStore.SetIntensity(selectedLight, intensity);
             }
-            if (light.lightType == LightType_Directional) {
-                ImGui::DragFloat3("Direction", (float*)&light.direction, 0.1f);
+            bool castsShadow = app.lightStore.GetCastsShadow(selectedLight);
+            if (ImGui::Checkbox("Casts Shadow", &castsShadow)) {
+                app.lightStore.SetCastsShadow(selectedLight, castsShadow);
             }
-            ImGui::DragFloat("Range", &light.range, 0.1f, 0.0f, 1000.0f, nullptr, 1.0f);
-            ImGui::DragFloat("Intensity", &light.intensity, 0.05f, 0.0f, 100.0f, nullptr, 1.0f);
 
             ImGui::PopID();
         } else {
@@ -251,6 +305,25 @@ void DrawEnvironmentEditor(App& app)
         ImGui::DragFloat("Gamma", &app.PostProcessPass.gamma, 0.1f, 0.0f, 3.0f, nullptr, 1.0f);
         ImGui::DragFloat("Exposure", &app.PostProcessPass.exposure, 0.1f, 0.0f, 2.0f, nullptr, 1.0f);
         ImGui::DragFloat("Bloom threshold", &app.Bloom.threshold, 0.1f, 0.2f, 2.0f, nullptr, 1.0f);
+
+        ImGui::DragInt("Probes per axis", &app.RenderSettings.probesPerAxis, 1.0f, 2, 32);
+        ImGui::DragInt("Samples per probe", &app.RenderSettings.probeSamples, 16.0f, 16, 4096);
+        ImGui::DragInt("Probe bounces", &app.RenderSettings.probeBounces, 1.0f, 0, 8);
+        if (ImGui::Button("Bake Irradiance Probes")) {
+            BakeIrradianceProbes(app);
+        }
+        const glm::uvec3& probeCounts = app.IrradianceProbes.volume.counts;
+        if (probeCounts.x > 0) {
+            ImGui::SameLine();
+            ImGui::Checkbox("Use Probes", (bool*)&app.LightBuffer.passData->probeVolumeEnabled);
+            ImGui::Text("%dx%dx%d probes, %s in %.1fms",
+                (int)probeCounts.x,
+                (int)probeCounts.y,
+                (int)probeCounts.z,
+                app.Stats.probeBakeFromCache ? "loaded from cache" : "baked",
+                app.Stats.probeBakeMS
+            );
+        }
     }
 }
 
@@ -286,7 +359,7 @@ void DrawMenuBar(App& app)
     {
         if (ImGui::BeginMenu("File")) {
             if (ImGui::MenuItem("Add GLTF")) {
-                const char* filters[] = { "*.gltf" };
+                const char* filters[] = { "*.gltf", "*.glb", "*.mdxrmodel" };
                 char* gltfFile = tinyfd_openFileDialog(
                     "Choose GLTF File",
                     app.dataDir.c_str(),
@@ -327,14 +400,6 @@ void DrawMenuBar(App& app)
 void DrawGeekMenu(App& app)
 {
     if (ImGui::CollapsingHeader("Nerd Stuff")) {
-        static bool debugSkybox = false;
-        if (ImGui::Checkbox("Debug Diffuse IBL", &debugSkybox)) {
-            if (app.Skybox.mesh && app.Skybox.mesh->isReadyForRender) {
-                app.Skybox.mesh->primitives[0]->miscDescriptorParameter =
-                    debugSkybox ? app.Skybox.irradianceCubeSRV.Ref() : app.Skybox.texcubeSRV.Ref();
-            }
-        }
-
         float degreesFOV = glm::degrees(app.camera.fovY);
         ImGui::DragFloat("Camera FOVy Degrees", &degreesFOV, 0.05f, 0.01f, 180.0f);
         app.camera.fovY = glm::radians(degreesFOV);
@@ -358,6 +423,11 @@ void DrawGeekMenu(App& app)
 
         ImGui::Checkbox("Disable Shadows", &app.RenderSettings.disableShadows);
 
+        int blasTriangleBudget = (int)app.RenderSettings.blasBuildBudget.triangles;
+        if (ImGui::DragInt("BLAS triangles per frame", &blasTriangleBudget, 10000.0f, 10000, 50000000)) {
+            app.RenderSettings.blasBuildBudget.triangles = blasTriangleBudget;
+        }
+
         const char* debugNames[DebugVisualizerMode_Count] = { "Disabled", "Radiance", "BaseColor", "Normal", "Depth", "MetalRoughness" };
         const char* debugName = debugNames[app.DebugVisualizer.mode];
         ImGui::SliderInt("Debug Visualizer", (int*)&app.DebugVisualizer.mode, DebugVisualizerMode_Disabled, DebugVisualizerMode_Count - 1, debugName);
@@ -375,6 +445,82 @@ void DrawGeekMenu(App& app)
         if (ImGui::Button("Reload Skybox")) {
             StartSkyboxLoad(app);
         }
+
+        ImGui::Text("Transform update: %.3fms (%d transforms, %d dirty, %d uploaded)",
+            app.Stats.transformUpdateMS,
+            (int)app.transforms.Count(),
+            (int)app.Stats.dirtyTransforms,
+            (int)app.Stats.uploadedTransforms
+        );
+        ImGui::Text("Instance buffer: %d / %d slots", (int)app.InstanceBuffer.allocator.Used(), (int)app.InstanceBuffer.allocator.Capacity());
+
+        ImGui::Text("Light binning: %.3fms (%d cluster light references)", app.Stats.lightBinningMS, (int)app.Stats.clusterLightReferences);
+        ImGui::Text("Visible point lights: %d / %d", (int)app.Stats.visiblePointLights, (int)app.LightBuffer.ranges[LightType_Point].count);
+
+        if (ImGui::Button("Benchmark Asset I/O")) {
+            BenchmarkAssetIO(app);
+        }
+        ImGui::SameLine();
+        ImGui::Text("Models: %.1fms cold, %.1fms warm. Reading %.1fMB: %.1fms streamed, %.1fms mapped, %.1fms async",
+            app.Stats.assetLoadColdMS,
+            app.Stats.assetLoadWarmMS,
+            app.Stats.assetReadMB,
+            app.Stats.assetReadStreamMS,
+            app.Stats.assetReadMappedMS,
+            app.Stats.assetReadAsyncMS
+        );
+        ImGui::Text("Models with a .glb and .gltf version: %.2fms as .glb, %.2fms as .gltf",
+            app.Stats.glbLoadMS,
+            app.Stats.glbAsGLTFLoadMS
+        );
+        ImGui::Text("Cooked models: %.2fms cooked, %.2fms from source (CPU side only)",
+            app.Stats.cookedLoadMS,
+            app.Stats.cookedSourceLoadMS
+        );
+        ImGui::Text("Last model's images: decoded on %u threads, %.1fMB peak waiting for upload",
+            app.Stats.imageDecodeThreads,
+            app.Stats.imageDecodePeakMB
+        );
+        ImGui::Text("Decoding textures: %.1fms, %.0fKB moved per texture. Through a tinygltf::Image: %.1fms, %.0fKB moved per texture",
+            app.Stats.imageDecodeMS,
+            app.Stats.imageBytesMovedKB,
+            app.Stats.imageDecodeOldMS,
+            app.Stats.imageBytesMovedOldKB
+        );
+        ImGui::Text("Asset cache: %.1fms filling it (%.1fMB), %.1fms from it with %u hits. This session: %llu hits, %llu misses, %.1fMB on disk",
+            app.Stats.assetLoadCacheMissMS,
+            app.Stats.assetCacheBenchmarkMB,
+            app.Stats.assetLoadCacheHitMS,
+            app.Stats.assetCacheBenchmarkHits,
+            (unsigned long long)app.AssetThread.cache.Hits(),
+            (unsigned long long)app.AssetThread.cache.Misses(),
+            app.AssetThread.cache.SizeInBytes() / (1024.0f * 1024.0f)
+        );
+        {
+            std::scoped_lock lock(app.BLASBuilds.mutex);
+            ImGui::Text("BLAS builds: %d queued (%lld triangles), %d issued this frame (%lld triangles)",
+                (int)app.BLASBuilds.scheduler.PendingCount(),
+                (long long)app.BLASBuilds.scheduler.PendingTriangles(),
+                (int)app.Stats.blasBuildsIssued,
+                (long long)app.Stats.blasTrianglesIssued
+            );
+        }
+        ImGui::Text("BLAS memory: %.1fMB (%.1fMB before compaction), %.1fMB scratch",
+            app.Stats.blasCompactedBytes / (1024.0f * 1024.0f),
+            app.Stats.blasUncompactedBytes / (1024.0f * 1024.0f),
+            app.BLASBuilds.scratchArena ? app.BLASBuilds.scratchArena->GetSize() / (1024.0f * 1024.0f) : 0.0f
+        );
+        static const char* TLASBuildLabels[] = { "up to date", "refit", "rebuilt" };
+        ImGui::Text("TLAS: %d instances, %d patched, %s",
+            (int)app.TLAS.instanceSet.Count(),
+            (int)app.Stats.tlasPatchedInstances,
+            TLASBuildLabels[app.Stats.tlasBuildKind]
+        );
+        ImGui::Text("Transparent pass: %.3fms (%d draws, %d light references)",
+            app.Stats.transparentPrepareMS,
+            (int)app.Stats.transparentDraws,
+            (int)app.Stats.transparentLightReferences
+        );
     }
 }
 
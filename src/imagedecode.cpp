@@ -0,0 +1,159 @@
+#include "imagedecode.h"
+#include "mipchain.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+DecodedImage::~DecodedImage()
+{
+    Free();
+}
+
+DecodedImage::DecodedImage(DecodedImage&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+DecodedImage& DecodedImage::operator=(DecodedImage&& other) noexcept
+{
+    if (this != &other) {
+        Free();
+        pixels = std::exchange(other.pixels, nullptr);
+        width = std::exchange(other.width, 0);
+        height = std::exchange(other.height, 0);
+        components = std::exchange(other.components, 0);
+    }
+    return *this;
+}
+
+bool DecodedImage::Decode(std::span<const uint8_t> encoded)
+{
+    Free();
+
+    int w, h, c;
+    pixels = stbi_load_from_memory(encoded.data(), (int)encoded.size(), &w, &h, &c, 0);
+    if (!pixels) {
+        return false;
+    }
+
+    width = (uint32_t)w;
+    height = (uint32_t)h;
+    components = (uint32_t)c;
+    return true;
+}
+
+void DecodedImage::Free()
+{
+    if (pixels) {
+        stbi_image_free(pixels);
+    }
+    pixels = nullptr;
+    width = 0;
+    height = 0;
+    components = 0;
+}
+
+// Expands one row of width texels with components channels to RGBA8
+static void ExpandRowRGBA8(const uint8_t* src, uint32_t width, uint32_t components, uint8_t* dst)
+{
+    switch (components) {
+    case 4:
+        memcpy(dst, src, (size_t)width * 4);
+        break;
+    case 3:
+        for (uint32_t x = 0; x < width; x++) {
+            dst[x * 4 + 0] = src[x * 3 + 0];
+            dst[x * 4 + 1] = src[x * 3 + 1];
+            dst[x * 4 + 2] = src[x * 3 + 2];
+            dst[x * 4 + 3] = 255;
+        }
+        break;
+    case 2:
+        for (uint32_t x = 0; x < width; x++) {
+            dst[x * 4 + 0] = src[x * 2];
+            dst[x * 4 + 1] = src[x * 2];
+            dst[x * 4 + 2] = src[x * 2];
+            dst[x * 4 + 3] = src[x * 2 + 1];
+        }
+        break;
+    case 1:
+        for (uint32_t x = 0; x < width; x++) {
+            dst[x * 4 + 0] = src[x];
+            dst[x * 4 + 1] = src[x];
+            dst[x * 4 + 2] = src[x];
+            dst[x * 4 + 3] = 255;
+        }
+        break;
+    }
+}
+
+void DecodedImage::WriteRGBA8(uint8_t* dest, size_t rowPitch) const
+{
+    for (uint32_t y = 0; y < height; y++) {
+        ExpandRowRGBA8(pixels + (size_t)y * width * components, width, components, dest + y * rowPitch);
+    }
+}
+
+void DecodedImage::GenerateMipChain(bool isSRGB, uint8_t* dest, uint32_t threadCount) const
+{
+    // Enough rows that a thread has more work than it costs to start it, as in ::GenerateMipChain()
+    const uint32_t MinRowsPerThread = 64;
+
+    if (components == 4) {
+        ::GenerateMipChain(pixels, (size_t)width * 4, width, height, isSRGB, dest, true, threadCount);
+        return;
+    }
+
+    std::vector<MipLevel> levels = MipChainLevels(width, height);
+    if (levels.empty()) {
+        return;
+    }
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    const MipLevel& firstMip = levels[0];
+    auto downsampleRows = [&](uint32_t firstRow, uint32_t endRow) {
+        std::vector<uint8_t> rows((size_t)width * 4 * 2);
+        for (uint32_t y = firstRow; y < endRow; y++) {
+            uint32_t y0 = std::min(y * 2, height - 1);
+            uint32_t y1 = std::min(y * 2 + 1, height - 1);
+            ExpandRowRGBA8(pixels + (size_t)y0 * width * components, width, components, rows.data());
+            ExpandRowRGBA8(pixels + (size_t)y1 * width * components, width, components, rows.data() + (size_t)width * 4);
+            DownsampleRowRGBA8(rows.data(), rows.data() + (size_t)width * 4, width, dest + (size_t)y * firstMip.width * 4, isSRGB);
+        }
+    };
+
+    uint32_t firstMipThreads = std::clamp(firstMip.height / MinRowsPerThread, 1u, threadCount);
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < firstMipThreads; t++) {
+        threads.emplace_back(downsampleRows, firstMip.height * t / firstMipThreads, firstMip.height * (t + 1) / firstMipThreads);
+    }
+    downsampleRows(0, firstMip.height / firstMipThreads);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // The rest of the chain follows on from the first mip
+    size_t firstMipSize = (size_t)firstMip.width * firstMip.height * 4;
+    ::GenerateMipChain(dest, (size_t)firstMip.width * 4, firstMip.width, firstMip.height, isSRGB, dest + firstMipSize, true, threadCount);
+}
+
+bool ReadImageInfo(std::span<const uint8_t> encoded, uint32_t& width, uint32_t& height, uint32_t& components)
+{
+    int w, h, c;
+    if (!stbi_info_from_memory(encoded.data(), (int)encoded.size(), &w, &h, &c)) {
+        return false;
+    }
+
+    width = (uint32_t)w;
+    height = (uint32_t)h;
+    components = (uint32_t)c;
+    return true;
+}
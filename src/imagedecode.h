@@ -0,0 +1,70 @@
+#pragma once
+
+#include <span>
+#include <cstdint>
+
+// An 8 bit image decoded by stb_image with the channel count it was stored with.
+//
+// Letting stb_image expand images to RGBA8 costs it a second pass over the pixels, and copying
+// the result into a tinygltf::Image and then into upload memory costs two more. Instead the
+// channels are expanded while the pixels are written straight into their destination, usually
+// a texture's footprint in upload memory, so the decoded pixels are only read once.
+class DecodedImage
+{
+public:
+    DecodedImage() = default;
+    ~DecodedImage();
+
+    DecodedImage(DecodedImage&& other) noexcept;
+    DecodedImage& operator=(DecodedImage&& other) noexcept;
+    DecodedImage(const DecodedImage&) = delete;
+    DecodedImage& operator=(const DecodedImage&) = delete;
+
+    // Returns false if the image can't be decoded. 16 bit images are decoded to 8 bit.
+    bool Decode(std::span<const uint8_t> encoded);
+    void Free();
+
+    // Writes the image as RGBA8 rows rowPitch bytes apart. Grey is replicated and missing alpha is 255.
+    void WriteRGBA8(uint8_t* dest, size_t rowPitch) const;
+
+    // Writes mips 1 down to 1x1 to dest, as GenerateMipChain() in mipchain.h does, with the same bytes as
+    // expanding to RGBA8 first. Images with fewer than 4 channels are expanded two rows at a time for the
+    // first mip, rather than as a whole. Rows are split across threads the same way too.
+    void GenerateMipChain(bool isSRGB, uint8_t* dest, uint32_t threadCount = 1) const;
+
+    bool IsEmpty() const
+    {
+        return pixels == nullptr;
+    }
+
+    uint32_t Width() const
+    {
+        return width;
+    }
+
+    uint32_t Height() const
+    {
+        return height;
+    }
+
+    uint32_t Components() const
+    {
+        return components;
+    }
+
+    // Bytes held by the decoded pixels
+    uint64_t SizeInBytes() const
+    {
+        return (uint64_t)width * height * components;
+    }
+
+private:
+    uint8_t* pixels = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t components = 0;
+};
+
+// Reads the size and channel count from an image's header without decoding it.
+// Returns false if stb_image doesn't recognize the image.
+bool ReadImageInfo(std::span<const uint8_t> encoded, uint32_t& width, uint32_t& height, uint32_t& components);
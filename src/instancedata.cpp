@@ -0,0 +1,114 @@
+#include "instancedata.h"
+
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+InstanceTransform PackInstanceTransform(const glm::mat4& matrix)
+{
+    InstanceTransform result;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 4; c++) {
+            result.rows[r][c] = matrix[c][r];
+        }
+    }
+    return result;
+}
+
+glm::mat4 UnpackInstanceTransform(const InstanceTransform& transform)
+{
+    glm::mat4 result(1.0f);
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 4; c++) {
+            result[c][r] = transform.rows[r][c];
+        }
+    }
+    return result;
+}
+
+void StreamInstanceTransform(const glm::mat4& matrix, InstanceTransform* destination)
+{
+#ifdef __AVX2__
+    // Columns in, rows out. The 4th row is dropped.
+    __m128 c0 = _mm_loadu_ps(&matrix[0][0]);
+    __m128 c1 = _mm_loadu_ps(&matrix[1][0]);
+    __m128 c2 = _mm_loadu_ps(&matrix[2][0]);
+    __m128 c3 = _mm_loadu_ps(&matrix[3][0]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+    float* out = &destination->rows[0][0];
+    _mm_stream_ps(out + 0, c0);
+    _mm_stream_ps(out + 4, c1);
+    _mm_stream_ps(out + 8, c2);
+#else
+    *destination = PackInstanceTransform(matrix);
+#endif
+}
+
+void StreamFence()
+{
+#ifdef __AVX2__
+    _mm_sfence();
+#endif
+}
+
+RangeAllocator::RangeAllocator(uint32_t capacity)
+    : capacity(capacity)
+{
+    if (capacity > 0) {
+        freeRanges.emplace_back(0, capacity);
+    }
+}
+
+uint32_t RangeAllocator::Allocate(uint32_t count)
+{
+    std::scoped_lock lock(mutex);
+
+    for (auto iter = freeRanges.begin(); iter != freeRanges.end(); iter++) {
+        auto& [first, rangeCount] = *iter;
+        if (rangeCount >= count) {
+            uint32_t result = first;
+            first += count;
+            rangeCount -= count;
+            if (rangeCount == 0) {
+                freeRanges.erase(iter);
+            }
+            used += count;
+            return result;
+        }
+    }
+
+    return InvalidIndex;
+}
+
+void RangeAllocator::Free(uint32_t first, uint32_t count)
+{
+    std::scoped_lock lock(mutex);
+
+    auto iter = std::lower_bound(freeRanges.begin(), freeRanges.end(), std::make_pair(first, 0u));
+    iter = freeRanges.emplace(iter, first, count);
+    used -= count;
+
+    // Merge with the next range, then the previous one
+    auto next = iter + 1;
+    if (next != freeRanges.end() && iter->first + iter->second == next->first) {
+        iter->second += next->second;
+        freeRanges.erase(next);
+    }
+    if (iter != freeRanges.begin()) {
+        auto prev = iter - 1;
+        if (prev->first + prev->second == iter->first) {
+            prev->second += iter->second;
+            freeRanges.erase(iter);
+        }
+    }
+}
+
+uint32_t RangeAllocator::Used() const
+{
+    std::scoped_lock lock(mutex);
+
+    return used;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+// World matrix of one instance as stored in the instance buffer, InstanceData in common.hlsli.
+// Row major 3x4, the last row is always (0, 0, 0, 1). This is the same layout as
+// D3D12_RAYTRACING_INSTANCE_DESC::Transform, so it can be copied straight into the TLAS.
+struct InstanceTransform
+{
+    float rows[3][4];
+};
+static_assert(sizeof(InstanceTransform) == 48, "InstanceTransform must match the HLSL structured buffer stride");
+
+InstanceTransform PackInstanceTransform(const glm::mat4& matrix);
+glm::mat4 UnpackInstanceTransform(const InstanceTransform& transform);
+
+// Pack straight into write-combined upload memory with non-temporal stores where available.
+// destination must be 16-byte aligned, call StreamFence() before the GPU reads it.
+void StreamInstanceTransform(const glm::mat4& matrix, InstanceTransform* destination);
+void StreamFence();
+
+// Hands out contiguous ranges of slots in a fixed size buffer.
+//
+// All instances of a mesh occupy one range, so a draw only needs the first slot and
+// the shader finds each instance at first + SV_InstanceID.
+class RangeAllocator
+{
+public:
+    static constexpr uint32_t InvalidIndex = UINT32_MAX;
+
+    explicit RangeAllocator(uint32_t capacity = 0);
+
+    // First fit, returns InvalidIndex when no range is large enough.
+    uint32_t Allocate(uint32_t count);
+    // Adjacent free ranges are merged back together.
+    void Free(uint32_t first, uint32_t count);
+
+    uint32_t Capacity() const
+    {
+        return capacity;
+    }
+
+    uint32_t Used() const;
+
+private:
+    mutable std::mutex mutex;
+
+    uint32_t capacity;
+    uint32_t used = 0;
+
+    // Sorted by first, as (first, count)
+    std::vector<std::pair<uint32_t, uint32_t>> freeRanges;
+};
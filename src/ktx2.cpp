@@ -0,0 +1,191 @@
+#include "ktx2.h"
+
+#include <algorithm>
+#include <cstring>
+
+static constexpr uint8_t KTX2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct KTX2Header
+{
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+static_assert(sizeof(KTX2Header) == 80);
+
+struct KTX2LevelIndex
+{
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+// Color models of the data format descriptor, for the Basis Universal payloads with no VkFormat
+enum KTX2ColorModel : uint8_t
+{
+    KTX2ColorModel_ETC1S = 163,
+    KTX2ColorModel_UASTC = 166,
+};
+
+static void FormatFromVkFormat(uint32_t vkFormat, KTX2Format& format, bool& isSRGB)
+{
+    format = KTX2Format::Unsupported;
+    isSRGB = false;
+    switch (vkFormat) {
+    case 37: // VK_FORMAT_R8G8B8A8_UNORM
+        format = KTX2Format::RGBA8;
+        break;
+    case 43: // VK_FORMAT_R8G8B8A8_SRGB
+        format = KTX2Format::RGBA8;
+        isSRGB = true;
+        break;
+    case 131: // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+    case 133: // VK_FORMAT_BC1_RGBA_UNORM_BLOCK
+        format = KTX2Format::BC1;
+        break;
+    case 132: // VK_FORMAT_BC1_RGB_SRGB_BLOCK
+    case 134: // VK_FORMAT_BC1_RGBA_SRGB_BLOCK
+        format = KTX2Format::BC1;
+        isSRGB = true;
+        break;
+    case 135: // VK_FORMAT_BC2_UNORM_BLOCK
+        format = KTX2Format::BC2;
+        break;
+    case 136: // VK_FORMAT_BC2_SRGB_BLOCK
+        format = KTX2Format::BC2;
+        isSRGB = true;
+        break;
+    case 137: // VK_FORMAT_BC3_UNORM_BLOCK
+        format = KTX2Format::BC3;
+        break;
+    case 138: // VK_FORMAT_BC3_SRGB_BLOCK
+        format = KTX2Format::BC3;
+        isSRGB = true;
+        break;
+    case 139: // VK_FORMAT_BC4_UNORM_BLOCK
+        format = KTX2Format::BC4;
+        break;
+    case 141: // VK_FORMAT_BC5_UNORM_BLOCK
+        format = KTX2Format::BC5;
+        break;
+    case 145: // VK_FORMAT_BC7_UNORM_BLOCK
+        format = KTX2Format::BC7;
+        break;
+    case 146: // VK_FORMAT_BC7_SRGB_BLOCK
+        format = KTX2Format::BC7;
+        isSRGB = true;
+        break;
+    }
+}
+
+bool IsKTX2(std::span<const uint8_t> bytes)
+{
+    return bytes.size() >= sizeof(KTX2Identifier) && memcmp(bytes.data(), KTX2Identifier, sizeof(KTX2Identifier)) == 0;
+}
+
+uint32_t KTX2RowCount(KTX2Format format, uint32_t height)
+{
+    return format == KTX2Format::RGBA8 ? height : (height + 3) / 4;
+}
+
+uint32_t KTX2RowBytes(KTX2Format format, uint32_t width)
+{
+    switch (format) {
+    case KTX2Format::RGBA8:
+        return width * 4;
+    case KTX2Format::BC1:
+    case KTX2Format::BC4:
+        return (width + 3) / 4 * 8;
+    default:
+        return (width + 3) / 4 * 16;
+    }
+}
+
+bool ParseKTX2(std::span<const uint8_t> bytes, KTX2Image& image, std::string& error)
+{
+    image = {};
+
+    KTX2Header header;
+    if (!IsKTX2(bytes) || bytes.size() < sizeof(header)) {
+        error = "not a KTX2 file";
+        return false;
+    }
+    memcpy(&header, bytes.data(), sizeof(header));
+
+    auto inBounds = [&](uint64_t offset, uint64_t size) {
+        return offset <= bytes.size() && size <= bytes.size() - offset;
+    };
+
+    if (header.vkFormat == 0) {
+        // Basis Universal, which says which codec it is in the data format descriptor
+        uint8_t colorModel = 0;
+        if (header.dfdByteLength >= 16 && inBounds(header.dfdByteOffset, header.dfdByteLength)) {
+            colorModel = bytes[header.dfdByteOffset + 12];
+        }
+        error = colorModel == KTX2ColorModel_UASTC ? "UASTC needs a Basis Universal transcoder"
+            : colorModel == KTX2ColorModel_ETC1S || header.supercompressionScheme == 1 ? "ETC1S needs a Basis Universal transcoder"
+            : "no VkFormat";
+        return false;
+    }
+    if (header.supercompressionScheme != 0) {
+        error = header.supercompressionScheme == 2 ? "zstd supercompression isn't supported" : "supercompression isn't supported";
+        return false;
+    }
+
+    FormatFromVkFormat(header.vkFormat, image.format, image.isSRGB);
+    if (image.format == KTX2Format::Unsupported) {
+        error = "VkFormat " + std::to_string(header.vkFormat) + " isn't supported";
+        return false;
+    }
+    if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1) {
+        error = "only 2D textures are supported";
+        return false;
+    }
+    if (image.format != KTX2Format::RGBA8 && (header.pixelWidth % 4 != 0 || header.pixelHeight % 4 != 0)) {
+        // D3D12 needs the top mip of a block compressed texture to be whole blocks
+        error = "block compressed size isn't a multiple of 4";
+        return false;
+    }
+
+    // 0 levels asks the loader to generate mips, only the base level is stored
+    uint32_t levelCount = std::max(header.levelCount, 1u);
+    if (levelCount > 32 || !inBounds(sizeof(header), (uint64_t)levelCount * sizeof(KTX2LevelIndex))) {
+        error = "truncated level index";
+        return false;
+    }
+
+    image.width = header.pixelWidth;
+    image.height = header.pixelHeight;
+    for (uint32_t level = 0; level < levelCount; level++) {
+        KTX2LevelIndex index;
+        memcpy(&index, bytes.data() + sizeof(header) + level * sizeof(index), sizeof(index));
+
+        uint32_t width = std::max(header.pixelWidth >> level, 1u);
+        uint32_t height = std::max(header.pixelHeight >> level, 1u);
+        uint64_t size = (uint64_t)KTX2RowBytes(image.format, width) * KTX2RowCount(image.format, height);
+        if (index.byteLength != size || !inBounds(index.byteOffset, index.byteLength)) {
+            error = "level " + std::to_string(level) + " is truncated or the wrong size";
+            return false;
+        }
+        image.levels.push_back(KTX2Level{ width, height, bytes.subspan(index.byteOffset, index.byteLength) });
+
+        if (width == 1 && height == 1) {
+            break;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// KTX2 texture containers with pre-transcoded BC or RGBA8 levels.
+//
+// Levels already stored in a format the GPU samples (BC1-5, BC7 or RGBA8) with no supercompression
+// are used as they are: each level is copied from the file into upload memory, with no decoding and
+// no mip generation. There's no Basis Universal transcoder or zstd decoder, so ParseKTX2() rejects
+// ETC1S and UASTC payloads and supercompressed levels. KHR_texture_basisu only allows those, so
+// textures of a conforming asset always load their fallback image instead.
+
+enum class KTX2Format : uint32_t
+{
+    Unsupported,
+    RGBA8,
+    BC1,
+    BC2,
+    BC3,
+    BC4,
+    BC5,
+    BC7,
+};
+
+struct KTX2Level
+{
+    uint32_t width;
+    uint32_t height;
+    // KTX2RowCount() rows of KTX2RowBytes(), with no padding
+    std::span<const uint8_t> data;
+};
+
+struct KTX2Image
+{
+    KTX2Format format = KTX2Format::Unsupported;
+    bool isSRGB = false;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // Level 0 is the full size image
+    std::vector<KTX2Level> levels;
+};
+
+// True if bytes start with the KTX2 file identifier
+bool IsKTX2(std::span<const uint8_t> bytes);
+
+// Reads the levels of a KTX2 file, as spans into bytes. Returns false with the reason in error if
+// the file is truncated, or isn't a 2D texture that can be uploaded as it's stored.
+bool ParseKTX2(std::span<const uint8_t> bytes, KTX2Image& image, std::string& error);
+
+// Rows in a level of the format (texels or 4x4 blocks), and the bytes in each row
+uint32_t KTX2RowCount(KTX2Format format, uint32_t height);
+uint32_t KTX2RowBytes(KTX2Format format, uint32_t width);
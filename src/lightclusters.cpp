@@ -0,0 +1,411 @@
+#include "lightclusters.h"
+
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+LightClusterDepthParams ComputeLightClusterDepthParams(float nearZ, float farZ)
+{
+    float logRatio = logf(farZ / nearZ);
+    return {
+        (float)LightClusterCountZ / logRatio,
+        -(float)LightClusterCountZ * logf(nearZ) / logRatio,
+    };
+}
+
+void SphereSoA::Clear()
+{
+    for (auto& component : xyzr) {
+        component.clear();
+    }
+    ids.clear();
+    count = 0;
+}
+
+void SphereSoA::Push(const glm::vec4& sphere, uint32_t id)
+{
+    for (int c = 0; c < 4; c++) {
+        xyzr[c].push_back(sphere[c]);
+    }
+    ids.push_back(id);
+    count++;
+}
+
+void SphereSoA::Pad()
+{
+    // Far away with no radius, never overlaps anything
+    while (xyzr[0].size() % 8 != 0) {
+        xyzr[0].push_back(FLT_MAX);
+        xyzr[1].push_back(FLT_MAX);
+        xyzr[2].push_back(FLT_MAX);
+        xyzr[3].push_back(0.0f);
+    }
+}
+
+// Same operations in the same order as the AVX2 path, so both give identical results.
+static inline bool SphereOverlapsAABB(const AABB& box, float x, float y, float z, float r)
+{
+    float ex = std::max(std::max(box.min.x - x, x - box.max.x), 0.0f);
+    float ey = std::max(std::max(box.min.y - y, y - box.max.y), 0.0f);
+    float ez = std::max(std::max(box.min.z - z, z - box.max.z), 0.0f);
+    return ex * ex + ey * ey + ez * ez <= r * r;
+}
+
+// Calls fn(i) for every sphere in input overlapping box, in order.
+template<class Fn>
+static void ForEachSphereInAABB(const SphereSoA& input, const AABB& box, bool useSIMD, Fn&& fn)
+{
+    const float* xs = input.xyzr[0].data();
+    const float* ys = input.xyzr[1].data();
+    const float* zs = input.xyzr[2].data();
+    const float* rs = input.xyzr[3].data();
+
+#ifdef __AVX2__
+    if (useSIMD) {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 minX = _mm256_set1_ps(box.min.x);
+        const __m256 minY = _mm256_set1_ps(box.min.y);
+        const __m256 minZ = _mm256_set1_ps(box.min.z);
+        const __m256 maxX = _mm256_set1_ps(box.max.x);
+        const __m256 maxY = _mm256_set1_ps(box.max.y);
+        const __m256 maxZ = _mm256_set1_ps(box.max.z);
+
+        for (uint32_t i = 0; i < input.count; i += 8) {
+            __m256 x = _mm256_load_ps(xs + i);
+            __m256 y = _mm256_load_ps(ys + i);
+            __m256 z = _mm256_load_ps(zs + i);
+            __m256 r = _mm256_load_ps(rs + i);
+
+            __m256 ex = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minX, x), _mm256_sub_ps(x, maxX)), zero);
+            __m256 ey = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minY, y), _mm256_sub_ps(y, maxY)), zero);
+            __m256 ez = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minZ, z), _mm256_sub_ps(z, maxZ)), zero);
+            __m256 distanceSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)), _mm256_mul_ps(ez, ez));
+
+            int mask = _mm256_movemask_ps(_mm256_cmp_ps(distanceSq, _mm256_mul_ps(r, r), _CMP_LE_OQ));
+            while (mask) {
+                // Padding never passes, so every set bit is a real sphere
+                int bit = std::countr_zero((unsigned)mask);
+                fn(i + bit);
+                mask &= mask - 1;
+            }
+        }
+        return;
+    }
+#endif
+
+    for (uint32_t i = 0; i < input.count; i++) {
+        if (SphereOverlapsAABB(box, xs[i], ys[i], zs[i], rs[i])) {
+            fn(i);
+        }
+    }
+}
+
+void FilterSpheresAABB(const SphereSoA& input, const AABB& box, SphereSoA& output, bool useSIMD)
+{
+    ForEachSphereInAABB(input, box, useSIMD, [&](uint32_t i) {
+        output.Push(glm::vec4(input.xyzr[0][i], input.xyzr[1][i], input.xyzr[2][i], input.xyzr[3][i]), input.ids[i]);
+    });
+}
+
+FrustumPlanes ComputeViewFrustumPlanes(const glm::mat4& projection, float nearZ, float farZ)
+{
+    // Side planes from the rows of the projection, see ComputeFrustum in renderer.cpp.
+    // Near and far are built directly since the depth rows depend on the clip space convention.
+    glm::vec4 row0 = glm::vec4(projection[0][0], projection[1][0], projection[2][0], projection[3][0]);
+    glm::vec4 row1 = glm::vec4(projection[0][1], projection[1][1], projection[2][1], projection[3][1]);
+    glm::vec4 row3 = glm::vec4(projection[0][3], projection[1][3], projection[2][3], projection[3][3]);
+
+    FrustumPlanes planes = {
+        row3 - row0,
+        row3 + row0,
+        row3 - row1,
+        row3 + row1,
+        glm::vec4(0.0f, 0.0f, -1.0f, -nearZ),
+        glm::vec4(0.0f, 0.0f, 1.0f, farZ),
+    };
+
+    for (auto& plane : planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    return planes;
+}
+
+// Same operations in the same order as the AVX2 path.
+static inline bool SphereIntersectsFrustum(const FrustumPlanes& planes, float x, float y, float z, float r)
+{
+    if (!(r > 0.0f)) {
+        return false;
+    }
+    for (const glm::vec4& plane : planes) {
+        float distance = plane.x * x + plane.y * y + plane.z * z + plane.w;
+        if (!(distance >= -r)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FilterSpheresFrustum(const SphereSoA& input, const FrustumPlanes& planes, SphereSoA& output, bool useSIMD)
+{
+    const float* xs = input.xyzr[0].data();
+    const float* ys = input.xyzr[1].data();
+    const float* zs = input.xyzr[2].data();
+    const float* rs = input.xyzr[3].data();
+
+    auto push = [&](uint32_t i) {
+        output.Push(glm::vec4(xs[i], ys[i], zs[i], rs[i]), input.ids[i]);
+    };
+
+#ifdef __AVX2__
+    if (useSIMD) {
+        __m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+        for (int p = 0; p < 6; p++) {
+            planeX[p] = _mm256_set1_ps(planes[p].x);
+            planeY[p] = _mm256_set1_ps(planes[p].y);
+            planeZ[p] = _mm256_set1_ps(planes[p].z);
+            planeW[p] = _mm256_set1_ps(planes[p].w);
+        }
+        const __m256 zero = _mm256_setzero_ps();
+
+        for (uint32_t i = 0; i < input.count; i += 8) {
+            __m256 x = _mm256_load_ps(xs + i);
+            __m256 y = _mm256_load_ps(ys + i);
+            __m256 z = _mm256_load_ps(zs + i);
+            __m256 r = _mm256_load_ps(rs + i);
+            __m256 negR = _mm256_sub_ps(zero, r);
+
+            // Lights with no radius are out of range of everything, this also rejects padding
+            __m256 inside = _mm256_cmp_ps(r, zero, _CMP_GT_OQ);
+            for (int p = 0; p < 6; p++) {
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                    _mm256_mul_ps(planeX[p], x),
+                    _mm256_mul_ps(planeY[p], y)),
+                    _mm256_mul_ps(planeZ[p], z)),
+                    planeW[p]);
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negR, _CMP_GE_OQ));
+            }
+
+            int mask = _mm256_movemask_ps(inside);
+            while (mask) {
+                int bit = std::countr_zero((unsigned)mask);
+                push(i + bit);
+                mask &= mask - 1;
+            }
+        }
+        return;
+    }
+#endif
+
+    for (uint32_t i = 0; i < input.count; i++) {
+        if (SphereIntersectsFrustum(planes, xs[i], ys[i], zs[i], rs[i])) {
+            push(i);
+        }
+    }
+}
+
+static AABB UnionAABB(const AABB& a, const AABB& b)
+{
+    return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+}
+
+void LightClusterBuilder::SetProjection(const glm::mat4& newProjection, float newNearZ, float newFarZ)
+{
+    if (newProjection == projection && newNearZ == nearZ && newFarZ == farZ) {
+        return;
+    }
+
+    projection = newProjection;
+    nearZ = newNearZ;
+    farZ = newFarZ;
+    depthParams = ComputeLightClusterDepthParams(nearZ, farZ);
+    frustumPlanes = ComputeViewFrustumPlanes(projection, nearZ, farZ);
+
+    glm::mat4 inverseProjection = glm::inverse(projection);
+
+    // View space direction through an NDC xy, scaled so that z = -1.
+    // Multiplying by a view distance gives the point at that depth, whatever the depth convention.
+    auto viewRay = [&](float ndcX, float ndcY) {
+        glm::vec4 point = inverseProjection * glm::vec4(ndcX, ndcY, 0.5f, 1.0f);
+        glm::vec3 view = glm::vec3(point) / point.w;
+        return view / -view.z;
+    };
+
+    clusterBounds.resize(LightClusterCount);
+    rowBounds.resize(LightClusterCountY * LightClusterCountZ);
+    sliceBounds.resize(LightClusterCountZ);
+
+    float depthRatio = farZ / nearZ;
+    for (uint32_t z = 0; z < LightClusterCountZ; z++) {
+        float sliceNear = nearZ * powf(depthRatio, (float)z / LightClusterCountZ);
+        float sliceFar = nearZ * powf(depthRatio, (float)(z + 1) / LightClusterCountZ);
+
+        for (uint32_t y = 0; y < LightClusterCountY; y++) {
+            // Tile rows go top down, NDC y goes bottom up
+            float ndcTop = 1.0f - 2.0f * (float)y / LightClusterCountY;
+            float ndcBottom = 1.0f - 2.0f * (float)(y + 1) / LightClusterCountY;
+
+            for (uint32_t x = 0; x < LightClusterCountX; x++) {
+                float ndcLeft = -1.0f + 2.0f * (float)x / LightClusterCountX;
+                float ndcRight = -1.0f + 2.0f * (float)(x + 1) / LightClusterCountX;
+
+                glm::vec3 rays[4] = {
+                    viewRay(ndcLeft, ndcTop),
+                    viewRay(ndcRight, ndcTop),
+                    viewRay(ndcLeft, ndcBottom),
+                    viewRay(ndcRight, ndcBottom),
+                };
+
+                // The tile's corners at both ends of the slice bound the whole froxel
+                AABB box = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+                for (const glm::vec3& ray : rays) {
+                    for (float depth : { sliceNear, sliceFar }) {
+                        box.min = glm::min(box.min, ray * depth);
+                        box.max = glm::max(box.max, ray * depth);
+                    }
+                }
+
+                clusterBounds[LightClusterIndex(x, y, z)] = box;
+            }
+        }
+    }
+
+    for (uint32_t z = 0; z < LightClusterCountZ; z++) {
+        AABB slice = clusterBounds[LightClusterIndex(0, 0, z)];
+        for (uint32_t y = 0; y < LightClusterCountY; y++) {
+            AABB row = clusterBounds[LightClusterIndex(0, y, z)];
+            for (uint32_t x = 1; x < LightClusterCountX; x++) {
+                row = UnionAABB(row, clusterBounds[LightClusterIndex(x, y, z)]);
+            }
+            rowBounds[z * LightClusterCountY + y] = row;
+            slice = UnionAABB(slice, row);
+        }
+        sliceBounds[z] = slice;
+    }
+}
+
+void LightClusterBuilder::BinSlice(uint32_t z, bool useSIMD, SliceResult& result) const
+{
+    result.indices.clear();
+
+    result.sliceLights.Clear();
+    FilterSpheresAABB(visibleLights, sliceBounds[z], result.sliceLights, useSIMD);
+    result.sliceLights.Pad();
+
+    for (uint32_t y = 0; y < LightClusterCountY; y++) {
+        result.rowLights.Clear();
+        FilterSpheresAABB(result.sliceLights, rowBounds[z * LightClusterCountY + y], result.rowLights, useSIMD);
+        result.rowLights.Pad();
+
+        for (uint32_t x = 0; x < LightClusterCountX; x++) {
+            uint32_t offset = (uint32_t)result.indices.size();
+            ForEachSphereInAABB(result.rowLights, clusterBounds[LightClusterIndex(x, y, z)], useSIMD, [&](uint32_t i) {
+                result.indices.push_back(result.rowLights.ids[i]);
+            });
+            result.clusters[y * LightClusterCountX + x] = glm::uvec2(offset, (uint32_t)result.indices.size() - offset);
+        }
+    }
+}
+
+void LightClusterBuilder::Build(
+    std::span<const glm::vec4> viewSpheres,
+    std::span<const uint32_t> lightIds,
+    bool useSIMD,
+    uint32_t threadCount
+)
+{
+    lights.Clear();
+    for (size_t i = 0; i < viewSpheres.size(); i++) {
+        lights.Push(viewSpheres[i], lightIds[i]);
+    }
+    lights.Pad();
+
+    visibleLights.Clear();
+    FilterSpheresFrustum(lights, frustumPlanes, visibleLights, useSIMD);
+    visibleLights.Pad();
+
+    if (threadCount == 0) {
+        // Spawning threads costs more than binning a few hundred lights
+        threadCount = visibleLights.count >= 1024 ? std::max(std::thread::hardware_concurrency(), 1u) : 1;
+    }
+    threadCount = std::min(threadCount, LightClusterCountZ);
+
+    slices.resize(LightClusterCountZ);
+
+    // Interleave slices between threads, near slices are much thinner than far ones
+    auto binSlices = [&](uint32_t firstSlice) {
+        for (uint32_t z = firstSlice; z < LightClusterCountZ; z += threadCount) {
+            BinSlice(z, useSIMD, slices[z]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < threadCount; t++) {
+        threads.emplace_back(binSlices, t);
+    }
+    binSlices(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    Flatten();
+}
+
+void LightClusterBuilder::Flatten()
+{
+    clusters.resize(LightClusterCount);
+    lightIndices.clear();
+    overflow = 0;
+
+    for (uint32_t z = 0; z < LightClusterCountZ; z++) {
+        const SliceResult& slice = slices[z];
+        for (uint32_t i = 0; i < LightClusterCountX * LightClusterCountY; i++) {
+            glm::uvec2 local = slice.clusters[i];
+
+            uint32_t offset = (uint32_t)lightIndices.size();
+            uint32_t count = std::min(local.y, MaxLightClusterIndices - offset);
+            overflow += local.y - count;
+
+            lightIndices.insert(lightIndices.end(), slice.indices.begin() + local.x, slice.indices.begin() + local.x + count);
+            clusters[z * LightClusterCountX * LightClusterCountY + i] = glm::uvec2(offset, count);
+        }
+    }
+}
+
+void LightClusterBuilder::BuildReference(std::span<const glm::vec4> viewSpheres, std::span<const uint32_t> lightIds)
+{
+    clusters.resize(LightClusterCount);
+    lightIndices.clear();
+    overflow = 0;
+
+    visibleLights.Clear();
+    for (size_t i = 0; i < viewSpheres.size(); i++) {
+        const glm::vec4& sphere = viewSpheres[i];
+        if (SphereIntersectsFrustum(frustumPlanes, sphere.x, sphere.y, sphere.z, sphere.w)) {
+            visibleLights.Push(sphere, lightIds[i]);
+        }
+    }
+    visibleLights.Pad();
+
+    for (uint32_t cluster = 0; cluster < LightClusterCount; cluster++) {
+        uint32_t offset = (uint32_t)lightIndices.size();
+        for (size_t i = 0; i < visibleLights.count; i++) {
+            glm::vec4 sphere = glm::vec4(visibleLights.xyzr[0][i], visibleLights.xyzr[1][i], visibleLights.xyzr[2][i], visibleLights.xyzr[3][i]);
+            if (SphereOverlapsAABB(clusterBounds[cluster], sphere.x, sphere.y, sphere.z, sphere.w)) {
+                if (lightIndices.size() < MaxLightClusterIndices) {
+                    lightIndices.push_back(visibleLights.ids[i]);
+                }
+                else {
+                    overflow++;
+                }
+            }
+        }
+        clusters[cluster] = glm::uvec2(offset, (uint32_t)lightIndices.size() - offset);
+    }
+}
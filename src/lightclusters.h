@@ -0,0 +1,156 @@
+#pragma once
+
+#include "transforms.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+// Froxel grid dimensions. Tiles are laid out in screen space from the top left,
+// slices are exponentially distributed between the near and far planes.
+static constexpr uint32_t LightClusterCountX = 16;
+static constexpr uint32_t LightClusterCountY = 9;
+static constexpr uint32_t LightClusterCountZ = 24;
+static constexpr uint32_t LightClusterCount = LightClusterCountX * LightClusterCountY * LightClusterCountZ;
+
+// Upper bound of the GPU light index list. Lights past this are dropped and counted as overflow.
+static constexpr uint32_t MaxLightClusterIndices = 1 << 20;
+
+inline uint32_t LightClusterIndex(uint32_t x, uint32_t y, uint32_t z)
+{
+    return (z * LightClusterCountY + y) * LightClusterCountX + x;
+}
+
+// slice = log(-viewZ) * scale + bias, shared with the lighting shaders.
+struct LightClusterDepthParams
+{
+    float scale;
+    float bias;
+};
+
+LightClusterDepthParams ComputeLightClusterDepthParams(float nearZ, float farZ);
+
+// Spheres in SoA form with an id per sphere.
+// Padded to a multiple of 8 with spheres that never pass a test, so SIMD loops need no remainder.
+struct SphereSoA
+{
+    std::array<AlignedVector<float>, 4> xyzr;
+    std::vector<uint32_t> ids;
+    uint32_t count = 0;
+
+    void Clear();
+    void Push(const glm::vec4& sphere, uint32_t id);
+    // Call after the last Push()
+    void Pad();
+};
+
+// Appends the spheres of input that overlap box to output, output must be padded afterwards.
+void FilterSpheresAABB(const SphereSoA& input, const AABB& box, SphereSoA& output, bool useSIMD = true);
+
+// Planes as (normal, distance) with normals pointing inwards
+using FrustumPlanes = std::array<glm::vec4, 6>;
+
+// View space frustum of a perspective projection, independent of its depth convention.
+FrustumPlanes ComputeViewFrustumPlanes(const glm::mat4& projection, float nearZ, float farZ);
+
+// Appends the spheres of input with a radius that intersect the frustum to output,
+// output must be padded afterwards. Conservative, spheres near frustum corners may pass.
+void FilterSpheresFrustum(const SphereSoA& input, const FrustumPlanes& planes, SphereSoA& output, bool useSIMD = true);
+
+// Bins light spheres into a view space froxel grid, producing a CSR list of light ids per cluster.
+//
+// Lights are first culled against the view frustum into a compact visible list, so off screen
+// lights are only ever looked at once. Visible lights are then filtered per depth slice, then per row of tiles, then tested against each
+// cluster's AABB 8 lights at a time with AVX2 (scalar fallback otherwise).
+// Slices are independent so large light sets are spread over several threads.
+class LightClusterBuilder
+{
+public:
+    // Cluster bounds only depend on the projection, they are rebuilt when it changes.
+    void SetProjection(const glm::mat4& projection, float nearZ, float farZ);
+
+    // viewSpheres are (view space position, radius), lightIds are written into the index list.
+    // threadCount of 0 picks a count based on the number of lights.
+    void Build(
+        std::span<const glm::vec4> viewSpheres,
+        std::span<const uint32_t> lightIds,
+        bool useSIMD = true,
+        uint32_t threadCount = 0
+    );
+
+    // Frustum culls then tests every light against every cluster, only used to validate Build().
+    void BuildReference(std::span<const glm::vec4> viewSpheres, std::span<const uint32_t> lightIds);
+
+    // (offset, count) into LightIndices() per cluster
+    const std::vector<glm::uvec2>& Clusters() const
+    {
+        return clusters;
+    }
+
+    const std::vector<uint32_t>& LightIndices() const
+    {
+        return lightIndices;
+    }
+
+    const AABB& ClusterBounds(uint32_t clusterIndex) const
+    {
+        return clusterBounds[clusterIndex];
+    }
+
+    LightClusterDepthParams DepthParams() const
+    {
+        return depthParams;
+    }
+
+    // Ids of the lights that survived frustum culling in the last build, in input order
+    std::span<const uint32_t> VisibleLights() const
+    {
+        return { visibleLights.ids.data(), visibleLights.count };
+    }
+
+    // View space spheres of the visible lights, padded
+    const SphereSoA& VisibleLightSpheres() const
+    {
+        return visibleLights;
+    }
+
+    // Light references that didn't fit in MaxLightClusterIndices during the last build
+    uint32_t Overflow() const
+    {
+        return overflow;
+    }
+
+private:
+    struct SliceResult
+    {
+        SphereSoA sliceLights;
+        SphereSoA rowLights;
+        std::vector<uint32_t> indices;
+        std::array<glm::uvec2, LightClusterCountX * LightClusterCountY> clusters;
+    };
+
+    void BinSlice(uint32_t z, bool useSIMD, SliceResult& result) const;
+    void Flatten();
+
+    glm::mat4 projection = glm::mat4(0.0f);
+    float nearZ = 0.0f;
+    float farZ = 0.0f;
+    LightClusterDepthParams depthParams = {};
+    FrustumPlanes frustumPlanes = {};
+
+    std::vector<AABB> clusterBounds;
+    // Union of the clusters in each row of each slice, [z * CountY + y]
+    std::vector<AABB> rowBounds;
+    std::vector<AABB> sliceBounds;
+
+    SphereSoA lights;
+    SphereSoA visibleLights;
+    std::vector<SliceResult> slices;
+
+    std::vector<glm::uvec2> clusters;
+    std::vector<uint32_t> lightIndices;
+    uint32_t overflow = 0;
+};
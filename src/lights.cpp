@@ -0,0 +1,403 @@
+#include "lights.h"
+
+#include <algorithm>
+#include <cmath>
+
+float ComputeEffectiveRadius(const glm::vec3& color, float intensity, float range, float radianceThreshold)
+{
+    float CI = glm::length(color * intensity);
+    float effectiveRadius = sqrtf(CI / radianceThreshold);
+    if (range > 0.0f) {
+        effectiveRadius = std::min(effectiveRadius, range);
+    }
+    return effectiveRadius;
+}
+
+uint32_t LightStore::PartitionFirst(LightType type) const
+{
+    uint32_t first = 0;
+    for (int t = 0; t < type; t++) {
+        first += typeCounts[t];
+    }
+    return first;
+}
+
+void LightStore::MarkDirty(uint32_t slot)
+{
+    if (!dirty[slot]) {
+        dirty[slot] = 1;
+        dirtySlots.push_back(slot);
+    }
+}
+
+void LightStore::MoveSlot(uint32_t from, uint32_t to)
+{
+    positions[to] = positions[from];
+    directions[to] = directions[from];
+    colors[to] = colors[from];
+    intensities[to] = intensities[from];
+    ranges[to] = ranges[from];
+    effectiveRadii[to] = effectiveRadii[from];
+    castsShadow[to] = castsShadow[from];
+    types[to] = types[from];
+
+    handleOfSlot[to] = handleOfSlot[from];
+    slotOfHandle[handleOfSlot[to]] = to;
+
+    MarkDirty(to);
+}
+
+void LightStore::InsertSlot(uint32_t handle, LightType type)
+{
+    uint32_t hole = (uint32_t)positions.size();
+
+    positions.emplace_back();
+    directions.emplace_back();
+    colors.emplace_back();
+    intensities.emplace_back();
+    ranges.emplace_back();
+    effectiveRadii.emplace_back();
+    castsShadow.emplace_back();
+    types.emplace_back();
+    dirty.emplace_back(0);
+    handleOfSlot.emplace_back();
+
+    // Make room at the end of the type's partition by moving the first light of each
+    // following partition to that partition's end, one move per type.
+    for (int t = LightType_Count - 1; t > type; t--) {
+        uint32_t first = PartitionFirst((LightType)t);
+        if (typeCounts[t] > 0) {
+            MoveSlot(first, hole);
+        }
+        hole = first;
+    }
+
+    handleOfSlot[hole] = handle;
+    slotOfHandle[handle] = hole;
+    types[hole] = type;
+    typeCounts[type]++;
+    MarkDirty(hole);
+}
+
+void LightStore::RemoveSlot(uint32_t slot)
+{
+    LightType type = types[slot];
+
+    // Fill the gap with the last light of the same type, then shift each following
+    // partition down by moving its last light into the gap in front of it.
+    uint32_t hole = slot;
+    uint32_t last = PartitionFirst(type) + typeCounts[type] - 1;
+    if (last != hole) {
+        MoveSlot(last, hole);
+    }
+    hole = last;
+    typeCounts[type]--;
+
+    for (int t = type + 1; t < LightType_Count; t++) {
+        if (typeCounts[t] > 0) {
+            uint32_t lastOfType = PartitionFirst((LightType)t) + typeCounts[t];
+            MoveSlot(lastOfType, hole);
+            hole = lastOfType;
+        }
+    }
+
+    positions.pop_back();
+    directions.pop_back();
+    colors.pop_back();
+    intensities.pop_back();
+    ranges.pop_back();
+    effectiveRadii.pop_back();
+    castsShadow.pop_back();
+    types.pop_back();
+    dirty.pop_back();
+    handleOfSlot.pop_back();
+}
+
+uint32_t LightStore::Add(LightType type)
+{
+    std::scoped_lock lock(mutex);
+
+    uint32_t handle;
+    if (!freeHandles.empty()) {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+    } else {
+        handle = (uint32_t)slotOfHandle.size();
+        slotOfHandle.push_back(InvalidHandle);
+    }
+
+    InsertSlot(handle, type);
+
+    uint32_t slot = slotOfHandle[handle];
+    positions[slot] = glm::vec3(0.0f);
+    directions[slot] = glm::vec3(0.0f, -1.0f, 0.0f);
+    colors[slot] = glm::vec3(1.0f);
+    intensities[slot] = 1.0f;
+    ranges[slot] = 0.0f;
+    castsShadow[slot] = 1;
+    effectiveRadii[slot] = ComputeEffectiveRadius(colors[slot], intensities[slot], ranges[slot], RadianceThreshold);
+
+    return handle;
+}
+
+void LightStore::Remove(uint32_t handle)
+{
+    std::scoped_lock lock(mutex);
+
+    RemoveSlot(slotOfHandle[handle]);
+    slotOfHandle[handle] = InvalidHandle;
+    freeHandles.push_back(handle);
+}
+
+void LightStore::Clear()
+{
+    std::scoped_lock lock(mutex);
+
+    positions.clear();
+    directions.clear();
+    colors.clear();
+    intensities.clear();
+    ranges.clear();
+    effectiveRadii.clear();
+    castsShadow.clear();
+    types.clear();
+    dirty.clear();
+    handleOfSlot.clear();
+    dirtySlots.clear();
+    typeCounts = {};
+    slotOfHandle.clear();
+    freeHandles.clear();
+}
+
+void LightStore::SetType(uint32_t handle, LightType type)
+{
+    std::scoped_lock lock(mutex);
+
+    uint32_t slot = slotOfHandle[handle];
+    if (types[slot] == type) {
+        return;
+    }
+
+    // Moves the light into the other partition, keeping its handle
+    glm::vec3 position = positions[slot];
+    glm::vec3 direction = directions[slot];
+    glm::vec3 color = colors[slot];
+    float intensity = intensities[slot];
+    float range = ranges[slot];
+    uint8_t shadow = castsShadow[slot];
+
+    RemoveSlot(slot);
+    InsertSlot(handle, type);
+
+    slot = slotOfHandle[handle];
+    positions[slot] = position;
+    directions[slot] = direction;
+    colors[slot] = color;
+    intensities[slot] = intensity;
+    ranges[slot] = range;
+    castsShadow[slot] = shadow;
+    effectiveRadii[slot] = ComputeEffectiveRadius(color, intensity, range, RadianceThreshold);
+}
+
+void LightStore::SetPosition(uint32_t handle, const glm::vec3& position)
+{
+    std::scoped_lock lock(mutex);
+
+    uint32_t slot = slotOfHandle[handle];
+    positions[slot] = position;
+    MarkDirty(slot);
+}
+
+void LightStore::SetDirection(uint32_t handle, const glm::vec3& direction)
+{
+    std::scoped_lock lock(mutex);
+
+    uint32_t slot = slotOfHandle[handle];
+    directions[slot] = direction;
+    MarkDirty(slot);
+}
+
+void LightStore::SetColor(uint32_t handle, const glm::vec3& color)
+{
+    std::scoped_lock lock(mutex);
+
+    uint32_t slot = slotOfHandle[handle];
+    colors[slot] = color;
+    effectiveRadii[slot] = ComputeEffectiveRadius(color, intensities[slot], ranges[slot], RadianceThreshold);
+    MarkDirty(slot);
+}
+
+void LightStore::SetIntensity(uint32_t handle, float intensity)
+{
+    std::scoped_lock lock(mutex);
+
+    uint32_t slot = slotOfHandle[handle];
+    intensities[slot] = intensity;
+    effectiveRadii[slot] = ComputeEffectiveRadius(colors[slot], intensity, ranges[slot], RadianceThreshold);
+    MarkDirty(slot);
+}
+
+void LightStore::SetRange(uint32_t handle, float range)
+{
+    std::scoped_lock lock(mutex);
+
+    uint32_t slot = slotOfHandle[handle];
+    ranges[slot] = range;
+    effectiveRadii[slot] = ComputeEffectiveRadius(colors[slot], intensities[slot], range, RadianceThreshold);
+    MarkDirty(slot);
+}
+
+void LightStore::SetCastsShadow(uint32_t handle, bool shadow)
+{
+    std::scoped_lock lock(mutex);
+
+    uint32_t slot = slotOfHandle[handle];
+    castsShadow[slot] = shadow;
+    MarkDirty(slot);
+}
+
+LightType LightStore::GetType(uint32_t handle) const
+{
+    std::scoped_lock lock(mutex);
+
+    return types[slotOfHandle[handle]];
+}
+
+glm::vec3 LightStore::GetPosition(uint32_t handle) const
+{
+    std::scoped_lock lock(mutex);
+
+    return positions[slotOfHandle[handle]];
+}
+
+glm::vec3 LightStore::GetDirection(uint32_t handle) const
+{
+    std::scoped_lock lock(mutex);
+
+    return directions[slotOfHandle[handle]];
+}
+
+glm::vec3 LightStore::GetColor(uint32_t handle) const
+{
+    std::scoped_lock lock(mutex);
+
+    return colors[slotOfHandle[handle]];
+}
+
+float LightStore::GetIntensity(uint32_t handle) const
+{
+    std::scoped_lock lock(mutex);
+
+    return intensities[slotOfHandle[handle]];
+}
+
+float LightStore::GetRange(uint32_t handle) const
+{
+    std::scoped_lock lock(mutex);
+
+    return ranges[slotOfHandle[handle]];
+}
+
+bool LightStore::GetCastsShadow(uint32_t handle) const
+{
+    std::scoped_lock lock(mutex);
+
+    return castsShadow[slotOfHandle[handle]];
+}
+
+uint32_t LightStore::Count() const
+{
+    std::scoped_lock lock(mutex);
+
+    return (uint32_t)positions.size();
+}
+
+uint32_t LightStore::HandleAt(uint32_t slot) const
+{
+    std::scoped_lock lock(mutex);
+
+    return handleOfSlot[slot];
+}
+
+LightStore::Range LightStore::TypeRange(LightType type) const
+{
+    std::scoped_lock lock(mutex);
+
+    return { PartitionFirst(type), typeCounts[type] };
+}
+
+void LightStore::MarkAllDirty()
+{
+    std::scoped_lock lock(mutex);
+
+    for (uint32_t slot = 0; slot < (uint32_t)positions.size(); slot++) {
+        MarkDirty(slot);
+    }
+}
+
+LightStore::UpdateStats LightStore::Update(LightConstantData* destination, uint32_t capacity, bool disableShadows)
+{
+    std::scoped_lock lock(mutex);
+
+    UpdateStats stats;
+
+    if (disableShadows != lastDisableShadows) {
+        for (uint32_t slot = 0; slot < (uint32_t)positions.size(); slot++) {
+            MarkDirty(slot);
+        }
+        lastDisableShadows = disableShadows;
+    }
+
+    // Anything that doesn't fit yet stays queued for after the buffer grows
+    std::vector<uint32_t> deferred;
+
+    for (uint32_t slot : dirtySlots) {
+        // Entries of removed slots, or slots queued twice, are stale
+        if (slot >= positions.size() || !dirty[slot]) {
+            continue;
+        }
+        if (slot >= capacity) {
+            deferred.push_back(slot);
+            continue;
+        }
+
+        LightConstantData data = {};
+        data.position = glm::vec4(positions[slot], 1.0f);
+        data.direction = glm::vec4(glm::normalize(directions[slot]), 0.0f);
+        data.colorIntensity = glm::vec4(colors[slot] * intensities[slot], 1.0f);
+        data.MVP = glm::mat4(1.0f);
+        data.range = ranges[slot];
+        data.lightType = types[slot];
+        data.castsShadow = castsShadow[slot] && !disableShadows;
+        data.effectiveRadius = effectiveRadii[slot];
+        destination[slot] = data;
+
+        dirty[slot] = 0;
+        stats.uploadedLights++;
+    }
+    dirtySlots = std::move(deferred);
+
+    for (int t = 0; t < LightType_Count; t++) {
+        stats.ranges[t] = { PartitionFirst((LightType)t), typeCounts[t] };
+    }
+
+    return stats;
+}
+
+void LightStore::GatherViewSpheres(Range range, const glm::mat4& view, std::vector<glm::vec4>& spheres, std::vector<uint32_t>& ids) const
+{
+    std::scoped_lock lock(mutex);
+
+    spheres.clear();
+    ids.clear();
+
+    // The range may be stale if lights were added since it was taken
+    uint32_t end = std::min(range.first + range.count, (uint32_t)positions.size());
+    spheres.reserve(end - std::min(range.first, end));
+    ids.reserve(end - std::min(range.first, end));
+    for (uint32_t slot = range.first; slot < end; slot++) {
+        glm::vec3 viewPosition = glm::vec3(view * glm::vec4(positions[slot], 1.0f));
+        spheres.push_back(glm::vec4(viewPosition, effectiveRadii[slot]));
+        ids.push_back(slot);
+    }
+}
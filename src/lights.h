@@ -0,0 +1,142 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+enum LightType : uint8_t
+{
+    LightType_Point,
+    LightType_Directional,
+    LightType_Count,
+};
+
+// One light in the GPU light buffer, LightConstantData in common.hlsli.
+// Only holds world space data, so lights only need uploading when they change.
+struct LightConstantData
+{
+    glm::vec4 position;
+    glm::vec4 direction;
+    glm::vec4 colorIntensity;
+
+    // MVP used for rendering.
+    // For spot lights, this is the spot lights point of view.
+    // For point lights, this transforms the sphere into the world.
+    glm::mat4 MVP;
+
+    float range;
+    uint32_t lightType;
+    uint32_t castsShadow;
+
+    // Point lights contribute nothing past this distance
+    float effectiveRadius;
+};
+static_assert(sizeof(LightConstantData) == 128, "LightConstantData must match the HLSL structured buffer stride");
+
+// Point lights follow the inverse square law and don't have a radius.
+// But for optimization purposes we need to limit the range of the light.
+// So we compute the effective radius using radianceThreshold^
+//
+// float radiance = attenuation * colorIntensity
+// radiance = (1.0f / (distance * distance)) * colorIntensity
+// let effectiveRadius = distance
+// let radianceThreshold = radiance
+// radianceThreshold = colorIntensity / (effectiveRadius * effectiveRadius)
+// effectiveRadius = sqrt(colorIntensity / radianceThreshold)
+//
+// A glTF range of 0 means infinite, otherwise it clamps the radius.
+float ComputeEffectiveRadius(const glm::vec3& color, float intensity, float range, float radianceThreshold);
+
+// Structure-of-arrays storage for every light in the app.
+//
+// Lights are referred to by stable handles, but stored densely and partitioned by type, so
+// each type occupies one contiguous range of slots. The slots map 1:1 onto the GPU light buffer,
+// which lets passes draw a whole type at once without scanning.
+// Setters only flag a light as dirty, Update() uploads just the dirty lights.
+class LightStore
+{
+public:
+    static constexpr uint32_t InvalidHandle = UINT32_MAX;
+    static constexpr float RadianceThreshold = 0.001f;
+
+    struct Range
+    {
+        uint32_t first = 0;
+        uint32_t count = 0;
+    };
+
+    struct UpdateStats
+    {
+        uint32_t uploadedLights = 0;
+        // Type ranges the upload was done with
+        std::array<Range, LightType_Count> ranges;
+    };
+
+    uint32_t Add(LightType type);
+    void Remove(uint32_t handle);
+    void Clear();
+
+    void SetType(uint32_t handle, LightType type);
+    void SetPosition(uint32_t handle, const glm::vec3& position);
+    void SetDirection(uint32_t handle, const glm::vec3& direction);
+    void SetColor(uint32_t handle, const glm::vec3& color);
+    void SetIntensity(uint32_t handle, float intensity);
+    void SetRange(uint32_t handle, float range);
+    void SetCastsShadow(uint32_t handle, bool castsShadow);
+
+    LightType GetType(uint32_t handle) const;
+    glm::vec3 GetPosition(uint32_t handle) const;
+    glm::vec3 GetDirection(uint32_t handle) const;
+    glm::vec3 GetColor(uint32_t handle) const;
+    float GetIntensity(uint32_t handle) const;
+    float GetRange(uint32_t handle) const;
+    bool GetCastsShadow(uint32_t handle) const;
+
+    uint32_t Count() const;
+    // Handle of the light currently in a slot, for listing lights in order
+    uint32_t HandleAt(uint32_t slot) const;
+    Range TypeRange(LightType type) const;
+
+    // Forces every light to be uploaded on the next Update()
+    void MarkAllDirty();
+
+    // Writes dirty lights into destination. Lights in slots at or past capacity stay dirty.
+    UpdateStats Update(LightConstantData* destination, uint32_t capacity, bool disableShadows);
+
+    // (view space position, effective radius) of each light in range, as light cluster input.
+    // ids are the lights' slots.
+    void GatherViewSpheres(Range range, const glm::mat4& view, std::vector<glm::vec4>& spheres, std::vector<uint32_t>& ids) const;
+
+private:
+    uint32_t PartitionFirst(LightType type) const;
+    void MoveSlot(uint32_t from, uint32_t to);
+    void MarkDirty(uint32_t slot);
+    void InsertSlot(uint32_t handle, LightType type);
+    void RemoveSlot(uint32_t slot);
+
+    mutable std::mutex mutex;
+
+    // Per slot
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> directions;
+    std::vector<glm::vec3> colors;
+    std::vector<float> intensities;
+    std::vector<float> ranges;
+    std::vector<float> effectiveRadii;
+    std::vector<uint8_t> castsShadow;
+    std::vector<LightType> types;
+    std::vector<uint8_t> dirty;
+    std::vector<uint32_t> handleOfSlot;
+
+    std::vector<uint32_t> dirtySlots;
+    std::array<uint32_t, LightType_Count> typeCounts = {};
+
+    // Per handle
+    std::vector<uint32_t> slotOfHandle;
+    std::vector<uint32_t> freeHandles;
+
+    bool lastDisableShadows = false;
+};
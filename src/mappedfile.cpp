@@ -0,0 +1,141 @@
+#include "mappedfile.h"
+
+#include <filesystem>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other) {
+        Close();
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+        isOpen = std::exchange(other.isOpen, false);
+#ifdef _WIN32
+        mapping = std::exchange(other.mapping, nullptr);
+#endif
+    }
+    return *this;
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+    HANDLE file = CreateFileW(
+        std::filesystem::path(path).c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    // Mapping an empty file fails, but it is a valid file with no bytes
+    if (fileSize.QuadPart > 0) {
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+    }
+    // The mapping keeps the file open
+    CloseHandle(file);
+
+    if (fileSize.QuadPart > 0 && !data) {
+        Close();
+        return false;
+    }
+
+    size = data ? static_cast<size_t>(fileSize.QuadPart) : 0;
+    isOpen = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    data = nullptr;
+    mapping = nullptr;
+    size = 0;
+    isOpen = false;
+}
+#else
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+    int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file == -1) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0) {
+        close(file);
+        return false;
+    }
+
+    // Mapping an empty file fails, but it is a valid file with no bytes
+    if (fileStat.st_size > 0) {
+        void* view = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (view == MAP_FAILED) {
+            close(file);
+            return false;
+        }
+        data = static_cast<const uint8_t*>(view);
+        size = (size_t)fileStat.st_size;
+    }
+    // The mapping keeps the file open
+    close(file);
+
+    isOpen = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data) {
+        munmap(const_cast<uint8_t*>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+    isOpen = false;
+}
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <cstdint>
+
+// Read only view of a whole file, mapped into memory rather than copied into a buffer.
+//
+// Pages are read in by the OS the first time they are touched, and come straight from the
+// file cache once the file is warm. While a file is mapped it can't be overwritten on Windows,
+// so files that get rewritten while the app runs (shaders) should only be held briefly.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false if the file can't be opened. Empty files open with no bytes.
+    bool Open(const std::string& path);
+    void Close();
+
+    bool IsOpen() const
+    {
+        return isOpen;
+    }
+
+    std::span<const uint8_t> Bytes() const
+    {
+        return { data, size };
+    }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    bool isOpen = false;
+#ifdef _WIN32
+    // File mapping HANDLE, kept as void* so windows.h stays out of the header
+    void* mapping = nullptr;
+#endif
+};
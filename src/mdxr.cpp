@@ -169,7 +169,7 @@ void UpdateScene(App& app)
     long long deltaTicks = currentTick - app.lastFrameTick;
     float deltaSeconds = (float)deltaTicks / (float)1e9;
 
-    glm::mat4 projection = glm::perspective(app.camera.fovY, (float)app.windowWidth / (float)app.windowHeight, 0.1f, 1000.0f);
+    glm::mat4 projection = glm::perspective(app.camera.fovY, (float)app.windowWidth / (float)app.windowHeight, app.camera.nearZ, app.camera.farZ);
     //glm::mat4 projection = glm::ortho(-3.0f, 3.0f, -3.0f, 3.0f, 0.1f, 100.0f);
     glm::mat4 view = UpdateFlyCamera(app, deltaSeconds);
 
@@ -177,7 +177,7 @@ void UpdateScene(App& app)
     std::call_once(onceFlag, [view] {DEBUG_VAR(view)});
 
     if (app.Skybox.mesh) {
-        app.Skybox.mesh->translation = app.camera.translation;
+        app.transforms.SetTranslation(app.Skybox.mesh->instances[0].transformIndex, app.camera.translation);
     }
 
     UpdateRenderData(app, projection, view, app.camera.translation);
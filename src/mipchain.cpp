@@ -0,0 +1,279 @@
+#include "mipchain.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <thread>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Linear values are rounded to 8 bits through a table of this many buckets, which is fine enough
+// that each bucket holds at most one rounding threshold (sRGB thresholds are furthest apart
+// from each other near black, at 1 / (255 * 12.92)).
+static constexpr uint32_t EncodeBuckets = 4096;
+
+static double SRGBToLinear(double c)
+{
+    return c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+static double LinearToSRGB(double c)
+{
+    return c <= 0.0031308 ? c * 12.92 : 1.055 * pow(c, 1.0 / 2.4) - 0.055;
+}
+
+// Every table has an sRGB half and a linear half. Channel tables pick the half per channel.
+struct MipTables
+{
+    // 8 bit value to linear float
+    alignas(32) float decode[2][256];
+    // Linear float to the 8 bit value at the start of its bucket
+    alignas(32) int32_t encodeBucket[2][EncodeBuckets];
+    // Linear float where each 8 bit value rounds up to the next, past 1 for 255
+    alignas(32) float encodeThreshold[2][256];
+
+    MipTables()
+    {
+        for (int table = 0; table < 2; table++) {
+            bool isSRGB = table == 0;
+            for (int i = 0; i < 256; i++) {
+                decode[table][i] = (float)(isSRGB ? SRGBToLinear(i / 255.0) : i / 255.0);
+                encodeThreshold[table][i] = i < 255 ? (float)(isSRGB ? SRGBToLinear((i + 0.5) / 255.0) : (i + 0.5) / 255.0) : 2.0f;
+            }
+
+            int32_t value = 0;
+            for (uint32_t bucket = 0; bucket < EncodeBuckets; bucket++) {
+                float bucketStart = (float)bucket / EncodeBuckets;
+                while (value < 255 && encodeThreshold[table][value] <= bucketStart) {
+                    value++;
+                }
+                encodeBucket[table][bucket] = value;
+            }
+        }
+    }
+};
+
+static const MipTables& GetMipTables()
+{
+    static const MipTables tables;
+    return tables;
+}
+
+// Table half used by each channel of an RGBA texel
+static std::array<int, 4> ChannelTables(bool isSRGB)
+{
+    return isSRGB ? std::array<int, 4>{ 0, 0, 0, 1 } : std::array<int, 4>{ 1, 1, 1, 1 };
+}
+
+static uint8_t EncodeLinear(const MipTables& tables, int table, float linear)
+{
+    int32_t bucket = std::min((int32_t)(linear * (float)EncodeBuckets), (int32_t)EncodeBuckets - 1);
+    int32_t value = tables.encodeBucket[table][bucket];
+    return (uint8_t)(value + (linear >= tables.encodeThreshold[table][value] ? 1 : 0));
+}
+
+static void DownsampleTexels(const uint8_t* row0, const uint8_t* row1, uint32_t srcWidth, uint8_t* dest, bool isSRGB, uint32_t firstX)
+{
+    const MipTables& tables = GetMipTables();
+    std::array<int, 4> channelTables = ChannelTables(isSRGB);
+    uint32_t destWidth = std::max(srcWidth / 2, 1u);
+
+    for (uint32_t x = firstX; x < destWidth; x++) {
+        uint32_t x0 = std::min(x * 2, srcWidth - 1);
+        uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+        for (int c = 0; c < 4; c++) {
+            const float* decode = tables.decode[channelTables[c]];
+            // Same order as the AVX2 path: down the columns, then across
+            float sum = (decode[row0[x0 * 4 + c]] + decode[row1[x0 * 4 + c]]) + (decode[row0[x1 * 4 + c]] + decode[row1[x1 * 4 + c]]);
+            dest[x * 4 + c] = EncodeLinear(tables, channelTables[c], sum * 0.25f);
+        }
+    }
+}
+
+#ifdef __AVX2__
+// Averages the 2x2 blocks of two pairs of texels, each vector holding two RGBA texels of linear floats.
+// Returns the two averaged texels.
+static __m256 AverageBlocks(__m256 top0, __m256 bottom0, __m256 top1, __m256 bottom1)
+{
+    __m256 columns0 = _mm256_add_ps(top0, bottom0);
+    __m256 columns1 = _mm256_add_ps(top1, bottom1);
+    __m256 left = _mm256_permute2f128_ps(columns0, columns1, 0x20);
+    __m256 right = _mm256_permute2f128_ps(columns0, columns1, 0x31);
+    return _mm256_mul_ps(_mm256_add_ps(left, right), _mm256_set1_ps(0.25f));
+}
+
+// Same operations as DownsampleTexels, 4 destination texels at a time. Returns the first texel left for the scalar tail.
+static uint32_t DownsampleTexelsAVX2(const uint8_t* row0, const uint8_t* row1, uint32_t srcWidth, uint8_t* dest, bool isSRGB)
+{
+    const MipTables& tables = GetMipTables();
+    uint32_t destWidth = srcWidth / 2;
+
+    // Two RGBA texels per vector, offset into the table half each channel uses
+    std::array<int, 4> channelTables = ChannelTables(isSRGB);
+    __m256i decodeOffsets = _mm256_setr_epi32(
+        channelTables[0] * 256, channelTables[1] * 256, channelTables[2] * 256, channelTables[3] * 256,
+        channelTables[0] * 256, channelTables[1] * 256, channelTables[2] * 256, channelTables[3] * 256
+    );
+    __m256i bucketOffsets = _mm256_slli_epi32(decodeOffsets, 4);
+    __m256 bucketScale = _mm256_set1_ps((float)EncodeBuckets);
+    __m256i maxBucket = _mm256_set1_epi32(EncodeBuckets - 1);
+    __m256i texelOrder = _mm256_setr_epi32(0, 4, 1, 5, 0, 0, 0, 0);
+
+    const float* decode = &tables.decode[0][0];
+    const int* encodeBucket = &tables.encodeBucket[0][0];
+    const float* encodeThreshold = &tables.encodeThreshold[0][0];
+
+    auto load = [&](const uint8_t* texels) {
+        __m256i values = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(texels)));
+        return _mm256_i32gather_ps(decode, _mm256_add_epi32(values, decodeOffsets), 4);
+    };
+
+    auto encode = [&](__m256 linear) {
+        __m256i bucket = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(linear, bucketScale)), maxBucket);
+        __m256i value = _mm256_i32gather_epi32(encodeBucket, _mm256_add_epi32(bucket, bucketOffsets), 4);
+        __m256 threshold = _mm256_i32gather_ps(encodeThreshold, _mm256_add_epi32(value, decodeOffsets), 4);
+        // The comparison mask is -1 where the value rounds up
+        return _mm256_sub_epi32(value, _mm256_castps_si256(_mm256_cmp_ps(linear, threshold, _CMP_GE_OQ)));
+    };
+
+    uint32_t x = 0;
+    for (; x + 4 <= destWidth; x += 4) {
+        const uint8_t* top = row0 + x * 8;
+        const uint8_t* bottom = row1 + x * 8;
+
+        __m256 texels01 = AverageBlocks(load(top), load(bottom), load(top + 8), load(bottom + 8));
+        __m256 texels23 = AverageBlocks(load(top + 16), load(bottom + 16), load(top + 24), load(bottom + 24));
+
+        // Packing works within 128 bit lanes, leaving the texels in the order 0, 2, 0, 2, 1, 3, 1, 3
+        __m256i words = _mm256_packus_epi32(encode(texels01), encode(texels23));
+        __m256i bytes = _mm256_packus_epi16(words, words);
+        bytes = _mm256_permutevar8x32_epi32(bytes, texelOrder);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + x * 4), _mm256_castsi256_si128(bytes));
+    }
+
+    return x;
+}
+#endif
+
+void DownsampleRowRGBA8(const uint8_t* row0, const uint8_t* row1, uint32_t srcWidth, uint8_t* dest, bool isSRGB, bool useSIMD)
+{
+    uint32_t firstX = 0;
+#ifdef __AVX2__
+    if (useSIMD) {
+        firstX = DownsampleTexelsAVX2(row0, row1, srcWidth, dest, isSRGB);
+    }
+#endif
+    DownsampleTexels(row0, row1, srcWidth, dest, isSRGB, firstX);
+}
+
+std::vector<MipLevel> MipChainLevels(uint32_t width, uint32_t height)
+{
+    std::vector<MipLevel> levels;
+    size_t offset = 0;
+    while (width > 1 || height > 1) {
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+        levels.push_back(MipLevel{ width, height, offset });
+        offset += (size_t)width * height * 4;
+    }
+    return levels;
+}
+
+size_t MipChainSize(uint32_t width, uint32_t height)
+{
+    std::vector<MipLevel> levels = MipChainLevels(width, height);
+    return levels.empty() ? 0 : levels.back().offset + (size_t)levels.back().width * levels.back().height * 4;
+}
+
+void GenerateMipChain(
+    const uint8_t* rgba,
+    size_t rowPitch,
+    uint32_t width,
+    uint32_t height,
+    bool isSRGB,
+    uint8_t* dest,
+    bool useSIMD,
+    uint32_t threadCount
+)
+{
+    // Enough rows that a thread has more work than it costs to start it
+    const uint32_t MinRowsPerThread = 64;
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    const uint8_t* source = rgba;
+    size_t sourcePitch = rowPitch;
+    uint32_t sourceWidth = width;
+    uint32_t sourceHeight = height;
+
+    for (const MipLevel& level : MipChainLevels(width, height)) {
+        uint8_t* mip = dest + level.offset;
+        size_t mipPitch = (size_t)level.width * 4;
+
+        auto downsampleRows = [&](uint32_t firstRow, uint32_t endRow) {
+            for (uint32_t y = firstRow; y < endRow; y++) {
+                const uint8_t* row0 = source + std::min(y * 2, sourceHeight - 1) * sourcePitch;
+                const uint8_t* row1 = source + std::min(y * 2 + 1, sourceHeight - 1) * sourcePitch;
+                DownsampleRowRGBA8(row0, row1, sourceWidth, mip + y * mipPitch, isSRGB, useSIMD);
+            }
+        };
+
+        uint32_t levelThreads = std::clamp(level.height / MinRowsPerThread, 1u, threadCount);
+        std::vector<std::thread> threads;
+        for (uint32_t t = 1; t < levelThreads; t++) {
+            threads.emplace_back(downsampleRows, level.height * t / levelThreads, level.height * (t + 1) / levelThreads);
+        }
+        downsampleRows(0, level.height / levelThreads);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        source = mip;
+        sourcePitch = mipPitch;
+        sourceWidth = level.width;
+        sourceHeight = level.height;
+    }
+}
+
+void GenerateMipChainReference(const uint8_t* rgba, size_t rowPitch, uint32_t width, uint32_t height, bool isSRGB, uint8_t* dest)
+{
+    const uint8_t* source = rgba;
+    size_t sourcePitch = rowPitch;
+    uint32_t sourceWidth = width;
+    uint32_t sourceHeight = height;
+
+    for (const MipLevel& level : MipChainLevels(width, height)) {
+        uint8_t* mip = dest + level.offset;
+        for (uint32_t y = 0; y < level.height; y++) {
+            const uint8_t* rows[2] = {
+                source + std::min(y * 2, sourceHeight - 1) * sourcePitch,
+                source + std::min(y * 2 + 1, sourceHeight - 1) * sourcePitch,
+            };
+            for (uint32_t x = 0; x < level.width; x++) {
+                uint32_t columns[2] = { std::min(x * 2, sourceWidth - 1), std::min(x * 2 + 1, sourceWidth - 1) };
+                for (int c = 0; c < 4; c++) {
+                    bool srgbChannel = isSRGB && c < 3;
+                    double sum = 0.0;
+                    for (const uint8_t* row : rows) {
+                        for (uint32_t column : columns) {
+                            double value = row[column * 4 + c] / 255.0;
+                            sum += srgbChannel ? SRGBToLinear(value) : value;
+                        }
+                    }
+                    double average = sum * 0.25;
+                    double encoded = srgbChannel ? LinearToSRGB(average) : average;
+                    mip[((size_t)y * level.width + x) * 4 + c] = (uint8_t)std::clamp(floor(encoded * 255.0 + 0.5), 0.0, 255.0);
+                }
+            }
+        }
+
+        source = mip;
+        sourcePitch = (size_t)level.width * 4;
+        sourceWidth = level.width;
+        sourceHeight = level.height;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// CPU mip generation for RGBA8 textures.
+//
+// Each mip halves the one above it with a 2x2 box filter, down to 1x1. Odd edges reuse the last
+// row or column. sRGB color is averaged in linear space and rounded to the nearest sRGB value,
+// alpha and the channels of linear textures are averaged as they are. The AVX2 and scalar paths
+// give identical results.
+
+struct MipLevel
+{
+    uint32_t width;
+    uint32_t height;
+    // Byte offset of the mip in a mip chain. Rows are width * 4 bytes with no padding.
+    size_t offset;
+};
+
+// Mips 1 down to 1x1 of a width x height image, one after another in a single buffer.
+// Mip 0 isn't part of the chain, it's the image itself.
+std::vector<MipLevel> MipChainLevels(uint32_t width, uint32_t height);
+size_t MipChainSize(uint32_t width, uint32_t height);
+
+// Averages two rows of srcWidth RGBA8 texels into one row of max(srcWidth / 2, 1) texels.
+// row1 is row0 again when the source has one row.
+void DownsampleRowRGBA8(const uint8_t* row0, const uint8_t* row1, uint32_t srcWidth, uint8_t* dest, bool isSRGB, bool useSIMD = true);
+
+// Writes mips 1 down to 1x1 of an RGBA8 image to dest, laid out as MipChainLevels() describes.
+// The rows of each mip are split across threads, 0 picks a count based on the size of the mip.
+void GenerateMipChain(
+    const uint8_t* rgba,
+    size_t rowPitch,
+    uint32_t width,
+    uint32_t height,
+    bool isSRGB,
+    uint8_t* dest,
+    bool useSIMD = true,
+    uint32_t threadCount = 1
+);
+
+// Same filter in double precision with exact sRGB conversions, only used to validate GenerateMipChain()
+void GenerateMipChainReference(const uint8_t* rgba, size_t rowPitch, uint32_t width, uint32_t height, bool isSRGB, uint8_t* dest);
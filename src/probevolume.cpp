@@ -0,0 +1,290 @@
+#include "probevolume.h"
+#include "contenthash.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cfloat>
+#include <fstream>
+#include <random>
+#include <thread>
+
+static constexpr char ProbeVolumeMagic[4] = { 'M', 'D', 'P', 'V' };
+static constexpr uint32_t ProbeVolumeVersion = 1;
+
+struct ProbeVolumeFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t hash;
+    uint32_t counts[3];
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+glm::vec3 ProbeVolume::ProbePosition(const glm::uvec3& coordinate) const
+{
+    glm::vec3 t = glm::vec3(coordinate) / glm::max(glm::vec3(counts) - 1.0f, glm::vec3(1.0f));
+    return glm::mix(bounds.min, bounds.max, t);
+}
+
+glm::vec3 ProbeVolume::SampleIrradiance(const glm::vec3& position, const glm::vec3& normal) const
+{
+    glm::vec3 cells = glm::max(glm::vec3(counts) - 1.0f, glm::vec3(1.0f));
+    glm::vec3 coordinate = glm::clamp((position - bounds.min) / glm::max(bounds.max - bounds.min, glm::vec3(FLT_MIN)), 0.0f, 1.0f) * cells;
+    glm::uvec3 base = glm::min(glm::uvec3(coordinate), counts - 1u);
+    glm::vec3 fraction = coordinate - glm::vec3(base);
+
+    glm::vec3 irradiance(0.0f);
+    for (uint32_t corner = 0; corner < 8; corner++) {
+        glm::uvec3 offset(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+        glm::uvec3 probe = glm::min(base + offset, counts - 1u);
+        glm::vec3 weights = glm::mix(1.0f - fraction, fraction, glm::vec3(offset));
+        float weight = weights.x * weights.y * weights.z;
+        irradiance += probes[(probe.z * counts.y + probe.y) * counts.x + probe.x].Evaluate(normal) * weight;
+    }
+    return irradiance;
+}
+
+ProbeGPUData PackProbe(const SHL2RGB& probe)
+{
+    ProbeGPUData data = {};
+    float* packed = &data.coefficients[0].x;
+    for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+        packed[i * 3 + 0] = probe.coefficients[i].x;
+        packed[i * 3 + 1] = probe.coefficients[i].y;
+        packed[i * 3 + 2] = probe.coefficients[i].z;
+    }
+    return data;
+}
+
+glm::uvec3 ChooseProbeCounts(const AABB& bounds, uint32_t maxProbesPerAxis)
+{
+    glm::vec3 extent = glm::max(bounds.max - bounds.min, glm::vec3(FLT_MIN));
+    float spacing = std::max(std::max(extent.x, extent.y), extent.z) / (float)std::max(maxProbesPerAxis - 1, 1u);
+    return glm::clamp(glm::uvec3(glm::ceil(extent / spacing)) + 1u, glm::uvec3(2), glm::uvec3(maxProbesPerAxis));
+}
+
+// Orthonormal basis around n, from Duff et al. 2017
+static void BuildBasis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+{
+    float sign = std::copysign(1.0f, n.z);
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+}
+
+static glm::vec3 SampleCosineHemisphere(const glm::vec3& n, float u1, float u2)
+{
+    float radius = sqrtf(u1);
+    float phi = glm::two_pi<float>() * u2;
+    glm::vec3 tangent, bitangent;
+    BuildBasis(n, tangent, bitangent);
+    return glm::normalize(tangent * (radius * cosf(phi)) + bitangent * (radius * sinf(phi)) + n * sqrtf(std::max(0.0f, 1.0f - u1)));
+}
+
+static glm::vec3 TraceRadiance(
+    const CPUBVH& bvh,
+    const ProbeBakeScene& scene,
+    const ProbeBakeSettings& settings,
+    float bias,
+    glm::vec3 origin,
+    glm::vec3 direction,
+    std::mt19937& rng
+)
+{
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    glm::vec3 radiance(0.0f);
+    glm::vec3 throughput(1.0f);
+
+    for (uint32_t bounce = 0;; bounce++) {
+        CPUBVH::Hit hit;
+        if (!bvh.Intersect(origin, direction, 0.0f, FLT_MAX, hit)) {
+            radiance += throughput * glm::max(settings.sky.Evaluate(direction), glm::vec3(0.0f));
+            break;
+        }
+
+        const glm::vec3& a = scene.positions[scene.indices[hit.triangle * 3 + 0]];
+        const glm::vec3& b = scene.positions[scene.indices[hit.triangle * 3 + 1]];
+        const glm::vec3& c = scene.positions[scene.indices[hit.triangle * 3 + 2]];
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float normalLength = glm::length(normal);
+        if (normalLength == 0.0f) {
+            break;
+        }
+        // Surfaces are treated as two sided, like the glTF double sided materials
+        normal /= normalLength;
+        if (glm::dot(normal, direction) > 0.0f) {
+            normal = -normal;
+        }
+
+        glm::vec3 albedo = scene.triangleAlbedo[hit.triangle];
+        glm::vec3 position = origin + direction * hit.t + normal * bias;
+
+        for (const ProbeBakeLight& light : settings.lights) {
+            float NdotL = glm::dot(normal, -light.direction);
+            if (NdotL > 0.0f && !bvh.Occluded(position, -light.direction, 0.0f, FLT_MAX)) {
+                radiance += throughput * albedo * light.radiance * (NdotL / glm::pi<float>());
+            }
+        }
+
+        if (bounce == settings.bounces) {
+            break;
+        }
+
+        // Cosine weighted, so the lambertian BRDF and pdf cancel out to just the albedo
+        throughput *= albedo;
+        origin = position;
+        direction = SampleCosineHemisphere(normal, uniform(rng), uniform(rng));
+    }
+
+    return radiance;
+}
+
+ProbeVolume BakeProbeVolume(
+    const CPUBVH& bvh,
+    const ProbeBakeScene& scene,
+    const AABB& bounds,
+    const glm::uvec3& counts,
+    const ProbeBakeSettings& settings,
+    uint32_t threadCount
+)
+{
+    // Probes per fetch from the shared counter, small enough to balance the load at the end
+    const uint32_t ProbesPerBatch = 4;
+
+    ProbeVolume volume;
+    volume.bounds = bounds;
+    volume.counts = counts;
+    uint32_t probeCount = counts.x * counts.y * counts.z;
+    volume.probes.resize(probeCount);
+
+    // Offsets hit points off the surface, relative to the scene size so it works at any scale
+    float bias = glm::length(bounds.max - bounds.min) * 1e-5f;
+    uint32_t samples = std::max(settings.samplesPerProbe, 1u);
+    float sampleWeight = 4.0f * glm::pi<float>() / samples;
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threadCount = std::clamp((probeCount + ProbesPerBatch - 1) / ProbesPerBatch, 1u, threadCount);
+
+    std::atomic_uint32_t nextProbe = 0;
+
+    auto bakeProbes = [&]() {
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+        for (;;) {
+            uint32_t first = nextProbe.fetch_add(ProbesPerBatch);
+            if (first >= probeCount) {
+                break;
+            }
+
+            for (uint32_t probe = first; probe < std::min(first + ProbesPerBatch, probeCount); probe++) {
+                std::mt19937 rng(probe);
+                glm::uvec3 coordinate(probe % counts.x, (probe / counts.x) % counts.y, probe / (counts.x * counts.y));
+                glm::vec3 origin = volume.ProbePosition(coordinate);
+
+                SHL2RGB radiance;
+                for (uint32_t i = 0; i < samples; i++) {
+                    // Uniform over the sphere, stratified along z
+                    float z = 1.0f - 2.0f * ((i + uniform(rng)) / samples);
+                    float phi = glm::two_pi<float>() * uniform(rng);
+                    float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+                    glm::vec3 direction(r * cosf(phi), r * sinf(phi), z);
+
+                    radiance.AddSample(direction, TraceRadiance(bvh, scene, settings, bias, origin, direction, rng), sampleWeight);
+                }
+
+                volume.probes[probe] = radiance.ConvolveCosine();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < threadCount; t++) {
+        threads.emplace_back(bakeProbes);
+    }
+    bakeProbes();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return volume;
+}
+
+uint32_t HashProbeBake(const ProbeBakeScene& scene, const AABB& bounds, const glm::uvec3& counts, const ProbeBakeSettings& settings)
+{
+    auto hashBytes = [](const void* data, size_t size) {
+        return HashContent32(data, size);
+    };
+
+    std::vector<uint32_t> hashes = {
+        ProbeVolumeVersion,
+        hashBytes(scene.positions.data(), scene.positions.size() * sizeof(glm::vec3)),
+        hashBytes(scene.indices.data(), scene.indices.size() * sizeof(uint32_t)),
+        hashBytes(scene.triangleAlbedo.data(), scene.triangleAlbedo.size() * sizeof(glm::vec3)),
+        hashBytes(&bounds, sizeof(bounds)),
+        hashBytes(&counts, sizeof(counts)),
+        settings.samplesPerProbe,
+        settings.bounces,
+        hashBytes(settings.sky.coefficients.data(), sizeof(settings.sky.coefficients)),
+        hashBytes(settings.lights.data(), settings.lights.size() * sizeof(ProbeBakeLight)),
+    };
+    return hashBytes(hashes.data(), hashes.size() * sizeof(uint32_t));
+}
+
+bool SaveProbeVolume(const std::string& path, const ProbeVolume& volume, uint32_t hash)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+
+    ProbeVolumeFileHeader header = {};
+    memcpy(header.magic, ProbeVolumeMagic, sizeof(header.magic));
+    header.version = ProbeVolumeVersion;
+    header.hash = hash;
+    for (int i = 0; i < 3; i++) {
+        header.counts[i] = volume.counts[i];
+        header.boundsMin[i] = volume.bounds.min[i];
+        header.boundsMax[i] = volume.bounds.max[i];
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(volume.probes.data()), volume.probes.size() * sizeof(SHL2RGB));
+    return file.good();
+}
+
+std::optional<ProbeVolume> LoadProbeVolume(const std::string& path, uint32_t hash)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+
+    ProbeVolumeFileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, ProbeVolumeMagic, sizeof(header.magic)) != 0 ||
+        header.version != ProbeVolumeVersion ||
+        header.hash != hash) {
+        return std::nullopt;
+    }
+
+    ProbeVolume volume;
+    for (int i = 0; i < 3; i++) {
+        volume.counts[i] = header.counts[i];
+        volume.bounds.min[i] = header.boundsMin[i];
+        volume.bounds.max[i] = header.boundsMax[i];
+    }
+    volume.probes.resize((size_t)volume.counts.x * volume.counts.y * volume.counts.z);
+    if (!file.read(reinterpret_cast<char*>(volume.probes.data()), volume.probes.size() * sizeof(SHL2RGB))) {
+        return std::nullopt;
+    }
+
+    return volume;
+}
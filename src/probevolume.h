@@ -0,0 +1,86 @@
+#pragma once
+
+#include "cpubvh.h"
+#include "sphericalharmonics.h"
+
+#include <glm/glm.hpp>
+
+#include <optional>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// World space triangles with one albedo each, the input of a probe bake.
+struct ProbeBakeScene
+{
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+    std::vector<glm::vec3> triangleAlbedo;
+};
+
+// Directional light, direction points from the light into the scene
+struct ProbeBakeLight
+{
+    glm::vec3 direction;
+    glm::vec3 radiance;
+};
+
+struct ProbeBakeSettings
+{
+    uint32_t samplesPerProbe = 256;
+    // Surface bounces after the first hit
+    uint32_t bounces = 2;
+    // Radiance of rays that escape the scene
+    SHL2RGB sky;
+    std::vector<ProbeBakeLight> lights;
+};
+
+// Grid of irradiance probes on the corners of a regular grid over bounds, x fastest.
+struct ProbeVolume
+{
+    AABB bounds = {};
+    glm::uvec3 counts = glm::uvec3(0);
+    // Cosine convolved, see SHL2RGB::ConvolveCosine()
+    std::vector<SHL2RGB> probes;
+
+    glm::vec3 ProbePosition(const glm::uvec3& coordinate) const;
+
+    // Trilinear blend of the 8 surrounding probes, the same as the lighting shader does
+    glm::vec3 SampleIrradiance(const glm::vec3& position, const glm::vec3& normal) const;
+};
+
+// One probe in the GPU probe buffer, ProbeData in lighting_environment_cubemap.hlsl.
+// The 9 RGB coefficients are packed back to back.
+struct ProbeGPUData
+{
+    glm::vec4 coefficients[7];
+};
+static_assert(sizeof(ProbeGPUData) == 112, "ProbeGPUData must match the HLSL structured buffer stride");
+
+ProbeGPUData PackProbe(const SHL2RGB& probe);
+
+// Probe counts per axis for a roughly even spacing, with maxProbesPerAxis along the longest axis
+glm::uvec3 ChooseProbeCounts(const AABB& bounds, uint32_t maxProbesPerAxis);
+
+// Path traces every probe of the grid against bvh, which must have been built from scene.
+//
+// Only indirect light is baked: rays that escape see the sky, surfaces they hit are lit by the
+// directional lights (with shadow rays) and keep bouncing with cosine weighted directions.
+// Probes are handed out to threads a few at a time, and each probe seeds its own random numbers,
+// so the result doesn't depend on the thread count. threadCount of 0 uses every core.
+ProbeVolume BakeProbeVolume(
+    const CPUBVH& bvh,
+    const ProbeBakeScene& scene,
+    const AABB& bounds,
+    const glm::uvec3& counts,
+    const ProbeBakeSettings& settings,
+    uint32_t threadCount = 0
+);
+
+// Hash of every bake input, cached bakes are only reused when it matches
+uint32_t HashProbeBake(const ProbeBakeScene& scene, const AABB& bounds, const glm::uvec3& counts, const ProbeBakeSettings& settings);
+
+bool SaveProbeVolume(const std::string& path, const ProbeVolume& volume, uint32_t hash);
+
+// Returns nothing if the file is missing, corrupt, or was baked from other inputs
+std::optional<ProbeVolume> LoadProbeVolume(const std::string& path, uint32_t hash);
@@ -9,8 +9,13 @@
 
 #include "d3dutils.h"
 
+std::mutex g_PSOMutex;
+
 void PSOManager::Reload(ID3D12Device5* device)
 {
+    // The asset thread may be creating PSOs from the same shader cache
+    std::scoped_lock<std::mutex> lock(g_PSOMutex);
+
     shaderByteCodeCache.Invalidate();
 
     for (auto PSO = PSOs.begin(); PSO != PSOs.end(); ) {
@@ -22,6 +27,9 @@ void PSOManager::Reload(ID3D12Device5* device)
             PSO = PSOs.erase(PSO);
         }
     }
+
+    // Unmap the shaders so they can be recompiled
+    shaderByteCodeCache.Invalidate();
 }
 
 ManagedPSORef PSOManager::FindPSO(UINT hash)
@@ -105,8 +113,6 @@ D3D12_GRAPHICS_PIPELINE_STATE_DESC DefaultLightPSODesc()
     return psoDesc;
 }
 
-std::mutex g_PSOMutex;
-
 ManagedPSORef CreatePSO(
     PSOManager& manager,
     ID3D12Device5* device,
@@ -130,11 +136,15 @@ ManagedPSORef CreatePSO(
     // Check if we've already created this PSO
     auto PSO = manager.FindPSO(mPso->hash);
     if (PSO) {
+        manager.shaderByteCodeCache.Invalidate();
         return PSO;
     }
 
     ASSERT_HRESULT(mPso->Compile(device));
 
+    // Unmap the shaders so they can be recompiled
+    manager.shaderByteCodeCache.Invalidate();
+
     manager.PSOs.emplace_back(mPso);
 
     return mPso;
@@ -6,8 +6,9 @@
 using namespace Microsoft::WRL;
 
 #include "gbuffer.h"
-#include "crc32.h"
+#include "contenthash.h"
 #include "util.h"
+#include "mappedfile.h"
 
 #include "d3dcompiler.h"
 #include <D3D12MemAlloc.h>
@@ -15,42 +16,39 @@ using namespace Microsoft::WRL;
 #include <mutex>
 #include <map>
 
+// Shader bytecode is used in place from mapped files.
+//
+// The device copies the bytecode when a PSO is compiled, and a mapped file can't be overwritten
+// on Windows, which would stop shaders from being recompiled while the app runs. So the PSOManager
+// invalidates the cache as soon as it is done compiling, and nothing may keep the bytecode pointers.
 struct ShaderByteCodeCache
 {
     std::mutex mutex;
-    std::vector<ComPtr<ID3DBlob>> blobs;
-    std::map<std::string, D3D12_SHADER_BYTECODE> cache;
+    std::map<std::string, MappedFile> cache;
 
     D3D12_SHADER_BYTECODE Fetch(const std::string& filepath)
     {
         std::scoped_lock lock(mutex);
 
-        auto cachedBytecode = cache.find(filepath);
-
-        if (cachedBytecode != cache.end()) {
-            return cachedBytecode->second;
-        }
+        auto cachedFile = cache.find(filepath);
 
-        ComPtr<ID3DBlob> blob;
-        auto wfilepath = convert_to_wstring(filepath);
+        if (cachedFile == cache.end()) {
+            MappedFile file;
+            if (!file.Open(filepath) || file.Bytes().empty()) {
+                return D3D12_SHADER_BYTECODE{ nullptr, 0 };
+            }
 
-        if (!SUCCEEDED(D3DReadFileToBlob(wfilepath.c_str(), &blob))) {
-            return D3D12_SHADER_BYTECODE{ nullptr, 0 };
+            cachedFile = cache.insert_or_assign(filepath, std::move(file)).first;
         }
 
-        blobs.push_back(blob);
-
-        D3D12_SHADER_BYTECODE bytecode = { reinterpret_cast<UINT8*>(blob->GetBufferPointer()), blob->GetBufferSize() };
-        auto item = cache.insert_or_assign(filepath, bytecode);
-
-        return bytecode;
+        std::span<const uint8_t> bytes = cachedFile->second.Bytes();
+        return D3D12_SHADER_BYTECODE{ bytes.data(), bytes.size() };
     }
 
     void Invalidate()
     {
         std::scoped_lock lock(mutex);
 
-        blobs.clear();
         cache.clear();
     }
 };
@@ -131,63 +129,72 @@ struct ManagedPSO
         return device->CreatePipelineState(&streamDesc, IID_PPV_ARGS(&PSO));
     }
 
+    // Shaders are hashed by content, their bytecode pointers change every time they are loaded
+    static UINT HashByteCode(const D3D12_SHADER_BYTECODE& bytecode)
+    {
+        if (!bytecode.pShaderBytecode) {
+            return 0;
+        }
+        return HashContent32(bytecode.pShaderBytecode, bytecode.BytecodeLength);
+    }
+
     void ComputeHash()
     {
         hash =
-            crc32b(reinterpret_cast<unsigned char*>(&desc.Flags), sizeof(desc.Flags)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.NodeMask), sizeof(desc.NodeMask)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.pRootSignature), sizeof(desc.pRootSignature)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.IBStripCutValue), sizeof(desc.IBStripCutValue)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.PrimitiveTopologyType), sizeof(desc.PrimitiveTopologyType)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.VS), sizeof(desc.VS)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.GS), sizeof(desc.GS)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.PS), sizeof(desc.PS)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.StreamOutput), sizeof(desc.StreamOutput)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.HS), sizeof(desc.HS)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.DS), sizeof(desc.DS)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.PS), sizeof(desc.PS)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.CS), sizeof(desc.CS)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.BlendState), sizeof(desc.BlendState)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.DepthStencilState), sizeof(desc.DepthStencilState)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.DSVFormat), sizeof(desc.DSVFormat)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.RasterizerState), sizeof(desc.RasterizerState)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.RTVFormats), sizeof(desc.RTVFormats)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.SampleDesc), sizeof(desc.SampleDesc)) +
-            crc32b(reinterpret_cast<unsigned char*>(&desc.SampleMask), sizeof(desc.SampleMask));
+            HashContent32(&desc.Flags, sizeof(desc.Flags)) +
+            HashContent32(&desc.NodeMask, sizeof(desc.NodeMask)) +
+            HashContent32(&desc.pRootSignature, sizeof(desc.pRootSignature)) +
+            HashContent32(&desc.IBStripCutValue, sizeof(desc.IBStripCutValue)) +
+            HashContent32(&desc.PrimitiveTopologyType, sizeof(desc.PrimitiveTopologyType)) +
+            HashByteCode(desc.VS) +
+            HashByteCode(desc.GS) +
+            HashByteCode(desc.PS) +
+            HashContent32(&desc.StreamOutput, sizeof(desc.StreamOutput)) +
+            HashByteCode(desc.HS) +
+            HashByteCode(desc.DS) +
+            HashByteCode(desc.PS) +
+            HashByteCode(desc.CS) +
+            HashContent32(&desc.BlendState, sizeof(desc.BlendState)) +
+            HashContent32(&desc.DepthStencilState, sizeof(desc.DepthStencilState)) +
+            HashContent32(&desc.DSVFormat, sizeof(desc.DSVFormat)) +
+            HashContent32(&desc.RasterizerState, sizeof(desc.RasterizerState)) +
+            HashContent32(&desc.RTVFormats, sizeof(desc.RTVFormats)) +
+            HashContent32(&desc.SampleDesc, sizeof(desc.SampleDesc)) +
+            HashContent32(&desc.SampleMask, sizeof(desc.SampleMask));
 
         for (const auto& inputLayoutElement : inputLayout) {
-            hash += crc32b(
-                reinterpret_cast<const unsigned char* const>(&inputLayoutElement.SemanticName),
+            hash += HashContent32(
+                inputLayoutElement.SemanticName,
                 strlen(inputLayoutElement.SemanticName)
             );
 
-            hash += crc32b(
-                reinterpret_cast<const unsigned char* const>(&inputLayoutElement.SemanticIndex),
+            hash += HashContent32(
+                &inputLayoutElement.SemanticIndex,
                 sizeof(inputLayoutElement.SemanticIndex)
             );
 
-            hash += crc32b(
-                reinterpret_cast<const unsigned char* const>(&inputLayoutElement.Format),
+            hash += HashContent32(
+                &inputLayoutElement.Format,
                 sizeof(inputLayoutElement.Format)
             );
 
-            hash += crc32b(
-                reinterpret_cast<const unsigned char* const>(&inputLayoutElement.InputSlot),
+            hash += HashContent32(
+                &inputLayoutElement.InputSlot,
                 sizeof(inputLayoutElement.InputSlot)
             );
 
-            hash += crc32b(
-                reinterpret_cast<const unsigned char* const>(&inputLayoutElement.AlignedByteOffset),
+            hash += HashContent32(
+                &inputLayoutElement.AlignedByteOffset,
                 sizeof(inputLayoutElement.AlignedByteOffset)
             );
 
-            hash += crc32b(
-                reinterpret_cast<const unsigned char* const>(&inputLayoutElement.InputSlotClass),
+            hash += HashContent32(
+                &inputLayoutElement.InputSlotClass,
                 sizeof(inputLayoutElement.InputSlotClass)
             );
 
-            hash += crc32b(
-                reinterpret_cast<const unsigned char* const>(&inputLayoutElement.InstanceDataStepRate),
+            hash += HashContent32(
+                &inputLayoutElement.InstanceDataStepRate,
                 sizeof(inputLayoutElement.InstanceDataStepRate)
             );
         }
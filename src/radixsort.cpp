@@ -0,0 +1,90 @@
+#include "radixsort.h"
+
+#include <algorithm>
+#include <array>
+#include <barrier>
+#include <thread>
+
+void RadixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch, uint32_t threadCount)
+{
+    const uint32_t RadixBits = 8;
+    const uint32_t RadixSize = 1 << RadixBits;
+    const uint32_t PassCount = 32 / RadixBits;
+    // Below this many items per thread, spawning the thread costs more than it saves
+    const uint32_t MinItemsPerThread = 16384;
+
+    uint32_t count = (uint32_t)items.size();
+    if (count < 2) {
+        return;
+    }
+    scratch.resize(count);
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threadCount = std::clamp(count / MinItemsPerThread, 1u, threadCount);
+
+    std::vector<std::array<uint32_t, RadixSize>> histograms(threadCount);
+    std::barrier sync(threadCount);
+
+    // Every thread runs every pass over its own chunk, and reaches the same result for which passes to skip
+    auto sortChunk = [&](uint32_t thread) {
+        uint32_t begin = (uint32_t)((uint64_t)count * thread / threadCount);
+        uint32_t end = (uint32_t)((uint64_t)count * (thread + 1) / threadCount);
+
+        SortItem* source = items.data();
+        SortItem* destination = scratch.data();
+
+        for (uint32_t pass = 0; pass < PassCount; pass++) {
+            uint32_t shift = pass * RadixBits;
+
+            auto& histogram = histograms[thread];
+            histogram.fill(0);
+            for (uint32_t i = begin; i < end; i++) {
+                histogram[(source[i].key >> shift) & (RadixSize - 1)]++;
+            }
+
+            sync.arrive_and_wait();
+
+            // Items with a lower digit come first, then items with this digit from earlier chunks
+            std::array<uint32_t, RadixSize> offsets;
+            uint32_t offset = 0;
+            bool allSameDigit = false;
+            for (uint32_t digit = 0; digit < RadixSize; digit++) {
+                uint32_t digitTotal = 0;
+                for (uint32_t t = 0; t < threadCount; t++) {
+                    if (t == thread) {
+                        offsets[digit] = offset + digitTotal;
+                    }
+                    digitTotal += histograms[t][digit];
+                }
+                allSameDigit |= digitTotal == count;
+                offset += digitTotal;
+            }
+
+            if (!allSameDigit) {
+                for (uint32_t i = begin; i < end; i++) {
+                    uint32_t digit = (source[i].key >> shift) & (RadixSize - 1);
+                    destination[offsets[digit]++] = source[i];
+                }
+                std::swap(source, destination);
+            }
+
+            // Histograms are overwritten by the next pass
+            sync.arrive_and_wait();
+        }
+
+        if (thread == 0 && source != items.data()) {
+            items.swap(scratch);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < threadCount; t++) {
+        threads.emplace_back(sortChunk, t);
+    }
+    sortChunk(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+struct SortItem
+{
+    uint32_t key;
+    uint32_t value;
+};
+
+// Maps a float to a key with the same ordering when compared as an unsigned integer.
+inline uint32_t FloatToSortKey(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    // Negative floats order backwards, so flip all their bits, otherwise just the sign bit.
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+// Stable least significant digit radix sort by key, 8 bits per pass.
+//
+// Large inputs are split into one chunk per thread. Each thread histograms its chunk, works
+// out where its items go from every thread's histogram, then scatters its chunk, so there's
+// no serial step between passes. Passes where every key has the same digit are skipped.
+// threadCount of 0 picks a count based on the number of items.
+void RadixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch, uint32_t threadCount = 0);
@@ -3,10 +3,16 @@
 #include "assets.h"
 #include "gui.h"
 #include "d3dutils.h"
+#include "cpubvh.h"
 
 #include <directx/d3dx12.h>
 #include <pix3.h>
 
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <numeric>
+#include <unordered_map>
+
 std::scoped_lock<std::mutex> LockRenderThread(App& app)
 {
     return std::scoped_lock<std::mutex>(app.renderFrameMutex);
@@ -164,7 +170,7 @@ void SetupGBuffer(App& app, bool isResize)
     if (!isResize) {
         // Create SRV heap for the render targets
         D3D12_DESCRIPTOR_HEAP_DESC heapDesc = {};
-        heapDesc.NumDescriptors = (UINT)GBuffer_Count + MaxLightCount + 1;
+        heapDesc.NumDescriptors = (UINT)GBuffer_Count + 1;
         heapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
         heapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
         //app.lightingPassDescriptorArena.Initialize(app.device.Get(), heapDesc, "LightPassArena");
@@ -435,32 +441,301 @@ void SetupMipMapGenerator(App& app)
     );
 }
 
+// Persistently mapped upload buffer with a structured buffer SRV
+void CreateMappedStructuredBuffer(
+    App& app,
+    ComPtr<ID3D12Resource>& resource,
+    UINT stride,
+    UINT count,
+    D3D12_CPU_DESCRIPTOR_HANDLE srvHandle,
+    void** mappedPtr,
+    const wchar_t* name
+)
+{
+    CD3DX12_HEAP_PROPERTIES heapProps(D3D12_HEAP_TYPE_UPLOAD);
+    auto resourceDesc = CD3DX12_RESOURCE_DESC::Buffer((UINT64)stride * count);
+    ASSERT_HRESULT(
+        app.device->CreateCommittedResource(
+            &heapProps,
+            D3D12_HEAP_FLAG_NONE,
+            &resourceDesc,
+            D3D12_RESOURCE_STATE_GENERIC_READ,
+            nullptr,
+            IID_PPV_ARGS(&resource)
+        )
+    );
+    resource->SetName(name);
+
+    D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+    srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+    srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+    srvDesc.Buffer.FirstElement = 0;
+    srvDesc.Buffer.NumElements = count;
+    srvDesc.Buffer.StructureByteStride = stride;
+    app.device->CreateShaderResourceView(resource.Get(), &srvDesc, srvHandle);
+
+    CD3DX12_RANGE readRange(0, 0);
+    ASSERT_HRESULT(resource->Map(0, &readRange, mappedPtr));
+}
+
 void SetupLightBuffer(App& app)
 {
-    auto descriptorHandle = AllocateDescriptorsUnique(app.descriptorPool, MaxLightCount + 1, "light pass and light buffer");
+    auto descriptorHandle = AllocateDescriptorsUnique(app.descriptorPool, 2, "light pass and light buffer");
 
     CreateConstantBufferAndViews(
         app.device.Get(),
         app.LightBuffer.constantBuffer,
-        sizeof(LightConstantData),
-        MaxLightCount + 1,
+        sizeof(LightPassConstantData),
+        1,
         descriptorHandle.CPUHandle()
     );
-
     app.LightBuffer.constantBuffer->Map(0, nullptr, (void**)&app.LightBuffer.passData);
-    // Lights are stored immediately after the pass data
-    app.LightBuffer.lightConstantData = reinterpret_cast<LightConstantData*>(app.LightBuffer.passData + 1);
-    app.LightBuffer.cbvHandle = std::move(descriptorHandle);
+
+    app.LightBuffer.capacity = InitialLightCapacity;
+    CreateMappedStructuredBuffer(
+        app,
+        app.LightBuffer.lightBuffer,
+        sizeof(LightConstantData),
+        app.LightBuffer.capacity,
+        descriptorHandle.CPUHandle(1),
+        reinterpret_cast<void**>(&app.LightBuffer.mappedLights),
+        L"Light buffer"
+    );
+
+    app.LightBuffer.descriptors = std::move(descriptorHandle);
 
     app.LightBuffer.passData->baseGBufferIndex = app.GBuffer.baseSrvReference.Index();
     app.LightBuffer.passData->environmentIntensity = glm::vec4(1.0f);
 
-    for (int i = 0; i < MaxLightCount; i++) {
-        // Link convenient light structures back to the constant buffer
-        app.lights[i].constantData = &app.LightBuffer.lightConstantData[i];
+    // Mesh shaders find lights through the view data, set up with the GBuffer pass
+    app.InstanceBuffer.viewData->lightBufferIndex = app.LightBuffer.LightBufferIndex();
+}
+
+// Replaces the light buffer with a larger one, reusing its SRV so shaders don't notice
+void GrowLightBuffer(App& app, UINT requiredCount)
+{
+    // The GPU may still be reading the old buffer
+    auto lock = LockRenderThread(app);
+    app.graphicsQueue.WaitForEventCPU(app.previousFrameEvent);
+
+    UINT capacity = app.LightBuffer.capacity;
+    while (capacity < requiredCount) {
+        capacity *= 2;
+    }
+
+    DebugLog() << "Growing light buffer from " << app.LightBuffer.capacity << " to " << capacity << " lights\n";
+
+    app.LightBuffer.capacity = capacity;
+    CreateMappedStructuredBuffer(
+        app,
+        app.LightBuffer.lightBuffer,
+        sizeof(LightConstantData),
+        capacity,
+        app.LightBuffer.descriptors.CPUHandle(1),
+        reinterpret_cast<void**>(&app.LightBuffer.mappedLights),
+        L"Light buffer"
+    );
+
+    app.lightStore.MarkAllDirty();
+}
+
+void SetupLightClusters(App& app)
+{
+    auto descriptorHandle = AllocateDescriptorsUnique(app.descriptorPool, 2, "Light clusters");
+
+    CreateMappedStructuredBuffer(
+        app,
+        app.LightClusters.clusterBuffer,
+        sizeof(glm::uvec2),
+        LightClusterCount,
+        descriptorHandle.CPUHandle(),
+        reinterpret_cast<void**>(&app.LightClusters.mappedClusters),
+        L"Light cluster buffer"
+    );
+    CreateMappedStructuredBuffer(
+        app,
+        app.LightClusters.indexBuffer,
+        sizeof(uint32_t),
+        MaxLightClusterIndices,
+        descriptorHandle.CPUHandle(1),
+        reinterpret_cast<void**>(&app.LightClusters.mappedIndices),
+        L"Light cluster index buffer"
+    );
+
+    // Nothing is binned until the first frame
+    memset(app.LightClusters.mappedClusters, 0, sizeof(glm::uvec2) * LightClusterCount);
+
+    app.LightClusters.descriptors = std::move(descriptorHandle);
+
+    LightPassConstantData* passData = app.LightBuffer.passData;
+    passData->clusterBufferIndex = app.LightClusters.descriptors.Index();
+    passData->clusterLightIndicesIndex = app.LightClusters.descriptors.Index() + 1;
+    passData->clusterCountX = LightClusterCountX;
+    passData->clusterCountY = LightClusterCountY;
+    passData->clusterCountZ = LightClusterCountZ;
+}
+
+void SetupTransparentPass(App& app)
+{
+    auto descriptorHandle = AllocateDescriptorsUnique(app.descriptorPool, 1, "Transparent light lists");
+
+    CreateMappedStructuredBuffer(
+        app,
+        app.TransparentPass.lightListBuffer,
+        sizeof(uint32_t),
+        MaxTransparentLightIndices,
+        descriptorHandle.CPUHandle(),
+        reinterpret_cast<void**>(&app.TransparentPass.mappedLightLists),
+        L"Transparent light list buffer"
+    );
+
+    app.TransparentPass.descriptor = std::move(descriptorHandle);
+    app.InstanceBuffer.viewData->transparentLightListIndex = app.TransparentPass.descriptor.Index();
+}
+
+void SetupIrradianceProbes(App& app)
+{
+    auto descriptorHandle = AllocateDescriptorsUnique(app.descriptorPool, 1, "Irradiance probes");
+
+    CreateMappedStructuredBuffer(
+        app,
+        app.IrradianceProbes.buffer,
+        sizeof(ProbeGPUData),
+        MaxIrradianceProbes,
+        descriptorHandle.CPUHandle(),
+        reinterpret_cast<void**>(&app.IrradianceProbes.mappedProbes),
+        L"Irradiance probe buffer"
+    );
+
+    app.IrradianceProbes.descriptor = std::move(descriptorHandle);
+    app.LightBuffer.passData->probeVolumeIndex = app.IrradianceProbes.descriptor.Index();
+    app.LightBuffer.passData->probeVolumeEnabled = 0;
+}
+
+// Bakes irradiance probes over the loaded geometry, or loads them from the cache if nothing changed.
+// The volume covers every triangle primitive where it currently is, so moving things needs a rebake.
+void BakeIrradianceProbes(App& app)
+{
+    const char* CachePath = "probevolume.cache";
+
+    auto start = std::chrono::steady_clock::now();
+
+    ProbeBakeScene scene;
+    AABB bounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+    {
+        std::scoped_lock lock(app.BakeGeometry.mutex, app.transforms.Mutex());
+        for (const App::BakePrimitive& primitive : app.BakeGeometry.primitives) {
+            for (uint32_t transform : primitive.transforms) {
+                const glm::mat4& world = app.transforms.World(transform);
+                uint32_t firstVertex = (uint32_t)scene.positions.size();
+                for (const glm::vec3& position : primitive.positions) {
+                    glm::vec3 worldPosition = glm::vec3(world * glm::vec4(position, 1.0f));
+                    bounds.min = glm::min(bounds.min, worldPosition);
+                    bounds.max = glm::max(bounds.max, worldPosition);
+                    scene.positions.push_back(worldPosition);
+                }
+                for (uint32_t index : primitive.indices) {
+                    scene.indices.push_back(firstVertex + index);
+                }
+                scene.triangleAlbedo.insert(scene.triangleAlbedo.end(), primitive.indices.size() / 3, primitive.albedo);
+            }
+        }
     }
 
-    // app.LightBuffer.pointSphereConstantData.Initialize(app.mainAllocator.Get());
+    if (scene.indices.empty()) {
+        DebugLog() << "No geometry to bake irradiance probes for\n";
+        return;
+    }
+
+    ProbeBakeSettings settings;
+    settings.samplesPerProbe = (uint32_t)app.RenderSettings.probeSamples;
+    settings.bounces = (uint32_t)app.RenderSettings.probeBounces;
+    {
+        // Written by the skybox loader under the same lock
+        auto lock = LockRenderThread(app);
+        glm::vec3 intensity = glm::vec3(app.LightBuffer.passData->environmentIntensity);
+        for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+            settings.sky.coefficients[i] = app.Skybox.radianceSH.coefficients[i] * intensity;
+        }
+    }
+
+    LightStore::Range directionalLights = app.lightStore.TypeRange(LightType_Directional);
+    for (uint32_t slot = directionalLights.first; slot < directionalLights.first + directionalLights.count; slot++) {
+        uint32_t handle = app.lightStore.HandleAt(slot);
+        settings.lights.push_back({
+            glm::normalize(app.lightStore.GetDirection(handle)),
+            app.lightStore.GetColor(handle) * app.lightStore.GetIntensity(handle)
+        });
+    }
+
+    glm::uvec3 counts = ChooseProbeCounts(bounds, (uint32_t)std::clamp(app.RenderSettings.probesPerAxis, 2, 32));
+    uint32_t hash = HashProbeBake(scene, bounds, counts, settings);
+
+    std::optional<ProbeVolume> volume = LoadProbeVolume(CachePath, hash);
+    app.Stats.probeBakeFromCache = volume.has_value();
+    if (!volume) {
+        CPUBVH bvh;
+        bvh.Build(scene.positions, scene.indices);
+        volume = BakeProbeVolume(bvh, scene, bounds, counts, settings);
+        if (!SaveProbeVolume(CachePath, *volume, hash)) {
+            DebugLog() << "Failed to write the irradiance probe cache to " << CachePath << "\n";
+        }
+    }
+
+    {
+        // The lighting pass of the previous frame may still be reading the probes
+        auto lock = LockRenderThread(app);
+        app.graphicsQueue.WaitForEventCPU(app.previousFrameEvent);
+
+        for (size_t i = 0; i < volume->probes.size(); i++) {
+            app.IrradianceProbes.mappedProbes[i] = PackProbe(volume->probes[i]);
+        }
+
+        LightPassConstantData* passData = app.LightBuffer.passData;
+        passData->probeVolumeMin = glm::vec4(volume->bounds.min, 0.0f);
+        passData->probeVolumeInverseSize = glm::vec4(1.0f / glm::max(volume->bounds.max - volume->bounds.min, glm::vec3(FLT_MIN)), 0.0f);
+        passData->probeVolumeCounts = glm::uvec4(volume->counts, 0);
+        passData->probeVolumeEnabled = 1;
+    }
+
+    app.IrradianceProbes.volume = std::move(*volume);
+
+    auto end = std::chrono::steady_clock::now();
+    app.Stats.probeBakeMS = std::chrono::duration<float, std::milli>(end - start).count();
+
+    DebugLog() << "Irradiance probes: " << counts.x << "x" << counts.y << "x" << counts.z << " probes over "
+        << scene.indices.size() / 3 << " triangles, "
+        << (app.Stats.probeBakeFromCache ? "loaded from cache in " : "baked in ")
+        << app.Stats.probeBakeMS << "ms\n";
+}
+
+void SetupInstanceBuffer(App& app)
+{
+    auto descriptorHandle = AllocateDescriptorsUnique(app.descriptorPool, 2, "Instance buffer and view constants");
+
+    CreateMappedStructuredBuffer(
+        app,
+        app.InstanceBuffer.resource,
+        sizeof(InstanceTransform),
+        MaxInstanceCount,
+        descriptorHandle.CPUHandle(),
+        reinterpret_cast<void**>(&app.InstanceBuffer.mappedPtr),
+        L"Instance buffer"
+    );
+
+    CreateConstantBufferAndViews(
+        app.device.Get(),
+        app.InstanceBuffer.viewConstantBuffer,
+        sizeof(ViewConstantData),
+        1,
+        descriptorHandle.CPUHandle(1)
+    );
+    CD3DX12_RANGE readRange(0, 0);
+    ASSERT_HRESULT(app.InstanceBuffer.viewConstantBuffer->Map(0, &readRange, reinterpret_cast<void**>(&app.InstanceBuffer.viewData)));
+
+    app.InstanceBuffer.descriptors = std::move(descriptorHandle);
+    app.InstanceBuffer.viewData->instanceBufferIndex = app.InstanceBuffer.SRVIndex();
 }
 
 void SetupMaterialBuffer(App& app)
@@ -492,11 +767,15 @@ void SetupGBufferPass(App& app)
     app.descriptorPool.Initialize(app.device.Get(), heapDesc, "Main DescriptorPool");
 
     SetupMaterialBuffer(app);
+    SetupInstanceBuffer(app);
 }
 
 void SetupLightPass(App& app)
 {
     SetupLightBuffer(app);
+    SetupLightClusters(app);
+    SetupTransparentPass(app);
+    SetupIrradianceProbes(app);
 
     // GBuffer lighting does not need an input layout, as the vertices are created
     // entirely in the vertex buffer without any input vertices.
@@ -883,7 +1162,7 @@ void InitRenderer(App& app)
 
     {
         D3D12_DESCRIPTOR_HEAP_DESC dsHeapDesc = {};
-        dsHeapDesc.NumDescriptors = MaxLightCount + 1;
+        dsHeapDesc.NumDescriptors = 1;
         dsHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
         dsHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
         app.dsvDescriptorPool.Initialize(app.device.Get(), dsHeapDesc, "DSV DescriptorPool");
@@ -1002,123 +1281,74 @@ void CreateGPUBufferWithData(
 
 void UpdatePerPrimitiveData(App& app, const glm::mat4& projection, const glm::mat4& view)
 {
-    glm::mat4 viewProjection = projection * view;
-
-    auto meshIter = app.meshPool.Begin();
-
-    while (meshIter) {
-        // Diffuse irradiance uses the primitive constant buffer before its ready to render
-        if (!meshIter->isReadyForRender) {
-            continue;
-        }
+    PIXScopedEvent(0x93E9BE, __func__);
 
-        auto& mesh = meshIter.item;
+    auto start = std::chrono::steady_clock::now();
 
-        auto modelMatrix = ApplyStandardTransforms(
-            mesh->baseModelTransform,
-            mesh->translation,
-            mesh->euler,
-            mesh->scale
-        );
+    app.InstanceBuffer.viewData->viewProjection = projection * view;
+    app.InstanceBuffer.viewData->view = view;
 
-        auto mvp = viewProjection * modelMatrix;
-        auto mv = view * modelMatrix;
-        for (const auto& primitive : mesh->primitives) {
-            primitive->constantData->MVP = mvp;
-            primitive->constantData->MV = mv;
-            primitive->constantData->M = modelMatrix;
-            // primitive->worldBoundingBox.max = modelMatrix * glm::vec4(primitive->localBoundingBox.max, 1.0f);
-            // primitive->worldBoundingBox.min = modelMatrix * glm::vec4(primitive->localBoundingBox.min, 1.0f);
-        }
+    TransformStore::UpdateStats stats = app.transforms.Update();
 
-        meshIter = app.meshPool.Next(meshIter);
-    }
+    auto end = std::chrono::steady_clock::now();
+    app.Stats.transformUpdateMS = std::chrono::duration<float, std::milli>(end - start).count();
+    app.Stats.dirtyTransforms = stats.dirtyTransforms;
+    app.Stats.uploadedTransforms = stats.uploadedTransforms;
 }
 
-void SetupLightShadowMap(App& app, Light& light, int lightIdx)
+void UpdateLightConstantBuffers(App& app, const glm::mat4& projection, const glm::mat4& view, const glm::vec3& eyePosWorld)
 {
-    // We can use the same resource description as the GBuffer depth render target
-    // for directional shadow map lights.
-    auto resourceDesc = GBufferResourceDesc(GBufferTarget::GBuffer_Depth, app.windowWidth, app.windowHeight);
-    resourceDesc.Format = DXGI_FORMAT_R32_FLOAT;
-    resourceDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
-
-    // Create the resource
-    {
-        D3D12_CLEAR_VALUE clearValue = {};
-        clearValue.Format = resourceDesc.Format;
-        clearValue.DepthStencil.Depth = 1.0f;
-        clearValue.DepthStencil.Stencil = 0;
+    auto& buffer = app.LightBuffer;
 
-        D3D12MA::ALLOCATION_DESC allocDesc{};
-        allocDesc.HeapType = D3D12_HEAP_TYPE_DEFAULT;
-        ASSERT_HRESULT(
-            app.mainAllocator->CreateResource(
-                &allocDesc,
-                &resourceDesc,
-                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
-                nullptr,
-                &light.RayTracedShadow.texture,
-                IID_NULL, nullptr
-            )
-        );
-
-        auto lightName = convert_to_wstring(
-            "LightRTShadow#" + std::to_string(lightIdx)
-        );
-        light.RayTracedShadow.texture->GetResource()->SetName(lightName.c_str());
+    // Only invert what changed, the projection rarely does
+    if (projection != buffer.projection) {
+        buffer.passData->inverseProjectionMatrix = glm::inverse(projection);
+        buffer.projection = projection;
     }
-
-    // Create SRV
-    {
-        light.RayTracedShadow.SRV = AllocateDescriptorsUnique(app.descriptorPool, 1, "RTShadowMap SRV");
-
-        D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-        srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-        srvDesc.Format = DXGI_FORMAT_R32_FLOAT; // Can't use D32_FLOAT with SRVs...
-        srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-        srvDesc.Texture2D.MipLevels = 1;
-        app.device->CreateShaderResourceView(
-            light.RayTracedShadow.texture->GetResource(),
-            &srvDesc,
-            light.RayTracedShadow.SRV.CPUHandle()
-        );
+    if (view != buffer.view) {
+        buffer.passData->inverseViewMatrix = glm::affineInverse(view);
+        buffer.view = view;
     }
+    buffer.passData->eyePosWorld = glm::vec4(eyePosWorld, 1.0f);
 
-    // Create UAV
-    {
-        light.RayTracedShadow.UAV = AllocateDescriptorsUnique(app.descriptorPool, 1, "RTShadowMap UAV");
-
-        D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
-        uavDesc.Format = DXGI_FORMAT_R32_FLOAT;
-        uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
-        app.device->CreateUnorderedAccessView(
-            light.RayTracedShadow.texture->GetResource(),
-            nullptr,
-            &uavDesc,
-            light.RayTracedShadow.UAV.CPUHandle()
-        );
+    UINT lightCount = app.lightStore.Count();
+    if (lightCount > buffer.capacity) {
+        GrowLightBuffer(app, lightCount);
     }
+
+    auto stats = app.lightStore.Update(buffer.mappedLights, buffer.capacity, app.RenderSettings.disableShadows);
+    buffer.ranges = stats.ranges;
+    app.Stats.uploadedLights = stats.uploadedLights;
 }
 
-void UpdateLightConstantBuffers(App& app, const glm::mat4& projection, const glm::mat4& view, const glm::vec3& eyePosWorld)
+// Bins every point light into the froxel grid and uploads the cluster lists for the point light pass
+void UpdateLightClusters(App& app, const glm::mat4& projection, const glm::mat4& view)
 {
-    app.LightBuffer.passData->inverseProjectionMatrix = glm::inverse(projection);
-    app.LightBuffer.passData->inverseViewMatrix = glm::inverse(view);
-    app.LightBuffer.passData->eyePosWorld = glm::vec4(eyePosWorld, 1.0f);
+    auto start = std::chrono::steady_clock::now();
 
-    for (UINT i = 0; i < app.LightBuffer.count; i++) {
-        Light& light = app.lights[i];
-        if (light.castsShadow && !light.RayTracedShadow.texture) {
-            SetupLightShadowMap(app, light, i);
-        }
+    auto& clusters = app.LightClusters;
+    clusters.builder.SetProjection(projection, app.camera.nearZ, app.camera.farZ);
 
-        app.lights[i].UpdateConstantData(view);
+    app.lightStore.GatherViewSpheres(app.LightBuffer.ranges[LightType_Point], view, clusters.viewSpheres, clusters.lightIds);
 
-        if (app.RenderSettings.disableShadows) {
-            app.lights[i].constantData->castsShadow = false;
-        }
+    clusters.builder.Build(clusters.viewSpheres, clusters.lightIds);
+
+    const auto& lightIndices = clusters.builder.LightIndices();
+    memcpy(clusters.mappedClusters, clusters.builder.Clusters().data(), sizeof(glm::uvec2) * LightClusterCount);
+    memcpy(clusters.mappedIndices, lightIndices.data(), sizeof(uint32_t) * lightIndices.size());
+
+    LightClusterDepthParams depthParams = clusters.builder.DepthParams();
+    app.LightBuffer.passData->clusterDepthScale = depthParams.scale;
+    app.LightBuffer.passData->clusterDepthBias = depthParams.bias;
+
+    if (clusters.builder.Overflow() > 0) {
+        DebugLog() << "Light cluster index list is full, dropped " << clusters.builder.Overflow() << " light references\n";
     }
+
+    auto end = std::chrono::steady_clock::now();
+    app.Stats.lightBinningMS = std::chrono::duration<float, std::milli>(end - start).count();
+    app.Stats.clusterLightReferences = (uint32_t)lightIndices.size();
+    app.Stats.visiblePointLights = (uint32_t)clusters.builder.VisibleLights().size();
 }
 
 struct Plane
@@ -1195,25 +1425,27 @@ bool IsAABBCulled(const Frustum& f, const AABB& box)
     return false;
 }
 
-void DoFrustumCulling(PrimitivePool& primitivePool, const glm::mat4& viewProjection)
+void DoFrustumCulling(App& app, const glm::mat4& viewProjection)
 {
     PIXScopedEvent(0x93E9BE, __func__);
 
     Frustum f = ComputeFrustum(viewProjection);
 
-    auto primitiveIter = primitivePool.Begin();
+    // World bounds are kept up to date by the transform store, only transforms that moved had theirs recomputed.
+    std::scoped_lock lock(app.transforms.Mutex());
+
+    auto primitiveIter = app.primitivePool.Begin();
     while (primitiveIter) {
-        if (!primitiveIter->constantData) {
+        Primitive* primitive = primitiveIter.item;
+        primitiveIter = app.primitivePool.Next(primitiveIter);
+
+        // No bounds means never culled, e.g. the skybox.
+        if (primitive->boundsIndex == TransformStore::InvalidIndex) {
             continue;
         }
 
-        AABB worldBB = primitiveIter->localBoundingBox;
-        worldBB.min = primitiveIter->constantData->M * glm::vec4(worldBB.min, 1.0f);
-        worldBB.max = primitiveIter->constantData->M * glm::vec4(worldBB.max, 1.0f);
-
-
-        primitiveIter->cull = IsAABBCulled(f, worldBB);
-        primitiveIter = primitivePool.Next(primitiveIter);
+        // Union of every instance, they're all drawn in one call.
+        primitive->cull = IsAABBCulled(f, app.transforms.WorldBounds(primitive->boundsIndex));
     }
 }
 
@@ -1229,8 +1461,9 @@ void DoFrustumCulling(PrimitivePool& primitivePool, const glm::mat4& viewProject
 void UpdateRenderData(App& app, const glm::mat4& projection, const glm::mat4& view, const glm::vec3& camPos)
 {
     UpdateLightConstantBuffers(app, projection, view, camPos);
+    UpdateLightClusters(app, projection, view);
     UpdatePerPrimitiveData(app, projection, view);
-    DoFrustumCulling(app.primitivePool, projection * view);
+    DoFrustumCulling(app, projection * view);
     //UpdateRayTraceInfo(app, projection * view, camPos);
 }
 
@@ -1247,111 +1480,353 @@ std::vector<Mesh*> PickSceneMeshes(Scene& scene)
     return meshes;
 }
 
-void BuildTLAS(App& app, GraphicsCommandList* commandList)
+// Records the builds of the next batch the scheduler picks, with their compacted sizes copied back.
+void IssueBLASBuildBatch(App& app, GraphicsCommandList* commandList, std::span<const BLASBuildRequest> requests)
 {
-    auto meshes = PickSceneMeshes(app.scene);
+    const UINT64 Alignment = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT;
+    auto alignUp = [&](UINT64 size) {
+        return (size + Alignment - 1) & ~(Alignment - 1);
+    };
 
-    std::vector<D3D12_RAYTRACING_INSTANCE_DESC> instanceDescs;
-    int instanceId = 0;
-    for (auto& mesh : meshes)
+    auto& builds = app.BLASBuilds;
+    const UINT count = (UINT)requests.size();
+
+    BLASBuildBatch batch;
+    batch.resultOffsets.resize(count);
+
+    std::vector<D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS> inputs(count);
+    std::vector<UINT64> scratchOffsets(count);
+    UINT64 scratchSize = 0;
+    for (UINT i = 0; i < count; i++) {
+        inputs[i].Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+        inputs[i].DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+        inputs[i].NumDescs = 1;
+        inputs[i].pGeometryDescs = &requests[i].geometry;
+        inputs[i].Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
+        app.device->GetRaytracingAccelerationStructurePrebuildInfo(&inputs[i], &prebuildInfo);
+
+        batch.primitives.push_back(requests[i].primitive);
+        batch.resultOffsets[i] = batch.resultSize;
+        batch.resultSize += alignUp(prebuildInfo.ResultDataMaxSizeInBytes);
+
+        // The batch is budgeted, so every build gets its own slice of the arena and they all overlap
+        scratchOffsets[i] = scratchSize;
+        scratchSize += alignUp(prebuildInfo.ScratchDataSizeInBytes);
+    }
+
+    // Nothing recorded last frame is still using the arena
+    if (!builds.scratchArena || builds.scratchArena->GetResource()->GetDesc().Width < scratchSize) {
+        builds.scratchArena = CreateBufferAllocation(app.mainAllocator.Get(), scratchSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, L"BlasScratchArena");
+    }
+
+    batch.uncompacted = CreateBufferAllocation(app.mainAllocator.Get(), batch.resultSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, L"BlasUncompacted");
+    batch.compactedSizes = CreateBufferAllocation(app.mainAllocator.Get(), count * sizeof(UINT64), D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, L"BlasCompactedSizes");
+    batch.compactedSizesReadback = CreateBufferAllocation(app.mainAllocator.Get(), count * sizeof(UINT64), D3D12_HEAP_TYPE_READBACK, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_FLAG_NONE, L"BlasCompactedSizesReadback");
+
+    for (UINT i = 0; i < count; i++) {
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
+        desc.Inputs = inputs[i];
+        desc.ScratchAccelerationStructureData = builds.scratchArena->GetResource()->GetGPUVirtualAddress() + scratchOffsets[i];
+        desc.DestAccelerationStructureData = batch.uncompacted->GetResource()->GetGPUVirtualAddress() + batch.resultOffsets[i];
+
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildInfo = {};
+        postbuildInfo.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+        postbuildInfo.DestBuffer = batch.compactedSizes->GetResource()->GetGPUVirtualAddress() + i * sizeof(UINT64);
+
+        commandList->BuildRaytracingAccelerationStructure(&desc, 1, &postbuildInfo);
+    }
+
+    CD3DX12_RESOURCE_BARRIER barriers[] = {
+        CD3DX12_RESOURCE_BARRIER::UAV(batch.uncompacted->GetResource()),
+        CD3DX12_RESOURCE_BARRIER::Transition(batch.compactedSizes->GetResource(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE),
+    };
+    commandList->ResourceBarrier(_countof(barriers), barriers);
+    commandList->CopyBufferRegion(batch.compactedSizesReadback->GetResource(), 0, batch.compactedSizes->GetResource(), 0, count * sizeof(UINT64));
+
+    builds.building = std::move(batch);
+}
+
+// Records the compaction of last frame's builds, now that their compacted sizes are known.
+void CompactBLASBuildBatch(App& app, GraphicsCommandList* commandList, BLASBuildBatch& batch)
+{
+    const UINT64 Alignment = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT;
+    const UINT count = (UINT)batch.primitives.size();
+
+    batch.compactedSizes = nullptr;
+
+    batch.compactedOffsets.resize(count);
     {
-        for (auto& primitive : mesh->primitives)
-        {
-            if (!primitive->blasResult) {
-                continue;
-            }
+        UINT64* sizes;
+        D3D12_RANGE readRange = { 0, count * sizeof(UINT64) };
+        ASSERT_HRESULT(batch.compactedSizesReadback->GetResource()->Map(0, &readRange, reinterpret_cast<void**>(&sizes)));
+        for (UINT i = 0; i < count; i++) {
+            batch.compactedOffsets[i] = batch.compactedSize;
+            batch.compactedSize += (sizes[i] + Alignment - 1) & ~(Alignment - 1);
+        }
+        D3D12_RANGE writeRange = { 0, 0 };
+        batch.compactedSizesReadback->GetResource()->Unmap(0, &writeRange);
+    }
+    batch.compactedSizesReadback = nullptr;
 
-            glm::mat3x4 truncatedModelMat = glm::transpose(primitive->constantData->M);
+    batch.compacted = CreateBufferAllocation(app.mainAllocator.Get(), batch.compactedSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, L"BlasCompacted");
 
-            D3D12_RAYTRACING_INSTANCE_DESC instances = {};
-            instances.InstanceID = instanceId++;
-            instances.InstanceContributionToHitGroupIndex = 0;
-            instances.InstanceMask = 0xFF;
-            memcpy(instances.Transform, reinterpret_cast<void*>(&truncatedModelMat[0]), sizeof(instances.Transform));
-            instances.Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
-            instances.AccelerationStructure = primitive->blasResult->GetResource()->GetGPUVirtualAddress();
+    for (UINT i = 0; i < count; i++) {
+        commandList->CopyRaytracingAccelerationStructure(
+            batch.compacted->GetResource()->GetGPUVirtualAddress() + batch.compactedOffsets[i],
+            batch.uncompacted->GetResource()->GetGPUVirtualAddress() + batch.resultOffsets[i],
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT
+        );
+    }
+}
 
-            instanceDescs.push_back(instances);
+// Advances BLAS building by one frame. Every batch goes through three frames:
+// built with its compacted sizes read back, compacted into its own buffer, then handed
+// to its primitives so the TLAS picks them up. Only runs after the previous frame's fence.
+void UpdateBLASBuilds(App& app, GraphicsCommandList* commandList)
+{
+    PIXScopedEvent(commandList, 0x93E9BE, L"UpdateBLASBuilds");
+
+    auto& builds = app.BLASBuilds;
+
+    app.Stats.blasBuildsIssued = 0;
+    app.Stats.blasTrianglesIssued = 0;
+
+    if (builds.compacting) {
+        BLASBuildBatch& batch = *builds.compacting;
+        for (size_t i = 0; i < batch.primitives.size(); i++) {
+            batch.primitives[i]->blasBuffer = batch.compacted;
+            batch.primitives[i]->blasAddress = batch.compacted->GetResource()->GetGPUVirtualAddress() + batch.compactedOffsets[i];
         }
+
+        app.Stats.blasUncompactedBytes += batch.resultSize;
+        app.Stats.blasCompactedBytes += batch.compactedSize;
+
+        builds.compacting.reset();
     }
 
-    // DXR is quite strange...
-    auto instanceBufferSizeBytes = instanceDescs.size() * sizeof(D3D12_RAYTRACING_INSTANCE_DESC);
-    // If we don't have an instance buffer OR it's not big enough create one
-    // if (!app.TLAS.instancesUploadBuffer ||
-    //     app.TLAS.instancesUploadBuffer->GetResource()->GetDesc().Width < instanceBufferSizeBytes) {
+    if (builds.building) {
+        CompactBLASBuildBatch(app, commandList, *builds.building);
+        builds.compacting = std::move(builds.building);
+        builds.building.reset();
+    }
 
-    if (instanceBufferSizeBytes == 0) {
-        return;
+    std::vector<BLASBuildRequest> requests;
+    {
+        std::scoped_lock lock(builds.mutex, app.transforms.Mutex());
+
+        glm::vec3 cameraPosition = app.camera.translation;
+        std::vector<uint32_t> batch = builds.scheduler.NextBatch(app.RenderSettings.blasBuildBudget, [&](uint32_t id) {
+            const Primitive* primitive = builds.requests[id].primitive;
+
+            BLASBuildScheduler::Priority priority;
+            priority.visible = !primitive->cull;
+            if (primitive->boundsIndex != TransformStore::InvalidIndex) {
+                const AABB& bounds = app.transforms.WorldBounds(primitive->boundsIndex);
+                glm::vec3 closest = glm::clamp(cameraPosition, bounds.min, bounds.max);
+                priority.distance = glm::length(closest - cameraPosition);
+            }
+            return priority;
+        });
+
+        for (uint32_t id : batch) {
+            requests.push_back(builds.requests[id]);
+            builds.requests.erase(id);
+            app.Stats.blasTrianglesIssued += requests.back().primitive->indexCount / 3;
+        }
     }
 
-    // Per frame pain?
-    CreateOrReallocateUploadBufferWithData(
-        app.mainAllocator.Get(),
-        app.TLAS.instancesUploadBuffer,
-        instanceDescs.data(),
-        instanceBufferSizeBytes
-    );
+    if (!requests.empty()) {
+        IssueBLASBuildBatch(app, commandList, requests);
+        app.Stats.blasBuildsIssued = (uint32_t)requests.size();
+    } else if (!builds.building && !builds.compacting) {
+        // The last batch's compaction fence has passed, so the arena is idle. It's sized for the
+        // largest batch so far, which after loading a big model is worth giving back.
+        builds.scratchArena = nullptr;
+    }
+}
+
+static_assert(sizeof(TLASInstanceDesc) == sizeof(D3D12_RAYTRACING_INSTANCE_DESC), "TLASInstanceDesc is written straight into the TLAS instance buffer");
+
+// Recreates the TLAS buffers large enough for capacity instances.
+// Only called while the GPU is idle, after waiting on the previous frame.
+void GrowTLASBuffers(App& app, UINT requiredCapacity)
+{
+    auto& tlas = app.TLAS;
+
+    tlas.capacity = std::max({ requiredCapacity, tlas.capacity * 2, 256u });
+
+    {
+        auto resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(tlas.capacity * sizeof(TLASInstanceDesc));
+
+        D3D12MA::ALLOCATION_DESC allocDesc = {};
+        allocDesc.HeapType = D3D12_HEAP_TYPE_UPLOAD;
 
-    // }
-    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+        tlas.instancesUploadBuffer = nullptr;
+        ASSERT_HRESULT(
+            app.mainAllocator->CreateResource(
+                &allocDesc,
+                &resourceDesc,
+                D3D12_RESOURCE_STATE_GENERIC_READ,
+                nullptr,
+                &tlas.instancesUploadBuffer,
+                IID_NULL, nullptr
+            )
+        );
+        tlas.instancesUploadBuffer->GetResource()->SetName(L"tlasInstances");
+        tlas.instancesUploadBuffer->GetResource()->Map(0, nullptr, reinterpret_cast<void**>(&tlas.mappedInstances));
+    }
+
+    // Sized for a full capacity TLAS that can be refit
     D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS asInputs = {};
     asInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
     asInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-    asInputs.NumDescs = instanceDescs.size();
-    asInputs.InstanceDescs = app.TLAS.instancesUploadBuffer->GetResource()->GetGPUVirtualAddress();
-    asInputs.Flags = buildFlags;
+    asInputs.NumDescs = tlas.capacity;
+    asInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
 
     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
     app.device->GetRaytracingAccelerationStructurePrebuildInfo(
         &asInputs,
         &prebuildInfo
     );
-
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
-    desc.Inputs = asInputs;
+    prebuildInfo.ScratchDataSizeInBytes = std::max(prebuildInfo.ScratchDataSizeInBytes, prebuildInfo.UpdateScratchDataSizeInBytes);
 
     CreateAccelerationStructureBuffers(
         app.mainAllocator.Get(),
         prebuildInfo,
-        app.TLAS.scratch,
-        app.TLAS.result
+        tlas.scratch,
+        tlas.result
     );
-    app.TLAS.result->GetResource()->SetName(L"tlasResult");
-    app.TLAS.scratch->GetResource()->SetName(L"tlasScratch");
+    tlas.result->GetResource()->SetName(L"tlasResult");
+    tlas.scratch->GetResource()->SetName(L"tlasScratch");
 
-    desc.ScratchAccelerationStructureData = app.TLAS.scratch->GetResource()->GetGPUVirtualAddress();
-    desc.DestAccelerationStructureData = app.TLAS.result->GetResource()->GetGPUVirtualAddress();
-
-    // Create SRV to the TLAS
+    // The result may have moved
     {
-        if (!app.TLAS.descriptor.IsValid()) {
-            app.TLAS.descriptor = AllocateDescriptorsUnique(app.descriptorPool, 1, "TLAS SRV");
+        if (!tlas.descriptor.IsValid()) {
+            tlas.descriptor = AllocateDescriptorsUnique(app.descriptorPool, 1, "TLAS SRV");
         }
 
         D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-        srvDesc.RaytracingAccelerationStructure.Location = app.TLAS.result->GetResource()->GetGPUVirtualAddress();
+        srvDesc.RaytracingAccelerationStructure.Location = tlas.result->GetResource()->GetGPUVirtualAddress();
         srvDesc.ViewDimension = D3D12_SRV_DIMENSION_RAYTRACING_ACCELERATION_STRUCTURE;
         srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
         app.device->CreateShaderResourceView(
             nullptr,
             &srvDesc,
-            app.TLAS.descriptor.CPUHandle()
+            tlas.descriptor.CPUHandle()
         );
     }
 
+    // Everything has to be rewritten into the new instance buffer
+    tlas.instanceSet.Invalidate();
+}
+
+// Brings the TLAS up to date with the scene. Buffers persist between frames, only instances
+// that moved are written, and the TLAS is refit unless the set of BLASes changed.
+void BuildTLAS(App& app, GraphicsCommandList* commandList)
+{
+    auto& tlas = app.TLAS;
+    auto meshes = PickSceneMeshes(app.scene);
+
+    tlas.instances.clear();
+    for (auto& mesh : meshes)
+    {
+        for (auto& primitive : mesh->primitives)
+        {
+            if (!primitive->blasAddress) {
+                continue;
+            }
+
+            // Every instance shares the primitive's BLAS
+            for (const MeshInstance& instance : mesh->instances) {
+                tlas.instances.push_back({ primitive->blasAddress, instance.transformIndex });
+            }
+        }
+    }
+
+    UINT instanceCount = (UINT)tlas.instances.size();
+    // Created even with no instances, an empty TLAS is still built and bound
+    if (instanceCount > tlas.capacity || !tlas.result) {
+        GrowTLASBuffers(app, instanceCount);
+    }
+
+    // UpdatePerPrimitiveData ran TransformStore::Update() earlier in the frame
+    TLASInstanceSet::UpdateResult update;
+    {
+        std::scoped_lock transformLock(app.transforms.Mutex());
+        update = tlas.instanceSet.Update(tlas.instances, app.transforms.WorldMatrices(), app.transforms.UpdatedTransforms(), tlas.mappedInstances);
+    }
+    app.Stats.tlasPatchedInstances = update.patchedInstances;
+    app.Stats.tlasBuildKind = update.kind;
+
+    if (update.kind == TLASInstanceSet::BuildKind_None) {
+        return;
+    }
+
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS asInputs = {};
+    asInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+    asInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+    asInputs.NumDescs = instanceCount;
+    asInputs.InstanceDescs = tlas.instancesUploadBuffer->GetResource()->GetGPUVirtualAddress();
+    asInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
+    desc.ScratchAccelerationStructureData = tlas.scratch->GetResource()->GetGPUVirtualAddress();
+    desc.DestAccelerationStructureData = tlas.result->GetResource()->GetGPUVirtualAddress();
+
+    if (update.kind == TLASInstanceSet::BuildKind_Refit) {
+        // Refit in place
+        asInputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+        desc.SourceAccelerationStructureData = desc.DestAccelerationStructureData;
+    }
+    desc.Inputs = asInputs;
+
     commandList->BuildRaytracingAccelerationStructure(
         &desc,
         0,
         nullptr
     );
+
+    // The light pass traces against it
+    auto barrier = CD3DX12_RESOURCE_BARRIER::UAV(tlas.result->GetResource());
+    commandList->ResourceBarrier(1, &barrier);
 }
 
-void DrawMeshesGBuffer(App& app, GraphicsCommandList* commandList)
+DrawPass GetPrimitiveDrawPass(const Primitive* primitive)
 {
-    commandList->OMSetStencilRef(0xFFFFFFFF);
+    const Material* material = primitive->material.get();
+    if (!material) {
+        return DrawPass_GBuffer;
+    }
 
-    ManagedPSORef lastUsedPSO = nullptr;
+    switch (material->materialType) {
+    case MaterialType_AlphaBlendPBR:
+        return DrawPass_AlphaBlend;
+    case MaterialType_Unlit:
+        return DrawPass_Unlit;
+    default:
+        return DrawPass_GBuffer;
+    }
+}
+
+// Flatten every renderable primitive in the scene into the draw packet list.
+void BuildDrawPackets(App& app)
+{
+    PIXScopedEvent(0x93E9BE, __func__);
+
+    DrawPacketList& list = app.drawPackets;
+    list.packets.clear();
+    list.sourcePrimitives.clear();
+    list.vertexBufferViews.clear();
+    list.PSOs.clear();
+
+    // Key is the raw bytes of a primitive's vertex buffer views, value is the offset in the table.
+    std::unordered_map<std::string, UINT> internedVertexBufferViews;
+    std::unordered_map<ManagedPSO*, UINT16> psoIndices;
+
+    std::vector<DrawPacket> packets;
+    std::vector<Primitive*> sources;
 
     auto meshes = PickSceneMeshes(app.scene);
 
@@ -1361,144 +1836,222 @@ void DrawMeshesGBuffer(App& app, GraphicsCommandList* commandList)
         }
 
         for (const auto& primitive : mesh->primitives) {
-            if (primitive->cull) {
-                continue;
+            DrawPacket packet = {};
+            packet.indexBufferView = primitive->indexBufferView;
+            packet.indexCount = primitive->indexCount;
+            packet.instanceCount = primitive->instanceCount;
+            packet.firstInstance = mesh->firstInstance;
+            packet.miscDescriptorIndex = primitive->miscDescriptorParameter.index;
+            packet.primitiveTopology = static_cast<UINT8>(primitive->primitiveTopology);
+            packet.pass = GetPrimitiveDrawPass(primitive.get());
+
+            const Material* material = primitive->material.get();
+            packet.materialDataIndex = material ? material->cbvDescriptor.Index() : DescriptorRef().index;
+
+            const auto& views = primitive->vertexBufferViews;
+            std::string viewKey(reinterpret_cast<const char*>(views.data()), views.size() * sizeof(D3D12_VERTEX_BUFFER_VIEW));
+            auto [viewIter, viewInserted] = internedVertexBufferViews.try_emplace(viewKey, (UINT)list.vertexBufferViews.size());
+            if (viewInserted) {
+                list.vertexBufferViews.insert(list.vertexBufferViews.end(), views.begin(), views.end());
             }
+            packet.firstVertexBufferView = viewIter->second;
+            packet.vertexBufferViewCount = static_cast<UINT16>(views.size());
 
-            const auto& material = primitive->material.get();
-            // FIXME: if I am not lazy I will SORT by material type
-            // Transparent materials drawn in different pass
-            DescriptorRef materialDescriptor;
-
-            if (material) {
-                if (material->materialType == MaterialType_AlphaBlendPBR || material->materialType == MaterialType_Unlit) {
-                    continue;
-                }
-                materialDescriptor = material->cbvDescriptor.Ref();
+            auto [psoIter, psoInserted] = psoIndices.try_emplace(primitive->PSO.get(), (UINT16)list.PSOs.size());
+            if (psoInserted) {
+                list.PSOs.push_back(primitive->PSO);
             }
+            packet.psoIndex = psoIter->second;
 
-            // Set the per-primitive constant buffer
-            UINT constantValues[5] = { primitive->perPrimitiveDescriptor.index, materialDescriptor.index, 0, 0, primitive->miscDescriptorParameter.index };
-            commandList->SetGraphicsRoot32BitConstants(0, _countof(constantValues), constantValues, 0);
-            commandList->IASetPrimitiveTopology(primitive->primitiveTopology);
-
-            if (primitive->PSO != lastUsedPSO) {
-                commandList->SetPipelineState(primitive->PSO->Get());
-                lastUsedPSO = primitive->PSO;
-            }
+            packets.push_back(packet);
+            sources.push_back(primitive.get());
+        }
+    }
 
-            commandList->IASetVertexBuffers(0, (UINT)primitive->vertexBufferViews.size(), primitive->vertexBufferViews.data());
-            commandList->IASetIndexBuffer(&primitive->indexBufferView);
-            commandList->DrawIndexedInstanced(primitive->indexCount, primitive->instanceCount, 0, 0, 0);
+    // Sort to minimize state changes while recording
+    std::vector<UINT> order(packets.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](UINT a, UINT b) {
+        const DrawPacket& pa = packets[a];
+        const DrawPacket& pb = packets[b];
+        return std::tie(pa.pass, pa.psoIndex, pa.firstVertexBufferView, pa.indexBufferView.BufferLocation) <
+            std::tie(pb.pass, pb.psoIndex, pb.firstVertexBufferView, pb.indexBufferView.BufferLocation);
+    });
+
+    list.packets.reserve(packets.size());
+    list.sourcePrimitives.reserve(packets.size());
+    for (UINT idx : order) {
+        list.packets.push_back(packets[idx]);
+        list.sourcePrimitives.push_back(sources[idx]);
+    }
 
-            app.Stats.drawCalls++;
+    list.passRanges = {};
+    for (UINT i = 0; i < (UINT)list.packets.size(); i++) {
+        DrawPacketRange& range = list.passRanges[list.packets[i].pass];
+        if (range.begin == range.end) {
+            range.begin = i;
         }
+        range.end = i + 1;
     }
 }
 
-void DrawAlphaBlendedMeshes(App& app, GraphicsCommandList* commandList)
+// Rebuilds the packets if the scene changed and pulls this frame's culling and PSO state into them.
+void PrepareDrawPackets(App& app)
 {
-    const UINT MaxLightsPerDraw = 8;
+    DrawPacketList& list = app.drawPackets;
 
-    ManagedPSORef lastUsedPSO = nullptr;
+    if (list.dirty.exchange(false)) {
+        BuildDrawPackets(app);
+    }
 
-    auto meshes = PickSceneMeshes(app.scene);
+    for (size_t i = 0; i < list.packets.size(); i++) {
+        list.packets[i].culled = list.sourcePrimitives[i]->cull;
+    }
 
-    for (auto& mesh : meshes) {
-        if (!mesh->isReadyForRender) {
-            continue;
-        }
+    list.pipelineStates.resize(list.PSOs.size());
+    for (size_t i = 0; i < list.PSOs.size(); i++) {
+        list.pipelineStates[i] = list.PSOs[i]->Get();
+    }
+}
 
-        for (const auto& primitive : mesh->primitives) {
-            auto material = primitive->material.get();
-            // FIXME: if I am not lazy I will SORT by material type
-            // Only draw alpha blended materials in this pass.
-            if (!material || material->materialType != MaterialType_AlphaBlendPBR) {
+// Sorts the visible transparent packets back to front and builds each one's light list:
+// every directional light, plus the visible point lights whose range touches its bounds.
+// Runs after PrepareDrawPackets, once the GPU is done with the previous frame's lists.
+void PrepareTransparentDraws(App& app)
+{
+    PIXScopedEvent(0x93E9BE, __func__);
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto& pass = app.TransparentPass;
+    const DrawPacketList& list = app.drawPackets;
+    const DrawPacketRange& range = list.passRanges[DrawPass_AlphaBlend];
+    const glm::mat4& view = app.LightBuffer.view;
+
+    pass.sortItems.clear();
+    pass.viewBounds.resize(list.packets.size());
+    {
+        std::scoped_lock lock(app.transforms.Mutex());
+
+        for (UINT i = range.begin; i < range.end; i++) {
+            if (list.packets[i].culled) {
                 continue;
             }
-            auto materialDescriptor = material->cbvDescriptor.Ref();
-
-            for (UINT lightIdx = 0; lightIdx < app.LightBuffer.count; lightIdx += MaxLightsPerDraw) {
-                UINT lightCount = glm::max(app.LightBuffer.count - lightIdx, MaxLightsPerDraw);
-
-                UINT lightDescriptorIndex = app.LightBuffer.cbvHandle.Index() + lightIdx + 1u;
-                // Set the per-primitive constant buffer
-                UINT constantValues[5] = {
-                    primitive->perPrimitiveDescriptor.index,
-                    materialDescriptor.Index(),
-                    lightDescriptorIndex,
-                    0,
-                    primitive->miscDescriptorParameter.index
-                };
-                commandList->SetGraphicsRoot32BitConstants(0, _countof(constantValues), constantValues, 0);
-                commandList->IASetPrimitiveTopology(primitive->primitiveTopology);
-
-                if (primitive->PSO != lastUsedPSO) {
-                    commandList->SetPipelineState(primitive->PSO->Get());
-                    lastUsedPSO = primitive->PSO;
-                }
 
-                commandList->IASetVertexBuffers(0, (UINT)primitive->vertexBufferViews.size(), primitive->vertexBufferViews.data());
-                commandList->IASetIndexBuffer(&primitive->indexBufferView);
-                commandList->DrawIndexedInstanced(primitive->indexCount, primitive->instanceCount, 0, 0, 0);
-
-                app.Stats.drawCalls++;
+            UINT boundsIndex = list.sourcePrimitives[i]->boundsIndex;
+            if (boundsIndex == TransformStore::InvalidIndex) {
+                // Unbounded, so it's behind everything and touched by every light
+                pass.sortItems.push_back({ 0, i });
+                continue;
             }
+
+            pass.viewBounds[i] = TransformAABB(app.transforms.WorldBounds(boundsIndex), view);
+
+            // Instances share a packet, so they're sorted as one by the center of their union
+            float depth = -(pass.viewBounds[i].min.z + pass.viewBounds[i].max.z) * 0.5f;
+            pass.sortItems.push_back({ ~FloatToSortKey(depth), i });
         }
     }
-}
 
-void DrawUnlitMeshes(App& app, GraphicsCommandList* commandList)
-{
-    commandList->RSSetViewports(1, &app.viewport);
-    commandList->RSSetScissorRects(1, &app.scissorRect);
+    RadixSort(pass.sortItems, pass.sortScratch);
 
-    auto rtvHandle = app.nonSRGBFrameBufferRTVs[app.frameIdx].CPUHandle();
-    auto dsvHandle = app.depthStencilDescriptor.CPUHandle();
-    commandList->OMSetRenderTargets(1, &rtvHandle, false, &dsvHandle);
+    const SphereSoA& pointLights = app.LightClusters.builder.VisibleLightSpheres();
+    LightStore::Range directionalLights = app.LightBuffer.ranges[LightType_Directional];
 
-    ManagedPSORef lastUsedPSO = nullptr;
+    pass.packets.clear();
+    pass.lightRanges.clear();
 
-    auto meshes = PickSceneMeshes(app.scene);
+    UINT lightCount = 0;
+    UINT overflow = 0;
+    auto pushLight = [&](uint32_t slot) {
+        if (lightCount < MaxTransparentLightIndices) {
+            pass.mappedLightLists[lightCount++] = slot;
+        }
+        else {
+            overflow++;
+        }
+    };
 
-    for (auto& mesh : meshes) {
-        if (!mesh->isReadyForRender) {
-            continue;
+    for (const SortItem& item : pass.sortItems) {
+        UINT first = lightCount;
+
+        for (UINT slot = directionalLights.first; slot < directionalLights.first + directionalLights.count; slot++) {
+            pushLight(slot);
         }
 
-        for (const auto& primitive : mesh->primitives) {
-            if (primitive->cull) {
-                continue;
+        if (list.sourcePrimitives[item.value]->boundsIndex == TransformStore::InvalidIndex) {
+            for (uint32_t i = 0; i < pointLights.count; i++) {
+                pushLight(pointLights.ids[i]);
+            }
+        }
+        else {
+            pass.objectLights.Clear();
+            FilterSpheresAABB(pointLights, pass.viewBounds[item.value], pass.objectLights);
+            for (uint32_t i = 0; i < pass.objectLights.count; i++) {
+                pushLight(pass.objectLights.ids[i]);
             }
+        }
 
-            const auto& material = primitive->material.get();
-            // FIXME: if I am not lazy I will SORT by material type
-            // Transparent materials drawn in different pass
-            DescriptorRef materialDescriptor;
+        pass.packets.push_back(list.packets[item.value]);
+        pass.lightRanges.push_back({ first, lightCount - first });
+    }
 
-            if (!material || material->materialType != MaterialType_Unlit) {
-                continue;
-            }
+    if (overflow > 0) {
+        DebugLog() << "Transparent light lists are full, dropped " << overflow << " light references\n";
+    }
 
-            materialDescriptor = material->cbvDescriptor.Ref();
+    auto end = std::chrono::steady_clock::now();
+    app.Stats.transparentPrepareMS = std::chrono::duration<float, std::milli>(end - start).count();
+    app.Stats.transparentDraws = (uint32_t)pass.packets.size();
+    app.Stats.transparentLightReferences = lightCount;
+}
 
-            // Set the per-primitive constant buffer
-            UINT constantValues[5] = { primitive->perPrimitiveDescriptor.index, materialDescriptor.index, 0, 0, primitive->miscDescriptorParameter.index };
-            commandList->SetGraphicsRoot32BitConstants(0, _countof(constantValues), constantValues, 0);
-            commandList->IASetPrimitiveTopology(primitive->primitiveTopology);
+void DrawPacketPass(App& app, GraphicsCommandList* commandList, DrawPass pass)
+{
+    const DrawPacketList& list = app.drawPackets;
+
+    app.Stats.drawCalls += RecordDrawPackets(
+        commandList,
+        list.PassPackets(pass),
+        list.vertexBufferViews.data(),
+        list.pipelineStates.data(),
+        app.InstanceBuffer.ViewDataIndex()
+    );
+}
 
-            if (primitive->PSO != lastUsedPSO) {
-                commandList->SetPipelineState(primitive->PSO->Get());
-                lastUsedPSO = primitive->PSO;
-            }
+void DrawMeshesGBuffer(App& app, GraphicsCommandList* commandList)
+{
+    commandList->OMSetStencilRef(0xFFFFFFFF);
 
-            commandList->IASetVertexBuffers(0, (UINT)primitive->vertexBufferViews.size(), primitive->vertexBufferViews.data());
-            commandList->IASetIndexBuffer(&primitive->indexBufferView);
-            commandList->DrawIndexedInstanced(primitive->indexCount, primitive->instanceCount, 0, 0, 0);
+    DrawPacketPass(app, commandList, DrawPass_GBuffer);
+}
 
-            app.Stats.drawCalls++;
-        }
-    }
+// Each transparent primitive is drawn once, back to front, shading only the lights in its list
+void DrawAlphaBlendedMeshes(App& app, GraphicsCommandList* commandList)
+{
+    const DrawPacketList& list = app.drawPackets;
+    const auto& pass = app.TransparentPass;
+
+    app.Stats.drawCalls += RecordDrawPackets(
+        commandList,
+        std::span<const DrawPacket>(pass.packets),
+        list.vertexBufferViews.data(),
+        list.pipelineStates.data(),
+        app.InstanceBuffer.ViewDataIndex(),
+        pass.lightRanges.data()
+    );
+}
+
+void DrawUnlitMeshes(App& app, GraphicsCommandList* commandList)
+{
+    commandList->RSSetViewports(1, &app.viewport);
+    commandList->RSSetScissorRects(1, &app.scissorRect);
+
+    auto rtvHandle = app.nonSRGBFrameBufferRTVs[app.frameIdx].CPUHandle();
+    auto dsvHandle = app.depthStencilDescriptor.CPUHandle();
+    commandList->OMSetRenderTargets(1, &rtvHandle, false, &dsvHandle);
+
+    DrawPacketPass(app, commandList, DrawPass_Unlit);
 }
 
 void DrawFullscreenQuad(App& app, GraphicsCommandList* commandList)
@@ -1548,17 +2101,6 @@ void TransitionResourcesForGBufferPass(const App& app, GraphicsCommandList* comm
         barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(app.GBuffer.renderTargets[i].Get(), D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET));
     }
 
-    // Transition any light shadow maps to being unordered access
-    for (UINT i = 0; i < app.LightBuffer.count; i++) {
-        if (app.lights[i].castsShadow && app.lights[i].RayTracedShadow.texture != nullptr) {
-            barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(
-                app.lights[i].RayTracedShadow.texture->GetResource(),
-                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
-                D3D12_RESOURCE_STATE_UNORDERED_ACCESS
-            ));
-        }
-    }
-
     commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
 }
 
@@ -1571,6 +2113,7 @@ void GBufferPass(App& app, GraphicsCommandList* commandList)
 
     TransitionResourcesForGBufferPass(app, commandList);
 
+    UpdateBLASBuilds(app, commandList);
     BuildTLAS(app, commandList);
 
     BindAndClearGBufferRTVs(app, commandList);
@@ -1680,17 +2223,6 @@ void TransitionResourcesForLightPass(const App& app, GraphicsCommandList* comman
     // Depth buffer is special
     barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(app.depthStencilBuffer.Get(), D3D12_RESOURCE_STATE_DEPTH_WRITE, LightPassDepthResourceState));
 
-    // Transition any RT shadow maps to being pixel resources
-    for (UINT i = 0; i < app.LightBuffer.count; i++) {
-        if (app.lights[i].castsShadow && app.lights[i].RayTracedShadow.texture != nullptr) {
-            barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(
-                app.lights[i].RayTracedShadow.texture->GetResource(),
-                D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE
-            ));
-        }
-    }
-
     commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
 }
 
@@ -1724,48 +2256,39 @@ void LightPass(App& app, GraphicsCommandList* commandList)
         PIXBeginEvent(commandList, 0xFF9F82, L"PointLights");
         commandList->SetPipelineState(app.LightPass.pointLightPSO->Get());
 
-        for (UINT i = 0; i < app.LightBuffer.count; i++) {
-            // Group together as many point lights as possible into one draw
-            int lightCount = 0;
-            int lightStartIdx = i;
-            while (i < app.LightBuffer.count && app.lights[i].lightType == LightType_Point) {
-                lightCount++;
-                i++;
-            }
-
-            if (lightCount > 0) {
-                UINT constantValues[4] = {
-                    app.TLAS.descriptor.Index(),
-                    app.LightBuffer.cbvHandle.Index() + lightStartIdx + 1,
-                    app.LightBuffer.cbvHandle.Index(),
-                    lightCount,
-                };
-                commandList->SetGraphicsRoot32BitConstants(0, _countof(constantValues), constantValues, 1);
-                DrawFullscreenQuad(app, commandList);
-            }
+        // One fullscreen pass, each pixel only shades the point lights in its cluster.
+        // Skipped entirely when every point light was culled.
+        const LightClusterBuilder& clusterBuilder = app.LightClusters.builder;
+        if (!clusterBuilder.VisibleLights().empty() && !clusterBuilder.LightIndices().empty()) {
+            UINT constantValues[5] = {
+                app.TLAS.descriptor.Index(),
+                0,
+                app.LightBuffer.PassDataIndex(),
+                0,
+                app.InstanceBuffer.ViewDataIndex(),
+            };
+            commandList->SetGraphicsRoot32BitConstants(0, _countof(constantValues), constantValues, 1);
+            DrawFullscreenQuad(app, commandList);
         }
 
         PIXEndEvent(commandList);
 
-        // Directional lights
+        // Directional lights, contiguous in the light buffer
         PIXBeginEvent(commandList, 0xFF9F82, L"DirectionalLights");
-        bool hasSetPSO = false;
-        for (UINT i = 0; i < app.LightBuffer.count; i++) {
-            if (app.lights[i].lightType == LightType_Directional) {
-                // avoid setting PSO if no directional lights
-                if (!hasSetPSO) {
-                    commandList->SetPipelineState(app.LightPass.directionalLightPso->Get());
-                    hasSetPSO = true;
-                }
-
-                UINT constantValues[3] = {
-                    app.TLAS.descriptor.Index(),
-                    app.LightBuffer.cbvHandle.Index() + i + 1,
-                    app.LightBuffer.cbvHandle.Index()
-                };
-                commandList->SetGraphicsRoot32BitConstants(0, _countof(constantValues), constantValues, 1);
-                DrawFullscreenQuad(app, commandList);
-            }
+        LightStore::Range directionalLights = app.LightBuffer.ranges[LightType_Directional];
+        if (directionalLights.count > 0) {
+            commandList->SetPipelineState(app.LightPass.directionalLightPso->Get());
+        }
+        for (UINT i = directionalLights.first; i < directionalLights.first + directionalLights.count; i++) {
+            UINT constantValues[5] = {
+                app.TLAS.descriptor.Index(),
+                i,
+                app.LightBuffer.PassDataIndex(),
+                0,
+                app.InstanceBuffer.ViewDataIndex(),
+            };
+            commandList->SetGraphicsRoot32BitConstants(0, _countof(constantValues), constantValues, 1);
+            DrawFullscreenQuad(app, commandList);
         }
         PIXEndEvent(commandList);
 
@@ -1776,8 +2299,8 @@ void LightPass(App& app, GraphicsCommandList* commandList)
             UINT constantValues[5] = {
                 app.TLAS.descriptor.Index(),
                 app.Skybox.brdfLUTDescriptor.Index(),
-                app.Skybox.irradianceCubeSRV.Index(),
-                app.LightBuffer.cbvHandle.Index(),
+                0,
+                app.LightBuffer.PassDataIndex(),
                 app.Skybox.prefilterMapSRV.Index(),
             };
             commandList->SetGraphicsRoot32BitConstants(0, _countof(constantValues), constantValues, 0);
@@ -1825,7 +2348,7 @@ void DebugVisualizer(App& app, GraphicsCommandList* commandList)
     commandList->OMSetRenderTargets(1, &rtvHandle, FALSE, &dsvHandle);
     commandList->SetPipelineState(app.DebugVisualizer.PSO->Get());
     UINT constantValues[2] = {
-        app.LightBuffer.cbvHandle.Index(),
+        app.LightBuffer.PassDataIndex(),
         (UINT)app.DebugVisualizer.mode,
     };
     commandList->SetGraphicsRoot32BitConstants(0, _countof(constantValues), constantValues, 3);
@@ -2194,6 +2717,9 @@ void RenderFrame(App& app)
 
     app.Stats.drawCalls = 0;
 
+    PrepareDrawPackets(app);
+    PrepareTransparentDraws(app);
+
     FetchCusorColor(app);
 
     BuildCommandLists(app);
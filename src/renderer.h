@@ -12,3 +12,5 @@ void DestroyRenderer(App& app);
 void UpdateRenderData(App& app, const glm::mat4& projection, const glm::mat4& view, const glm::vec3& camPos);
 void WaitForPreviousFrame(App& app);
 void RenderFrame(App& app);
+
+void BakeIrradianceProbes(App& app);
@@ -2,6 +2,8 @@
 
 #include <glm/glm.hpp>
 
+#include <random>
+
 void InitializeCamera(App& app)
 {
     // SPONZA cam
@@ -17,25 +19,46 @@ void InitializeCamera(App& app)
 
 void InitializeLights(App& app)
 {
-    app.LightBuffer.count = 0;
-
-    app.lights[0].lightType = LightType_Directional;
-    app.lights[0].color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
-    app.lights[0].intensity = 1.5f;
-    app.lights[0].position = glm::vec3(0.0f);
-    app.lights[0].direction = glm::normalize(glm::vec3(1.0f, -0.4f, -1.0f));
-    app.lights[0].range = 5.0f;
-
-    for (int i = 1; i < MaxLightCount; i++) {
-        float angle = i * glm::two_pi<float>() / 4;
-        float x = cos(angle);
-        float z = sin(angle);
-        app.lights[i].color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
-        app.lights[i].intensity = 8.0f;
-        app.lights[i].position = glm::vec3(x, 2.0f, z);
-        app.lights[i].direction = glm::vec3(0.0f, 0.0f, 0.0f);
-        app.lights[i].range = 5.0f;
-        app.lights[i].lightType = LightType_Point;
+    app.lightStore.Clear();
+}
+
+uint32_t AddDefaultLight(App& app)
+{
+    uint32_t index = app.lightStore.Count();
+
+    // The first light is the sun, the rest are point lights circling the origin
+    if (index == 0) {
+        uint32_t light = app.lightStore.Add(LightType_Directional);
+        app.lightStore.SetColor(light, glm::vec3(1.0f));
+        app.lightStore.SetIntensity(light, 1.5f);
+        app.lightStore.SetDirection(light, glm::normalize(glm::vec3(1.0f, -0.4f, -1.0f)));
+        app.lightStore.SetRange(light, 5.0f);
+        return light;
+    }
+
+    float angle = index * glm::two_pi<float>() / 4;
+    uint32_t light = app.lightStore.Add(LightType_Point);
+    app.lightStore.SetColor(light, glm::vec3(1.0f));
+    app.lightStore.SetIntensity(light, 8.0f);
+    app.lightStore.SetPosition(light, glm::vec3(cos(angle), 2.0f, sin(angle)));
+    app.lightStore.SetRange(light, 5.0f);
+    return light;
+}
+
+void AddRandomPointLights(App& app, uint32_t count)
+{
+    std::mt19937 rng((uint32_t)app.lightStore.Count());
+    std::uniform_real_distribution<float> spread(-20.0f, 20.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t light = app.lightStore.Add(LightType_Point);
+        app.lightStore.SetColor(light, glm::vec3(unit(rng), unit(rng), unit(rng)));
+        app.lightStore.SetIntensity(light, 0.5f);
+        app.lightStore.SetPosition(light, glm::vec3(spread(rng), unit(rng) * 5.0f, spread(rng)));
+        app.lightStore.SetRange(light, 2.0f);
+        // Thousands of shadow rays per pixel would swamp the light pass
+        app.lightStore.SetCastsShadow(light, false);
     }
 }
 
@@ -49,6 +72,8 @@ void InitializeScene(App& app)
 
 void AddModelToScene(App& app, Model& model)
 {
+    auto lock = LockRenderThread(app);
+
     for (const auto& mesh : model.meshes) {
         app.scene.nodes.emplace_back(
             Node{
@@ -57,6 +82,8 @@ void AddModelToScene(App& app, Model& model)
             }
         );
     }
+
+    app.drawPackets.dirty = true;
 }
 
 void StartSkyboxLoad(App& app)
@@ -5,6 +5,9 @@
 void AddModelToScene(App& app, Model& model);
 void InitializeCamera(App& app);
 void InitializeLights(App& app);
+// Adds a light in the spot the light editor's "New light" button would put it
+uint32_t AddDefaultLight(App& app);
+void AddRandomPointLights(App& app, uint32_t count);
 void InitializeScene(App& app);
 void StartSkyboxLoad(App& app);
 void StartSceneAssetLoad(App& app);
\ No newline at end of file
@@ -0,0 +1,326 @@
+#include "sphericalharmonics.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+std::array<float, SHCoefficientCount> SHBasis(const glm::vec3& direction)
+{
+    float x = direction.x;
+    float y = direction.y;
+    float z = direction.z;
+
+    return {
+        0.282095f,
+        0.488603f * y,
+        0.488603f * z,
+        0.488603f * x,
+        1.092548f * x * y,
+        1.092548f * y * z,
+        0.315392f * (3.0f * z * z - 1.0f),
+        1.092548f * x * z,
+        0.546274f * (x * x - y * y),
+    };
+}
+
+SHL2RGB SHL2RGB::Constant(const glm::vec3& value)
+{
+    // Only the DC term, which integrates Y0 * value over the sphere
+    SHL2RGB sh;
+    sh.coefficients[0] = value * (0.282095f * 4.0f * glm::pi<float>());
+    return sh;
+}
+
+void SHL2RGB::AddSample(const glm::vec3& direction, const glm::vec3& value, float weight)
+{
+    std::array<float, SHCoefficientCount> basis = SHBasis(direction);
+    for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+        coefficients[i] += value * (basis[i] * weight);
+    }
+}
+
+glm::vec3 SHL2RGB::Evaluate(const glm::vec3& direction) const
+{
+    std::array<float, SHCoefficientCount> basis = SHBasis(direction);
+    glm::vec3 result(0.0f);
+    for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+        result += coefficients[i] * basis[i];
+    }
+    return result;
+}
+
+SHL2RGB SHL2RGB::ConvolveCosine() const
+{
+    // Zonal harmonics of the clamped cosine per band (pi, 2pi/3, pi/4), over pi
+    const float BandScale[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+
+    SHL2RGB result;
+    for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+        uint32_t band = i == 0 ? 0 : (i < 4 ? 1 : 2);
+        result.coefficients[i] = coefficients[i] * BandScale[band];
+    }
+    return result;
+}
+
+SHL2RGB& SHL2RGB::operator+=(const SHL2RGB& other)
+{
+    for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+        coefficients[i] += other.coefficients[i];
+    }
+    return *this;
+}
+
+SHL2RGB& SHL2RGB::operator*=(float scale)
+{
+    for (glm::vec3& coefficient : coefficients) {
+        coefficient *= scale;
+    }
+    return *this;
+}
+
+// Texel (s, t) in [-1, 1] of a face points along axis + s * u + t * v, t growing downwards
+struct CubemapFaceFrame
+{
+    glm::vec3 axis;
+    glm::vec3 u;
+    glm::vec3 v;
+};
+
+static constexpr CubemapFaceFrame CubemapFaceFrames[6] = {
+    { {  1,  0,  0 }, {  0,  0, -1 }, { 0, -1,  0 } },
+    { { -1,  0,  0 }, {  0,  0,  1 }, { 0, -1,  0 } },
+    { {  0,  1,  0 }, {  1,  0,  0 }, { 0,  0,  1 } },
+    { {  0, -1,  0 }, {  1,  0,  0 }, { 0,  0, -1 } },
+    { {  0,  0,  1 }, {  1,  0,  0 }, { 0, -1,  0 } },
+    { {  0,  0, -1 }, { -1,  0,  0 }, { 0, -1,  0 } },
+};
+
+// Per coefficient RGB sums, kept in double across rows so large cubemaps don't lose precision
+using SHAccumulator = std::array<double, SHCoefficientCount * 3>;
+
+static void ProjectTexels(const SHCubemapFace& face, const CubemapFaceFrame& frame, uint32_t y, uint32_t firstX, SHAccumulator& sums)
+{
+    float texelArea = (2.0f / face.width) * (2.0f / face.height);
+    float t = 2.0f * (y + 0.5f) / face.height - 1.0f;
+    const float* row = face.rgba.data() + (size_t)y * face.width * 4;
+
+    for (uint32_t x = firstX; x < face.width; x++) {
+        float s = 2.0f * (x + 0.5f) / face.width - 1.0f;
+        glm::vec3 direction = frame.axis + frame.u * s + frame.v * t;
+        float inverseLength = 1.0f / sqrtf(1.0f + s * s + t * t);
+        // Solid angle of a texel shrinks with the cube of the distance to the cube's center
+        float weight = texelArea * inverseLength * inverseLength * inverseLength;
+
+        std::array<float, SHCoefficientCount> basis = SHBasis(direction * inverseLength);
+        for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+            float basisWeight = basis[i] * weight;
+            for (uint32_t c = 0; c < 3; c++) {
+                sums[i * 3 + c] += row[x * 4 + c] * basisWeight;
+            }
+        }
+    }
+}
+
+#ifdef __AVX2__
+static double HorizontalSum(__m256 v)
+{
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+// Same operations as ProjectTexels, 8 texels at a time. Returns the first texel left for the scalar tail.
+static uint32_t ProjectTexelsAVX2(const SHCubemapFace& face, const CubemapFaceFrame& frame, uint32_t y, SHAccumulator& sums)
+{
+    float texelArea = (2.0f / face.width) * (2.0f / face.height);
+    float t = 2.0f * (y + 0.5f) / face.height - 1.0f;
+    const float* row = face.rgba.data() + (size_t)y * face.width * 4;
+
+    glm::vec3 rowBase = frame.axis + frame.v * t;
+    __m256 baseX = _mm256_set1_ps(rowBase.x);
+    __m256 baseY = _mm256_set1_ps(rowBase.y);
+    __m256 baseZ = _mm256_set1_ps(rowBase.z);
+    __m256 uX = _mm256_set1_ps(frame.u.x);
+    __m256 uY = _mm256_set1_ps(frame.u.y);
+    __m256 uZ = _mm256_set1_ps(frame.u.z);
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 tSquaredPlusOne = _mm256_set1_ps(1.0f + t * t);
+    __m256 area = _mm256_set1_ps(texelArea);
+    __m256 sScale = _mm256_set1_ps(2.0f / face.width);
+    __m256 sBias = _mm256_set1_ps(1.0f / face.width - 1.0f);
+    __m256 laneOffsets = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    // RGBA texels, one channel of 8 texels per gather
+    __m256i gatherIndices = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+
+    __m256 accumulators[SHCoefficientCount * 3];
+    for (__m256& accumulator : accumulators) {
+        accumulator = _mm256_setzero_ps();
+    }
+
+    uint32_t x = 0;
+    for (; x + 8 <= face.width; x += 8) {
+        __m256 s = _mm256_fmadd_ps(_mm256_add_ps(_mm256_set1_ps((float)x), laneOffsets), sScale, sBias);
+        __m256 inverseLength = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_fmadd_ps(s, s, tSquaredPlusOne)));
+        __m256 weight = _mm256_mul_ps(area, _mm256_mul_ps(inverseLength, _mm256_mul_ps(inverseLength, inverseLength)));
+
+        __m256 dx = _mm256_mul_ps(_mm256_fmadd_ps(s, uX, baseX), inverseLength);
+        __m256 dy = _mm256_mul_ps(_mm256_fmadd_ps(s, uY, baseY), inverseLength);
+        __m256 dz = _mm256_mul_ps(_mm256_fmadd_ps(s, uZ, baseZ), inverseLength);
+
+        __m256 basis[SHCoefficientCount] = {
+            _mm256_set1_ps(0.282095f),
+            _mm256_mul_ps(_mm256_set1_ps(0.488603f), dy),
+            _mm256_mul_ps(_mm256_set1_ps(0.488603f), dz),
+            _mm256_mul_ps(_mm256_set1_ps(0.488603f), dx),
+            _mm256_mul_ps(_mm256_set1_ps(1.092548f), _mm256_mul_ps(dx, dy)),
+            _mm256_mul_ps(_mm256_set1_ps(1.092548f), _mm256_mul_ps(dy, dz)),
+            _mm256_mul_ps(_mm256_set1_ps(0.315392f), _mm256_fmsub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(dz, dz), one)),
+            _mm256_mul_ps(_mm256_set1_ps(1.092548f), _mm256_mul_ps(dx, dz)),
+            _mm256_mul_ps(_mm256_set1_ps(0.546274f), _mm256_fmsub_ps(dx, dx, _mm256_mul_ps(dy, dy))),
+        };
+
+        const float* texels = row + x * 4;
+        __m256 color[3] = {
+            _mm256_i32gather_ps(texels + 0, gatherIndices, 4),
+            _mm256_i32gather_ps(texels + 1, gatherIndices, 4),
+            _mm256_i32gather_ps(texels + 2, gatherIndices, 4),
+        };
+
+        for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+            __m256 basisWeight = _mm256_mul_ps(basis[i], weight);
+            for (uint32_t c = 0; c < 3; c++) {
+                accumulators[i * 3 + c] = _mm256_fmadd_ps(color[c], basisWeight, accumulators[i * 3 + c]);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < SHCoefficientCount * 3; i++) {
+        sums[i] += HorizontalSum(accumulators[i]);
+    }
+
+    return x;
+}
+#endif
+
+SHL2RGB ProjectCubemap(std::span<const SHCubemapFace, 6> faces, bool useSIMD, uint32_t threadCount)
+{
+    // Enough rows that a thread has more work than it costs to start it
+    const uint32_t MinRowsPerThread = 64;
+
+    uint32_t rowsPerFace = faces[0].height;
+    uint32_t rowCount = rowsPerFace * 6;
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threadCount = std::clamp(rowCount / MinRowsPerThread, 1u, threadCount);
+
+    std::vector<SHAccumulator> threadSums(threadCount, SHAccumulator{});
+
+    auto projectRows = [&](uint32_t threadIndex) {
+        SHAccumulator& sums = threadSums[threadIndex];
+        uint32_t firstRow = (uint32_t)((uint64_t)rowCount * threadIndex / threadCount);
+        uint32_t lastRow = (uint32_t)((uint64_t)rowCount * (threadIndex + 1) / threadCount);
+
+        for (uint32_t row = firstRow; row < lastRow; row++) {
+            uint32_t faceIndex = row / rowsPerFace;
+            uint32_t y = row % rowsPerFace;
+
+            uint32_t firstX = 0;
+#ifdef __AVX2__
+            if (useSIMD) {
+                firstX = ProjectTexelsAVX2(faces[faceIndex], CubemapFaceFrames[faceIndex], y, sums);
+            }
+#endif
+            ProjectTexels(faces[faceIndex], CubemapFaceFrames[faceIndex], y, firstX, sums);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < threadCount; t++) {
+        threads.emplace_back(projectRows, t);
+    }
+    projectRows(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    SHAccumulator total = {};
+    for (const SHAccumulator& sums : threadSums) {
+        for (uint32_t i = 0; i < total.size(); i++) {
+            total[i] += sums[i];
+        }
+    }
+
+    SHL2RGB result;
+    for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+        result.coefficients[i] = glm::vec3((float)total[i * 3 + 0], (float)total[i * 3 + 1], (float)total[i * 3 + 2]);
+    }
+    return result;
+}
+
+// Solid angle of the face region between the center and (s, t), from the area element
+// of a unit cube face projected onto the sphere
+static double CubeCornerSolidAngle(double s, double t)
+{
+    return atan2(s * t, sqrt(s * s + t * t + 1.0));
+}
+
+SHL2RGB ProjectCubemapReference(std::span<const SHCubemapFace, 6> faces)
+{
+    SHAccumulator sums = {};
+
+    for (uint32_t faceIndex = 0; faceIndex < 6; faceIndex++) {
+        const SHCubemapFace& face = faces[faceIndex];
+        const CubemapFaceFrame& frame = CubemapFaceFrames[faceIndex];
+
+        for (uint32_t y = 0; y < face.height; y++) {
+            double t0 = 2.0 * y / face.height - 1.0;
+            double t1 = 2.0 * (y + 1) / face.height - 1.0;
+
+            for (uint32_t x = 0; x < face.width; x++) {
+                double s0 = 2.0 * x / face.width - 1.0;
+                double s1 = 2.0 * (x + 1) / face.width - 1.0;
+                double solidAngle =
+                    CubeCornerSolidAngle(s0, t0) - CubeCornerSolidAngle(s0, t1) -
+                    CubeCornerSolidAngle(s1, t0) + CubeCornerSolidAngle(s1, t1);
+
+                double s = (s0 + s1) * 0.5;
+                double t = (t0 + t1) * 0.5;
+                glm::dvec3 direction = glm::normalize(glm::dvec3(frame.axis) + glm::dvec3(frame.u) * s + glm::dvec3(frame.v) * t);
+                double basis[SHCoefficientCount] = {
+                    0.282095,
+                    0.488603 * direction.y,
+                    0.488603 * direction.z,
+                    0.488603 * direction.x,
+                    1.092548 * direction.x * direction.y,
+                    1.092548 * direction.y * direction.z,
+                    0.315392 * (3.0 * direction.z * direction.z - 1.0),
+                    1.092548 * direction.x * direction.z,
+                    0.546274 * (direction.x * direction.x - direction.y * direction.y),
+                };
+
+                const float* texel = face.rgba.data() + ((size_t)y * face.width + x) * 4;
+                for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+                    for (uint32_t c = 0; c < 3; c++) {
+                        sums[i * 3 + c] += texel[c] * basis[i] * solidAngle;
+                    }
+                }
+            }
+        }
+    }
+
+    SHL2RGB result;
+    for (uint32_t i = 0; i < SHCoefficientCount; i++) {
+        result.coefficients[i] = glm::vec3((float)sums[i * 3 + 0], (float)sums[i * 3 + 1], (float)sums[i * 3 + 2]);
+    }
+    return result;
+}
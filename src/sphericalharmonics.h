@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <span>
+#include <cstdint>
+
+static constexpr uint32_t SHCoefficientCount = 9;
+
+// Real L2 spherical harmonics basis, in the usual order (l, m) = (0,0), (1,-1), (1,0), (1,1), (2,-2)...
+// direction must be normalized.
+std::array<float, SHCoefficientCount> SHBasis(const glm::vec3& direction);
+
+// RGB function on the sphere projected onto L2 spherical harmonics.
+struct SHL2RGB
+{
+    std::array<glm::vec3, SHCoefficientCount> coefficients = {};
+
+    static SHL2RGB Constant(const glm::vec3& value);
+
+    // Monte Carlo projection, weight is the sample's solid angle (4 pi / count for uniform samples)
+    void AddSample(const glm::vec3& direction, const glm::vec3& value, float weight);
+
+    glm::vec3 Evaluate(const glm::vec3& direction) const;
+
+    // Convolves radiance with the clamped cosine lobe and divides by pi, so Evaluate(N) gives the
+    // same value as the diffuse irradiance cubemap: constant radiance L evaluates to L.
+    SHL2RGB ConvolveCosine() const;
+
+    SHL2RGB& operator+=(const SHL2RGB& other);
+    SHL2RGB& operator*=(float scale);
+};
+
+// One face of an RGBA float cubemap, rows top to bottom
+struct SHCubemapFace
+{
+    std::span<const float> rgba;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Projects a cubemap of radiance onto L2 spherical harmonics, faces in D3D order (+X, -X, +Y, -Y, +Z, -Z).
+// Every texel is weighted by its approximate solid angle. Rows are split over threads, and each
+// thread processes 8 texels at a time with AVX2 unless useSIMD is false.
+// threadCount of 0 picks a count based on the number of texels.
+SHL2RGB ProjectCubemap(std::span<const SHCubemapFace, 6> faces, bool useSIMD = true, uint32_t threadCount = 0);
+
+// Single threaded in double precision with exact texel solid angles, only used to validate ProjectCubemap()
+SHL2RGB ProjectCubemapReference(std::span<const SHCubemapFace, 6> faces);
@@ -0,0 +1,84 @@
+#include "tlas.h"
+
+static TLASInstanceDesc MakeInstanceDesc(const TLASInstanceSource& instance, const glm::mat4& world, uint32_t instanceId)
+{
+    TLASInstanceDesc desc;
+    desc.transform = PackInstanceTransform(world);
+    desc.instanceIdAndMask = (instanceId & 0xFFFFFF) | (0xFFu << 24);
+    desc.hitGroupAndFlags = 0;
+    desc.accelerationStructure = instance.blasAddress;
+    return desc;
+}
+
+TLASInstanceSet::UpdateResult TLASInstanceSet::Update(
+    std::span<const TLASInstanceSource> instances,
+    std::span<const glm::mat4> world,
+    std::span<const uint32_t> updatedTransforms,
+    TLASInstanceDesc* destination
+)
+{
+    UpdateResult result;
+
+    bool topologyChanged = invalid || instances.size() != current.size();
+    for (size_t i = 0; !topologyChanged && i < instances.size(); i++) {
+        topologyChanged = instances[i].blasAddress != current[i].blasAddress || instances[i].transformIndex != current[i].transformIndex;
+    }
+
+    if (topologyChanged) {
+        current.assign(instances.begin(), instances.end());
+        for (uint32_t i = 0; i < (uint32_t)instances.size(); i++) {
+            destination[i] = MakeInstanceDesc(instances[i], world[instances[i].transformIndex], i);
+        }
+
+        // Counting sort of instances by transform
+        transformOffsets.assign(world.size() + 1, 0);
+        for (const TLASInstanceSource& instance : instances) {
+            transformOffsets[instance.transformIndex + 1]++;
+        }
+        for (size_t t = 1; t < transformOffsets.size(); t++) {
+            transformOffsets[t] += transformOffsets[t - 1];
+        }
+        instancesOfTransform.resize(instances.size());
+        std::vector<uint32_t> cursors(transformOffsets.begin(), transformOffsets.end() - 1);
+        for (uint32_t i = 0; i < (uint32_t)instances.size(); i++) {
+            instancesOfTransform[cursors[instances[i].transformIndex]++] = i;
+        }
+
+        invalid = false;
+        refitsSinceRebuild = 0;
+        result.patchedInstances = (uint32_t)instances.size();
+        result.kind = BuildKind_Rebuild;
+        return result;
+    }
+
+    for (uint32_t transformIndex : updatedTransforms) {
+        // Transforms allocated since the last rebuild have no instances yet
+        if (transformIndex + 1 >= transformOffsets.size()) {
+            continue;
+        }
+        uint32_t first = transformOffsets[transformIndex];
+        uint32_t last = transformOffsets[transformIndex + 1];
+        if (first == last) {
+            continue;
+        }
+        InstanceTransform transform = PackInstanceTransform(world[transformIndex]);
+        for (uint32_t i = first; i < last; i++) {
+            destination[instancesOfTransform[i]].transform = transform;
+        }
+        result.patchedInstances += last - first;
+    }
+
+    if (result.patchedInstances == 0) {
+        return result;
+    }
+
+    if (++refitsSinceRebuild >= RefitsBeforeRebuild) {
+        refitsSinceRebuild = 0;
+        result.kind = BuildKind_Rebuild;
+    }
+    else {
+        result.kind = BuildKind_Refit;
+    }
+
+    return result;
+}
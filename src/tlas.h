@@ -0,0 +1,87 @@
+#pragma once
+
+#include "instancedata.h"
+
+#include <glm/glm.hpp>
+
+#include <span>
+#include <vector>
+#include <cstdint>
+
+// Same layout as D3D12_RAYTRACING_INSTANCE_DESC, kept API independent so the
+// instance diffing can run and be tested without a device.
+struct TLASInstanceDesc
+{
+    InstanceTransform transform;
+    // InstanceID in the low 24 bits, InstanceMask in the high 8
+    uint32_t instanceIdAndMask;
+    // InstanceContributionToHitGroupIndex in the low 24 bits, Flags in the high 8
+    uint32_t hitGroupAndFlags;
+    uint64_t accelerationStructure;
+};
+static_assert(sizeof(TLASInstanceDesc) == 64, "TLASInstanceDesc must match D3D12_RAYTRACING_INSTANCE_DESC");
+
+// One TLAS instance as the scene sees it
+struct TLASInstanceSource
+{
+    uint64_t blasAddress;
+    // Into TransformStore
+    uint32_t transformIndex;
+};
+
+// Tracks the TLAS instance array between frames and works out the least work to bring it up to date.
+//
+// If the list of instances changed every desc is rewritten and the TLAS must be rebuilt, even
+// when it's now empty, so the TLAS that's bound never holds instances that are gone.
+// Otherwise only instances whose transform the TransformStore updated are patched, and the TLAS
+// is refit, or left alone if nothing moved. Refits degrade the TLAS, so it's rebuilt every
+// RefitsBeforeRebuild refits regardless.
+class TLASInstanceSet
+{
+public:
+    static constexpr uint32_t RefitsBeforeRebuild = 300;
+
+    enum BuildKind
+    {
+        BuildKind_None,
+        BuildKind_Refit,
+        BuildKind_Rebuild,
+    };
+
+    struct UpdateResult
+    {
+        BuildKind kind = BuildKind_None;
+        uint32_t patchedInstances = 0;
+    };
+
+    // instances are in InstanceID order. world is every world matrix by transform index, and
+    // updatedTransforms the transforms whose world matrix changed since the last Update(), i.e.
+    // TransformStore::UpdatedTransforms() when this runs after every TransformStore::Update().
+    // destination holds at least instances.size() descs, and is expected to keep whatever was
+    // last written to it until Invalidate() is called.
+    UpdateResult Update(
+        std::span<const TLASInstanceSource> instances,
+        std::span<const glm::mat4> world,
+        std::span<const uint32_t> updatedTransforms,
+        TLASInstanceDesc* destination
+    );
+
+    // Forces the next Update() to rewrite everything and rebuild, e.g. after destination moved.
+    void Invalidate()
+    {
+        invalid = true;
+    }
+
+    uint32_t Count() const
+    {
+        return (uint32_t)current.size();
+    }
+
+private:
+    std::vector<TLASInstanceSource> current;
+    // The instances using each transform in CSR form, instancesOfTransform[offsets[t]..offsets[t + 1]]
+    std::vector<uint32_t> transformOffsets;
+    std::vector<uint32_t> instancesOfTransform;
+    uint32_t refitsSinceRebuild = 0;
+    bool invalid = true;
+};
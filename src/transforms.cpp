@@ -0,0 +1,507 @@
+#include "transforms.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+uint32_t TransformStore::Allocate(uint32_t allocCount)
+{
+    std::scoped_lock lock(mutex);
+
+    // First fit from previously freed ranges
+    for (auto iter = freeRanges.begin(); iter != freeRanges.end(); iter++) {
+        auto& [first, rangeCount] = *iter;
+        if (rangeCount >= allocCount) {
+            uint32_t result = first;
+            first += allocCount;
+            rangeCount -= allocCount;
+            if (rangeCount == 0) {
+                freeRanges.erase(iter);
+            }
+            std::fill(dirty.begin() + result, dirty.begin() + result + allocCount, 1);
+            return result;
+        }
+    }
+
+    uint32_t result = count;
+    Grow(count + allocCount);
+    return result;
+}
+
+void TransformStore::Free(uint32_t first, uint32_t freeCount)
+{
+    std::scoped_lock lock(mutex);
+
+    std::erase_if(destinationEntries, [&](const auto& entry) {
+        return entry.first >= first && entry.first < first + freeCount;
+    });
+    destinationsDirty = true;
+
+    for (uint32_t i = first; i < first + freeCount; i++) {
+        for (int e = 0; e < 16; e++) {
+            base[e][i] = (e % 5 == 0) ? 1.0f : 0.0f;
+        }
+        for (int c = 0; c < 3; c++) {
+            translation[c][i] = 0.0f;
+            euler[c][i] = 0.0f;
+            scale[c][i] = 1.0f;
+            eulerSin[c][i] = 0.0f;
+            eulerCos[c][i] = 1.0f;
+        }
+        parents[i] = InvalidIndex;
+        dirty[i] = 0;
+    }
+
+    freeRanges.emplace_back(first, freeCount);
+}
+
+void TransformStore::Grow(uint32_t newCount)
+{
+    uint32_t oldCount = count;
+    count = newCount;
+    if (newCount <= capacity) {
+        std::fill(dirty.begin() + oldCount, dirty.begin() + newCount, 1);
+        return;
+    }
+
+    uint32_t newCapacity = std::max(newCount, capacity * 2);
+    newCapacity = (newCapacity + BatchWidth - 1) / BatchWidth * BatchWidth;
+
+    for (int e = 0; e < 16; e++) {
+        // Identity
+        base[e].resize(newCapacity, (e % 5 == 0) ? 1.0f : 0.0f);
+    }
+    for (int c = 0; c < 3; c++) {
+        translation[c].resize(newCapacity, 0.0f);
+        euler[c].resize(newCapacity, 0.0f);
+        scale[c].resize(newCapacity, 1.0f);
+        eulerSin[c].resize(newCapacity, 0.0f);
+        eulerCos[c].resize(newCapacity, 1.0f);
+    }
+    parents.resize(newCapacity, InvalidIndex);
+    dirty.resize(newCapacity, 0);
+    std::fill(dirty.begin() + oldCount, dirty.begin() + newCount, 1);
+    world.resize(newCapacity, glm::mat4(1.0f));
+
+    capacity = newCapacity;
+    destinationsDirty = true;
+}
+
+void TransformStore::SetBase(uint32_t index, const glm::mat4& matrix)
+{
+    std::scoped_lock lock(mutex);
+
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            base[c * 4 + r][index] = matrix[c][r];
+        }
+    }
+    dirty[index] = 1;
+}
+
+void TransformStore::SetTranslation(uint32_t index, const glm::vec3& value)
+{
+    std::scoped_lock lock(mutex);
+
+    for (int c = 0; c < 3; c++) {
+        translation[c][index] = value[c];
+    }
+    dirty[index] = 1;
+}
+
+void TransformStore::SetEuler(uint32_t index, const glm::vec3& value)
+{
+    std::scoped_lock lock(mutex);
+
+    for (int c = 0; c < 3; c++) {
+        euler[c][index] = value[c];
+        // Matches the negated angles in glm::eulerAngleXYZ
+        eulerSin[c][index] = std::sin(-value[c]);
+        eulerCos[c][index] = std::cos(-value[c]);
+    }
+    dirty[index] = 1;
+}
+
+void TransformStore::SetScale(uint32_t index, const glm::vec3& value)
+{
+    std::scoped_lock lock(mutex);
+
+    for (int c = 0; c < 3; c++) {
+        scale[c][index] = value[c];
+    }
+    dirty[index] = 1;
+}
+
+void TransformStore::SetParent(uint32_t index, uint32_t parent)
+{
+    std::scoped_lock lock(mutex);
+
+    if (parent != InvalidIndex && parent >= index) {
+        // Would break the single pass propagation in Update()
+        abort();
+    }
+
+    parents[index] = parent;
+    dirty[index] = 1;
+}
+
+glm::vec3 TransformStore::GetTranslation(uint32_t index) const
+{
+    std::scoped_lock lock(mutex);
+
+    return glm::vec3(translation[0][index], translation[1][index], translation[2][index]);
+}
+
+glm::vec3 TransformStore::GetEuler(uint32_t index) const
+{
+    std::scoped_lock lock(mutex);
+
+    return glm::vec3(euler[0][index], euler[1][index], euler[2][index]);
+}
+
+glm::vec3 TransformStore::GetScale(uint32_t index) const
+{
+    std::scoped_lock lock(mutex);
+
+    return glm::vec3(scale[0][index], scale[1][index], scale[2][index]);
+}
+
+uint32_t TransformStore::GetParent(uint32_t index) const
+{
+    std::scoped_lock lock(mutex);
+
+    return parents[index];
+}
+
+void TransformStore::AddDestination(uint32_t index, InstanceTransform* destination)
+{
+    std::scoped_lock lock(mutex);
+
+    destinationEntries.emplace_back(index, destination);
+    destinationsDirty = true;
+    // The new destination needs writing even if nothing else changes
+    dirty[index] = 1;
+}
+
+uint32_t TransformStore::AddBounds(const AABB& localBounds, std::span<const uint32_t> transformIndices)
+{
+    std::scoped_lock lock(mutex);
+
+    uint32_t boundsIndex;
+    if (!freeBounds.empty()) {
+        boundsIndex = freeBounds.back();
+        freeBounds.pop_back();
+    } else {
+        boundsIndex = (uint32_t)bounds.size();
+        bounds.emplace_back();
+    }
+
+    Bounds& entry = bounds[boundsIndex];
+    entry.local = localBounds;
+    entry.transforms.assign(transformIndices.begin(), transformIndices.end());
+    entry.active = true;
+
+    // Computed now so the entry is valid before the next Update()
+    entry.world = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+    for (uint32_t transformIndex : entry.transforms) {
+        dirty[transformIndex] = 1;
+    }
+
+    return boundsIndex;
+}
+
+void TransformStore::FreeBounds(uint32_t boundsIndex)
+{
+    std::scoped_lock lock(mutex);
+
+    bounds[boundsIndex].active = false;
+    bounds[boundsIndex].transforms.clear();
+    freeBounds.push_back(boundsIndex);
+}
+
+void TransformStore::MarkAllDirty()
+{
+    std::scoped_lock lock(mutex);
+
+    std::fill(dirty.begin(), dirty.begin() + count, 1);
+}
+
+void TransformStore::RebuildDestinationOffsets()
+{
+    std::stable_sort(destinationEntries.begin(), destinationEntries.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+
+    destinationOffsets.assign(capacity + 1, 0);
+    destinations.resize(destinationEntries.size());
+
+    for (size_t i = 0; i < destinationEntries.size(); i++) {
+        destinationOffsets[destinationEntries[i].first + 1]++;
+        destinations[i] = destinationEntries[i].second;
+    }
+    for (uint32_t i = 0; i < capacity; i++) {
+        destinationOffsets[i + 1] += destinationOffsets[i];
+    }
+
+    destinationsDirty = false;
+}
+
+TransformStore::UpdateStats TransformStore::Update(bool useSIMD)
+{
+    std::scoped_lock lock(mutex);
+
+    UpdateStats stats;
+
+    if (destinationsDirty) {
+        RebuildDestinationOffsets();
+    }
+
+    // Parents come first, so a single pass pushes dirty flags down whole subtrees.
+    updated.clear();
+    for (uint32_t i = 0; i < count; i++) {
+        if (parents[i] != InvalidIndex) {
+            dirty[i] |= dirty[parents[i]];
+        }
+        if (dirty[i]) {
+            updated.push_back(i);
+        }
+    }
+    stats.dirtyTransforms = (uint32_t)updated.size();
+
+    for (uint32_t first = 0; first < count; first += BatchWidth) {
+        uint64_t batchDirty;
+        memcpy(&batchDirty, &dirty[first], sizeof(batchDirty));
+
+        if (!batchDirty) {
+            continue;
+        }
+
+        if (useSIMD) {
+            ComputeWorldAVX2(first);
+        } else {
+            ComputeWorldScalar(first);
+        }
+        ApplyParents(first);
+
+        // Only world matrices are uploaded, view and projection are applied once per pass on the GPU.
+        for (uint32_t i = first; i < first + BatchWidth; i++) {
+            if (!dirty[i]) {
+                continue;
+            }
+            for (uint32_t d = destinationOffsets[i]; d < destinationOffsets[i + 1]; d++) {
+                StreamInstanceTransform(world[i], destinations[d]);
+            }
+            stats.uploadedTransforms += destinationOffsets[i + 1] - destinationOffsets[i];
+        }
+    }
+
+    // Make the non-temporal stores visible before the GPU work is submitted
+    StreamFence();
+
+    UpdateBounds(stats);
+
+    std::fill(dirty.begin(), dirty.begin() + count, 0);
+
+    return stats;
+}
+
+AABB TransformAABB(const AABB& box, const glm::mat4& transform)
+{
+    // Transform the center and project the extents onto the new axes
+    glm::vec3 center = (box.min + box.max) * 0.5f;
+    glm::vec3 extents = (box.max - box.min) * 0.5f;
+
+    glm::vec3 worldCenter = transform * glm::vec4(center, 1.0f);
+    glm::mat3 absTransform(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+    glm::vec3 worldExtents = absTransform * extents;
+
+    return AABB{ worldCenter - worldExtents, worldCenter + worldExtents };
+}
+
+void TransformStore::UpdateBounds(UpdateStats& stats)
+{
+    for (Bounds& entry : bounds) {
+        if (!entry.active) {
+            continue;
+        }
+
+        bool boundsDirty = false;
+        for (uint32_t transformIndex : entry.transforms) {
+            if (dirty[transformIndex]) {
+                boundsDirty = true;
+                break;
+            }
+        }
+        if (!boundsDirty) {
+            continue;
+        }
+
+        entry.world = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+        for (uint32_t transformIndex : entry.transforms) {
+            AABB transformed = TransformAABB(entry.local, world[transformIndex]);
+            entry.world.min = glm::min(entry.world.min, transformed.min);
+            entry.world.max = glm::max(entry.world.max, transformed.max);
+        }
+        stats.dirtyBounds++;
+    }
+}
+
+void TransformStore::ApplyParents(uint32_t first)
+{
+    // In lane order, a parent in the same batch is always finished before its children.
+    for (uint32_t i = first; i < first + BatchWidth; i++) {
+        if (parents[i] != InvalidIndex) {
+            world[i] = world[parents[i]] * world[i];
+        }
+    }
+}
+
+void TransformStore::ComputeWorldScalar(uint32_t first)
+{
+    for (uint32_t i = first; i < first + BatchWidth; i++) {
+        float c1 = eulerCos[0][i], c2 = eulerCos[1][i], c3 = eulerCos[2][i];
+        float s1 = eulerSin[0][i], s2 = eulerSin[1][i], s3 = eulerSin[2][i];
+
+        // Same as glm::eulerAngleXYZ
+        glm::mat3 R;
+        R[0][0] = c2 * c3;
+        R[0][1] = -c1 * s3 + s1 * s2 * c3;
+        R[0][2] = s1 * s3 + c1 * s2 * c3;
+        R[1][0] = c2 * s3;
+        R[1][1] = c1 * c3 + s1 * s2 * s3;
+        R[1][2] = -s1 * c3 + c1 * s2 * s3;
+        R[2][0] = -s2;
+        R[2][1] = s1 * c2;
+        R[2][2] = c1 * c2;
+
+        // T * S * R
+        glm::mat4 local(1.0f);
+        for (int c = 0; c < 3; c++) {
+            for (int r = 0; r < 3; r++) {
+                local[c][r] = scale[r][i] * R[c][r];
+            }
+        }
+        local[3] = glm::vec4(translation[0][i], translation[1][i], translation[2][i], 1.0f);
+
+        glm::mat4 baseMatrix;
+        for (int e = 0; e < 16; e++) {
+            baseMatrix[e / 4][e % 4] = base[e][i];
+        }
+
+        // Parent is applied afterwards by ApplyParents
+        world[i] = baseMatrix * local;
+    }
+}
+
+#ifdef __AVX2__
+
+// In: rows[e] holds element e of 8 lanes. Out: rows[lane] holds elements 0-7 of that lane.
+static inline void Transpose8x8(__m256 rows[8])
+{
+    __m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+    __m256 t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+    __m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+    __m256 t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+    __m256 t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+    __m256 t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+    __m256 t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+    __m256 t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    rows[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    rows[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    rows[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    rows[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    rows[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    rows[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    rows[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    rows[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+void TransformStore::ComputeWorldAVX2(uint32_t first)
+{
+    __m256 c1 = _mm256_load_ps(&eulerCos[0][first]);
+    __m256 c2 = _mm256_load_ps(&eulerCos[1][first]);
+    __m256 c3 = _mm256_load_ps(&eulerCos[2][first]);
+    __m256 s1 = _mm256_load_ps(&eulerSin[0][first]);
+    __m256 s2 = _mm256_load_ps(&eulerSin[1][first]);
+    __m256 s3 = _mm256_load_ps(&eulerSin[2][first]);
+
+    // Same as glm::eulerAngleXYZ, R[c * 3 + r]
+    __m256 s1s2 = _mm256_mul_ps(s1, s2);
+    __m256 c1s2 = _mm256_mul_ps(c1, s2);
+    __m256 R[9];
+    R[0] = _mm256_mul_ps(c2, c3);
+    R[1] = _mm256_fmsub_ps(s1s2, c3, _mm256_mul_ps(c1, s3));
+    R[2] = _mm256_fmadd_ps(c1s2, c3, _mm256_mul_ps(s1, s3));
+    R[3] = _mm256_mul_ps(c2, s3);
+    R[4] = _mm256_fmadd_ps(s1s2, s3, _mm256_mul_ps(c1, c3));
+    R[5] = _mm256_fmsub_ps(c1s2, s3, _mm256_mul_ps(s1, c3));
+    R[6] = _mm256_sub_ps(_mm256_setzero_ps(), s2);
+    R[7] = _mm256_mul_ps(s1, c2);
+    R[8] = _mm256_mul_ps(c1, c2);
+
+    __m256 S[3];
+    __m256 T[3];
+    for (int i = 0; i < 3; i++) {
+        S[i] = _mm256_load_ps(&scale[i][first]);
+        T[i] = _mm256_load_ps(&translation[i][first]);
+    }
+
+    __m256 B[16];
+    for (int e = 0; e < 16; e++) {
+        B[e] = _mm256_load_ps(&base[e][first]);
+    }
+
+    // M = base * (T * S * R), the parent is applied afterwards by ApplyParents
+    __m256 M[16];
+    for (int c = 0; c < 3; c++) {
+        __m256 l0 = _mm256_mul_ps(S[0], R[c * 3 + 0]);
+        __m256 l1 = _mm256_mul_ps(S[1], R[c * 3 + 1]);
+        __m256 l2 = _mm256_mul_ps(S[2], R[c * 3 + 2]);
+        for (int r = 0; r < 4; r++) {
+            __m256 sum = _mm256_mul_ps(B[0 * 4 + r], l0);
+            sum = _mm256_fmadd_ps(B[1 * 4 + r], l1, sum);
+            sum = _mm256_fmadd_ps(B[2 * 4 + r], l2, sum);
+            M[c * 4 + r] = sum;
+        }
+    }
+    for (int r = 0; r < 4; r++) {
+        __m256 sum = _mm256_fmadd_ps(B[0 * 4 + r], T[0], B[3 * 4 + r]);
+        sum = _mm256_fmadd_ps(B[1 * 4 + r], T[1], sum);
+        sum = _mm256_fmadd_ps(B[2 * 4 + r], T[2], sum);
+        M[12 + r] = sum;
+    }
+
+    // SoA -> one matrix per lane, as two 8-wide halves
+    Transpose8x8(M);
+    Transpose8x8(M + 8);
+
+    for (uint32_t lane = 0; lane < BatchWidth; lane++) {
+        float* worldPtr = &world[first + lane][0][0];
+        _mm256_storeu_ps(worldPtr, M[lane]);
+        _mm256_storeu_ps(worldPtr + 8, M[8 + lane]);
+    }
+}
+
+#else
+
+void TransformStore::ComputeWorldAVX2(uint32_t first)
+{
+    ComputeWorldScalar(first);
+}
+
+#endif
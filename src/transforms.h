@@ -0,0 +1,191 @@
+#pragma once
+
+#include "instancedata.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <mutex>
+#include <new>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+struct AABB
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+AABB TransformAABB(const AABB& box, const glm::mat4& transform);
+
+// std::allocator with an alignment suitable for AVX loads and stores.
+template<class T, size_t Alignment = 32>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    AlignedAllocator() = default;
+
+    template<class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    template<class U>
+    struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* ptr, size_t)
+    {
+        ::operator delete(ptr, std::align_val_t(Alignment));
+    }
+
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+template<class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Structure-of-arrays storage for every transform in the app, forming a hierarchy.
+//
+// Local matrices are composed from a base matrix and live translation/euler/scale offsets,
+// in the same order as ApplyStandardTransforms, and world = parent world * local.
+// Parents always have a lower index than their children, so one linear pass over the
+// arrays propagates both dirty flags and world matrices.
+//
+// Update() only recomputes batches of 8 transforms containing a dirty transform, with
+// AVX2 (scalar fallback otherwise), and streams the world matrices of dirty transforms
+// into their destinations in the GPU instance buffer.
+// World matrices and bounds are cached on the CPU, so culling and TLAS building never
+// have to read back from write-combined memory.
+class TransformStore
+{
+public:
+    static constexpr uint32_t BatchWidth = 8;
+    static constexpr uint32_t InvalidIndex = UINT32_MAX;
+
+    struct UpdateStats
+    {
+        uint32_t dirtyTransforms = 0;
+        uint32_t uploadedTransforms = 0;
+        uint32_t dirtyBounds = 0;
+    };
+
+    // Allocates count contiguous transforms initialised to identity with no parent. Returns the first index.
+    uint32_t Allocate(uint32_t count);
+    void Free(uint32_t first, uint32_t count);
+
+    void SetBase(uint32_t index, const glm::mat4& base);
+    void SetTranslation(uint32_t index, const glm::vec3& translation);
+    void SetEuler(uint32_t index, const glm::vec3& euler);
+    void SetScale(uint32_t index, const glm::vec3& scale);
+    // Parent must have a lower index than the child
+    void SetParent(uint32_t index, uint32_t parent);
+
+    glm::vec3 GetTranslation(uint32_t index) const;
+    glm::vec3 GetEuler(uint32_t index) const;
+    glm::vec3 GetScale(uint32_t index) const;
+    uint32_t GetParent(uint32_t index) const;
+
+    // destination is written whenever the transform's world matrix changes
+    void AddDestination(uint32_t index, InstanceTransform* destination);
+
+    // World space bounds of localBounds under each of the transforms, kept up to date by Update().
+    uint32_t AddBounds(const AABB& localBounds, std::span<const uint32_t> transformIndices);
+    void FreeBounds(uint32_t boundsIndex);
+
+    // Cached world matrix from the last Update()
+    const glm::mat4& World(uint32_t index) const
+    {
+        return world[index];
+    }
+
+    // Every cached world matrix, by transform index
+    std::span<const glm::mat4> WorldMatrices() const
+    {
+        return { world.data(), count };
+    }
+
+    // Transforms whose world matrix was recomputed by the last Update()
+    std::span<const uint32_t> UpdatedTransforms() const
+    {
+        return updated;
+    }
+
+    const AABB& WorldBounds(uint32_t boundsIndex) const
+    {
+        return bounds[boundsIndex].world;
+    }
+
+    uint32_t Count() const
+    {
+        return count;
+    }
+
+    // Forces every transform to be recomputed and uploaded on the next Update()
+    void MarkAllDirty();
+
+    UpdateStats Update(bool useSIMD = true);
+
+    // Every member takes this lock except World() and WorldBounds(), hold it when reading those while other threads allocate.
+    std::mutex& Mutex()
+    {
+        return mutex;
+    }
+
+private:
+    struct Bounds
+    {
+        AABB local;
+        AABB world;
+        std::vector<uint32_t> transforms;
+        bool active;
+    };
+
+    void Grow(uint32_t newCount);
+    void RebuildDestinationOffsets();
+    void ComputeWorldScalar(uint32_t first);
+    void ComputeWorldAVX2(uint32_t first);
+    void ApplyParents(uint32_t first);
+    void UpdateBounds(UpdateStats& stats);
+
+    mutable std::mutex mutex;
+
+    uint32_t count = 0;
+    // Always a multiple of BatchWidth so batches never need a remainder loop
+    uint32_t capacity = 0;
+
+    // Column major elements, base[c * 4 + r][index]
+    std::array<AlignedVector<float>, 16> base;
+    std::array<AlignedVector<float>, 3> translation;
+    std::array<AlignedVector<float>, 3> euler;
+    std::array<AlignedVector<float>, 3> scale;
+
+    // Cached sin/cos of -euler, trig is too expensive to do for every transform each frame.
+    std::array<AlignedVector<float>, 3> eulerSin;
+    std::array<AlignedVector<float>, 3> eulerCos;
+
+    std::vector<uint32_t> parents;
+    // Set when a transform or one of its ancestors changed since the last Update()
+    std::vector<uint8_t> dirty;
+    // Indices of the transforms that were dirty in the last Update()
+    std::vector<uint32_t> updated;
+
+    std::vector<glm::mat4> world;
+
+    std::vector<Bounds> bounds;
+    std::vector<uint32_t> freeBounds;
+
+    // Free ranges as (first, count)
+    std::vector<std::pair<uint32_t, uint32_t>> freeRanges;
+
+    // (transform index, destination) sorted into CSR form on demand
+    std::vector<std::pair<uint32_t, InstanceTransform*>> destinationEntries;
+    std::vector<uint32_t> destinationOffsets;
+    std::vector<InstanceTransform*> destinations;
+    bool destinationsDirty = false;
+};
@@ -64,6 +64,25 @@ public:
     }
 
     void AddTexture(ID3D12Resource* destResource, D3D12_SUBRESOURCE_DATA* subresourceData, int subresource, int numSubresources)
+    {
+        AddTextureInPlace(destResource, subresource, numSubresources, [&](int i, UINT8* dest, UINT rowPitch, UINT numRows) {
+            if (subresourceData[i].RowPitch == rowPitch) {
+                // Already laid out like the footprint (cooked textures), so it's one copy
+                memcpy(dest, subresourceData[i].pData, (size_t)rowPitch * numRows);
+            } else {
+                for (UINT y = 0; y < numRows; y++) {
+                    UINT8* pSrcPtr = (UINT8*)subresourceData[i].pData + y * subresourceData[i].RowPitch;
+                    UINT8* pDestPtr = dest + y * rowPitch;
+                    memcpy(pDestPtr, pSrcPtr, subresourceData[i].RowPitch);
+                }
+            }
+        });
+    }
+
+    // Like AddTexture, but write(i, dest, rowPitch, numRows) fills in subresource + i itself, straight
+    // into its footprint in upload memory. Saves staging data somewhere else just to copy it here.
+    template <typename WriteFn>
+    void AddTextureInPlace(ID3D12Resource* destResource, int subresource, int numSubresources, WriteFn&& write)
     {
         // Suballocate one resource at a time. It's just easier this way and the end effect should be the same.
         for (int i = 0; i < numSubresources; i++) {
@@ -96,22 +115,19 @@ public:
 
             auto resourceDesc = destResource->GetDesc();
             D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint{};
+            UINT numRows;
             device->GetCopyableFootprints(
                 &resourceDesc,
                 subresource + i,
                 1,
                 offset,
                 &footprint,
-                nullptr,
+                &numRows,
                 nullptr,
                 &requiredBytes
             );
 
-            for (UINT y = 0; y < footprint.Footprint.Height; y++) {
-                UINT8* pSrcPtr = (UINT8*)subresourceData[i].pData + y * subresourceData[i].RowPitch;
-                UINT8* pDestPtr = uploadDataPtr + footprint.Offset + y * footprint.Footprint.RowPitch;
-                memcpy(pDestPtr, pSrcPtr, subresourceData[i].RowPitch);
-            }
+            write(i, uploadDataPtr + footprint.Offset, footprint.Footprint.RowPitch, numRows);
 
             const CD3DX12_TEXTURE_COPY_LOCATION Dst(destResource, subresource + i);
             const CD3DX12_TEXTURE_COPY_LOCATION Src(uploadBuffer->GetResource(), footprint);
@@ -119,7 +135,7 @@ public:
         }
     }
 
-    void AddBuffer(ID3D12Resource* destinationResource, UINT64 destOffset, void* srcData, UINT64 numBytes)
+    void AddBuffer(ID3D12Resource* destinationResource, UINT64 destOffset, const void* srcData, UINT64 numBytes)
     {
         // If a big resource can't fit into one upload, split into two. This
         // will recurse, so if a resource is somehow uploadBufferSize * 2, then
@@ -129,7 +145,7 @@ public:
             Wait();
             UINT64 leftoverBytes = numBytes - uploadBufferSize;
             AddBuffer(destinationResource, destOffset, srcData, uploadBufferSize);
-            AddBuffer(destinationResource, destOffset + uploadBufferSize, srcData, leftoverBytes);
+            AddBuffer(destinationResource, destOffset + uploadBufferSize, static_cast<const UINT8*>(srcData) + uploadBufferSize, leftoverBytes);
             return;
         }
 
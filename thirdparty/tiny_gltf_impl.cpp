@@ -1,4 +1,6 @@
 #define TINYGLTF_IMPLEMENTATION
+// External images are mapped and decoded by the asset loader, see BeginModelImageLoad()
+#define TINYGLTF_NO_EXTERNAL_IMAGE
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "tiny_gltf.h"
\ No newline at end of file